@@ -159,3 +159,111 @@ public:
     return (cur & write_lock_bit);
   }
 };
+
+// A table of NStripes reader-writer locks, addressed by hash. Each thread
+// has its own row of reader flags, so read-locking a stripe writes only
+// the reader's row; readers of the same stripe share no written cache
+// line. A writer sets the stripe's writer word and waits for the
+// stripe's column of reader flags to drain. Locks are held per thread
+// (by thread id), not per caller.
+template <unsigned NStripes, unsigned MaxThreads>
+class StripedRWLockTable {
+public:
+  static constexpr unsigned nstripes = NStripes;
+
+  StripedRWLockTable() : readers_(), writer_() {}
+
+  static unsigned stripe(uint64_t hash) {
+    hash ^= hash >> 29;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    return (hash ^ (hash >> 32)) % NStripes;
+  }
+
+  bool readHeld(unsigned s, int tid) const {
+    return readers_[tid][s];
+  }
+  bool writeHeld(unsigned s, int tid) const {
+    return writer_[s] == tid + 1;
+  }
+
+  // @spins is set to the number of times we had to wait.
+  bool tryReadLock(unsigned s, int tid, long spin, long& spins) {
+    for (spins = 0; spins <= spin; ++spins) {
+      if (!writer_[s]) {
+        readers_[tid][s] = 1;
+        fence();
+        if (!writer_[s])
+          return true;
+        // a writer got in first; it waits for us to leave
+        readers_[tid][s] = 0;
+      }
+      relax_fence();
+    }
+    return false;
+  }
+
+  bool tryWriteLock(unsigned s, int tid, long spin, long& spins) {
+    for (spins = 0; spins <= spin; ++spins) {
+      if (!writer_[s] && bool_cmpxchg(&writer_[s], 0, tid + 1))
+        break;
+      relax_fence();
+    }
+    if (spins > spin)
+      return false;
+    for (; spins <= spin; ++spins) {
+      if (!otherReaders(s, tid)) {
+        acquire_fence();
+        return true;
+      }
+      relax_fence();
+    }
+    writer_[s] = 0;
+    return false;
+  }
+
+  // Like RWLock::tryUpgrade: give up at once if another writer is
+  // waiting, since it is probably waiting for us.
+  bool tryUpgrade(unsigned s, int tid, long spin, long& spins) {
+    spins = 0;
+    if (writer_[s] || !bool_cmpxchg(&writer_[s], 0, tid + 1))
+      return false;
+    for (; spins <= spin; ++spins) {
+      if (!otherReaders(s, tid)) {
+        acquire_fence();
+        return true;
+      }
+      relax_fence();
+    }
+    writer_[s] = 0;
+    return false;
+  }
+
+  // Drops whatever @tid holds on @s.
+  void unlock(unsigned s, int tid) {
+    release_fence();
+    if (writer_[s] == tid + 1)
+      writer_[s] = 0;
+    readers_[tid][s] = 0;
+  }
+
+private:
+  struct reader_row {
+    volatile uint8_t held[NStripes];
+    uint8_t operator[](unsigned s) const {
+      return held[s];
+    }
+    volatile uint8_t& operator[](unsigned s) {
+      return held[s];
+    }
+  } __attribute__((aligned(64)));
+
+  reader_row readers_[MaxThreads];
+  int writer_[NStripes];
+
+  bool otherReaders(unsigned s, int tid) const {
+    for (unsigned t = 0; t != MaxThreads; ++t)
+      if (int(t) != tid && readers_[t][s])
+        return true;
+    return false;
+  }
+};
@@ -3,9 +3,12 @@
 #include "compiler.hh"
 // XXX: honestly hashtable should probably use local_vector too
 #include <vector>
+#include <functional>
 #include "Interface.hh"
 #include "Transaction.hh"
 #include "TWrapped.hh"
+#include "TPredicate.hh"
+#include "TCommute.hh"
 #include "simple_str.hh"
 #include "print_value.hh"
 
@@ -15,6 +18,14 @@
 #define READ_MY_WRITES 1
 #endif 
 
+// Support for locking frequently contended elements at access time (see
+// lock_if_hot). Tables opt in with nontrans_set_adaptive_cc(true).
+// Commit-time locking under STO_SORT_WRITESET doesn't give up, so it
+// could deadlock against access-time locks.
+#ifndef HASHTABLE_ADAPTIVE_CC
+#define HASHTABLE_ADAPTIVE_CC !STO_SORT_WRITESET
+#endif
+
 template <typename K, typename V, bool Opacity = true, unsigned Init_size = 129, typename W = V, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
 #ifdef STO_NO_STM
 class Hashtable {
@@ -31,6 +42,9 @@ public:
     typedef typename std::conditional<Opacity, TWrapped<Value>, TNonopaqueWrapped<Value>>::type wrapped_type;
 
     typedef V write_value_type;
+    // a commutative update (see transApply)
+    typedef std::function<void(Value&)> apply_type;
+    typedef TApplyPending<Value> pending_type;
 
     static constexpr typename Version_type::type invalid_bit = TransactionTid::user_bit;
 private:
@@ -43,15 +57,19 @@ private:
     internal_elem *next;
     Version_type version;
     wrapped_type value;
+    // rough count of recent commit-time conflicts (see lock_if_hot)
+    volatile uint8_t temperature;
+    // transactions holding the element in shared mode (see lock_if_hot)
+    uint16_t hot_readers;
 #ifndef STO_NO_STM
     internal_elem(Key k, Value val, bool mark_valid)
-        : key(k), next(NULL), version(Sto::initialized_tid() | (mark_valid ? 0 : invalid_bit)), value(val) {}
+        : key(k), next(NULL), version(Sto::initialized_tid() | (mark_valid ? 0 : invalid_bit)), value(val), temperature(0), hot_readers(0) {}
     bool valid() const {
         return !(version.value() & invalid_bit);
     }
 #else
     internal_elem(Key k, Value val, bool)
-        : key(k), next(NULL), version(Sto::initialized_tid()), value(val) {}
+        : key(k), next(NULL), version(Sto::initialized_tid()), value(val), temperature(0), hot_readers(0) {}
 #endif
   };
 
@@ -72,19 +90,44 @@ private:
   MapType map_;
   Hash hasher_;
   Pred pred_;
+  bool adaptive_cc_;
 
   // used to mark whether a key is a bucket (for bucket version checks)
   // or a pointer (which will always have the lower 3 bits as 0)
   static constexpr uintptr_t bucket_bit = 1U<<0;
+  // marks the item that holds an element's access-time lock (its key is
+  // the element pointer with this bit set)
+  static constexpr uintptr_t elem_lock_bit = 1U<<1;
 
   static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
+  // write value is a pending_type to run on the installed value
+  static constexpr TransItem::flags_type apply_bit = TransItem::user0_bit<<2;
+  // element was locked at access time, so its lock item unlocks it
+  static constexpr TransItem::flags_type early_lock_bit = TransItem::user0_bit<<3;
+  // an access-time lock item that holds its element in shared mode
+  static constexpr TransItem::flags_type shared_lock_bit = TransItem::user0_bit<<4;
+  // key of a transCount item
+  static constexpr uintptr_t count_bit = 1U<<2;
+
+  // In a table with adaptive_cc_ set, an element whose temperature
+  // reaches hot_temperature is locked when first accessed. Each
+  // commit-time conflict on it adds one; locking it exclusively without
+  // waiting takes one away.
+  static constexpr uint8_t hot_temperature = 4;
+  static constexpr unsigned hot_lock_spins = 1 << 10;
 
 public:
-  Hashtable(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred()) : map_(), hasher_(h), pred_(p) {
+  Hashtable(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred()) : map_(), hasher_(h), pred_(p), adaptive_cc_(false) {
     map_.resize(size);
   }
 
+  // Lock hot elements at access time (see lock_if_hot). Off by default;
+  // set it before the table is shared.
+  void nontrans_set_adaptive_cc(bool on) {
+    adaptive_cc_ = HASHTABLE_ADAPTIVE_CC && on;
+  }
+
   inline size_t hash(const Key& k) {
     return hasher_(k);
   }
@@ -107,6 +150,7 @@ public:
     internal_elem *e = find(buck, k);
     if (e) {
       auto item = t_read_only_item(e);
+      bool held = lock_if_hot(item, e, false);
       if (!validity_check(item, e)) {
         Sto::abort();
         return false;
@@ -116,6 +160,13 @@ public:
       if (has_delete(item)) {
         return false;
       }
+      if (has_apply(item)) {
+        // the pending update is installed on top of exactly this value
+        Value v = held ? e->value.access() : e->value.read(item, e->version);
+        item.template write_value<pending_type>()(v);
+        retval = v;
+        return true;
+      }
       if (item.has_write()) {
         retval = item.template write_value<write_value_type>();
         return true;
@@ -128,7 +179,11 @@ public:
       //item.add_read(elem_vers);
       //if (Opacity)
       //  check_opacity(e->version);
-      retval = e->value.read(item, e->version);
+      // nobody can change a value we hold the lock on, so there's nothing to validate
+      if (held)
+        retval = e->value.access();
+      else
+        retval = e->value.read(item, e->version);
       return true;
     } else {
       Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
@@ -149,6 +204,7 @@ public:
       Version_type elemvers = e->version;
       fence();
       auto item = t_item(e);
+      bool held = lock_if_hot(item, e, true);
       bool valid = e->valid();
 #if READ_MY_WRITES
       if (!valid && has_insert(item)) {
@@ -174,9 +230,12 @@ public:
       }
 #endif
       // we need to make sure this bucket didn't change (e.g. what was once there got removed)
-      item.observe(elemvers);
+      if (!held)
+        item.observe(elemvers);
       //if (Opacity)
       //  check_opacity(e->version);
+      if (has_apply(item))
+        item.clear_write().clear_flags(apply_bit);
       // we use delete_bit to detect deletes so we don't need any other data
       // for deletes, just to mark it as a write
       item.add_write().add_flags(delete_bit);
@@ -207,6 +266,7 @@ private:
       Version_type elemvers = e->version;
       fence();
       auto item = t_item(e);
+      bool held = lock_if_hot(item, e, true);
       if (!validity_check(item, e)) {
         Sto::abort();
         // unreachable (t.abort() raises an exception)
@@ -228,11 +288,14 @@ private:
 
 #if HASHTABLE_DELETE
       // make sure the item doesn't get deleted before us
-      item.observe(elemvers);
+      if (!held)
+        item.observe(elemvers);
       //if (Opacity)
       //  check_opacity(e->version);
 #endif
       if (SET) {
+        if (has_apply(item))
+          item.clear_write().clear_flags(apply_bit);
         item.template add_write<write_value_type>(v);
 #if READ_MY_WRITES
         if (has_insert(item)) {
@@ -277,6 +340,41 @@ private:
     }
   }
 
+  // `op` updates a value directly; `add_pending` records it in a
+  // pending_type.
+  template <typename KT, typename Op, typename AddPending>
+  bool trans_apply(const KT& k, Op op, AddPending add_pending) {
+    bucket_entry& buck = buck_entry(k);
+    internal_elem *e = find(buck, k);
+    if (e) {
+      auto item = t_item(e);
+      if (!validity_check(item, e)) {
+        Sto::abort();
+        return false;
+      }
+      if (!has_delete(item)) {
+        if (has_insert(item)) {
+          // our own invisible insert: update it directly
+          Value& v = item.template write_value<write_value_type>();
+          op(v);
+          e->value.write(v);
+        } else if (has_apply(item))
+          add_pending(item.template write_value<pending_type>());
+        else if (item.has_write())
+          op(item.template write_value<write_value_type>());
+        else {
+          pending_type p;
+          add_pending(p);
+          item.template add_write<pending_type>(std::move(p)).add_flags(apply_bit);
+        }
+        return true;
+      }
+    }
+    Value v = Value();
+    op(v);
+    return trans_write</*insert*/true, /*set*/true>(k, v);
+  }
+
 public:
   template <typename KT, typename VT>
   bool transPut(const KT& k, const VT& v) {
@@ -294,8 +392,63 @@ public:
     return trans_write</*insert*/false, /*set*/true>(k, v);
   }
 
+  // Commutative update: `op` (callable as `void op(Value&)`) is applied to
+  // whatever value k has when this transaction commits. Nothing is read, so
+  // concurrent transApplys on the same key don't conflict; ops on one key
+  // within a transaction are composed in order and run once, under the
+  // element lock, at install time. A later transGet of k in this transaction
+  // reads (and validates) the current value and applies the pending ops to
+  // it. If k is absent, op is applied to Value() and the result inserted.
+  // Only ops that commute with each other may be mixed on one key.
+  // Returns true if k already existed.
+  template <typename KT, typename Op>
+  bool transApply(const KT& k, Op op) {
+    return trans_apply(k, op, [&op] (pending_type& p) { p.push(op); });
+  }
+
+  // Increments of one key fold into a single pending delta.
+  template <typename KT>
+  bool transIncrement(const KT& k, const Value& delta) {
+    return trans_apply(k, [&delta] (Value& v) { v += delta; },
+                       [&delta] (pending_type& p) { p.increment(delta); });
+  }
+
+  // The number of keys in [lo, hi) present in the table, counting this
+  // transaction's inserts and deletes, for integral keys. The result is a
+  // TIntRangeProxy, so `transCount(lo, hi) == 0` ("nothing in this range")
+  // depends only on its outcome: concurrent inserts into the same buckets
+  // that leave the outcome alone don't abort us. This visits every key in
+  // the range, so keep ranges short. See TPredicate.hh.
+  TIntRangeProxy<int> transCount(const Key& lo, const Key& hi) {
+    static_assert(std::is_integral<Key>::value, "transCount requires integral keys");
+    int delta = 0;
+    if (Sto::any_writes())
+      for (Key k = lo; k < hi; ++k)
+        if (internal_elem* e = elem(k))
+          if (auto item = Sto::check_item(this, e))
+            delta += item->has_flag(insert_bit) - item->has_flag(delete_bit);
+    return count_type::observe(this, Sto::new_item(this, (void*) count_bit), count_args{lo, hi}, delta);
+  }
+
+  // The committed number of present keys in [lo, hi), for TAggregate. The
+  // virtual methods instantiate this for every key type.
+  struct count_args {
+    Key lo;
+    Key hi;
+  };
+  typedef TAggregate<int, count_args> count_type;
+  int aggregate(const count_args& args, TAggregateScan& scan) {
+    return count_present(args, scan, std::is_integral<Key>());
+  }
+  bool check_predicate(TransItem& item, Transaction& txn, bool committing) override {
+    assert(is_count(item));
+    return count_type::check_predicate(this, item, txn, committing);
+  }
+
 
-  bool check(TransItem& item, Transaction&) override {
+  bool check(TransItem& item, Transaction& txn) override {
+    if (is_count(item))
+      return count_type::check(this, item, txn);
     if (is_bucket(item)) {
       bucket_entry& buck = map_[bucket_key(item)];
       return buck.version.check_version(item.template read_value<Version_type>());
@@ -306,17 +459,45 @@ public:
     // otherwise we check that it is both valid and not locked
     // XXX bool validity_check = has_insert(item) || (el->valid() && (!is_locked(el->version) || item.has_lock(t)));
     // XXX Why isn't it enough to just do the versionCheck?
-    return el->version.check_version(read_version);
+    if (!el->version.check_version(read_version)) {
+      heat(el);
+      return false;
+    }
+    return true;
   }
 
   bool lock(TransItem& item, Transaction& txn) override {
     assert(!is_bucket(item));
+    if (is_elem_lock(item)) {
+      assert(item.has_flag(shared_lock_bit) || lock_elem(item)->version.is_locked_here(txn));
+      return true;
+    }
     auto el = item.key<internal_elem*>();
-    return txn.try_lock(item, el->version);
+    // the only way we can already hold an element's lock is lock_if_hot
+    bool early = el->version.is_locked_here(txn);
+    if (early)
+      item.add_flags(early_lock_bit);
+    else if (!txn.try_lock(item, el->version)) {
+      heat(el);
+      return false;
+    } else if (adaptive_cc_ && !wait_for_hot_readers(el, holds_shared(txn, el))) {
+      unlock(el->version);
+      heat(el);
+      return false;
+    }
+    // a blind apply never observed the element, so catch concurrent deletes here
+    if (has_apply(item) && !el->valid()) {
+      if (!early)
+        unlock(el->version);
+      return false;
+    }
+    return true;
   }
 
   void install(TransItem& item, Transaction& t) override {
     assert(!is_bucket(item));
+    if (is_elem_lock(item))
+      return;
     auto el = item.key<internal_elem*>();
     assert(is_locked(el));
     // delete
@@ -328,7 +509,11 @@ public:
       return;
     }
     // else must be insert/update
-    if (!(item.flags() & insert_bit)) {
+    if (has_apply(item)) {
+      Value new_v = el->value.access();
+      item.template write_value<pending_type>()(new_v);
+      el->value.write(new_v);
+    } else if (!(item.flags() & insert_bit)) {
       // Update
       Value& new_v = item.template write_value<write_value_type>();
       el->value.write(new_v);
@@ -355,11 +540,28 @@ public:
 
   void unlock(TransItem& item) override {
     assert(!is_bucket(item));
-    auto el = item.key<internal_elem*>();
-    unlock(el->version);
+    if (is_elem_lock(item)) {
+      // shared holds last until cleanup
+      if (!item.has_flag(shared_lock_bit))
+        unlock(lock_elem(item)->version);
+    }
+    else if (!(item.flags() & early_lock_bit))
+      unlock(item.key<internal_elem*>()->version);
   }
 
   void cleanup(TransItem& item, bool committed) override {
+    if (is_elem_lock(item)) {
+      // we may abort before the commit-time unlock, or before commit at all
+      auto el = lock_elem(item);
+      if (item.has_flag(shared_lock_bit)) {
+        fetch_and_add(&el->hot_readers, uint16_t(-1));
+        return;
+      }
+      int owner = item.template write_value<int>();
+      if (el->version.is_locked_here(owner))
+        el->version.unlock(owner);
+      return;
+    }
     if (committed ? has_delete(item) : has_insert(item)) {
       auto el = item.key<internal_elem*>();
       assert(!el->valid());
@@ -415,16 +617,24 @@ public:
 
     void print(std::ostream& w, const TransItem& item) const override {
         w << "{Hashtable<" << typeid(K).name() << "," << typeid(V).name() << "> " << (void*) this;
-        if (is_bucket(item)) {
+        if (is_count(item)) {
+            w << ".count";
+            count_type::print(w, item);
+        } else if (is_bucket(item)) {
             w << ".b[" << bucket_key(item) << "]";
             if (item.has_read())
                 w << " R" << item.read_value<Version_type>();
+        } else if (is_elem_lock(item)) {
+            w << "[" << mass::print_value(lock_elem(item)->key) << "] "
+              << (item.has_flag(shared_lock_bit) ? "S" : "L");
         } else {
             auto el = item.key<internal_elem*>();
             w << "[" << mass::print_value(el->key) << "]";
             if (item.has_read())
                 w << " R" << item.read_value<Version_type>();
-            if (item.has_write())
+            if (item.has_write() && (item.flags() & apply_bit))
+                w << " =f(*)";
+            else if (item.has_write())
                 w << " =" << mass::print_value(item.write_value<write_value_type>());
         }
         w << "}";
@@ -652,12 +862,45 @@ public:
     unlock(e->version);
   }
 
+  // Number of committed keys. Not synchronized with concurrent writers.
+  size_t approx_size() const {
+    size_t n = 0;
+    for (auto& buck : map_)
+      for (internal_elem* e = buck.head; e; e = e->next)
+        n += !(e->version.value() & invalid_bit);
+    return n;
+  }
+
+  // Remove every element. Must not run concurrently with transactions on
+  // this table; elements are freed once current RCU readers are done.
+  void nontrans_clear() {
+    for (auto& buck : map_) {
+      lock(buck.version);
+      internal_elem* e = buck.head;
+      buck.head = NULL;
+#ifndef STO_NO_STM
+      buck.version.inc_nonopaque_version();
+#endif
+      unlock(buck.version);
+      while (e) {
+        internal_elem* next = e->next;
+        Transaction::rcu_delete(e);
+        e = next;
+      }
+    }
+  }
+
   bool nontrans_insert(const Key& k, const Value& v) { return insert(k, v); }
 
   bool nontrans_find(const Key& k, Value& v) { return read(k, v); }
 
   bool nontrans_remove(const Key& k) { return remove(k); }
 
+  // Changes @k's value in place, if present; @oldval gets the old value.
+  bool nontrans_replace(const Key& k, const Value& v, Value& oldval) {
+    return put_getold<false, true>(k, v, oldval);
+  }
+
   // XXX: there's a race between the read and the remove (oldval might be stale) but mehh
   bool nontrans_remove(const Key& k, Value& oldval) { if (read(k,oldval)) return remove(k); else return false; }
 
@@ -680,6 +923,23 @@ private:
     return find(buck_entry(k), k);
   }
 
+  int count_present(const count_args& args, TAggregateScan& scan, std::true_type) {
+    int n = 0;
+    for (Key k = args.lo; k < args.hi; ++k) {
+      bucket_entry& buck = buck_entry(k);
+      scan.visit(buck.version);
+      fence();
+      // an element not yet inserted or already deleted is invalid
+      if (internal_elem* e = find(buck, k))
+        n += !(scan.visit(e->version) & invalid_bit);
+    }
+    return n;
+  }
+  int count_present(const count_args&, TAggregateScan&, std::false_type) {
+    always_assert(false);
+    return 0;
+  }
+
   bool has_delete(const TransItem& item) {
       return item.flags() & delete_bit;
   }
@@ -688,6 +948,10 @@ private:
       return item.flags() & insert_bit;
   }
 
+  static bool has_apply(const TransItem& item) {
+      return item.flags() & apply_bit;
+  }
+
   bool validity_check(const TransItem& item, internal_elem *e) {
     return has_insert(item) || e->valid();
   }
@@ -714,6 +978,18 @@ private:
   void* pack_bucket(unsigned bucket) {
       return (void*) ((bucket << 1) | bucket_bit);
   }
+  static bool is_count(const TransItem& item) {
+      return item.key<uintptr_t>() == count_bit;
+  }
+  static bool is_elem_lock(const TransItem& item) {
+      return item.key<uintptr_t>() & elem_lock_bit;
+  }
+  static internal_elem* lock_elem(const TransItem& item) {
+      return (internal_elem*) (item.key<uintptr_t>() & ~elem_lock_bit);
+  }
+  static void* pack_elem_lock(internal_elem* e) {
+      return (void*) ((uintptr_t) e | elem_lock_bit);
+  }
 
   static bool is_locked(Version_type &v) {
     return v.is_locked();
@@ -756,6 +1032,105 @@ private:
     return Sto::item(this, e);
   }
 
+#ifndef STO_NO_STM
+  // Hot elements are locked as soon as a transaction touches them and
+  // stay locked until it commits or aborts: in shared mode for reads
+  // (@write false), exclusively for writes. Transactions contending for a
+  // hot element then wait their turn at access time rather than all but
+  // one aborting at commit, while readers still run side by side. A shared
+  // hold counts in hot_readers; anyone who locks the element's version,
+  // here or at commit, waits for the other shared holders to leave. Waits
+  // are bounded by hot_lock_spins and end in an abort, which breaks
+  // lock-order cycles. The hold belongs to a separate write item so
+  // cleanup releases it even when we abort mid-transaction; its write
+  // value is our thread id. A transaction holding an element shared
+  // doesn't upgrade here; its write takes the lock at commit. Returns true
+  // if nobody else can change @e until we finish.
+  bool lock_if_hot(TransProxy& item, internal_elem* e, bool write) {
+#if HASHTABLE_ADAPTIVE_CC
+    if (!adaptive_cc_)
+      return false;
+    int here = TThread::id();
+    if (e->version.is_locked_here(here))
+      return true;
+    bool shared = holds_shared(item.transaction(), e);
+    if (shared || e->temperature < hot_temperature || has_insert(item))
+      return shared && !write;
+    unsigned n = 0;
+    if (write) {
+      while (!e->version.try_lock(here)) {
+        if (++n == hot_lock_spins) {
+          heat(e);
+          Sto::abort();
+        }
+        relax_fence();
+      }
+      fence();
+      if (!wait_for_hot_readers(e, 0)) {
+        e->version.unlock(here);
+        heat(e);
+        Sto::abort();
+      }
+    } else {
+      while (1) {
+        if (!e->version.is_locked()) {
+          // pairs with the fence between locking and wait_for_hot_readers
+          fetch_and_add(&e->hot_readers, uint16_t(1));
+          if (!e->version.is_locked())
+            break;
+          fetch_and_add(&e->hot_readers, uint16_t(-1));
+        }
+        if (++n == hot_lock_spins) {
+          heat(e);
+          Sto::abort();
+        }
+        relax_fence();
+      }
+    }
+    acquire_fence();
+    // shared holds say nothing about contention among writers
+    if (write && n == 0)
+      e->temperature = e->temperature - 1;
+    Sto::new_item(this, pack_elem_lock(e)).add_write(here)
+      .add_flags(write ? 0 : shared_lock_bit);
+    return true;
+#else
+    (void) item, (void) e, (void) write;
+    return false;
+#endif
+  }
+
+  // Wait, with @e's version locked by us, until the only shared holders
+  // of @e left are @own of our own.
+  static bool wait_for_hot_readers(internal_elem* e, uint16_t own) {
+    for (unsigned n = 0; e->hot_readers != own; ++n) {
+      if (n == hot_lock_spins)
+        return false;
+      relax_fence();
+    }
+    return true;
+  }
+  uint16_t holds_shared(Transaction& txn, internal_elem* e) const {
+    auto litem = txn.check_item(this, pack_elem_lock(e));
+    return litem && litem->has_flag(shared_lock_bit);
+  }
+
+  // Temperature is a heuristic, so it is updated without atomics:
+  // racing updates may lose a step, which only shifts when an element
+  // turns hot or cold by a conflict.
+  void heat(internal_elem* e) const {
+#if HASHTABLE_ADAPTIVE_CC
+    if (!adaptive_cc_)
+      return;
+    uint8_t t = e->temperature;
+    if (t != 255)
+      e->temperature = t + 1;
+#else
+    (void) e;
+#endif
+  }
+#endif
+
   TransProxy t_read_only_item(internal_elem* e) {
 #if READ_MY_WRITES
     return Sto::read_item(this, e);
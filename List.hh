@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+#include <algorithm>
 #include "TaggedLow.hh"
 #include "Interface.hh"
 
@@ -19,8 +21,35 @@ public:
 
 template <typename T, bool Duplicates = false, typename Compare = DefaultCompare<T>, bool Sorted = true, bool Opacity = true> class ListIterator;
 
+// Transactional linked list: a set, or a multiset if Duplicates.
+//
+// The list is a Harris-style lock-free list. Each node's link to its
+// successor carries a mark bit, set once the node is being removed. An
+// insert links its node with one CAS on the predecessor's link; a removal
+// marks the node's own link and then CASes the node out of its predecessor,
+// and any walk that meets a marked node helps unlink it. There is no
+// list-wide lock, so changes to different parts of the list don't
+// serialize.
+//
+// Transactions validate against per-node state:
+//   - A node a lookup finds is validated by its version. As in Hashtable,
+//     transInsert links its node at execution time, invalid until commit,
+//     and a committed delete marks its node invalid before unlinking it.
+//   - A lookup that misses observes the link that would have pointed at
+//     the element, and iteration observes every link it follows. A link
+//     changes when a node is linked after it or when either end of the gap
+//     is removed, so comparing it at commit catches inserts into a gap we
+//     saw empty. (An unsorted list has no such gap: a miss observes every
+//     link.)
+//   - size() observes listsize_.
+//
+// With index_stride > 0, a sorted list also keeps an index of every
+// index_stride-th node, so walks start near their target and positioning
+// takes O(log n + index_stride) steps. The index is rebuilt once long walks
+// have cost about as much as a rebuild. A node the index refers to is
+// freed by the index, not by whoever unlinks it.
 template <typename T, bool Duplicates = false, typename Compare = DefaultCompare<T>, bool Sorted = true, bool Opacity = true>
-class List 
+class List
 #ifndef STO_NO_STM
 : public TObject
 #endif
@@ -28,14 +57,32 @@ class List
   friend class ListIterator<T, Duplicates, Compare, Sorted, Opacity>;
   typedef ListIterator<T, Duplicates, Compare, Sorted, Opacity> iterator;
 public:
-  List(Compare comp = Compare()) : head_(NULL), listsize_(0), listlock_(0), listversion_(0), comp_(comp) {
+  List(Compare comp = Compare(), unsigned index_stride = 0)
+    : listsize_(0), comp_(comp), index_(NULL), index_stride_(index_stride),
+      index_building_(0), index_walked_(0) {
+  }
+
+  ~List() {
+    // indexed nodes that were unlinked are only reachable from the index
+    if (index_) {
+      for (unsigned i = 0; i != index_->n; ++i)
+        if (index_->nodes[i]->indexed == 2)
+          delete index_->nodes[i];
+      free(index_);
+    }
+    list_node* n = link_ptr(head_.next);
+    while (n) {
+      list_node* next = link_ptr(n->next);
+      delete n;
+      n = next;
+    }
   }
 
 private:
-  // not an actual tid but we use that type for the spinlock implementations
-  typedef TransactionTid::type list_lock_type;
   typedef TVersion node_version_type;
-  typedef TVersion list_version_type;
+
+  static constexpr uintptr_t mark_bit = 1;
+  static constexpr uintptr_t gap_bit = 1;
 
 public:
     static constexpr TransactionTid::type invalid_bit = TransactionTid::user_bit;
@@ -44,9 +91,21 @@ public:
     static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
     static constexpr TransItem::flags_type doupdate_bit = TransItem::user0_bit<<2;
 
-  struct list_node {
+  struct list_node;
+
+  // Link to the next node. mark_bit is set once the node owning the link
+  // is being removed; a marked link never changes again.
+  struct list_link {
+    list_link() : next(0) {
+    }
+    volatile uintptr_t next;
+  };
+
+  struct list_node : public list_link {
     list_node(const T& val, list_node *next, bool invalid)
-      : val(val), next(next), vers(Sto::initialized_tid() | (invalid ? (invalid_bit | TransactionTid::lock_bit | TThread::id()) : 0)) {
+      : val(val), indexed(0),
+        vers(Sto::initialized_tid() | (invalid ? (invalid_bit | TransactionTid::lock_bit | TThread::id()) : 0)) {
+      this->next = (uintptr_t) next;
     }
 
     // used for delete commit
@@ -80,14 +139,21 @@ public:
       return !(vers.value() & invalid_bit);
     }
 
+    bool is_marked() const {
+      return this->next & mark_bit;
+    }
+
     T val;
-    list_node *next;
+    // 0: not in the index; 1: in the index; 2: in the index and unlinked,
+    // so the index frees it
+    volatile int indexed;
     node_version_type vers;
   };
 
+  // observes listsize_
   static constexpr list_node* list_key = nullptr;
   // Can't have non-NULL constexpr pointer
-  static inline list_node* size_key() { return (list_node*)1; }
+  static inline list_node* size_key() { return (list_node*)2; }
 
   bool find(const T& elem, T& val) {
     auto *ret = _find(elem);
@@ -106,57 +172,54 @@ public:
   }
 
   list_node* _find(const T& elem) {
-    list_node *cur = head_;
-    while (cur != NULL) {
-      int c = comp_(cur->val, elem);
-      if (c == 0) {
-        return cur;
-      }
-      if (Sorted && c > 0) {
-        return NULL;
-      }
-      cur = cur->next;
-    }
+    list_link *pred;
+    uintptr_t pw;
+    list_node *cur = walk(elem, pred, pw);
+    if (cur && comp_(cur->val, elem) == 0)
+      return cur;
     return NULL;
   }
 
   template <bool Txnal = false>
   list_node* _insert(const T& elem, bool *inserted = NULL) {
+    list_node *n = NULL;
+    list_link *pred;
+    uintptr_t pw;
+    while (1) {
+      if (!Sorted && Duplicates) {
+        pred = &head_;
+        pw = head_.next;
+      } else {
+        list_node *cur = walk(elem, pred, pw);
+        if (!Duplicates && cur && comp_(cur->val, elem) == 0) {
+          delete n;
+          if (inserted)
+            *inserted = false;
+          return cur;
+        }
+      }
+      if (!n)
+        n = new list_node(elem, NULL, Txnal);
+      n->next = pw;
+      if (cas_link(pred, pw, (uintptr_t) n))
+        break;
+    }
     if (inserted)
       *inserted = true;
-    lock(listlock_);
-    if (!Sorted && !Duplicates) {
-      list_node *new_head = new list_node(elem, head_, Txnal);
-      head_ = new_head;
-      unlock(listlock_);
-      return new_head;
-    }
-
-    list_node *prev = NULL;
-    list_node *cur = head_;
-    while (cur != NULL) {
-      int c = comp_(cur->val, elem);
-      if (!Duplicates && c == 0) {
-        unlock(listlock_);
-        if (inserted)
-          *inserted = false;
-        return cur;
-      } else if (Sorted && c >= 0) {
-        break;
+    if (!Txnal)
+      fetch_and_add(&listsize_, 1L);
+#ifndef STO_NO_STM
+    else {
+      // our own insert shouldn't invalidate our view of the gap, but the
+      // part of the gap now behind our node must still stay empty
+      auto gap_item = Sto::check_item(this, pack_gap(pred));
+      if (gap_item) {
+        gap_item->update_read(pw, (uintptr_t) n);
+        observe_gap(n, pw);
       }
-      prev = cur;
-      cur = cur->next;
-    }
-    auto ret = new list_node(elem, cur, Txnal);
-    if (prev) {
-        prev->next = ret;
-    } else {
-        head_ = ret;
     }
-    if (!Txnal)
-      listsize_++;
-    unlock(listlock_);
-    return ret;
+#endif
+    return n;
   }
 
   bool insert(const T& elem) {
@@ -166,56 +229,29 @@ public:
   }
 
   template <bool Txnal>
-  bool remove(const T& elem, bool locked = false) {
-    return _remove<Txnal>([&] (list_node *n2) { return comp_(n2->val, elem) == 0; }, locked);
+  bool remove(const T& elem) {
+    list_node *n = _find(elem);
+    return n && remove<Txnal>(n);
   }
 
   template <bool Txnal>
-  bool remove(list_node *n, bool locked = false) {
-    // TODO: doing this remove means we don't have to value compare, but we also
-    // have to go through the whole list (possibly). Unclear which is better.
-    return _remove<Txnal>([n] (list_node *n2) { return n == n2; }, locked);
-  }
-
-  template <bool Txnal, typename FoundFunc>
-  bool _remove(FoundFunc found_f, bool locked = false) {
-    if (!locked)
-      lock(listlock_);
-    list_node *prev = NULL;
-    list_node *cur = head_;
-    while (cur != NULL) {
-      if (found_f(cur)) {
-        cur->mark_invalid(Txnal);
-        if (prev) {
-            prev->next = cur->next;
-        } else {
-            head_ = cur->next;
-        }
-        if (Txnal) {
-          Transaction::rcu_delete(cur);
-        } else {
-          delete cur;
-        }
-        if (!Txnal)
-          listsize_--;
-        if (!locked)
-          unlock(listlock_);
-        return true;
-      }
-      prev = cur;
-      cur = cur->next;
-    }
-    if (!locked)
-      unlock(listlock_);
-    return false;
+  bool remove(list_node *n) {
+    list_link *pred;
+    uintptr_t succ;
+    n->mark_invalid(Txnal);
+    if (!remove_node(n, pred, succ))
+      return false;
+    if (!Txnal)
+      fetch_and_add(&listsize_, -1L);
+    return true;
   }
 
 #ifndef STO_NO_STM
   T* transFind(const T& elem) {
-    auto listv = listversion_;
-    fence();
-    auto *n = _find(elem);
-    if (n) {
+    list_link *pred;
+    uintptr_t pw;
+    auto *n = walk(elem, pred, pw, NULL, !Sorted);
+    if (n && comp_(n->val, elem) == 0) {
       auto version = n->version();
       fence();
       auto item = t_item(n);
@@ -228,8 +264,7 @@ public:
       }
       item.observe(version);
     } else {
-      // log list v#
-      verify_list(listv);
+      observe_gap(pred, pw);
       return NULL;
     }
     return &n->val;
@@ -268,18 +303,16 @@ public:
       return false;
     }
     add_trans_size_offs(1);
-    // we lock the list for inserts
-    add_lock_list_item();
     item.add_write(0);
     item.add_flags(insert_bit);
     return true;
   }
 
   bool transDelete(const T& elem) {
-    auto listv = listversion_;
-    fence();
-    auto *n = _find(elem);
-    if (n) {
+    list_link *pred;
+    uintptr_t pw;
+    auto *n = walk(elem, pred, pw, NULL, !Sorted);
+    if (n && comp_(n->val, elem) == 0) {
       auto version = n->version();
       fence();
       auto item = t_item(n);
@@ -300,12 +333,26 @@ public:
       }
       // insert-then-delete becomes absent-get
       if (has_insert(item)) {
-        remove<true>(n);
+        uintptr_t succ;
+        n->mark_invalid(true);
+        if (remove_node(n, pred, succ)) {
+          // the gap is back the way we saw it
+          auto gap_item = Sto::check_item(this, pack_gap(pred));
+          if (gap_item)
+            gap_item->update_read((uintptr_t) n, succ);
+        }
+        auto own_gap_item = Sto::check_item(this, pack_gap(n));
+        if (own_gap_item)
+          own_gap_item->remove_read();
         item.remove_read().remove_write().clear_flags(insert_bit);
         add_trans_size_offs(-1);
-        // TODO: should have a count on add_lock_list_item so we can cancel that here
         // still need to make sure no one else inserts something
-        verify_list(listv);
+        n = walk(elem, pred, pw, NULL, !Sorted);
+        if (!n || comp_(n->val, elem) != 0)
+          observe_gap(pred, pw);
+        else if (!n->is_valid())
+          // someone else's uncommitted insert
+          Sto::abort();
         return true;
       }
       item.assign_flags(delete_bit);
@@ -314,50 +361,26 @@ public:
       // we also need to check that it's still valid at commit time (not
       // bothering with valid_check_only_bit optimization right now)
       item.observe(version);
-      add_lock_list_item();
       add_trans_size_offs(-1);
       return true;
     } else {
-      verify_list(listv);
+      observe_gap(pred, pw);
       return false;
     }
   }
 
-  inline list_version_type opacity_check() {
-    // When we check for opacity, we need to compare the latest listversion and not
-    // the one at the beginning of the operation.
-    assert(Opacity);
-    auto listv = listversion_;
-    fence();
-    if (listv.is_locked_elsewhere()) {
-      Sto::abort();
-    }
-    Sto::check_opacity(listv.value());
-    return listv;
-  }
-
   struct ListIter;
 
   ListIter transIter() {
-    auto listv = listversion_;
-    fence();
-    auto head = head_;
-    fence();
-    if (listv != listversion_)
-      Sto::abort();
-    verify_list(listv);
-    return ListIter(this, head, true);
+    return ListIter(this, trans_next(&head_));
   }
 
   size_t size() {
-    auto listv = listversion_;
-    fence();
-    auto size = listsize_;
+    long size = listsize_;
     fence();
-    // doesn't seem worth putting much effort in here--if we got different versions just abort.
-    if (listv != listversion_)
-      Sto::abort();
-    verify_list(listv);
+    t_item(list_key).add_read(size);
+    if (Opacity)
+      Sto::check_opacity();
     return size + trans_size_offs();
   }
 
@@ -366,8 +389,8 @@ public:
   }
 
 #endif /* !STO_NO_STM */
-    
-  iterator begin() { return iterator(this, head_); }
+
+  iterator begin() { return iterator(this, trans_next(&head_)); }
   iterator end() { return iterator(this, NULL); }
 
   struct ListIter {
@@ -382,30 +405,29 @@ public:
     }
 
     void reset() {
-      cur = us->head_;
+      cur = link_ptr(us->head_.next);
     }
 
     T* next() {
       auto ret = cur ? &cur->val : NULL;
       if (cur)
-        cur = cur->next;
+        cur = link_ptr(cur->next);
       return ret;
     }
 
+#ifndef STO_NO_STM
     bool transHasNext() const {
       return !!cur;
     }
 
     void transReset() {
-      cur = us->head_;
-      ensureValid();
+      cur = us->trans_next(&us->head_);
     }
 
     T* transNext() {
       auto ret = cur ? &cur->val : NULL;
       if (cur)
-        cur = cur->next;
-      ensureValid();
+        cur = us->trans_next(cur);
       return ret;
     }
 
@@ -419,39 +441,10 @@ public:
         return ret;
       return NULL;
     }
+#endif
 
 private:
-    ListIter(List *us, list_node *cur, bool trans) : us(us), cur(cur) {
-      if (trans)
-        ensureValid();
-    }
-
-    void ensureValid() {
-#ifndef STO_NO_STM
-      while (cur) {
-        // need to check if this item already exists
-	// XXX: we could probably use threadids in inserted items so this
-        // doesn't have to search the write set. But I'm not sure there's
-        // a way to avoid checking for if we deleted the item?
-        auto item = Sto::check_item(us, cur);
-        if (!cur->is_valid()) {
-          if (!item || !us->has_insert(*item)) {
-            Sto::abort();
-            // TODO: do we continue in this situation or abort?
-            cur = cur->next;
-            continue;
-          }
-        }
-        if (item && us->has_delete(*item)) {
-          cur = cur->next;
-          continue;
-        }
-        break;
-      }
-      fence();
-      if (Opacity)
-        us->opacity_check();
-#endif
+    ListIter(List *us, list_node *cur) : us(us), cur(cur) {
     }
 
     friend class List;
@@ -460,7 +453,7 @@ private:
   };
 
   ListIter iter() {
-    return ListIter(this, head_, false);
+    return ListIter(this, link_ptr(head_.next));
   }
 
   size_t unsafe_size() const {
@@ -468,35 +461,227 @@ private:
   }
 
   void clear() {
-      while (auto item = head_)
-        remove<false>(head_, true);
+      while (list_node *n = link_ptr(head_.next))
+        remove<false>(n);
   }
 
-  void verify_list(list_version_type readv) {
-    t_item(list_key).observe(readv);
-    acquire_fence();
+private:
+  struct list_index {
+    unsigned n;
+    list_node* nodes[1];
+  };
+
+  static list_node* link_ptr(uintptr_t w) {
+    return (list_node*) (w & ~mark_bit);
   }
 
+  static bool cas_link(list_link* link, uintptr_t expected, uintptr_t desired) {
+    return bool_cmpxchg(const_cast<uintptr_t*>(&link->next), expected, desired);
+  }
 
-  void lock(list_lock_type& v) {
-    TransactionTid::lock(v);
+  // Harris search. Walks from the closest index node before @elem (or the
+  // head), unlinking marked nodes on the way, and stops at the first live
+  // node not less than @elem (for unsorted lists, the first node equal to
+  // @elem). If @target is set, stops at @target instead, or returns NULL
+  // once past where it could be. On return @pred is the link that pointed
+  // at the result and @pw that link's value. With @observe_all, observes
+  // every link passed.
+  list_node* walk(const T& elem, list_link*& pred, uintptr_t& pw,
+                  list_node* target = NULL, bool observe_all = false) {
+  retry:
+    pred = start_link(elem);
+    pw = pred->next;
+    if (pw & mark_bit) {
+      pred = &head_;
+      pw = head_.next;
+    }
+    unsigned hops = 0;
+    list_node *cur;
+    while ((cur = link_ptr(pw))) {
+      uintptr_t cw = cur->next;
+      if (cw & mark_bit) {
+        // cur is being removed: help unlink it
+        if (!cas_link(pred, pw, cw & ~mark_bit))
+          goto retry;
+        retire(cur);
+        pw = cw & ~mark_bit;
+        continue;
+      }
+      if (cur == target)
+        break;
+      int c = comp_(cur->val, elem);
+      if (target ? Sorted && c > 0 : (Sorted ? c >= 0 : c == 0)) {
+        if (target)
+          cur = NULL;
+        break;
+      }
+#ifndef STO_NO_STM
+      if (observe_all)
+        observe_gap(pred, pw);
+#endif
+      pred = cur;
+      pw = cw;
+      ++hops;
+    }
+    if (Sorted && index_stride_ && hops > 4 * index_stride_)
+      note_long_walk(hops);
+    return cur;
+  }
+
+  // Mark @n's link, then unlink @n. Returns false if @n was already being
+  // removed. Sets @pred to the link that pointed at @n if our own CAS
+  // unlinked it (else NULL), and @succ to @n's successor.
+  bool remove_node(list_node* n, list_link*& pred, uintptr_t& succ) {
+    uintptr_t pw;
+    list_node *cur = walk(n->val, pred, pw, n);
+    do {
+      succ = n->next;
+      if (succ & mark_bit) {
+        walk(n->val, pred, pw, n);
+        pred = NULL;
+        return false;
+      }
+    } while (!cas_link(n, succ, succ | mark_bit));
+    if (cur == n && cas_link(pred, pw, succ)) {
+      retire(n);
+      return true;
+    }
+    // our view of the predecessor is stale; let a walk unlink n
+    walk(n->val, pred, pw, n);
+    pred = NULL;
+    return true;
   }
 
-  void unlock(list_lock_type& v) {
-    TransactionTid::unlock(v);
+  // Free @n, which our CAS just unlinked, unless the index refers to it.
+  void retire(list_node* n) {
+    if (n->indexed == 1 && bool_cmpxchg(const_cast<int*>(&n->indexed), 1, 2))
+      return;
+    Transaction::rcu_delete(n);
   }
 
-  bool is_locked(list_lock_type& v) {
-    return TransactionTid::is_locked(v);
+  // Last live index node before @elem, or the head.
+  list_link* start_link(const T& elem) {
+    list_index *idx = index_;
+    if (!Sorted || !idx)
+      return &head_;
+    acquire_fence();
+    int lo = 0, hi = idx->n;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (comp_(idx->nodes[mid]->val, elem) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    while (--lo >= 0)
+      if (!idx->nodes[lo]->is_marked())
+        return idx->nodes[lo];
+    return &head_;
+  }
+
+  void note_long_walk(unsigned hops) {
+    // racy, but it's only a heuristic
+    index_walked_ += hops;
+    if (index_walked_ > (unsigned long) listsize_ && !index_building_)
+      rebuild_index();
+  }
+
+  void rebuild_index() {
+    if (!bool_cmpxchg(const_cast<int*>(&index_building_), 0, 1))
+      return;
+    index_walked_ = 0;
+    std::vector<list_node*> nodes;
+    unsigned count = 0;
+    for (list_node *n = link_ptr(head_.next); n; n = link_ptr(n->next)) {
+      if (n->is_marked() || ++count % index_stride_ != 0)
+        continue;
+      if (n->indexed == 0) {
+        // claim n, then make sure no unlinker missed the claim
+        bool_cmpxchg(const_cast<int*>(&n->indexed), 0, 1);
+        fence();
+        if (n->is_marked()) {
+          if (!bool_cmpxchg(const_cast<int*>(&n->indexed), 1, 0))
+            Transaction::rcu_delete(n);
+          continue;
+        }
+      } else if (n->indexed != 1)
+        continue;
+      nodes.push_back(n);
+    }
+
+    list_index *idx = NULL;
+    if (!nodes.empty()) {
+      idx = (list_index*) malloc(sizeof(list_index) + sizeof(list_node*) * (nodes.size() - 1));
+      idx->n = nodes.size();
+      std::copy(nodes.begin(), nodes.end(), idx->nodes);
+    }
+    list_index *old = index_;
+    release_fence();
+    index_ = idx;
+
+    // release the nodes the new index dropped
+    if (old) {
+      std::sort(nodes.begin(), nodes.end());
+      for (unsigned i = 0; i != old->n; ++i) {
+        list_node *n = old->nodes[i];
+        if (!std::binary_search(nodes.begin(), nodes.end(), n)
+            && !bool_cmpxchg(const_cast<int*>(&n->indexed), 1, 0))
+          Transaction::rcu_delete(n);
+      }
+      Transaction::rcu_free(old);
+    }
+    release_fence();
+    index_building_ = 0;
   }
 
 #ifndef STO_NO_STM
+  static list_node* pack_gap(list_link* link) {
+    return (list_node*) ((uintptr_t) link | gap_bit);
+  }
+  static bool is_gap(const TransItem& item) {
+    return item.key<uintptr_t>() & gap_bit;
+  }
+  static list_link* gap_link(const TransItem& item) {
+    return (list_link*) (item.key<uintptr_t>() & ~gap_bit);
+  }
+
+  // Record that @link pointed at @w; validation fails if the link changes.
+  void observe_gap(list_link* link, uintptr_t w) {
+    t_item(pack_gap(link)).add_read(w);
+    if (Opacity)
+      Sto::check_opacity();
+  }
+
+  // First node after @from this transaction sees, observing every link
+  // followed.
+  list_node* trans_next(list_link* from) {
+    while (1) {
+      uintptr_t w = from->next;
+      // from is being removed
+      if (w & mark_bit)
+        Sto::abort();
+      observe_gap(from, w);
+      list_node *n = link_ptr(w);
+      if (!n)
+        return NULL;
+      // need to check if this item already exists
+      auto item = Sto::check_item(this, n);
+      if (!n->is_valid() && (!item || !has_insert(*item)))
+        Sto::abort();
+      if (item && has_delete(*item)) {
+        from = n;
+        continue;
+      }
+      return n;
+    }
+  }
+
+public:
     bool lock(TransItem& item, Transaction&) override {
       list_node *n = item.key<list_node*>();
-      if (n == list_key) {
-        return listversion_.try_lock();
-      } else if (!has_insert(item)) {
-        // we only lock non-inserts (removes, updates) so as to make our 
+      assert(!is_gap(item) && n != list_key);
+      if (!has_insert(item)) {
+        // we only lock non-inserts (removes, updates) so as to make our
 	// life harder (also it's not necessary for inserts).
         return n->try_lock();
       }
@@ -504,10 +689,10 @@ private:
     }
 
   bool check(TransItem& item, Transaction&) override {
-    if (item.key<list_node*>() == list_key) {
-      auto lv = listversion_;
-      return lv.check_version(item.template read_value<list_version_type>());
-    }
+    if (is_gap(item))
+      return gap_link(item)->next == item.template read_value<uintptr_t>();
+    if (item.key<list_node*>() == list_key)
+      return listsize_ == item.template read_value<long>();
     auto n = item.key<list_node*>();
     if (!n->is_valid()) {
       return has_insert(item);
@@ -516,42 +701,27 @@ private:
   }
 
   void install(TransItem& item, Transaction& t) override {
-    // TODO: this item tracks the total size differential so we could just do 
+    // TODO: this item tracks the total size differential so we could just do
     // a single fetch and add of the size delta here.
-    if (item.key<list_node*>() == list_key)
-      return;
     list_node *n = item.key<list_node*>();
     if (has_delete(item)) {
-      remove<true>(n, true);
-      listsize_--;
-      // not super ideal that we have to change version
-      // but we need to invalidate transSize() calls
-      if (Opacity) {
-        listversion_.set_version(t.commit_tid());
-      } else {
-        listversion_.inc_nonopaque_version();
-      }
+      remove<true>(n);
+      fetch_and_add(&listsize_, -1L);
     } else if (has_doupdate(item)) {
       n->set_version(t.commit_tid());
       n->val = item.template write_value<T>();
     } else {
-      // insert
+      // insert: count it before it becomes visible, so size() readers
+      // that see the node also see the new size
+      fetch_and_add(&listsize_, 1L);
       // clears the invalid bit too
       n->set_version_unlock(t.commit_tid());
-      listsize_++;
-      if (Opacity) {
-        listversion_.set_version(t.commit_tid());
-      } else {
-        listversion_.inc_nonopaque_version();
-      }
     }
   }
 
   void unlock(TransItem& item) override {
     auto n = item.key<list_node*>();
-    if (n == list_key) {
-      listversion_.unlock();
-    } else if (!has_insert(item)) {
+    if (!has_insert(item)) {
       n->unlock();
     }
   }
@@ -563,6 +733,7 @@ private:
       }
   }
 
+private:
   TransProxy t_item(list_node* node) {
     // can switch this to fresh_item to not read our writes
     return Sto::item(this, node);
@@ -580,12 +751,8 @@ private:
       return item.flags() & doupdate_bit;
   }
 
-  void add_lock_list_item() {
-    t_item(list_key).add_write(0);
-  }
-
   void add_trans_size_offs(int size_offs) {
-    // TODO: it'd be simpler and maybe even faster if this was just the 
+    // TODO: it'd be simpler and maybe even faster if this was just the
     // write_value of our list_key item (and we renamed list_key to size_key)
     auto item = t_item(size_key());
     item.template set_stash<int>(item.template stash_value<int>(0) + size_offs);
@@ -600,14 +767,16 @@ private:
       return n->is_valid() || (item.flags() & insert_bit);
   }
 
-  list_node *head_;
+  list_link head_;
   long listsize_;
-  list_lock_type listlock_;
-  list_version_type listversion_;
   Compare comp_;
+  list_index * volatile index_;
+  unsigned index_stride_;
+  volatile int index_building_;
+  unsigned long index_walked_;
 };
 
-    
+
 template <typename T, bool Duplicates, typename Compare, bool Sorted, bool Opacity>
 class ListIterator : public std::iterator<std::forward_iterator_tag, T> {
     typedef ListIterator<T, Duplicates, Compare, Sorted, Opacity> iterator;
@@ -615,67 +784,47 @@ class ListIterator : public std::iterator<std::forward_iterator_tag, T> {
     typedef typename list_type::list_node list_node;
 public:
     ListIterator(list_type * list, list_node* ptr) : myList(list), myPtr(ptr) {
-        myList->list_verify(myList->listversion_);
     }
     ListIterator(const ListIterator& itr) : myList(itr.myList), myPtr(itr.myPtr) {}
-    
+
     ListIterator& operator= (const ListIterator& v) {
         myList = v.myList;
         myPtr = v.myPtr;
         return *this;
     }
-    
+
     bool operator==(iterator other) const {
         return (myList == other.myList) && (myPtr == other.myPtr);
     }
-    
+
     bool operator!=(iterator other) const {
         return !(operator==(other));
     }
-    
+
     T& operator*() {
         return myPtr->val; // Just returing the pointer to the value because this
                            // list does not transactionally track updates to list values.
     }
-    
+
     void increment_ptr() {
         if (myPtr)
-            myPtr = myPtr->next;
-        while (myPtr) {
-            // need to check if this item already exists
-            auto item = Sto::check_item(myList, myPtr);
-            if (!myPtr->is_valid()) {
-                if (!item || !myList->has_insert(*item)) {
-                    Sto::abort();
-                    // TODO: do we continue in this situation or abort?
-                    myPtr = myPtr->next;
-                    continue;
-                }
-            }
-            if (item && myList->has_delete(*item)) {
-                myPtr = myPtr->next;
-                continue;
-            }
-            break;
-        }
+            myPtr = myList->trans_next(myPtr);
     }
-    
+
     /* This is the prefix case */
     iterator& operator++() {
         increment_ptr();
         return *this;
     }
-    
+
     /* This is the postfix case */
     iterator operator++(int) {
         iterator clone(*this);
         increment_ptr();
         return clone;
     }
-    
+
 private:
     list_type * myList;
     list_node * myPtr;
 };
-
-
@@ -10,7 +10,9 @@
 #include "masstree_remove.hh"
 #include "masstree_scan.hh"
 #include "string.hh"
+#include <functional>
 #include "Transaction.hh"
+#include "TCommute.hh"
 
 #include "StringWrapper.hh"
 #include "versioned_value.hh"
@@ -103,6 +105,9 @@ protected:
 public:
     typedef V write_value_type;
     typedef std::string key_write_value_type;
+    // a commutative update (see transApply)
+    typedef std::function<void(V&)> apply_type;
+    typedef TApplyPending<V> pending_type;
 
   MassTrans() {
 #if RCU
@@ -168,7 +173,7 @@ public:
       versioned_value *e = lp.value();
       e->writeable_value() = value;
     } else {
-      versioned_value *val = (versioned_value *)versioned_value::make(value, Sto::initialized_tid());
+      versioned_value *val = make_box(value, Sto::initialized_tid(), *ti.ti);
       lp.value() = val;
       lp.finish(1, *ti.ti);
     }
@@ -179,37 +184,58 @@ public:
   bool transGet(Str key, ValType& retval, threadinfo_type& ti = mythreadinfo) {
     unlocked_cursor_type lp(table_, key);
     bool found = lp.find_unlocked(*ti.ti);
-    if (found) {
-      versioned_value *e = lp.value();
-      //      __builtin_prefetch(&e->version);
-      auto item = t_read_only_item(e);
-      if (!validityCheck(item, e)) {
-        Sto::abort();
-        return false;
-      }
-      //      __builtin_prefetch();
-      //__builtin_prefetch(e->value.data() - sizeof(std::string::size_type)*3);
-#if READ_MY_WRITES
-      if (has_delete(item)) {
-        return false;
-      }
-      if (item.has_write()) {
-        // read directly from the element if we're inserting it
-        if (has_insert(item)) {
-	  assign_val(retval, e->read_value());
+    if (found)
+      return read_found(lp.value(), retval);
+    ensureNotFound(lp.node(), lp.full_version_value());
+    return found;
+  }
+
+  // Batched point lookups: looks up keys[0..n), storing values in
+  // retvals[i] and presence in found[i]; returns the number of keys found.
+  // Keys are processed in sorted batches of multiget_batch. Every key in a
+  // batch is first descended to its leaf (sorted order keeps the shared
+  // upper levels of the tree hot) and a prefetch of its value box issued;
+  // only then are values read and read items registered, so the box
+  // accesses can overlap with the remaining descents.
+  template <typename K, typename ValType>
+  size_t transMultiGet(const K* keys, unsigned n, ValType* retvals, bool* found, threadinfo_type& ti = mythreadinfo) {
+    unsigned order[multiget_batch];
+    multiget_slot slots[multiget_batch];
+    size_t nfound = 0;
+    for (unsigned base = 0; base < n; base += multiget_batch) {
+      unsigned m = std::min(n - base, multiget_batch);
+      for (unsigned j = 0; j != m; ++j)
+        order[j] = base + j;
+      std::sort(order, order + m, [&] (unsigned a, unsigned b) {
+          return Str(keys[a]) < Str(keys[b]);
+        });
+
+      for (unsigned j = 0; j != m; ++j) {
+        unlocked_cursor_type lp(table_, Str(keys[order[j]]));
+        multiget_slot& slot = slots[j];
+        slot.found = lp.find_unlocked(*ti.ti);
+        if (slot.found) {
+          slot.e = lp.value();
+          prefetch(slot.e);
         } else {
-	    retval = item.template write_value<write_value_type>();
+          slot.node = lp.node();
+          slot.version = lp.full_version_value();
         }
-        return true;
       }
-#endif
-      Version elem_vers;
-      atomicRead(e, elem_vers, retval);
-      item.observe(tversion_type(elem_vers));
-    } else {
-      ensureNotFound(lp.node(), lp.full_version_value());
+
+      for (unsigned j = 0; j != m; ++j) {
+        unsigned i = order[j];
+        multiget_slot& slot = slots[j];
+        if (slot.found)
+          found[i] = read_found(slot.e, retvals[i]);
+        else {
+          ensureNotFound(slot.node, slot.version);
+          found[i] = false;
+        }
+        nfound += found[i];
+      }
     }
-    return found;
+    return nfound;
   }
 
   template <typename K>
@@ -247,6 +273,8 @@ public:
       }
 #endif
       item.observe(tversion_type(v));
+      if (has_apply(item))
+        item.clear_write().clear_flags(apply_bit);
       // same as inserts we need to Store (copy) key so we can lookup to remove later
       item.template add_write<key_write_value_type>(key).add_flags(delete_bit);
       return found;
@@ -281,7 +309,7 @@ private:
       return handlePutFound<INSERT, SET>(e, key, value);
     } else {
       //      auto p = ti.ti->allocate(sizeof(versioned_value), memtag_value);
-      versioned_value* val = (versioned_value*)versioned_value::make(value, invalid_bit);
+      versioned_value* val = make_box(value, invalid_bit, *ti.ti);
       lp.value() = val;
 #if ABORT_ON_WRITE_READ_CONFLICT
       auto orig_node = lp.node();
@@ -319,6 +347,43 @@ private:
     }
   }
 
+  // `op` updates a value directly; `add_pending` records it in a
+  // pending_type.
+  template <typename KT, typename Op, typename AddPending>
+  bool trans_apply(const KT& key, Op op, AddPending add_pending, threadinfo_type& ti) {
+    static_assert(std::is_same<typename versioned_value::value_type, V>::value,
+                  "transApply needs a box that stores V itself (not versioned_str_struct)");
+    unlocked_cursor_type lp(table_, key);
+    if (lp.find_unlocked(*ti.ti)) {
+      versioned_value* e = lp.value();
+      auto item = t_item(e);
+      if (!validityCheck(item, e)) {
+        Sto::abort();
+        return false;
+      }
+      if (!has_delete(item)) {
+        if (has_insert(item)) {
+          // our own invisible insert: update it directly
+          V v = e->read_value();
+          op(v);
+          e->set_value(v);
+        } else if (has_apply(item))
+          add_pending(item.template write_value<pending_type>());
+        else if (item.has_write())
+          op(item.template write_value<write_value_type>());
+        else {
+          pending_type p;
+          add_pending(p);
+          item.template add_write<pending_type>(std::move(p)).add_flags(apply_bit);
+        }
+        return true;
+      }
+    }
+    V v = V();
+    op(v);
+    return trans_write</*insert*/true, /*set*/true>(key, v, ti);
+  }
+
 public:
   template <typename KT, typename VT>
   bool transPut(const KT& k, const VT& v, threadinfo_type& ti = mythreadinfo) {
@@ -335,6 +400,27 @@ public:
     return !trans_write</*insert*/true, /*set*/false>(k, v, ti);
   }
 
+  // Commutative update: `op` (callable as `void op(V&)`) is applied to
+  // whatever value the key has when this transaction commits. Nothing is
+  // read, so concurrent transApplys on the same key don't conflict; ops on
+  // one key within a transaction are composed in order and run once, under
+  // the element lock, at install time. Later reads of the key in this
+  // transaction read (and validate) the current value and apply the pending
+  // ops to it. If the key is absent, op is applied to V() and the result
+  // inserted. Only ops that commute with each other may be mixed on one key.
+  // Returns true if the key already existed.
+  template <typename KT, typename Op>
+  bool transApply(const KT& key, Op op, threadinfo_type& ti = mythreadinfo) {
+    return trans_apply(key, op, [&op] (pending_type& p) { p.push(op); }, ti);
+  }
+
+  // Increments of one key fold into a single pending delta.
+  template <typename KT>
+  bool transIncrement(const KT& key, const V& delta, threadinfo_type& ti = mythreadinfo) {
+    return trans_apply(key, [&delta] (V& v) { v += delta; },
+                       [&delta] (pending_type& p) { p.increment(delta); }, ti);
+  }
+
 
   size_t approx_size() const {
     // looks like if we want to implement this we have to tree walkers and all sorts of annoying things like that. could also possibly
@@ -369,13 +455,12 @@ public:
       this->ensureNotFound(node, version);
     };
     auto value_callback = [&] (Str key, versioned_value* e) {
-      // TODO: this needs to read my writes
       auto item = this->t_read_only_item(e);
 #if READ_MY_WRITES
       if (has_delete(item)) {
         return true;
       }
-      if (item.has_write()) {
+      if (item.has_write() && !has_apply(item)) {
         // read directly from the element if we're inserting it
         if (has_insert(item)) {
 	      return range_query_has_insert(callback, key, e, va);
@@ -395,6 +480,8 @@ public:
       // skip nodes that are marked invalid
       if (v & invalid_bit)
         return true;
+      if (has_apply(item))
+        apply_pending(item, val);
 
       // key and val are both only guaranteed until callback returns
       return callback(key, val);//query_callback_overload(key, val, callback);
@@ -418,7 +505,7 @@ public:
       if (has_delete(item)) {
         return true;
       }
-      if (item.has_write()) {
+      if (item.has_write() && !has_apply(item)) {
         // read directly from the element if we're inserting it
         if (has_insert(item)) {
 	        return range_query_has_insert(callback, key, e, va);
@@ -433,6 +520,8 @@ public:
 
       if (v & invalid_bit)
         return true;
+      if (has_apply(item))
+        apply_pending(item, val);
 
       return callback(key, val);
     };
@@ -441,6 +530,48 @@ public:
     table_.rscan(begin, true, scanner, *ti.ti);
   }
 
+  // Zero-copy range scans that read my writes. Keys this transaction
+  // inserted are already physically in the tree (invisible to everyone else
+  // via invalid_bit), so a single ordered pass over the leaves merges them in
+  // key order; keys it deleted are skipped and keys it updated report the
+  // buffered write value.
+  // The callback is `bool callback(Str key, const V& value)` (for
+  // versioned_str_struct boxes the value is a Str). Neither key nor value is
+  // copied: both are only valid until the callback returns. The element
+  // version is rechecked once the callback returns, so a callback that raced
+  // with a concurrent writer aborts before its result can be used.
+  // At most `limit` entries are reported if limit >= 0; returns the number
+  // of entries reported.
+  template <typename Callback>
+  size_t transScan(Str begin, Str end, Callback callback, int limit = -1, threadinfo_type& ti = mythreadinfo) {
+    return scan_impl<false>(begin, end, callback, limit, ti);
+  }
+
+  // like transScan, but visits keys in descending order starting at `begin`
+  // and stops before `end`
+  template <typename Callback>
+  size_t transRScan(Str begin, Str end, Callback callback, int limit = -1, threadinfo_type& ti = mythreadinfo) {
+    return scan_impl<true>(begin, end, callback, limit, ti);
+  }
+
+  // scans all keys that start with `prefix`, in ascending order
+  template <typename Callback>
+  size_t transPrefixScan(Str prefix, Callback callback, int limit = -1, threadinfo_type& ti = mythreadinfo) {
+    std::string end = prefix_successor(prefix);
+    return scan_impl<false>(prefix, Str(end), callback, limit, ti);
+  }
+
+  // smallest key greater than every key starting with `prefix`; empty (no
+  // upper bound) if there is none
+  static std::string prefix_successor(Str prefix) {
+    std::string end(prefix.data(), prefix.length());
+    while (!end.empty() && (unsigned char) end.back() == 0xFF)
+      end.pop_back();
+    if (!end.empty())
+      end.back() = char((unsigned char) end.back() + 1);
+    return end;
+  }
+
 #if READ_MY_WRITES
   template <typename Callback, typename ValAllocator>
   // for some reason inlining this/not making it a function gives a 5% slowdown on g++...
@@ -453,6 +584,55 @@ public:
 #endif
 
 protected:
+  template <bool Reverse, typename Callback>
+  size_t scan_impl(Str begin, Str end, Callback& callback, int limit, threadinfo_type& ti) {
+    size_t count = 0;
+    if (limit == 0)
+      return count;
+    auto node_callback = [&] (leaf_type* node, typename unlocked_cursor_type::nodeversion_value_type version) {
+      this->ensureNotFound(node, version);
+    };
+    auto value_callback = [&] (Str key, versioned_value* e) {
+      auto item = this->t_read_only_item(e);
+      bool more;
+#if READ_MY_WRITES
+      if (has_delete(item))
+        return true;
+      if (item.has_write() && !has_apply(item)) {
+        // inserts live in the element itself, updates in the write set
+        if (has_insert(item))
+          more = callback(key, e->read_value());
+        else
+          more = callback(key, item.template write_value<write_value_type>());
+        ++count;
+        return more && (limit < 0 || count < size_t(limit));
+      }
+#endif
+      Version v = e->version();
+      fence();
+      item.observe(tversion_type(v));
+      if (v & invalid_bit)
+        return true;
+      if (has_apply(item))
+        // pending commutative updates need a private copy to run on
+        more = scan_applied(callback, key, e, item);
+      else
+        more = callback(key, e->read_value());
+      fence();
+      if (e->version() != v)
+        Sto::abort();
+      ++count;
+      return more && (limit < 0 || count < size_t(limit));
+    };
+
+    range_scanner<decltype(node_callback), decltype(value_callback), Reverse> scanner(end, node_callback, value_callback);
+    if (Reverse)
+      table_.rscan(begin, true, scanner, *ti.ti);
+    else
+      table_.scan(begin, true, scanner, *ti.ti);
+    return count;
+  }
+
   // range query class thang
   template <typename Nodecallback, typename Valuecallback, bool Reverse = false>
   class range_scanner {
@@ -530,7 +710,14 @@ public:
 
     bool lock(TransItem& item, Transaction& txn) override {
         versioned_value* vv = item.key<versioned_value*>();
-        return txn.try_lock(item, vv->version());
+        if (!txn.try_lock(item, vv->version()))
+            return false;
+        // a blind apply never observed the element, so catch concurrent deletes here
+        if (has_apply(item) && (vv->version() & invalid_bit)) {
+            unlock(vv);
+            return false;
+        }
+        return true;
     }
   bool check(TransItem& item, Transaction&) override {
     if (is_inter(item)) {
@@ -566,7 +753,11 @@ public:
       assert(success);
       return;
     }
-    if (!has_insert(item)) {
+    if (has_apply(item)) {
+        value_type v = e->read_value();
+        apply_pending(item, v);
+        e->set_value(v);
+    } else if (!has_insert(item)) {
         write_value_type& v = item.template write_value<write_value_type>();
         e->set_value(v);
     }
@@ -654,6 +845,8 @@ protected:
     {
       if (new_location != e)
         item = Sto::new_item(this, new_location);
+      if (has_apply(item))
+        item.clear_write().clear_flags(apply_bit);
       item.template add_write<write_value_type>(value);
     }
   }
@@ -697,6 +890,57 @@ protected:
     return true;
   }
 
+  // transactional read of an element found in the tree; returns false if
+  // this transaction has deleted it
+  template <typename ValType>
+  bool read_found(versioned_value* e, ValType& retval) {
+    auto item = t_read_only_item(e);
+    if (!validityCheck(item, e)) {
+      Sto::abort();
+      return false;
+    }
+#if READ_MY_WRITES
+    if (has_delete(item)) {
+      return false;
+    }
+    if (has_apply(item)) {
+      // the pending update is installed on top of exactly this value
+      value_type v;
+      Version elem_vers;
+      atomicRead(e, elem_vers, v);
+      item.observe(tversion_type(elem_vers));
+      apply_pending(item, v);
+      assign_val(retval, v);
+      return true;
+    }
+    if (item.has_write()) {
+      // read directly from the element if we're inserting it
+      if (has_insert(item)) {
+        assign_val(retval, e->read_value());
+      } else {
+        retval = item.template write_value<write_value_type>();
+      }
+      return true;
+    }
+#endif
+    Version elem_vers;
+    atomicRead(e, elem_vers, retval);
+    item.observe(tversion_type(elem_vers));
+    return true;
+  }
+
+  // boxes that can allocate from the Masstree thread pool do so
+  template <typename ValueType>
+  static auto make_box(const ValueType& value, Version v, threadinfo& ti)
+    -> typename std::enable_if<std::is_same<decltype(versioned_value::make(value, v, ti)),
+                                            versioned_value*>::value, versioned_value*>::type {
+    return versioned_value::make(value, v, ti);
+  }
+  template <typename ValueType, typename... Ignored>
+  static versioned_value* make_box(const ValueType& value, Version v, threadinfo&, Ignored...) {
+    return (versioned_value*)versioned_value::make(value, v);
+  }
+
   template <typename NODE, typename VERSION>
   void ensureNotFound(NODE n, VERSION v) {
     // TODO: could be more efficient to use fresh_item here, but that will also require more work for read-then-insert
@@ -740,6 +984,24 @@ protected:
   static bool has_delete(const TransItem& item) {
       return item.flags() & delete_bit;
   }
+  static bool has_apply(const TransItem& item) {
+      return item.flags() & apply_bit;
+  }
+
+  // only boxes storing V can carry apply_bit (see transApply)
+  static void apply_pending(TransItem& item, V& val) {
+    item.template write_value<pending_type>()(val);
+  }
+  template <typename T>
+  static void apply_pending(TransItem&, T&) {
+    always_assert(0);
+  }
+  template <typename Callback>
+  static bool scan_applied(Callback& callback, Str key, versioned_value* e, TransItem& item) {
+    value_type val = e->read_value();
+    apply_pending(item, val);
+    return callback(key, val);
+  }
 
   static bool validityCheck(const TransItem& item, versioned_value *e) {
     bool v =  //likely(has_insert(item)) || !(e->version & invalid_bit);
@@ -753,6 +1015,8 @@ protected:
 
   static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
+  // write value is a pending_type to run on the installed value
+  static constexpr TransItem::flags_type apply_bit = TransItem::user0_bit<<2;
 
   template <typename T>
   static T* tag_inter(T* p) {
@@ -833,6 +1097,15 @@ protected:
   typedef Masstree::unlocked_tcursor<table_params> unlocked_cursor_type;
   typedef Masstree::tcursor<table_params> cursor_type;
   typedef Masstree::leaf<table_params> leaf_type;
+
+  static constexpr unsigned multiget_batch = 16;
+  struct multiget_slot {
+    bool found;
+    versioned_value* e;
+    leaf_type* node;
+    typename unlocked_cursor_type::nodeversion_value_type version;
+  };
+
   table_type table_;
 };
 
@@ -842,3 +1115,6 @@ __thread typename MassTrans<V, Box, Opacity>::threadinfo_type MassTrans<V, Box,
 template <typename V, typename Box, bool Opacity>
 constexpr typename MassTrans<V, Box, Opacity>::Version MassTrans<V, Box, Opacity>::invalid_bit;
 
+template <typename V, typename Box, bool Opacity>
+constexpr unsigned MassTrans<V, Box, Opacity>::multiget_batch;
+
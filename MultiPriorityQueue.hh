@@ -0,0 +1,176 @@
+#pragma once
+
+#include <vector>
+#include "Transaction.hh"
+#include "PriorityQueue.hh"
+#include "randgen.hh"
+
+// Relaxed transactional priority queue in the style of MultiQueues: values
+// live in nqueues independent PriorityQueue sub-heaps. A push goes to a
+// random sub-heap; a pop or top looks at the tops of `choices` sub-heaps,
+// starting at a random one, and takes the largest. Transactions that pop
+// from different sub-heaps neither share a lock nor dirty each other's
+// heaps, so pops no longer serialize across all threads.
+//
+// The price is ordering: a pop may return an element that is not the
+// global maximum. The expected rank error grows with nqueues and shrinks
+// as choices grows; choices == nqueues compares every sub-heap's top,
+// which is exact for a single thread. nqueues == 1 behaves like a plain
+// PriorityQueue.
+//
+// Same API as PriorityQueue: pop and top return -1 on an empty queue, and
+// a pop following a top in the same transaction removes the value top
+// returned.
+template <typename T, bool Opacity = false>
+class MultiPriorityQueue : public TObject {
+    typedef PriorityQueue<T, Opacity> queue_type;
+
+    static constexpr int top_key = -1;
+public:
+    MultiPriorityQueue(unsigned nqueues = 8, unsigned choices = 2)
+        : qs_(nqueues), choices_(choices) {
+        assert(nqueues > 0);
+        if (choices_ < 1)
+            choices_ = 1;
+        if (choices_ > nqueues)
+            choices_ = nqueues;
+        for (int i = 0; i < MAX_THREADS; ++i)
+            rand_[i].r.x = i + 1;
+    }
+
+    void push_nontrans(T v) {
+        qs_[random_queue()].q.push_nontrans(v);
+    }
+
+    void push(T v) {
+        // avoid sub-heaps dirtied by other transactions' pops
+        unsigned start = random_queue();
+        unsigned k = 0;
+        while (k + 1 < qs_.size() && qs_[(start + k) % qs_.size()].q.dirty_elsewhere())
+            ++k;
+        qs_[(start + k) % qs_.size()].q.push(v);
+    }
+
+    T pop() {
+        int i = chosen_queue(true);
+        if (i < 0)
+            i = choose();
+        if (i >= 0) {
+            T v = qs_[i].q.pop();
+            if (v != -1)
+                return v;
+        }
+        // every sampled sub-heap looked empty: pop from the first nonempty
+        // one. If all are empty, each sub-heap's pop records the emptiness
+        // it saw, so a concurrent push to any of them aborts us.
+        unsigned start = random_queue();
+        for (unsigned k = 0; k != qs_.size(); ++k) {
+            T v = qs_[(start + k) % qs_.size()].q.pop();
+            if (v != -1)
+                return v;
+        }
+        return -1;
+    }
+
+    T top() {
+        int i = chosen_queue(false);
+        if (i < 0)
+            i = choose();
+        if (i >= 0) {
+            T v = qs_[i].q.top();
+            if (v != -1) {
+                Sto::item(this, top_key).set_stash(i);
+                return v;
+            }
+        }
+        unsigned start = random_queue();
+        for (unsigned k = 0; k != qs_.size(); ++k) {
+            unsigned j = (start + k) % qs_.size();
+            T v = qs_[j].q.top();
+            if (v != -1) {
+                Sto::item(this, top_key).set_stash(int(j));
+                return v;
+            }
+        }
+        return -1;
+    }
+
+    int unsafe_size() {
+        int n = 0;
+        for (auto& sq : qs_)
+            n += sq.q.unsafe_size();
+        return n;
+    }
+
+    unsigned nqueues() const {
+        return qs_.size();
+    }
+
+    // Items only carry the sub-heap chosen by top() (as a stash), so they
+    // are never locked, checked, or installed.
+    bool lock(TransItem&, Transaction&) override {
+        return true;
+    }
+    bool check(TransItem&, Transaction&) override {
+        return true;
+    }
+    void install(TransItem&, Transaction&) override {
+    }
+    void unlock(TransItem&) override {
+    }
+
+    // Used for debugging
+    void print() {
+        for (auto& sq : qs_)
+            sq.q.print();
+    }
+
+private:
+    struct subqueue {
+        queue_type q;
+        char pad_[64];
+    };
+    struct rand_state {
+        Rand r;
+        char pad_[64];
+        rand_state() : r(1) {}
+    };
+
+    unsigned random_queue() {
+        return (rand_[TThread::id()].r() >> 8) % qs_.size();
+    }
+
+    // Sub-heap whose top this transaction already read, or -1. A pop
+    // consumes the choice.
+    int chosen_queue(bool consume) {
+        auto item = Sto::check_item(this, top_key);
+        if (!item || !item->has_stash())
+            return -1;
+        int i = item->template stash_value<int>();
+        if (consume)
+            item->clear_stash();
+        return i;
+    }
+
+    // Sub-heap with the largest top among `choices_` consecutive sub-heaps
+    // from a random start, or -1 if none has a top we could pop (see
+    // PriorityQueue::peek_nontrans).
+    int choose() {
+        unsigned start = random_queue();
+        int best = -1;
+        T bestv = T();
+        for (unsigned k = 0; k != choices_; ++k) {
+            unsigned i = (start + k) % qs_.size();
+            T v;
+            if (qs_[i].q.peek_nontrans(v) && (best < 0 || v > bestv)) {
+                best = i;
+                bestv = v;
+            }
+        }
+        return best;
+    }
+
+    std::vector<subqueue> qs_;
+    unsigned choices_;
+    rand_state rand_[MAX_THREADS];
+};
@@ -17,12 +17,13 @@ void TransactionBuffer::hard_clear(bool delete_all) {
     while (e_ && e_->next) {
         elt* e = e_->next;
         e_->next = e->next;
-        e->clear();
+        e->clear(any_destroy_);
         delete[] (char*) e;
     }
     if (e_)
-        e_->clear();
+        e_->clear(any_destroy_);
     linked_size_ = 0;
+    any_destroy_ = false;
     if (e_ && delete_all) {
         delete[] (char*) e_;
         e_ = 0;
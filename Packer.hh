@@ -1,6 +1,7 @@
 #pragma once
 #include "compiler.hh"
 #include <algorithm>
+#include <type_traits>
 
 class TransactionBuffer;
 
@@ -46,7 +47,7 @@ class TransactionBuffer {
 
 public:
     TransactionBuffer()
-        : e_(), linked_size_(0) {
+        : e_(), linked_size_(0), any_destroy_(false) {
     }
     ~TransactionBuffer() {
         if (e_)
@@ -66,9 +67,15 @@ public:
     size_t buffer_size() const {
         return linked_size_ + (e_ ? e_->pos : 0);
     }
+    // Usually just rewinds: that's all it takes if everything fit in
+    // one elt and nothing needs its destructor run.
     void clear() {
-        if (e_ && e_->pos)
-            hard_clear(false);
+        if (e_ && e_->pos) {
+            if (!e_->next && !any_destroy_)
+                e_->pos = 0;
+            else
+                hard_clear(false);
+        }
     }
 
 private:
@@ -87,9 +94,9 @@ private:
     };
     struct elt : public elthdr {
         char buf[0];
-        void clear() {
+        void clear(bool destroy) {
             size_t off = 0;
-            while (off < pos) {
+            while (destroy && off < pos) {
                 itemhdr* i = (itemhdr*) &buf[off];
                 i->destroyer(i + 1);
                 off += i->size;
@@ -99,6 +106,7 @@ private:
     };
     elt* e_;
     size_t linked_size_;
+    bool any_destroy_;      // holds objects with nontrivial destructors
 
     item* get_space(size_t needed) {
         if (!e_ || e_->pos + needed > e_->capacity)
@@ -116,6 +124,8 @@ T* TransactionBuffer::allocate(Args&&... args) {
     item* space = this->get_space(isize);
     space->destroyer = ObjectDestroyer<T>::destroy;
     space->size = isize;
+    if (!std::is_trivially_destructible<T>::value)
+        any_destroy_ = true;
     return new (&space->buf[0]) T(std::forward<Args>(args)...);
 }
 
@@ -138,7 +138,7 @@ public:
     
     void push_nontrans(T v) {
         lock(&poplock_);
-        versioned_value* val = versioned_value::make(v, TransactionTid::increment_value + insert_bit);
+        versioned_value* val = versioned_value::make(v, TransactionTid::increment_value);
         add(val);
         unlock(&poplock_);
     }
@@ -261,6 +261,34 @@ public:
         return retval;
     }
     
+    // Hints for MultiPriorityQueue, which picks among several queues.
+    // True if another transaction's pops have dirtied the queue, so our
+    // pushes of large values and our pops would abort.
+    bool dirty_elsewhere() const {
+        return dirtytid_ != -1 && dirtytid_ != TThread::id();
+    }
+
+    // Nontransactional glimpse at the maximum. Returns false if the queue
+    // looks empty, is dirty elsewhere, or its maximum is being inserted by
+    // another transaction.
+    bool peek_nontrans(T& v) {
+        if (size_ == 0 || dirty_elsewhere())
+            return false;
+        lock(&poplock_);
+        bool ok = size_ > 0 && !dirty_elsewhere();
+        if (ok) {
+            versioned_value* top = heap_[0];
+            if (is_inserted(top->version())) {
+                auto item = Sto::check_item(this, top);
+                ok = item && has_insert(*item);
+            }
+            if (ok)
+                v = top->read_value();
+        }
+        unlock(&poplock_);
+        return ok;
+    }
+
     int unsafe_size() {
         return size_; // TODO: this is not transactional yet
     }
@@ -1,17 +1,30 @@
 #pragma once
 
 #include <list>
+#include <vector>
+#include <algorithm>
 #include "TaggedLow.hh"
 #include "Transaction.hh"
 #include "TWrapped.hh"
 
-template <typename T, unsigned BUF_SIZE = 1000000,
+// Elements are stored in a linked list of CHUNK_SIZE-element chunks that is
+// allocated on the first push and grows and shrinks with the queue, so an
+// idle queue costs the object plus at most one chunk.
+template <typename T, unsigned CHUNK_SIZE = 256,
           template <typename> class W = TOpaqueWrapped>
 class Queue: public TObject {
 public:
     typedef typename W<T>::version_type version_type;
 
-    Queue() : head_(0), tail_(0), tailversion_(0), headversion_(0) {}
+    Queue() : head_(0), tail_(0), head_chunk_(nullptr), tail_chunk_(nullptr),
+              tailversion_(0), headversion_(0) {}
+    ~Queue() {
+        while (head_chunk_) {
+            chunk* next = head_chunk_->next_;
+            delete head_chunk_;
+            head_chunk_ = next;
+        }
+    }
 
     static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit;
     static constexpr TransItem::flags_type read_writes = TransItem::user0_bit<<1;
@@ -20,15 +33,13 @@ public:
 
     // NONTRANSACTIONAL PUSH/POP/EMPTY
     void nontrans_push(T v) {
-        queueSlots[tail_] = v;
-        tail_ = (tail_+1)%BUF_SIZE;
-        assert(head_ != tail_);
+        append(v);
     }
     
     T nontrans_pop() {
         assert(head_ != tail_);
-        T v = queueSlots[head_];
-        head_ = (head_+1)%BUF_SIZE;
+        T v = slot(head_);
+        advance_head(false);
         return v;
     }
 
@@ -38,11 +49,12 @@ public:
 
     template <typename RandomGen>
     void nontrans_shuffle(RandomGen gen) {
-        auto head = &queueSlots[head_];
-        auto tail = &queueSlots[tail_];
-        // don't support wrap-around shuffle
-        assert(head < tail);
-        std::shuffle(head, tail, gen);
+        std::vector<T> v;
+        while (!nontrans_empty())
+            v.push_back(nontrans_pop());
+        std::shuffle(v.begin(), v.end(), gen);
+        for (auto& x : v)
+            nontrans_push(x);
     }
 
     void nontrans_clear() {
@@ -52,7 +64,7 @@ public:
 
     // TRANSACTIONAL CALLS
     void transPush(const T& v) {
-        auto item = Sto::item(this, -1);
+        auto item = Sto::item(this, push_key);
         if (item.has_write()) {
             if (!is_list(item)) {
                 auto& val = item.template write_value<T>();
@@ -77,16 +89,16 @@ public:
     bool transPop() {
         auto hv = headversion_;
         fence();
-        auto index = head_;
+        intptr_t index = head_;
         auto item = Sto::item(this, index);
 
         while (1) {
-           if (index == tail_) {
+           if (index == intptr_t(tail_)) {
                auto tv = tailversion_;
                fence();
                 // if someone has pushed onto tail, can successfully do a front read, so don't read our own writes
-                if (index == tail_) {
-                    auto pushitem = Sto::item(this,-1);
+                if (index == intptr_t(tail_)) {
+                    auto pushitem = Sto::item(this, push_key);
                     if (!pushitem.has_read())
                         pushitem.observe(tv);
                     if (pushitem.has_write()) {
@@ -112,13 +124,13 @@ public:
                 } 
             }
             if (has_delete(item)) {
-                index = (index + 1) % BUF_SIZE;
+                ++index;
                 item = Sto::item(this, index);
             }
             else break;
         }
         // ensure that head is not modified by time of commit 
-        auto lockitem = Sto::item(this, -2);
+        auto lockitem = Sto::item(this, pop_key);
         if (!lockitem.has_read()) {
             lockitem.observe(hv);
         }
@@ -131,16 +143,16 @@ public:
     bool transFront(T& val) {
         auto hv = headversion_;
         fence();
-        unsigned index = head_;
+        intptr_t index = head_;
         auto item = Sto::item(this, index);
         while (1) {
             // empty queue
-            if (index == tail_) {
+            if (index == intptr_t(tail_)) {
                 auto tv = tailversion_;
                 fence();
                 // if someone has pushed onto tail, can successfully do a front read, so skip reading from our pushes 
-                if (index == tail_) {
-                    auto pushitem = Sto::item(this,-1);
+                if (index == intptr_t(tail_)) {
+                    auto pushitem = Sto::item(this, push_key);
                     if (!pushitem.has_read())
                         pushitem.observe(tv);
                     if (pushitem.has_write()) {
@@ -165,17 +177,17 @@ public:
                 }
             }
             if (has_delete(item)) {
-                index = (index + 1) % BUF_SIZE;
+                ++index;
                 item = Sto::item(this, index);
             }
             else break;
         }
         // ensure that head was not modified at time of commit
-        auto lockitem = Sto::item(this, -2);
+        auto lockitem = Sto::item(this, pop_key);
         if (!lockitem.has_read()) {
             lockitem.observe(hv);
         }  
-        val = queueSlots[index];
+        val = slot(index);
         return true;
     }
     
@@ -197,9 +209,9 @@ private:
     }
 
     bool lock(TransItem& item, Transaction& txn) override {
-        if (item.key<int>() == -1)
+        if (item.key<intptr_t>() == push_key)
             return txn.try_lock(item, tailversion_);
-        else if (item.key<int>() == -2)
+        else if (item.key<intptr_t>() == pop_key)
             return txn.try_lock(item, headversion_);
         else
             return true;
@@ -208,10 +220,10 @@ private:
     bool check(TransItem& item, Transaction& t) override {
         (void) t;
         // check if was a pop or front 
-        if (item.key<int>() == -2)
+        if (item.key<intptr_t>() == pop_key)
             return item.check_version(headversion_);
         // check if we read off the write_list (and locked tailversion)
-        else if (item.key<int>() == -1)
+        else if (item.key<intptr_t>() == push_key)
             return item.check_version(tailversion_);
         // shouldn't reach this
         assert(0);
@@ -220,50 +232,100 @@ private:
 
     void install(TransItem& item, Transaction& txn) override {
 	    // ignore lock_headversion marker item
-        if (item.key<int>() == -2)
+        if (item.key<intptr_t>() == pop_key)
             return;
         // install pops
         if (has_delete(item)) {
             // only increment head if item popped from actual q
             if (!is_rw(item))
-                head_ = (head_+1) % BUF_SIZE;
+                advance_head(true);
             headversion_.set_version(txn.commit_tid());
         }
         // install pushes
-        else if (item.key<int>() == -1) {
-            auto head_index = head_;
+        else if (item.key<intptr_t>() == push_key) {
             // write all the elements
             if (is_list(item)) {
                 auto& write_list = item.template write_value<std::list<T>>();
                 while (!write_list.empty()) {
-                    // assert queue is not out of space            
-                    assert(tail_ != (head_index-1) % BUF_SIZE);
-                    queueSlots[tail_] = write_list.front();
+                    append(write_list.front());
                     write_list.pop_front();
-                    tail_ = (tail_+1) % BUF_SIZE;
                 }
             }
-            else if (!is_empty(item)) {
-                auto& val = item.template write_value<T>();
-                queueSlots[tail_] = val;
-                tail_ = (tail_+1) % BUF_SIZE;
-            }
+            else if (!is_empty(item))
+                append(item.template write_value<T>());
 
             tailversion_.set_version(txn.commit_tid());
         }
     }
     
     void unlock(TransItem& item) override {
-        if (item.key<int>() == -1)
+        if (item.key<intptr_t>() == push_key)
             tailversion_.unlock();
-        else if (item.key<int>() == -2)
+        else if (item.key<intptr_t>() == pop_key)
             headversion_.unlock();
     }
 
-    T queueSlots[BUF_SIZE];
+    // Chunk c holds positions [c->base_, c->base_ + CHUNK_SIZE). Positions
+    // only grow, so they double as item keys for pops.
+    struct chunk {
+        uint64_t base_;
+        chunk* next_;
+        T slots_[CHUNK_SIZE];
+        explicit chunk(uint64_t base) : base_(base), next_(nullptr) {}
+    };
+
+    static constexpr intptr_t push_key = -1;
+    static constexpr intptr_t pop_key = -2;
+
+    // Slot for position @pos, which must be in [head_, tail_). Readers walk
+    // from the head chunk without a lock; if a concurrent pop retired the
+    // chunk holding @pos the transaction would fail its headversion_ check,
+    // so abort early.
+    T& slot(uint64_t pos) {
+        chunk* c = head_chunk_;
+        fence();
+        while (c && pos >= c->base_ + CHUNK_SIZE)
+            c = c->next_;
+        if (!c || pos < c->base_)
+            Sto::abort();
+        return c->slots_[pos - c->base_];
+    }
+
+    // Append at tail_. Called with tailversion_ locked (or nontransactionally).
+    void append(const T& v) {
+        if (!tail_chunk_) {
+            tail_chunk_ = new chunk(tail_ - tail_ % CHUNK_SIZE);
+            head_chunk_ = tail_chunk_;
+        }
+        tail_chunk_->slots_[tail_ - tail_chunk_->base_] = v;
+        if ((tail_ + 1) % CHUNK_SIZE == 0) {
+            // link the next chunk before publishing a tail_ beyond this one,
+            // so a pop that crosses the boundary always finds it
+            tail_chunk_->next_ = new chunk(tail_ + 1);
+            tail_chunk_ = tail_chunk_->next_;
+        }
+        fence();
+        ++tail_;
+    }
+
+    // Advance head_ past one element. Called with headversion_ locked (or
+    // nontransactionally); head_ < tail_.
+    void advance_head(bool transactional) {
+        ++head_;
+        if (head_ % CHUNK_SIZE == 0) {
+            chunk* c = head_chunk_;
+            head_chunk_ = c->next_;
+            if (transactional)
+                Transaction::rcu_delete(c);
+            else
+                delete c;
+        }
+    }
 
-    unsigned head_;
-    unsigned tail_;
+    uint64_t head_;
+    uint64_t tail_;
+    chunk* head_chunk_;
+    chunk* tail_chunk_;
     version_type tailversion_;
     version_type headversion_;
 };
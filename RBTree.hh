@@ -180,10 +180,12 @@ class RBTree
     static constexpr TransItem::flags_type delete_tag = TransItem::user0_bit<<1;
     static constexpr TransactionTid::type insert_bit = TransactionTid::user_bit;
 
+public:
     typedef RBTreeIterator<K, T, GlobalSize> iterator;
     typedef const RBTreeIterator<K, T, GlobalSize> const_iterator;
+    // same type as iterator; ++ walks toward smaller keys
+    typedef RBTreeIterator<K, T, GlobalSize> reverse_iterator;
 
-public:
     RBTree() {
         sizeversion_ = 0;
         size_ = 0;
@@ -229,9 +231,12 @@ public:
     }
 */
 
+    // Lookups only retry around exclusive (rebalancing) writers. Concurrent
+    // leaf attaches (see find_or_insert) hold treelock_ in read mode and
+    // never move an existing node, so they don't invalidate a descent.
   __attribute__((always_inline)) std::tuple<wrapper_type*, Version, bool, boundaries_type> verified_lookup(rbwrapper<rbpair<K, T>>& rbkvp) const {
         do {
-            auto initial = treelock_;
+            auto initial = treelock_ & ~TransactionTid::threadid_mask;
 	    fence();
 	    if (TransactionTid::is_locked(initial)) {
                 relax_fence();
@@ -240,46 +245,38 @@ public:
 	    auto results = wrapper_tree_.find_any(rbkvp,
                              rbpriv::make_compare<wrapper_type, wrapper_type>(wrapper_tree_.r_.get_compare()));
 	    fence();
-	    if (initial == treelock_)
+	    if (initial == (treelock_ & ~TransactionTid::threadid_mask))
                 return results;
 	    relax_fence();
 	} while(1);
     }
 
 #ifndef STO_NO_STM
-/*
     // iterators
+    // Iteration and range lookups are serializable: every node a scan passes
+    // is tracked by nodeversion (see scan_visit), our own deletes are skipped
+    // and our own inserts are visible.
     iterator begin() {
-        lock(&treelock_);
-        wrapper_type* start = wrapper_tree_.r_.limit_[0];
-        if (start == nullptr) {
-            // tree empty, read tree version
-            // TODO(nate): this would race without the lock
-            Sto::item(this, tree_key_).observe(treeversion_);
-        } else {
-            // READ-MY-WRITES: skip our own deletes!
-            while(has_delete(Sto::item(this, start))) {
-                Sto::item(this, (reinterpret_cast<uintptr_t>(start)|0x1)).observe(start->nodeversion());
-                start = rbalgorithms<wrapper_type>::next_node(start);
-            }
-            if (start != nullptr) {
-                if (is_phantom_node(start)) {
-                    unlock(&treelock_);
-                    Sto::abort();
-                }
-                // valid start node, read nodeversion
-                Sto::item(this, (reinterpret_cast<uintptr_t>(start)|0x1)).observe(start->nodeversion());
-            }
-        }
-        unlock(&treelock_);
-        return iterator(this, start);
+        return iterator(this, scan_edge(false));
     }
-
     iterator end() {
         return iterator(this, nullptr);
     }
+    reverse_iterator rbegin() {
+        return reverse_iterator(this, scan_edge(true), true);
+    }
+    reverse_iterator rend() {
+        return reverse_iterator(this, nullptr, true);
+    }
+    // first element with key >= @key
+    iterator lower_bound(const K& key) {
+        return iterator(this, scan_bound(key, false));
+    }
+    // first element with key > @key
+    iterator upper_bound(const K& key) {
+        return iterator(this, scan_bound(key, true));
+    }
 
-*/
     bool lock(TransItem& item, Transaction&) override;
     void unlock(TransItem& item) override;
     bool check(TransItem& item, Transaction& trans) override;
@@ -294,64 +291,102 @@ private:
     size_t debug_size() const {
         return wrapper_tree_.size();
     }
-/*
-    // XXX should we inline these?
-    inline wrapper_type* get_next(wrapper_type* node) {
-        lock(&treelock_);
-        wrapper_type* next_node = rbalgorithms<wrapper_type>::next_node(node);
-        // READ-MY-WRITES: skip our own deletes
-        while (has_delete(Sto::item(this, next_node))) {
-            // add read of nodeversions of all deleted nodes; gosh, read-my-write is really a nightmare...
-            Sto::item(this, (reinterpret_cast<uintptr_t>(next_node) | 0x1)).observe(next_node->nodeversion());
-            next_node = rbalgorithms<wrapper_type>::next_node(next_node);
-        }
+    // Holds treelock_ for reading, which excludes rebalancing and erases
+    // (concurrent leaf attaches never move an existing node). Scans may
+    // abort while holding it.
+    struct scan_guard {
+        RWVersion* v_;
+        explicit scan_guard(RWVersion* v) : v_(v) { lock_read(v_); }
+        ~scan_guard() { unlock_read(v_); }
+    };
 
-        if (next_node != nullptr) {
-            if (is_phantom_node(next_node)) {
-                unlock(&treelock_);
-                Sto::abort();
-            }
-            Sto::item(this, (reinterpret_cast<uintptr_t>(next_node)|0x1)).observe(next_node->nodeversion());
-        }
-        Sto::item(this, (reinterpret_cast<uintptr_t>(node)|0x1)).observe(node->nodeversion());
-        unlock(&treelock_);
-        return next_node;
-    }
-
-    inline wrapper_type* get_prev(wrapper_type* node) {
-        lock(&treelock_);
-        // check if we are at the end() node (i.e. nullptr)
-        wrapper_type* prev_node = (node == nullptr) ? wrapper_tree_.r_.limit_[1] : rbalgorithms<wrapper_type>::prev_node(node);
-        // check that we are not begin (i.e. prev_node is not null)
-        if (prev_node == nullptr) {
-            unlock(&treelock_);
-            Sto::abort();
-        }
-        // READ-MY-WRITES: skip our own deletes
-        while (has_delete(Sto::item(this, prev_node))) {
-            Sto::item(this, (reinterpret_cast<uintptr_t>(prev_node) | 0x1)).observe(prev_node->nodeversion());
-            prev_node = rbalgorithms<wrapper_type>::prev_node(prev_node);
-        }
-        // check again after reading-my-writes...
-        if (prev_node == nullptr) {
-            unlock(&treelock_);
+    // A new node always lands under its in-order predecessor or successor,
+    // and that node's nodeversion is bumped when the insert commits; erasing
+    // a node bumps its own nodeversion. So tracking the nodeversion of every
+    // node a scan passes protects the scanned range against phantoms.
+    // Returns whether the scan should stop at @n (false: it's our own delete).
+    // Aborts if @n is another transaction's uncommitted insert.
+    inline bool scan_visit(wrapper_type* n) const {
+        auto self = const_cast<RBTree<K, T, GlobalSize>*>(this);
+        Version val_ver = n->version();
+        Sto::item(self, reinterpret_cast<uintptr_t>(n) | 0x1).observe(n->nodeversion());
+        auto item = Sto::check_item(self, n);
+        if (item && has_delete(*item))
+            return false;
+        if (is_inserted(val_ver) && !(item && has_insert(*item)))
             Sto::abort();
-        }
+        return true;
+    }
 
-        if (is_phantom_node(prev_node)) {
-            unlock(&treelock_);
-            Sto::abort();
+    // first visible node at or after @n, moving right or left
+    inline wrapper_type* scan_from(wrapper_type* n, bool right) const {
+        while (n && !scan_visit(n))
+            n = rbalgorithms<wrapper_type>::step_node(n, right);
+        return n;
+    }
+
+    // first visible node from the left (right == false) or right end
+    inline wrapper_type* scan_edge(bool right) const {
+        scan_guard guard(&treelock_);
+        wrapper_type* n = wrapper_tree_.r_.limit_[right];
+        if (!n) {
+            Sto::item(const_cast<RBTree<K, T, GlobalSize>*>(this), tree_key_)
+                .observe(wrapper_tree_.treeversion_);
+            return nullptr;
         }
-        if (node) {
-            Sto::item(this, (reinterpret_cast<uintptr_t>(node)|0x1)).observe(node->nodeversion());
+        // limit_ may lag behind a concurrent attach
+        n = rbalgorithms<wrapper_type>::edge_node(n, right);
+        return scan_from(n, !right);
+    }
+
+    // first visible node with key >= @key (> @key if @strict)
+    inline wrapper_type* scan_bound(const K& key, bool strict) const {
+        wrapper_type idx_pair(rbpair<K, T>(key, T()));
+        scan_guard guard(&treelock_);
+        auto results = wrapper_tree_.find_any(idx_pair,
+                rbpriv::make_compare<wrapper_type, wrapper_type>(wrapper_tree_.r_.get_compare()));
+        wrapper_type* x = std::get<0>(results);
+        bool found = std::get<2>(results);
+        if (!x) {
+            Sto::item(const_cast<RBTree<K, T, GlobalSize>*>(this), tree_key_)
+                .observe(std::get<1>(results));
+            return nullptr;
         }
-        if (prev_node) {
-            Sto::item(this, (reinterpret_cast<uintptr_t>(prev_node)|0x1)).observe(prev_node->nodeversion());
+        if (found) {
+            if (!strict)
+                return scan_from(x, true);
+            Sto::item(const_cast<RBTree<K, T, GlobalSize>*>(this),
+                      reinterpret_cast<uintptr_t>(x) | 0x1).observe(x->nodeversion());
+        } else {
+            // @key falls between its predecessor and successor; track both so
+            // that an insert into the gap invalidates the scan
+            node_info_type& lhs = std::get<3>(results).first;
+            if (std::get<0>(lhs))
+                Sto::item(const_cast<RBTree<K, T, GlobalSize>*>(this),
+                          reinterpret_cast<uintptr_t>(std::get<0>(lhs)) | 0x1).observe(std::get<1>(lhs));
+            if (wrapper_tree_.r_.node_compare(idx_pair, *x) < 0)
+                return scan_from(x, true);
+            Sto::item(const_cast<RBTree<K, T, GlobalSize>*>(this),
+                      reinterpret_cast<uintptr_t>(x) | 0x1).observe(x->nodeversion());
         }
-        unlock(&treelock_);
-        return prev_node;
+        return scan_from(rbalgorithms<wrapper_type>::step_node(x, true), true);
+    }
+
+    // next visible node after @node; from end() (nullptr) wraps to the first
+    inline wrapper_type* get_next(wrapper_type* node) const {
+        if (!node)
+            return scan_edge(false);
+        scan_guard guard(&treelock_);
+        return scan_from(rbalgorithms<wrapper_type>::step_node(node, true), true);
+    }
+
+    // previous visible node before @node; from end() (nullptr) goes to the last
+    inline wrapper_type* get_prev(wrapper_type* node) const {
+        if (!node)
+            return scan_edge(true);
+        scan_guard guard(&treelock_);
+        return scan_from(rbalgorithms<wrapper_type>::step_node(node, false), false);
     }
-*/
 
     // A (hard) phantom node is a node that's being inserted but not yet
     // committed by another transaction. It should be treated as invisible
@@ -459,12 +494,22 @@ private:
     // @ver: if inserted, nodeversion of @node; otherwise value version of @node
     // @boundary: boundary nodes info (*pre-insertion* state) of the inserted/found node
     // @parent: parent of the returned node, prior to any insertions
+    // Most inserts land under a black parent and need no rebalancing; those
+    // run with treelock_ held for reading, so writers in disjoint parts of
+    // the tree proceed in parallel. Only inserts that must recolor/rotate
+    // take treelock_ exclusively.
     inline std::tuple<wrapper_type*, Version, bool, boundaries_type, node_info_type>
     find_or_insert(wrapper_type& rbkvp) {
-        lock_write(&treelock_);
-        auto results = wrapper_tree_.find_insert(rbkvp,
-                           rbpriv::make_compare<wrapper_type, wrapper_type>(wrapper_tree_.r_.get_compare()));
-        unlock_write(&treelock_);
+        auto compare = rbpriv::make_compare<wrapper_type, wrapper_type>(wrapper_tree_.r_.get_compare());
+        std::tuple<wrapper_type*, Version, bool, boundaries_type, node_info_type> results;
+        lock_read(&treelock_);
+        bool attached = wrapper_tree_.find_attach(rbkvp, compare, results);
+        unlock_read(&treelock_);
+        if (!attached) {
+            lock_write(&treelock_);
+            results = wrapper_tree_.find_insert(rbkvp, compare);
+            unlock_write(&treelock_);
+        }
 
         bool found = std::get<2>(results);
         wrapper_type* ans = std::get<0>(results);
@@ -623,8 +668,9 @@ private:
     // only add a write to size if we erase or do an absent insert
     size_t size_;
     Version sizeversion_;
-    // XXX: this isn't actually a rwlock anymore so we could just make it a
-    // normal tid or something
+    // read-locked by concurrent leaf attaches, write-locked (and its version
+    // bumped) by anything that rebalances or erases; lookups validate against
+    // the write version
     mutable RWVersion treelock_;
     // used to mark whether a key is for the tree structure (for tree version checks)
     // or a pointer (which will always have the lower 3 bits as 0)
@@ -652,10 +698,11 @@ public:
     typedef RBProxy<K, T, GlobalSize> proxy_type;
     typedef std::pair<const K, proxy_type> proxy_pair_type;
 
-    RBTreeIterator(RBTree<K, T, GlobalSize> * tree, wrapper* node) : tree_(tree), node_(node), proxy_pair_(nullptr) {
+    RBTreeIterator(RBTree<K, T, GlobalSize> * tree, wrapper* node, bool reverse = false)
+        : tree_(tree), node_(node), reverse_(reverse), proxy_pair_(nullptr) {
         this->update_proxy_pair();
     }
-    RBTreeIterator(const RBTreeIterator& itr) : tree_(itr.tree_), node_(itr.node_), proxy_pair_(nullptr) {
+    RBTreeIterator(const RBTreeIterator& itr) : tree_(itr.tree_), node_(itr.node_), reverse_(itr.reverse_), proxy_pair_(nullptr) {
         this->update_proxy_pair();
     }
     ~RBTreeIterator() {
@@ -665,6 +712,7 @@ public:
     RBTreeIterator& operator=(const RBTreeIterator& v) {
         tree_ = v.tree_;
         node_ = v.node_;
+        reverse_ = v.reverse_;
         this->update_proxy_pair();
         return *this;
     }
@@ -694,7 +742,7 @@ public:
     
     // This is the prefix case
     iterator& operator++() { 
-        node_ = tree_->get_next(node_);
+        node_ = reverse_ ? tree_->get_prev(node_) : tree_->get_next(node_);
         this->update_proxy_pair();
         return *this; 
     }
@@ -702,20 +750,20 @@ public:
     // This is the postfix case
     iterator operator++(int) {
         RBTreeIterator<K, T, GlobalSize> clone(*this);
-        node_ = tree_->get_next(node_);
+        node_ = reverse_ ? tree_->get_prev(node_) : tree_->get_next(node_);
         this->update_proxy_pair();
         return clone;
     }
     
     iterator& operator--() { 
-        node_ = tree_->get_prev(node_);
+        node_ = reverse_ ? tree_->get_next(node_) : tree_->get_prev(node_);
         this->update_proxy_pair();
         return *this; 
     }
     
     iterator operator--(int) {
         RBTreeIterator<K, T, GlobalSize> clone(*this);
-        node_ = tree_->get_prev(node_);
+        node_ = reverse_ ? tree_->get_next(node_) : tree_->get_prev(node_);
         this->update_proxy_pair();
         return clone;
     }
@@ -742,6 +790,8 @@ private:
 
     RBTree<K, T, GlobalSize> * tree_;
     wrapper* node_;
+    // reverse iterators step toward smaller keys
+    bool reverse_;
     proxy_pair_type* proxy_pair_;
 };
 
@@ -27,6 +27,7 @@ class rbnodeptr {
 
     inline T* node() const;
     inline rbnodeptr<T>& child(bool isright) const;
+    inline bool cas_child(bool isright, rbnodeptr<T> expected, rbnodeptr<T> x) const;
     inline bool children_same_color() const;
     inline bool find_child(T* node) const;
     inline rbnodeptr<T>& load_color();
@@ -194,6 +195,9 @@ class rbtree {
 
     template <typename K, typename Comp>
     inline std::tuple<T*, Version, bool, boundaries_type, node_info_type> find_insert(K& key, Comp comp);
+    template <typename K, typename Comp>
+    inline bool find_attach(K& key, Comp comp, std::tuple<T*, Version, bool, boundaries_type, node_info_type>& result);
+    void advance_limit(bool side);
 
     template <typename K, typename Comp>
     inline std::tuple<rbnodeptr<T>, bool> find_or_parent(const K& key, Comp comp) const;
@@ -240,6 +244,11 @@ inline rbnodeptr<T>& rbnodeptr<T>::child(bool isright) const {
     return node()->rblinks_.c_[isright];
 }
 
+template <typename T>
+inline bool rbnodeptr<T>::cas_child(bool isright, rbnodeptr<T> expected, rbnodeptr<T> x) const {
+    return bool_cmpxchg(&child(isright).x_, expected.x_, x.x_);
+}
+
 template <typename T>
 inline bool rbnodeptr<T>::children_same_color() const {
     return ((node()->rblinks_.c_[0].x_ ^ node()->rblinks_.c_[1].x_) & 1) == 0;
@@ -619,6 +628,95 @@ rbtree<T, C>::find_insert(K& key, Comp comp) {
     return std::make_tuple(retnode, retver, found, boundary, parent);
 }
 
+// Concurrent variant of find_insert() for callers holding the tree lock in
+// *read* mode. Linking a new red leaf under a black parent never violates a
+// red-black invariant, so such inserts need no rebalancing: the node is
+// published with a CAS on the parent's empty child slot, and any number of
+// these attaches can run in parallel with each other and with lookups (no
+// existing link or color changes). Returns false without modifying the tree
+// if the key is absent and the insert would need rebalancing (red parent, or
+// empty tree); the caller then retries find_insert() with the lock held
+// exclusively. Boundaries and parent are reported exactly as in
+// find_insert().
+template <typename T, typename C> template <typename K, typename Comp>
+inline bool rbtree<T, C>::find_attach(K& key, Comp comp,
+                                      std::tuple<T*, Version, bool, boundaries_type, node_info_type>& result) {
+    T* lhs = r_.limit_[0];
+    T* rhs = r_.limit_[1];
+    boundaries_type boundary = std::make_pair(std::make_tuple(lhs, lhs ? lhs->nodeversion() : 0),
+                    std::make_tuple(rhs, rhs ? rhs->nodeversion() : 0));
+    if (!r_.root_)
+        return false;
+
+    rbnodeptr<T> n(r_.root_, false);
+    rbnodeptr<T> p(nullptr, false);
+    T* newnode = nullptr;
+    int cmp = 0;
+    // whether the path so far only went left (right), i.e. the new node
+    // would become limit_[0] (limit_[1])
+    bool extreme[2] = {true, true};
+    while (1) {
+        while (n.node()) {
+            cmp = comp.compare(key, *n.node());
+            if (cmp == 0)
+                break;
+            T* nb = n.node();
+            if (cmp > 0)
+                boundary.first = std::make_tuple(nb, nb->nodeversion());
+            else
+                boundary.second = std::make_tuple(nb, nb->nodeversion());
+            extreme[cmp < 0] = false;
+            p = n;
+            n = n.node()->rblinks_.c_[cmp > 0];
+        }
+
+        if (n.node()) {
+            // found (possibly a node that beat us to this slot)
+            if (newnode) {
+                newnode->~T();
+                free(newnode);
+            }
+            result = std::make_tuple(n.node(), n.node()->version(), true, boundary,
+                                     std::make_tuple(p.node(), p.node() ? p.node()->nodeversion() : 0));
+            return true;
+        }
+        if (p.red())
+            return false;
+
+        bool side = cmp > 0;
+        if (!newnode) {
+            newnode = (T*)malloc(sizeof(T));
+            new (newnode) T((rbpair<typename K::key_type, typename K::value_type>)key);
+        }
+        Version pver = p.node()->nodeversion();
+        newnode->rblinks_.p_ = p.node();
+        newnode->rblinks_.c_[0] = newnode->rblinks_.c_[1] = rbnodeptr<T>(0, false);
+        if (p.cas_child(side, rbnodeptr<T>(0, false), rbnodeptr<T>(newnode, true))) {
+            if (extreme[side])
+                advance_limit(side);
+            result = std::make_tuple(newnode, newnode->nodeversion(), false, boundary,
+                                     std::make_tuple(p.node(), pver));
+            return true;
+        }
+        // lost the race for this slot; keep descending from the winner
+        n = p.child(side);
+    }
+}
+
+// Move limit_[side] down to the extreme node after concurrent attaches.
+// Every attacher that may have become the extreme calls this after linking
+// its node, so whichever call runs last sees every attach.
+template <typename T, typename C>
+void rbtree<T, C>::advance_limit(bool side) {
+    T* l = r_.limit_[side];
+    while (1) {
+        T* e = rbalgorithms<T>::edge_node(l, side);
+        if (e == l || bool_cmpxchg(&r_.limit_[side], l, e))
+            return;
+        l = r_.limit_[side];
+    }
+}
+
 template <typename T, typename C>
 inline T* rbtree<T, C>::erase(T& node) {
     rbaccount(erase);
@@ -0,0 +1,540 @@
+#pragma once
+#include "config.h"
+#include "compiler.hh"
+#include <functional>
+#include <new>
+#include "Interface.hh"
+#include "Transaction.hh"
+#include "TWrapped.hh"
+#include "print_value.hh"
+
+// Transactional ordered map on a concurrent skiplist.
+//
+// Lookups and scans take no locks: they walk the list optimistically and
+// validate at commit. As in Hashtable, an insert links its node into the
+// list at execution time, marked invalid until it commits; a delete marks
+// its node invalid at install and unlinks it during cleanup. Linking and
+// unlinking lock only the affected node's predecessors, so inserts into
+// different parts of the key space proceed in parallel.
+//
+// Every node carries two versions:
+//   version      the element: value updates and insert/delete validity
+//   nextversion  the gap between the node and its level-0 successor. It is
+//                bumped when a node is linked into the gap or when the node
+//                itself is unlinked, and its lock bit protects the node's
+//                next pointers and `marked`.
+// A lookup that misses observes its predecessor's nextversion, and a range
+// scan observes the nextversion of every node it passes, so a concurrent
+// insert into a range we saw empty aborts us.
+template <typename K, typename V, bool Opacity = true, unsigned MaxHeight = 16,
+          typename Compare = std::less<K>>
+class SkipList : public TObject {
+public:
+    typedef K key_type;
+    typedef V value_type;
+
+    typedef typename std::conditional<Opacity, TVersion, TNonopaqueVersion>::type Version_type;
+    typedef typename std::conditional<Opacity, TWrapped<V>, TNonopaqueWrapped<V>>::type wrapped_type;
+
+    static constexpr typename Version_type::type invalid_bit = TransactionTid::user_bit;
+
+private:
+    struct node {
+        K key;
+        Version_type version;
+        Version_type nextversion;
+        wrapped_type value;
+        // set (under nextversion's lock) once the node is being unlinked
+        volatile bool marked;
+        unsigned height;
+        node* volatile next[1];
+
+        node(const K& k, const V& v, unsigned h, bool mark_valid)
+            : key(k), version(Sto::initialized_tid() | (mark_valid ? 0 : invalid_bit)),
+              nextversion(0), value(v), marked(false), height(h) {
+            for (unsigned l = 0; l != h; ++l)
+                next[l] = nullptr;
+        }
+        bool valid() const {
+            return !(version.value() & invalid_bit);
+        }
+    };
+
+    static constexpr uintptr_t gap_bit = 1;
+
+    static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
+    static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
+
+public:
+    SkipList(Compare comp = Compare())
+        : head_(make_node(K(), V(), MaxHeight, true)), comp_(comp) {
+        for (int i = 0; i < MAX_THREADS; ++i)
+            rand_[i].x = 88172645463325252ULL + i;
+    }
+    ~SkipList() {
+        node* n = head_;
+        while (n) {
+            node* next = n->next[0];
+            free_node(n);
+            n = next;
+        }
+    }
+
+    // returns true if found false if not
+    bool transGet(const K& k, V& retval) {
+        node* preds[MaxHeight];
+        node* succs[MaxHeight];
+        while (1) {
+            node* n = find(k, preds, succs);
+            if (n) {
+                auto item = Sto::read_item(this, n);
+                if (!validity_check(item, n))
+                    Sto::abort();
+                if (has_delete(item))
+                    return false;
+                if (item.has_write()) {
+                    retval = item.template write_value<V>();
+                    return true;
+                }
+                retval = n->value.read(item, n->version);
+                return true;
+            } else if (observe_gap(preds[0], succs[0]))
+                return false;
+            relax_fence();
+        }
+    }
+
+    // returns true if successful
+    bool transDelete(const K& k) {
+        node* preds[MaxHeight];
+        node* succs[MaxHeight];
+        while (1) {
+            node* n = find(k, preds, succs);
+            if (!n) {
+                if (observe_gap(preds[0], succs[0]))
+                    return false;
+                relax_fence();
+                continue;
+            }
+            Version_type elemvers = n->version;
+            fence();
+            auto item = Sto::item(this, n);
+            if (!n->valid() && has_insert(item)) {
+                // deleting our own insert: unlink it now, and make sure no
+                // one else inserts the key before we commit
+                unlink(n, true);
+                item.remove_read().remove_write().clear_flags(insert_bit | delete_bit);
+                observe_absent(k);
+                return true;
+            }
+            if (!n->valid())
+                Sto::abort();
+            // we already deleted!
+            if (has_delete(item))
+                return false;
+            item.observe(elemvers);
+            item.add_write().add_flags(delete_bit);
+            return true;
+        }
+    }
+
+    template <typename VT>
+    bool transPut(const K& k, const VT& v) {
+        return trans_write</*insert*/true, /*set*/true>(k, v);
+    }
+
+    // returns true if successful
+    template <typename VT>
+    bool transInsert(const K& k, const VT& v) {
+        return !trans_write</*insert*/true, /*set*/false>(k, v);
+    }
+
+    template <typename VT>
+    bool transUpdate(const K& k, const VT& v) {
+        return trans_write</*insert*/false, /*set*/true>(k, v);
+    }
+
+    // Range query over [begin, end): calls `bool callback(const K&, const V&)`
+    // on each key in ascending order and stops early if it returns false.
+    // Keys this transaction inserted are visible and keys it deleted are
+    // skipped. Every gap the scan crosses is observed, so an insert into
+    // the scanned range by another transaction aborts us.
+    template <typename Callback>
+    void transQuery(const K& begin, const K& end, Callback callback) {
+        node* preds[MaxHeight];
+        node* succs[MaxHeight];
+        while (1) {
+            find(begin, preds, succs);
+            if (observe_gap(preds[0], succs[0]))
+                break;
+            relax_fence();
+        }
+        node* n = succs[0];
+        while (n && comp_(n->key, end)) {
+            if (!visit(n, callback))
+                return;
+            node* succ;
+            while (1) {
+                succ = n->next[0];
+                if (observe_gap(n, succ))
+                    break;
+                // a node is only unlinked once it is invalid, which the
+                // element check will catch anyway
+                if (n->marked)
+                    Sto::abort();
+                relax_fence();
+            }
+            n = succ;
+        }
+    }
+
+    // these are wrappers for concurrent.cc and other
+    // frameworks we use the skiplist in
+    V transGet(const K& k) {
+        V v = V();
+        transGet(k, v);
+        return v;
+    }
+
+    bool check(TransItem& item, Transaction&) override {
+        if (is_gap(item))
+            return gap_node(item)->nextversion.check_version(item.template read_value<Version_type>());
+        auto n = item.key<node*>();
+        return n->version.check_version(item.template read_value<Version_type>());
+    }
+
+    bool lock(TransItem& item, Transaction& txn) override {
+        assert(!is_gap(item));
+        return txn.try_lock(item, item.key<node*>()->version);
+    }
+
+    void install(TransItem& item, Transaction& t) override {
+        assert(!is_gap(item));
+        auto n = item.key<node*>();
+        if (has_delete(item)) {
+            // unlinked in cleanup()
+            n->version.set_version_locked(n->version.value() | invalid_bit);
+            return;
+        }
+        // insert values were written at execution time
+        if (!has_insert(item))
+            n->value.write(item.template write_value<V>());
+        n->version.set_version(t.commit_tid()); // automatically sets valid to true
+    }
+
+    void unlock(TransItem& item) override {
+        assert(!is_gap(item));
+        item.key<node*>()->version.unlock();
+    }
+
+    void cleanup(TransItem& item, bool committed) override {
+        if (committed ? has_delete(item) : has_insert(item)) {
+            auto n = item.key<node*>();
+            assert(!n->valid());
+            unlink(n, false);
+        }
+    }
+
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{SkipList<" << typeid(K).name() << "," << typeid(V).name() << "> " << (void*) this;
+        if (is_gap(item)) {
+            node* n = gap_node(item);
+            if (n == head_)
+                w << ".gap[-inf]";
+            else
+                w << ".gap[" << mass::print_value(n->key) << "]";
+        } else
+            w << "[" << mass::print_value(item.key<node*>()->key) << "]";
+        if (item.has_read())
+            w << " R" << item.read_value<Version_type>();
+        if (item.has_write() && !has_delete(item))
+            w << " =" << mass::print_value(item.write_value<V>());
+        else if (item.has_write())
+            w << " =DEL";
+        w << "}";
+    }
+
+    // Nontransactional. These walk the list outside any RCU epoch, while
+    // nodes that committed deletes unlink are freed through RCU, so they must
+    // not run concurrently with transactional deletes. Concurrent inserts,
+    // nontransactional or transactional, are fine, except for transactions
+    // touching the same key.
+    bool nontrans_insert(const K& k, const V& v) {
+        node* preds[MaxHeight];
+        node* succs[MaxHeight];
+        while (1) {
+            if (find(k, preds, succs))
+                return false;
+            if (link(k, v, true, preds, succs))
+                return true;
+            relax_fence();
+        }
+    }
+
+    bool nontrans_find(const K& k, V& v) const {
+        node* preds[MaxHeight];
+        node* succs[MaxHeight];
+        node* n = find(k, preds, succs);
+        if (n && n->valid()) {
+            v = n->value.access();
+            return true;
+        }
+        return false;
+    }
+
+    V nontrans_get(const K& k) const {
+        V v = V();
+        nontrans_find(k, v);
+        return v;
+    }
+
+    size_t nontrans_size() const {
+        size_t n = 0;
+        for (node* x = head_->next[0]; x; x = x->next[0])
+            n += x->valid();
+        return n;
+    }
+
+private:
+    template <bool INSERT, bool SET, typename VT>
+    bool trans_write(const K& k, const VT& v) {
+        node* preds[MaxHeight];
+        node* succs[MaxHeight];
+        while (1) {
+            node* n = find(k, preds, succs);
+            if (n) {
+                Version_type elemvers = n->version;
+                fence();
+                auto item = Sto::item(this, n);
+                if (!validity_check(item, n))
+                    Sto::abort();
+                if (has_delete(item)) {
+                    // delete-then-insert == update; delete-then-update == not found
+                    if (INSERT)
+                        item.clear_flags(delete_bit).clear_write().template add_write<V>(v);
+                    return false;
+                }
+                // make sure the item doesn't get deleted before us
+                item.observe(elemvers);
+                if (SET) {
+                    item.template add_write<V>(v);
+                    if (has_insert(item))
+                        // Updating the value here, as we won't update it during install
+                        n->value.write(v);
+                }
+                return true;
+            }
+            if (!INSERT) {
+                if (observe_gap(preds[0], succs[0]))
+                    return false;
+            } else if ((n = link(k, v, false, preds, succs))) {
+                // use new_item because we know there are no collisions
+                Sto::new_item(this, n).template add_write<V>(v).add_flags(insert_bit);
+                return false;
+            }
+            relax_fence();
+        }
+    }
+
+    // Search for @k, filling in its predecessor and successor at every
+    // level. Returns the node holding @k, if any (valid or not).
+    node* find(const K& k, node** preds, node** succs) const {
+        node* pred = head_;
+        for (int l = MaxHeight - 1; l >= 0; --l) {
+            node* cur = pred->next[l];
+            acquire_fence();
+            while (cur && comp_(cur->key, k)) {
+                pred = cur;
+                cur = pred->next[l];
+                acquire_fence();
+            }
+            preds[l] = pred;
+            succs[l] = cur;
+        }
+        node* n = succs[0];
+        return n && !comp_(k, n->key) ? n : nullptr;
+    }
+
+    // Observe the gap after @pred, as long as it still ends at @succ.
+    // Returns false if the list changed under us; the caller retries.
+    bool observe_gap(node* pred, node* succ) {
+        Version_type v = pred->nextversion;
+        fence();
+        if (v.is_locked() || pred->marked || pred->next[0] != succ)
+            return false;
+        Sto::item(this, pack_gap(pred)).observe(v);
+        return true;
+    }
+
+    void observe_absent(const K& k) {
+        node* preds[MaxHeight];
+        node* succs[MaxHeight];
+        while (1) {
+            node* n = find(k, preds, succs);
+            if (n)
+                // someone else is inserting k
+                Sto::abort();
+            if (observe_gap(preds[0], succs[0]))
+                return;
+            relax_fence();
+        }
+    }
+
+    template <typename Callback>
+    bool visit(node* n, Callback& callback) {
+        auto item = Sto::read_item(this, n);
+        if (has_delete(item))
+            return true;
+        if (item.has_write())
+            return callback(n->key, item.template write_value<V>());
+        V v = n->value.read(item, n->version);
+        // someone else's uncommitted insert, or a committed delete awaiting
+        // unlink: not in the range (the observed version catches changes)
+        if (item.template read_value<Version_type>().value() & invalid_bit)
+            return true;
+        return callback(n->key, v);
+    }
+
+    // Link a new node for @k between @preds and @succs. Returns nullptr if
+    // they no longer describe the list, in which case the caller searches
+    // again.
+    node* link(const K& k, const V& v, bool valid, node** preds, node** succs) {
+        unsigned h = random_height();
+        // lock predecessors bottom-up, i.e., in decreasing key order (see
+        // unlink)
+        unsigned nlocked = 0;
+        bool ok = true;
+        while (ok && nlocked != h) {
+            node* p = preds[nlocked];
+            if (nlocked == 0 || p != preds[nlocked - 1])
+                p->nextversion.lock();
+            ok = !p->marked && p->next[nlocked] == succs[nlocked];
+            ++nlocked;
+        }
+        node* n = nullptr;
+        if (ok) {
+            n = make_node(k, v, h, valid);
+            Version_type nv = n->nextversion;
+            for (unsigned l = 0; l != h; ++l)
+                n->next[l] = succs[l];
+            release_fence();
+            for (unsigned l = 0; l != h; ++l)
+                preds[l]->next[l] = n;
+            auto prev_version = preds[0]->nextversion.unlocked();
+            preds[0]->nextversion.inc_nonopaque_version();
+            // see if we previously observed this gap. Our node splits it, so
+            // observe both halves: an insert behind our node changes only
+            // the new node's nextversion
+            if (!valid) {
+                auto gap_item = Sto::check_item(this, pack_gap(preds[0]));
+                if (gap_item) {
+                    gap_item->update_read(Version_type(prev_version),
+                                          Version_type(preds[0]->nextversion.unlocked()));
+                    Sto::item(this, pack_gap(n)).observe(nv);
+                }
+            }
+        }
+        unlock_preds(preds, nlocked);
+        return n;
+    }
+
+    // Unlink @n, which is invalid and will never become valid again, and
+    // free it through RCU. @own is true if n is this transaction's own
+    // insert; observations of n's gap are then moved to its predecessor.
+    void unlink(node* n, bool own) {
+        node* preds[MaxHeight];
+        node* succs[MaxHeight];
+        n->nextversion.lock();
+        n->marked = true;
+        while (1) {
+            find(n->key, preds, succs);
+            unsigned nlocked = 0;
+            bool ok = true;
+            while (ok && nlocked != n->height) {
+                node* p = preds[nlocked];
+                if (nlocked == 0 || p != preds[nlocked - 1])
+                    p->nextversion.lock();
+                ok = !p->marked && p->next[nlocked] == n;
+                ++nlocked;
+            }
+            if (ok) {
+                for (unsigned l = n->height; l-- != 0; )
+                    preds[l]->next[l] = n->next[l];
+                // whoever observed n's gap must now fail validation
+                n->nextversion.inc_nonopaque_version();
+                if (own) {
+                    auto gap_item = Sto::check_item(this, pack_gap(n));
+                    if (gap_item)
+                        gap_item->remove_read();
+                }
+            }
+            unlock_preds(preds, nlocked);
+            if (ok)
+                break;
+            relax_fence();
+        }
+        n->nextversion.unlock();
+        Transaction::rcu_call(free_node, n);
+    }
+
+    static void unlock_preds(node** preds, unsigned nlocked) {
+        for (unsigned l = 0; l != nlocked; ++l)
+            if (l == 0 || preds[l] != preds[l - 1])
+                preds[l]->nextversion.unlock();
+    }
+
+    unsigned random_height() {
+        // xorshift64
+        uint64_t& x = rand_[TThread::id()].x;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        // each level with probability 1/4
+        unsigned h = 1;
+        uint64_t r = x;
+        while (h < MaxHeight && (r & 3) == 0) {
+            ++h;
+            r >>= 2;
+        }
+        return h;
+    }
+
+    static node* make_node(const K& k, const V& v, unsigned h, bool valid) {
+        void* p = malloc(sizeof(node) + (h - 1) * sizeof(node*));
+        return new (p) node(k, v, h, valid);
+    }
+    static void free_node(void* p) {
+        node* n = static_cast<node*>(p);
+        n->~node();
+        free(n);
+    }
+
+    static bool has_delete(const TransItem& item) {
+        return item.flags() & delete_bit;
+    }
+    static bool has_insert(const TransItem& item) {
+        return item.flags() & insert_bit;
+    }
+    static bool validity_check(const TransItem& item, node* n) {
+        return has_insert(item) || n->valid();
+    }
+
+    static bool is_gap(const TransItem& item) {
+        return (uintptr_t) item.key<void*>() & gap_bit;
+    }
+    static node* gap_node(const TransItem& item) {
+        return (node*) ((uintptr_t) item.key<void*>() & ~gap_bit);
+    }
+    static void* pack_gap(node* n) {
+        return (void*) ((uintptr_t) n | gap_bit);
+    }
+
+    struct rand_state {
+        uint64_t x;
+        char pad_[56];
+    };
+
+    node* head_;
+    Compare comp_;
+    rand_state rand_[MAX_THREADS];
+};
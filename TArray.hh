@@ -1,8 +1,12 @@
 #pragma once
 #include "TWrapped.hh"
 #include "TArrayProxy.hh"
+#include "TArrayLayout.hh"
+#include "TCommute.hh"
+#include "TPredicate.hh"
 
-template <typename T, unsigned N, template <typename> class W = TOpaqueWrapped>
+template <typename T, unsigned N, template <typename> class W = TOpaqueWrapped,
+          template <typename, typename, unsigned> class L = TInterleavedLayout>
 class TArray : public TObject {
 public:
     class iterator;
@@ -12,8 +16,11 @@ public:
     typedef typename W<T>::version_type version_type;
     typedef unsigned size_type;
     typedef int difference_type;
-    typedef TConstArrayProxy<TArray<T, N, W> > const_proxy_type;
-    typedef TArrayProxy<TArray<T, N, W> > proxy_type;
+    typedef TConstArrayProxy<TArray<T, N, W, L> > const_proxy_type;
+    typedef TArrayProxy<TArray<T, N, W, L> > proxy_type;
+    typedef TCommutePending<T> pending_type;
+    // element write value is a pending_type (see transCommute)
+    static constexpr TransItem::flags_type commute_bit = TransItem::user0_bit;
 
     size_type size() const {
         return N;
@@ -39,65 +46,297 @@ public:
     get_type transGet(size_type i) const {
         assert(i < N);
         auto item = Sto::item(this, i);
+        if (item.has_flag(commute_bit)) {
+            // we depend on the value now, so the update becomes a plain write
+            T v = item.template write_value<pending_type>().applied_to(data_.value(i).read(item, data_.vers(i)));
+            item.clear_write().clear_flags(commute_bit).add_write(std::move(v));
+        }
         if (item.has_write())
             return item.template write_value<T>();
         else
-            return data_[i].v.read(item, data_[i].vers);
+            return data_.value(i).read(item, data_.vers(i));
     }
     void transPut(size_type i, T x) const {
         assert(i < N);
-        Sto::item(this, i).add_write(x);
+        auto item = Sto::item(this, i);
+        if (item.has_flag(commute_bit))
+            item.clear_write().clear_flags(commute_bit);
+        item.add_write(x);
+    }
+    // Set element i to Op()(value, x) at commit, without reading it; see
+    // TBox::commute.
+    template <typename Op>
+    void transCommute(size_type i, const T& x) const {
+        assert(i < N);
+        auto item = Sto::item(this, i);
+        if (item.has_flag(commute_bit)) {
+            pending_type& p = item.template write_value<pending_type>();
+            if (p.template is<Op>())
+                Op()(p.delta, x);
+            else {
+                T v = transGet(i);
+                Op()(v, x);
+                transPut(i, std::move(v));
+            }
+        } else if (item.has_write())
+            Op()(item.template write_value<T>(), x);
+        else
+            item.add_write(pending_type::template make<Op>(x)).add_flags(commute_bit);
+    }
+
+    // Read elements [first, last) into `out`. Unlike a transGet loop, this
+    // adds one item per range_chunk elements, whose read value is a
+    // fixed-size snapshot of those elements' version words (kept in the
+    // transaction's buffer, not on the heap); commit validates each chunk
+    // with one pass over its words. Elements this transaction wrote read
+    // back their written values.
+    template <typename OutputIt>
+    OutputIt transGetRange(size_type first, size_type last, OutputIt out) const {
+        assert(first <= last && last <= N);
+        while (first != last) {
+            size_type n = std::min(last - first, size_type(range_chunk));
+            out = get_chunk(first, first + n, out);
+            first += n;
+        }
+        return out;
+    }
+
+    // Sum of elements [first, last), including this transaction's writes.
+    // The result is a TIntRangeProxy, so a test like
+    // `a.transSum(0, 8) <= k` depends only on its outcome: concurrent
+    // writes to the slice that leave the outcome alone don't abort us.
+    // Pending transCommute additions count without reading their elements;
+    // other writes depend on the value they replace, so that value is
+    // observed. See TPredicate.hh.
+    TIntRangeProxy<T> transSum(size_type first, size_type last) const {
+        static_assert(std::is_integral<T>::value, "transSum requires an integral T");
+        assert(first <= last && last <= N);
+        T delta = T();
+        if (Sto::any_writes())
+            for (size_type i = first; i != last; ++i) {
+                auto eitem = Sto::check_item(this, i);
+                if (!eitem || !eitem->has_write())
+                    continue;
+                if (eitem->has_flag(commute_bit)) {
+                    const pending_type& p = eitem->template write_value<pending_type>();
+                    if (p.template is<TCommuteAdd<T>>())
+                        delta += p.delta;
+                    else {
+                        T base = data_.value(i).read(eitem.get(), data_.vers(i));
+                        delta += p.applied_to(base) - base;
+                    }
+                } else
+                    delta += eitem->template write_value<T>() - data_.value(i).read(eitem.get(), data_.vers(i));
+            }
+        return sum_type::observe(this, Sto::item(this, sum_key(first, last)), sum_args{first, last}, delta);
     }
 
     get_type nontrans_get(size_type i) const {
         assert(i < N);
-        return data_[i].v.access();
+        return data_.value(i).access();
     }
     void nontrans_put(size_type i, const T& x) {
         assert(i < N);
-        data_[i].v.access() = x;
+        data_.value(i).access() = x;
     }
     void nontrans_put(size_type i, T&& x) {
         assert(i < N);
-        data_[i].v.access() = std::move(x);
+        data_.value(i).access() = std::move(x);
     }
 
     // transactional methods
     bool lock(TransItem& item, Transaction& txn) override {
-        return txn.try_lock(item, data_[item.key<size_type>()].vers);
+        assert(!is_range(item) && !is_sum(item));
+        return txn.try_lock(item, data_.vers(item.key<size_type>()));
+    }
+    bool check_predicate(TransItem& item, Transaction& txn, bool committing) override {
+        assert(is_sum(item));
+        return sum_type::check_predicate(this, item, txn, committing);
     }
-    bool check(TransItem& item, Transaction&) override {
-        return item.check_version(data_[item.key<size_type>()].vers);
+    bool check(TransItem& item, Transaction& txn) override {
+        if (is_sum(item))
+            return sum_type::check(this, item, txn);
+        if (is_range(item))
+            return check_range(item, txn);
+        return item.check_version(data_.vers(item.key<size_type>()));
     }
     void install(TransItem& item, Transaction& txn) override {
         size_type i = item.key<size_type>();
-        data_[i].v.write(item.write_value<T>());
-        txn.set_version_unlock(data_[i].vers, item);
+        if (item.has_flag(commute_bit))
+            data_.value(i).write(item.write_value<pending_type>().applied_to(data_.value(i).access()));
+        else
+            data_.value(i).write(item.write_value<T>());
+        txn.set_version_unlock(data_.vers(i), item);
     }
     void unlock(TransItem& item) override {
-        data_[item.key<size_type>()].vers.unlock();
+        data_.vers(item.key<size_type>()).unlock();
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        if (!is_sum(item))
+            return TObject::print(w, item);
+        uint64_t key = item.key<uint64_t>();
+        w << "{TArray " << (void*) this << ".sum[" << ((key >> 32) & 0x7FFFFFFF) - 1
+          << "," << size_type(key) << ")";
+        sum_type::print(w, item);
+        w << "}";
+    }
+
+    // The committed sum of a slice, for TAggregate. The virtual methods
+    // instantiate this for every element type, not just integral ones.
+    typedef typename std::conditional<std::is_integral<T>::value, T, int>::type sum_value_type;
+    struct sum_args {
+        size_type first;
+        size_type last;
+    };
+    sum_value_type aggregate(const sum_args& args, TAggregateScan& scan) const {
+        return sum_slice(args, scan, std::is_integral<T>());
     }
 
 private:
-    struct elem {
-        version_type vers;
-        W<T> v;
+    L<version_type, W<T>, N> data_;
+
+    // Range reads snapshot at most this many version words per item.
+    static constexpr size_type range_chunk = 32;
+    struct range_versions {
+        typename version_type::type v[range_chunk];
     };
-    elem data_[N];
+    // check_range compares this many version words per step (its vector
+    // initializer spells out each lane)
+    static constexpr size_type range_lanes = 4;
+    typedef typename version_type::type range_lanes_type
+        __attribute__((vector_size(range_lanes * sizeof(typename version_type::type))));
+    typedef TAggregate<sum_value_type, sum_args> sum_type;
+
+    // Range items are keyed (first + 1) << 32 | last, which can't collide
+    // with element keys; sum items also set sum_bit.
+    static constexpr uint64_t sum_bit = uint64_t(1) << 63;
+    static uint64_t range_key(size_type first, size_type last) {
+        return (uint64_t(first) + 1) << 32 | last;
+    }
+    static uint64_t sum_key(size_type first, size_type last) {
+        return sum_bit | range_key(first, last);
+    }
+    static bool is_range(const TransItem& item) {
+        uint64_t key = item.key<uint64_t>();
+        return (key >> 32) && !(key & sum_bit);
+    }
+    static bool is_sum(const TransItem& item) {
+        return item.key<uint64_t>() & sum_bit;
+    }
+
+    template <typename OutputIt>
+    OutputIt get_chunk(size_type first, size_type last, OutputIt out) const {
+        auto item = Sto::item(this, range_key(first, last));
+        bool reread = item.has_read();
+        range_versions snap;
+        const range_versions& prev = reread ? item.template read_value<range_versions>() : snap;
+        bool any_writes = Sto::any_writes();
+        typename version_type::type maxv = 0;
+        for (size_type i = first; i != last; ++i, ++out) {
+            typename version_type::type v;
+            T x = read_element(i, v);
+            maxv = std::max(maxv, v);
+            if (!reread)
+                snap.v[i - first] = v;
+            else if (v != prev.v[i - first])
+                Sto::abort();
+            if (any_writes) {
+                auto eitem = Sto::check_item(this, i);
+                if (eitem && eitem->has_flag(commute_bit)) {
+                    *out = eitem->template write_value<pending_type>().applied_to(std::move(x));
+                    continue;
+                } else if (eitem && eitem->has_write()) {
+                    *out = eitem->template write_value<T>();
+                    continue;
+                }
+            }
+            *out = std::move(x);
+        }
+        // one opacity check covers the whole chunk
+        item.observe_opacity(version_type(maxv));
+        if (!reread)
+            item.add_read(snap);
+        return out;
+    }
+
+    // Read element i's value and the unlocked version it goes with,
+    // aborting if the element stays locked.
+    T read_element(size_type i, typename version_type::type& vers) const {
+        unsigned n = 0;
+        while (1) {
+            version_type v0 = data_.vers(i);
+            fence();
+            T result = data_.value(i).access();
+            fence();
+            version_type v1 = data_.vers(i);
+            if (v0 == v1 && !v1.is_locked()) {
+                vers = v1.value();
+                return result;
+            }
+            if (++n > (1 << STO_SPIN_BOUND_WAIT))
+                Sto::abort();
+            relax_fence();
+        }
+    }
+
+    T sum_slice(const sum_args& args, TAggregateScan& scan, std::true_type) const {
+        T sum = T();
+        for (size_type i = args.first; i != args.last; ++i) {
+            scan.visit(data_.vers(i));
+            fence();
+            sum += data_.value(i).access();
+        }
+        return sum;
+    }
+    sum_value_type sum_slice(const sum_args&, TAggregateScan&, std::false_type) const {
+        always_assert(false);
+        return 0;
+    }
+
+    bool check_range(TransItem& item, Transaction& txn) const {
+        uint64_t key = item.key<uint64_t>();
+        size_type first = (key >> 32) - 1, last = key;
+        const auto& snap = item.read_value<range_versions>().v;
+        // Branch-free pass over the version words, range_lanes at a time;
+        // only a mismatch (possibly an element we locked ourselves) needs a
+        // closer look. The compiler won't vectorize the scalar loop at -O2,
+        // or at all for interleaved layouts, so use vector types directly.
+        range_lanes_type vdiff = {};
+        size_type i = first;
+        for (; last - i >= range_lanes; i += range_lanes) {
+            range_lanes_type cur = {data_.vers(i).value(), data_.vers(i + 1).value(),
+                                    data_.vers(i + 2).value(), data_.vers(i + 3).value()};
+            range_lanes_type prev;
+            memcpy(&prev, &snap[i - first], sizeof(prev));
+            vdiff |= cur ^ prev;
+        }
+        typename version_type::type diff = 0;
+        for (size_type j = 0; j != range_lanes; ++j)
+            diff |= vdiff[j];
+        for (; i != last; ++i)
+            diff |= data_.vers(i).value() ^ snap[i - first];
+        if (!diff)
+            return true;
+        for (size_type i = first; i != last; ++i)
+            if (!TransactionTid::check_version(data_.vers(i).value(), snap[i - first], txn.threadid()))
+                return false;
+        return true;
+    }
 
     friend class iterator;
     friend class const_iterator;
 };
 
 
-template <typename T, unsigned N, template <typename> class W>
-class TArray<T, N, W>::const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
+template <typename T, unsigned N, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+class TArray<T, N, W, L>::const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
 public:
-    typedef TArray<T, N, W> array_type;
+    typedef TArray<T, N, W, L> array_type;
     typedef typename array_type::size_type size_type;
     typedef typename array_type::difference_type difference_type;
 
-    const_iterator(const TArray<T, N, W>* a, size_type i)
+    const_iterator(const TArray<T, N, W, L>* a, size_type i)
         : a_(const_cast<array_type*>(a)), i_(i) {
     }
 
@@ -169,14 +408,15 @@ protected:
     size_type i_;
 };
 
-template <typename T, unsigned N, template <typename> class W>
-class TArray<T, N, W>::iterator : public const_iterator {
+template <typename T, unsigned N, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+class TArray<T, N, W, L>::iterator : public const_iterator {
 public:
-    typedef TArray<T, N, W> array_type;
+    typedef TArray<T, N, W, L> array_type;
     typedef typename array_type::size_type size_type;
     typedef typename array_type::difference_type difference_type;
 
-    iterator(const TArray<T, N, W>* a, size_type i)
+    iterator(const TArray<T, N, W, L>* a, size_type i)
         : const_iterator(a, i) {
     }
 
@@ -216,32 +456,38 @@ public:
     }
 };
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::begin() -> iterator {
+template <typename T, unsigned N, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TArray<T, N, W, L>::begin() -> iterator {
     return iterator(this, 0);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::end() -> iterator {
+template <typename T, unsigned N, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TArray<T, N, W, L>::end() -> iterator {
     return iterator(this, N);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::cbegin() const -> const_iterator {
+template <typename T, unsigned N, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TArray<T, N, W, L>::cbegin() const -> const_iterator {
     return const_iterator(this, 0);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::cend() const -> const_iterator {
+template <typename T, unsigned N, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TArray<T, N, W, L>::cend() const -> const_iterator {
     return const_iterator(this, N);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::begin() const -> const_iterator {
+template <typename T, unsigned N, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TArray<T, N, W, L>::begin() const -> const_iterator {
     return const_iterator(this, 0);
 }
 
-template <typename T, unsigned N, template <typename> class W>
-inline auto TArray<T, N, W>::end() const -> const_iterator {
+template <typename T, unsigned N, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TArray<T, N, W, L>::end() const -> const_iterator {
     return const_iterator(this, N);
 }
@@ -0,0 +1,82 @@
+#pragma once
+#include "compiler.hh"
+
+// Element layouts for TArray and TVector. Each layout is a template
+// L<V, WT, N> holding N versions of type V and N wrapped values of type
+// WT, with accessors vers(i) and value(i). Layouts don't construct their
+// values beyond what their members' default constructors do, so TVector
+// can allocate one as raw memory and construct values lazily.
+
+// Version and value side by side (the default). A point read touches one
+// cache line for both.
+template <typename V, typename WT, unsigned N>
+class TInterleavedLayout {
+public:
+    V& vers(unsigned i) {
+        return d_[i].vers;
+    }
+    const V& vers(unsigned i) const {
+        return d_[i].vers;
+    }
+    WT& value(unsigned i) {
+        return d_[i].v;
+    }
+    const WT& value(unsigned i) const {
+        return d_[i].v;
+    }
+private:
+    struct elem {
+        V vers;
+        WT v;
+    };
+    elem d_[N];
+};
+
+// Structure of arrays: all versions, then all values. Scans that only need
+// values (nontransactional reads) or only versions (validation) touch half
+// as many lines, and values pack densely.
+template <typename V, typename WT, unsigned N>
+class TSplitLayout {
+public:
+    V& vers(unsigned i) {
+        return vers_[i];
+    }
+    const V& vers(unsigned i) const {
+        return vers_[i];
+    }
+    WT& value(unsigned i) {
+        return v_[i];
+    }
+    const WT& value(unsigned i) const {
+        return v_[i];
+    }
+private:
+    V vers_[N];
+    WT v_[N];
+};
+
+// One element per cache line (or more, for big values). Writers to
+// neighbouring elements never false-share, at the cost of memory and scan
+// bandwidth.
+template <typename V, typename WT, unsigned N>
+class TPaddedLayout {
+public:
+    V& vers(unsigned i) {
+        return d_[i].vers;
+    }
+    const V& vers(unsigned i) const {
+        return d_[i].vers;
+    }
+    WT& value(unsigned i) {
+        return d_[i].v;
+    }
+    const WT& value(unsigned i) const {
+        return d_[i].v;
+    }
+private:
+    struct elem {
+        V vers;
+        WT v;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+    elem d_[N];
+};
@@ -0,0 +1,338 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include "Interface.hh"
+#include "Hashtable.hh"
+
+// Transactional boosting on top of STO. A linearizable concurrent container
+// becomes transactional by
+// - taking abstract locks (TAbstractLock) on what an operation touches,
+//   normally its key, and holding them until the transaction ends;
+// - running the operation on the container right away;
+// - logging the operation's inverse, which runs if the transaction aborts.
+// Boosted objects are ordinary TObjects, so one transaction can mix them
+// with OCC objects: the abstract locks are still held while the OCC items
+// validate at commit.
+//
+// A transaction that finds an abstract lock taken waits for it rather than
+// aborting after a fixed number of spins. While it waits it publishes the
+// lock in a waits-for table; a waiter that finds itself on a cycle of the
+// waits-for graph aborts.
+
+class TAbstractLock {
+public:
+    typedef uint64_t mask_type;
+    static_assert(MAX_THREADS <= 64, "reader mask too small");
+
+    TAbstractLock()
+        : readers_(0), writer_(0) {
+    }
+
+    bool held_shared(int tid) const {
+        return readers_ & bit(tid);
+    }
+    bool held_exclusive(int tid) const {
+        return writer_ == tid + 1;
+    }
+
+    // Threads that keep @tid from taking this lock.
+    mask_type blockers(int tid, bool exclusive) const {
+        mask_type m = 0;
+        int w = writer_;
+        if (w && w != tid + 1)
+            m |= bit(w - 1);
+        if (exclusive)
+            m |= readers_ & ~bit(tid);
+        return m;
+    }
+
+    static mask_type bit(int tid) {
+        return mask_type(1) << tid;
+    }
+
+private:
+    volatile mask_type readers_;
+    volatile int writer_;    // 1 + holder's thread id, or 0
+
+    friend class TBoosting;
+};
+
+
+// Base class for boosted objects. Subclasses call read_lock/write_lock
+// before an operation and add_undo after it; everything is released, and
+// undone on abort, in cleanup.
+class TBoosting : public TObject {
+public:
+    typedef std::function<void()> undo_type;
+
+    void read_lock(TAbstractLock& l) {
+        int tid = TThread::id();
+        if (l.held_shared(tid) || l.held_exclusive(tid))
+            return;
+        boost_log& log = this->log();
+        unsigned spins = 0;
+        while (1) {
+            if (!l.writer_) {
+                __atomic_fetch_or(&l.readers_, TAbstractLock::bit(tid), __ATOMIC_SEQ_CST);
+                if (!l.writer_)
+                    break;
+                // a writer got in first; it waits for us to leave
+                __atomic_fetch_and(&l.readers_, ~TAbstractLock::bit(tid), __ATOMIC_SEQ_CST);
+            }
+            wait(l, false, spins);
+        }
+        stop_waiting(tid);
+        log.locks.push_back(&l);
+    }
+
+    void write_lock(TAbstractLock& l) {
+        int tid = TThread::id();
+        if (l.held_exclusive(tid))
+            return;
+        boost_log& log = this->log();
+        unsigned spins = 0;
+        while (l.writer_ || !__sync_bool_compare_and_swap(&l.writer_, 0, tid + 1))
+            wait(l, true, spins);
+        // released by cleanup even if we abort while draining readers
+        if (!l.held_shared(tid))
+            log.locks.push_back(&l);
+        while (l.readers_ & ~TAbstractLock::bit(tid))
+            wait(l, true, spins);
+        stop_waiting(tid);
+        acquire_fence();
+    }
+
+    // @f runs, most recent first, if the transaction aborts. It runs
+    // before this object's abstract locks are released.
+    template <typename F>
+    void add_undo(F&& f) {
+        log().undo.emplace_back(std::forward<F>(f));
+    }
+
+    bool lock(TransItem&, Transaction&) override {
+        return true;
+    }
+    bool check(TransItem&, Transaction&) override {
+        return true;
+    }
+    void install(TransItem&, Transaction&) override {
+    }
+    void unlock(TransItem&) override {
+    }
+    void cleanup(TransItem& item, bool committed) override {
+        boost_log* log = item.template write_value<boost_log*>();
+        if (!committed)
+            for (auto it = log->undo.rbegin(); it != log->undo.rend(); ++it)
+                (*it)();
+        int tid = TThread::id();
+        release_fence();
+        for (TAbstractLock* l : log->locks) {
+            if (l->held_exclusive(tid))
+                l->writer_ = 0;
+            if (l->held_shared(tid))
+                __atomic_fetch_and(&l->readers_, ~TAbstractLock::bit(tid), __ATOMIC_SEQ_CST);
+        }
+        delete log;
+    }
+
+private:
+    struct boost_log {
+        std::vector<TAbstractLock*> locks;
+        std::vector<undo_type> undo;
+    };
+
+    struct waiter {
+        TAbstractLock* volatile lock;
+        volatile bool exclusive;
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    static constexpr unsigned deadlock_check_spins = 1 << 8;
+
+    static waiter* waits_for() {
+        static waiter w[MAX_THREADS];
+        return w;
+    }
+
+    boost_log& log() {
+        auto item = Sto::item(this, this);
+        if (!item.has_write())
+            item.add_write(new boost_log);
+        return *item.template write_value<boost_log*>();
+    }
+
+    void wait(TAbstractLock& l, bool exclusive, unsigned& spins) {
+        int tid = TThread::id();
+        waiter& me = waits_for()[tid];
+        if (me.lock != &l) {
+            me.exclusive = exclusive;
+            __atomic_store_n(&me.lock, &l, __ATOMIC_SEQ_CST);
+        }
+        if (++spins % deadlock_check_spins == 0 && deadlocked(tid)) {
+            stop_waiting(tid);
+            Sto::abort();
+        }
+        relax_fence();
+    }
+
+    static void stop_waiting(int tid) {
+        waits_for()[tid].lock = nullptr;
+    }
+
+    // Follow waits-for edges from @tid; true if they lead back to it.
+    // Edges are read racily, so a cycle can be reported that was never
+    // there at any one instant; that costs one needless abort. A real
+    // deadlock does not go away, so it is found on some later check.
+    static bool deadlocked(int tid) {
+        waiter* w = waits_for();
+        TAbstractLock::mask_type seen = 0;
+        TAbstractLock::mask_type todo = w[tid].lock->blockers(tid, w[tid].exclusive);
+        while (todo) {
+            int t = __builtin_ctzll(todo);
+            todo &= todo - 1;
+            if (t == tid)
+                return true;
+            if (seen & TAbstractLock::bit(t))
+                continue;
+            seen |= TAbstractLock::bit(t);
+            TAbstractLock* l = w[t].lock;
+            if (l)
+                todo |= l->blockers(t, w[t].exclusive) & ~seen;
+        }
+        return false;
+    }
+};
+
+
+// One abstract lock per key, created on first use and kept for the
+// lifetime of the table.
+template <typename K, typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
+class TAbstractLockTable {
+public:
+    TAbstractLockTable(unsigned nbuckets = 129, Hash h = Hash(), Pred p = Pred())
+        : nbuckets_(nbuckets), buckets_(new lock_node*[nbuckets]()), hash_(h), pred_(p) {
+    }
+    ~TAbstractLockTable() {
+        for (unsigned i = 0; i != nbuckets_; ++i)
+            while (lock_node* n = buckets_[i]) {
+                buckets_[i] = n->next;
+                delete n;
+            }
+        delete[] buckets_;
+    }
+
+    TAbstractLock& lock_for(const K& key) {
+        lock_node* volatile* bucket = &buckets_[hash_(key) % nbuckets_];
+        lock_node* head = *bucket;
+        if (lock_node* n = find(head, nullptr, key))
+            return n->lock;
+        // nodes are only ever pushed at the head, so after a failed CAS
+        // only the nodes in front of the old head need checking
+        lock_node* fresh = new lock_node(key, head);
+        while (!__sync_bool_compare_and_swap(bucket, head, fresh)) {
+            lock_node* newhead = *bucket;
+            if (lock_node* n = find(newhead, head, key)) {
+                delete fresh;
+                return n->lock;
+            }
+            head = fresh->next = newhead;
+        }
+        return fresh->lock;
+    }
+
+private:
+    struct lock_node {
+        K key;
+        lock_node* next;
+        TAbstractLock lock;
+        lock_node(const K& k, lock_node* n)
+            : key(k), next(n) {
+        }
+    };
+
+    unsigned nbuckets_;
+    lock_node* volatile* buckets_;
+    Hash hash_;
+    Pred pred_;
+
+    lock_node* find(lock_node* n, lock_node* stop, const K& key) const {
+        for (; n != stop; n = n->next)
+            if (pred_(n->key, key))
+                return n;
+        return nullptr;
+    }
+};
+
+
+// A boosted map over any concurrent map with nontrans_find,
+// nontrans_insert, nontrans_remove and an in-place nontrans_replace (like
+// Hashtable's).
+template <typename K, typename V, typename Map = Hashtable<K, V, true, 129, V>,
+          typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
+class TBoostedMap : public TBoosting {
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef Map map_type;
+
+    TBoostedMap(unsigned nlocks = 129)
+        : map_(), locks_(nlocks) {
+    }
+
+    bool transGet(const K& k, V& retval) {
+        read_lock(locks_.lock_for(k));
+        return map_.nontrans_find(k, retval);
+    }
+
+    bool transInsert(const K& k, const V& v) {
+        write_lock(locks_.lock_for(k));
+        if (!map_.nontrans_insert(k, v))
+            return false;
+        add_undo([this, k] { map_.nontrans_remove(k); });
+        return true;
+    }
+
+    bool transDelete(const K& k) {
+        write_lock(locks_.lock_for(k));
+        V oldval;
+        if (!map_.nontrans_remove(k, oldval))
+            return false;
+        add_undo([this, k, oldval] { map_.nontrans_insert(k, oldval); });
+        return true;
+    }
+
+    // Returns true if @k was already present.
+    bool transPut(const K& k, const V& v) {
+        write_lock(locks_.lock_for(k));
+        V oldval;
+        bool exists = map_.nontrans_replace(k, v, oldval);
+        if (exists)
+            add_undo([this, k, oldval] { V x; map_.nontrans_replace(k, oldval, x); });
+        else {
+            map_.nontrans_insert(k, v);
+            add_undo([this, k] { map_.nontrans_remove(k); });
+        }
+        return exists;
+    }
+
+    // Changes @k only if it is present.
+    bool transUpdate(const K& k, const V& v) {
+        write_lock(locks_.lock_for(k));
+        V oldval;
+        if (!map_.nontrans_replace(k, v, oldval))
+            return false;
+        add_undo([this, k, oldval] { V x; map_.nontrans_replace(k, oldval, x); });
+        return true;
+    }
+
+    bool nontrans_find(const K& k, V& retval) {
+        return map_.nontrans_find(k, retval);
+    }
+
+    map_type& map() {
+        return map_;
+    }
+
+private:
+    Map map_;
+    TAbstractLockTable<K, Hash, Pred> locks_;
+};
@@ -1,12 +1,16 @@
 #pragma once
 #include "Interface.hh"
 #include "TWrapped.hh"
+#include "TCommute.hh"
 
 template <typename T, typename W = TWrapped<T> >
 class TBox : public TObject {
 public:
     typedef typename W::read_type read_type;
     typedef typename W::version_type version_type;
+    typedef TCommutePending<T> pending_type;
+    // write value is a pending_type (see commute)
+    static constexpr TransItem::flags_type commute_bit = TransItem::user0_bit;
 
     TBox() {
     }
@@ -17,20 +21,46 @@ public:
 
     read_type read() const {
         auto item = Sto::item(this, 0);
+        if (item.has_flag(commute_bit)) {
+            // we depend on the value now, so the update becomes a plain write
+            T v = item.template write_value<pending_type>().applied_to(v_.read(item, vers_));
+            item.clear_write().clear_flags(commute_bit).add_write(std::move(v));
+        }
         if (item.has_write())
             return item.template write_value<T>();
         else
             return v_.read(item, vers_);
     }
     void write(const T& x) {
-        Sto::item(this, 0).add_write(x);
+        write_item().add_write(x);
     }
     void write(T&& x) {
-        Sto::item(this, 0).add_write(std::move(x));
+        write_item().add_write(std::move(x));
     }
     template <typename... Args>
     void write(Args&&... args) {
-        Sto::item(this, 0).template add_write<T>(std::forward<Args>(args)...);
+        write_item().template add_write<T>(std::forward<Args>(args)...);
+    }
+
+    // Set the box to Op()(value, x) at commit, without reading it (see
+    // TCommute.hh). Updates with different ops needn't commute, so mixing
+    // ops in one transaction reads the box.
+    template <typename Op>
+    void commute(const T& x) {
+        auto item = Sto::item(this, 0);
+        if (item.has_flag(commute_bit)) {
+            pending_type& p = item.template write_value<pending_type>();
+            if (p.template is<Op>())
+                Op()(p.delta, x);
+            else {
+                T v = read();
+                Op()(v, x);
+                write(std::move(v));
+            }
+        } else if (item.has_write())
+            Op()(item.template write_value<T>(), x);
+        else
+            item.add_write(pending_type::template make<Op>(x)).add_flags(commute_bit);
     }
 
     operator read_type() const {
@@ -75,7 +105,10 @@ public:
         return item.check_version(vers_);
     }
     void install(TransItem& item, Transaction& txn) override {
-        v_.write(std::move(item.template write_value<T>()));
+        if (item.has_flag(commute_bit))
+            v_.write(item.template write_value<pending_type>().applied_to(v_.access()));
+        else
+            v_.write(std::move(item.template write_value<T>()));
         txn.set_version_unlock(vers_, item);
     }
     void unlock(TransItem&) override {
@@ -85,7 +118,9 @@ public:
         w << "{TBox<" << typeid(T).name() << "> " << (void*) this;
         if (item.has_read())
             w << " R" << item.read_value<version_type>();
-        if (item.has_write())
+        if (item.has_flag(commute_bit))
+            w << " =f(" << item.write_value<pending_type>().delta << ")";
+        else if (item.has_write())
             w << " =" << item.write_value<T>();
         w << "}";
     }
@@ -93,4 +128,11 @@ public:
 protected:
     version_type vers_;
     W v_;
+
+    TransProxy write_item() const {
+        auto item = Sto::item(this, 0);
+        if (item.has_flag(commute_bit))
+            item.clear_write().clear_flags(commute_bit);
+        return item;
+    }
 };
@@ -0,0 +1,36 @@
+#pragma once
+#include "TBox.hh"
+
+// A box whose updates all go through one commutative op, so transactions
+// that only update it never conflict. Reading it (read(), conversion to
+// T) takes a read dependency as usual, and an assignment overrides
+// updates. For example
+//   TCommutative<uint64_t, TCommuteMax<uint64_t>> max_seen;
+//   max_seen.update(ts);
+//   TCommutative<unsigned, TCommuteOr<unsigned>> flags;
+//   flags.update(0x4);
+template <typename T, typename Op, typename W = TWrapped<T> >
+class TCommutative : public TBox<T, W> {
+public:
+    typedef Op op_type;
+
+    TCommutative() {
+    }
+    template <typename... Args>
+    explicit TCommutative(Args&&... args)
+        : TBox<T, W>(std::forward<Args>(args)...) {
+    }
+
+    void update(const T& x) {
+        this->template commute<Op>(x);
+    }
+
+    TCommutative<T, Op, W>& operator=(const T& x) {
+        this->write(x);
+        return *this;
+    }
+    TCommutative<T, Op, W>& operator=(const TCommutative<T, Op, W>& x) {
+        this->write(x.read());
+        return *this;
+    }
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include "Interface.hh"
+
+// Commutative updates. An object that supports them (TBox, TArray
+// elements, TCommutative) buffers op(value, x) in its write item instead
+// of reading the value, and applies it to whatever value is current at
+// install time. The transaction takes no read dependency, so concurrent
+// updates with the same op never conflict with each other.
+//
+// An Op is a stateless functor `void operator()(T& value, const T& x)`.
+// Updates with one op must commute with each other; pending updates are
+// composed by applying the op to the buffered operand, so the op must
+// also be associative.
+
+template <typename T>
+struct TCommuteAdd {
+    void operator()(T& v, const T& x) const {
+        v += x;
+    }
+};
+
+template <typename T>
+struct TCommuteMax {
+    void operator()(T& v, const T& x) const {
+        v = std::max(v, x);
+    }
+};
+
+template <typename T>
+struct TCommuteMin {
+    void operator()(T& v, const T& x) const {
+        v = std::min(v, x);
+    }
+};
+
+template <typename T>
+struct TCommuteOr {
+    void operator()(T& v, const T& x) const {
+        v |= x;
+    }
+};
+
+template <typename T>
+struct TCommuteAnd {
+    void operator()(T& v, const T& x) const {
+        v &= x;
+    }
+};
+
+// T is a set-like container
+template <typename T>
+struct TCommuteUnion {
+    void operator()(T& v, const T& x) const {
+        v.insert(x.begin(), x.end());
+    }
+};
+
+// T is a sequence. Appends from different transactions land in commit
+// order, so use this only where that order doesn't matter (logs, bags).
+template <typename T>
+struct TCommuteAppend {
+    void operator()(T& v, const T& x) const {
+        v.insert(v.end(), x.begin(), x.end());
+    }
+};
+
+
+// The write value of an item with a pending commutative update.
+template <typename T>
+struct TCommutePending {
+    typedef void (*apply_type)(T&, const T&);
+
+    T delta;
+    apply_type apply;
+
+    template <typename Op>
+    static void apply_op(T& v, const T& x) {
+        Op()(v, x);
+    }
+    template <typename Op>
+    static TCommutePending<T> make(const T& x) {
+        return TCommutePending<T>{x, &apply_op<Op>};
+    }
+    template <typename Op>
+    bool is() const {
+        return apply == &apply_op<Op>;
+    }
+
+    T applied_to(T v) const {
+        apply(v, delta);
+        return v;
+    }
+};
+
+// The write value of a Hashtable or MassTrans element with pending
+// transApply/transIncrement updates. Increments fold into one delta, and
+// other ops are kept in order, so n updates cost O(n) however they mix.
+template <typename T>
+struct TApplyPending {
+    typedef std::function<void(T&)> op_type;
+
+    std::vector<op_type> ops;
+    T delta;
+    // null until there's an increment; only increment() needs T += T
+    typename TCommutePending<T>::apply_type add;
+
+    TApplyPending()
+        : delta(), add(nullptr) {
+    }
+
+    void push(op_type op) {
+        ops.push_back(std::move(op));
+    }
+    void increment(const T& x) {
+        if (add)
+            delta += x;
+        else {
+            delta = x;
+            add = &TCommutePending<T>::template apply_op<TCommuteAdd<T>>;
+        }
+    }
+    void operator()(T& v) const {
+        for (auto& op : ops)
+            op(v);
+        if (add)
+            add(v, delta);
+    }
+};
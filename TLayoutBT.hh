@@ -3,7 +3,7 @@
 #include "TWrapped.hh"
 #include "layoutLock/LayoutTree.hh"
 
-/* 
+/*
  *    A transactional version of the cohen DLtree running on top of STO
  *    Initialization will be non-transactional on tree construction time
  *    ------------------------------------------------------------------
@@ -16,152 +16,161 @@ using namespace std;
 
 // tracking set will be <GlobalLockTree*, treelet_log*>
 
-// This version uses a pessimistick lock for each treelet.
-// The optimistic version will either:
-// a: 	record all treelet modifications in the tracking
-// 		set, just like the STO protocol, or
-// b:	apply the modifications right away, since there is a
-// 		lock held for each treelet
+// Optimistic version: transactions never hold a treelet lock between
+// operations.
+// - A lookup locks its treelet only for the search itself and records the
+//   treelet's version (GlobalLockTree::version_) as the item's read.
+// - Inserts and removes are first lookups; the modification is buffered in
+//   a per-treelet log (the item's write value) and applied in install,
+//   under the treelet lock taken in lock().
+// - check() fails if the treelet changed or is locked by another committing
+//   transaction. A consolidation (enlarge_tree) freezes the old treelets
+//   while it copies them and then retires them, which bumps their versions,
+//   so transactions that read them still commit until the new backbone is
+//   published, and transactions that write them abort.
+// Two transactions that only read a treelet no longer serialize on it.
+// Reads are validated at commit, not opaque across treelets.
 template<typename T, typename W = TWrapped<T> >
 class TLayoutBT: public LayoutTree, public TObject {
-	std::map<T, bool> treelet_log;
-	
-	// When we have transactions, a treelet lock will not be released
-	// until the transaction commits. Thus, we must maintain pointers to
-	// all treelets used for this transaction. This means that
-	// getTreelet will first look in the data structure holding the treelet pointers
-	// before searching in the backbone.
-    GlobalLockTree* getTreelet(T key, dptrtype *dirtyP){
-		GlobalLockTree * t;
-        SYNC(start: llock_.startRead();)
-        node *cur = head;
-        while(cur->keys.type==NORMAL_NODE){
-            unsigned idx = asmsearch(key, (unsigned *)cur);
-            cur = cur->next[idx-16];
-            //assert(cur!=NULL);
-        }
-        t = (GlobalLockTree*)cur;
-		auto item = Sto::item(this, t);
-		// only acquire the lock if tracking set is empty!
-		if (! item.has_write() && ! item.has_read()){
-			t->acquire();
-		}
-#ifndef NOSYNC
-        if(llock_.finishRead(dirtyP)==false){
-            t->release();
-            goto start;
-        }
-#endif
-        return t;
-    }
-
+	typedef std::map<T, bool> treelet_log;
 
-	public:
-
-	TLayoutBT(){}
+	static constexpr int lock_spins = 1 << 10;
 
-	bool insert(T key, dptrtype *dirtyP){
-      CHCK(int n = __atomic_fetch_add(&next, 1, __ATOMIC_SEQ_CST);\
-      buffer[n] = key;)
-        bool insres;
-		GlobalLockTree * t;
-		t = getTreelet(key, dirtyP);
-		std::map<T, bool> * treelet_log;
+	// Look up @key as this transaction sees it. Returns the item for its
+	// treelet and sets @present.
+	TransProxy lookup(T key, dptrtype *dirtyP, bool& present){
+		SYNC(llock_.startWrite();)
+		GlobalLockTree * t = getTreelet(key, dirtyP, false);
 		auto item = Sto::item(this, t);
 		if (item.has_write()){
-			treelet_log = item.template write_value<std::map<T,bool>* >();
-		}
-		else {
-			cout <<"insert: Creating new log for treelet"<<endl;
-        	treelet_log = new std::map<T, bool>();
-			item.add_write(treelet_log);
+			treelet_log& log = *item.template write_value<treelet_log*>();
+			auto it = log.find(key);
+			if (it != log.end()){
+				t->release();
+				SYNC(llock_.finishWrite();)
+				present = it->second;
+				return item;
+			}
 		}
-		(*treelet_log)[key] = true;
-        // will do the actual insert in install phase!
-		//insres = t->insert(key);
-        insres = true;
-		if(unlikely((heuristic[stateOff_]+=insres)>=200))
+		present = t->search_locked(key);
+		unsigned long v = t->version_;
+		t->release();
+		SYNC(llock_.finishWrite();)
+		if (!item.has_read())
+			item.add_read(v);
+		else if (item.template read_value<unsigned long>() != v)
+			Sto::abort();
+		return item;
+	}
+
+	treelet_log& log_of(TransProxy& item){
+		if (!item.has_write())
+			item.add_write(new treelet_log);
+		return *item.template write_value<treelet_log*>();
+	}
+
+	// Apply the committed size change to the layout heuristics; may
+	// enlarge or shrink the backbone.
+	void resize_heuristic(){
+		if(unlikely(heuristic[stateOff_]>=200))
         {
             int res = __sync_add_and_fetch(&fuzzySize, heuristic[stateOff_]);
-            //printf("fuzzySize=%d, th=%d\n", tid_, res);
 			int lenlargeWhen;
             SYNC(lb: llock_.startRead();) lenlargeWhen=enlargeWhen; SYNC(if(llock_.finishRead()==false) goto lb;)
             if(res >= lenlargeWhen) enlarge_tree(res);
             heuristic[stateOff_]=0;
         }
-		return insres;
-	}
-
-	bool remove(T key, dptrtype *dirtyP){
-        bool res;//, shrink=false;
-		GlobalLockTree * t;
-        t = getTreelet(key, dirtyP);
-		std::map<T, bool> * treelet_log;
-        auto item = Sto::item(this, t);
-        if (item.has_write()){
-			treelet_log = item.template write_value<std::map<T,bool> *>();
-        }
-		else {
-			cout<<"remove: Creating new log for treelet"<<endl;
-			treelet_log = new std::map<T, bool>();
-            item.add_write(treelet_log);
-		}
-        (*treelet_log)[key] = false;
-		//item.add_flags(TransItem::user0_bit); // specify it is a remove operation : No need now! We specify it at the boolean value of the treelet_log map
-		res = true;
-		//res = t->remove(key);
-        if(unlikely((heuristic[stateOff_]-=res)<-200))
+        else if(unlikely(heuristic[stateOff_]<-200))
       	{
          	int res = __sync_add_and_fetch(&fuzzySize, heuristic[stateOff_]);
             int lshrinkWhen;
-         	SYNC(lb: llock_.startRead();) lshrinkWhen=shrinkWhen; SYNC(if(llock_.finishRead()==false) goto lb;)
+         	SYNC(lb2: llock_.startRead();) lshrinkWhen=shrinkWhen; SYNC(if(llock_.finishRead()==false) goto lb2;)
          	if(res <= lshrinkWhen) shrink_tree(res);
-		 	//printf("REMOVE: fuzzySize=%d, th=%d\n", res, tid_);
          	heuristic[stateOff_]=0;
       	}
-        return res;
+	}
+
+
+	public:
+
+	TLayoutBT(){}
+	// @levels is the initial backbone depth in bits of key, a multiple of 4
+	TLayoutBT(int levels): LayoutTree(levels){}
+
+	bool search(T key, dptrtype *dirtyP){
+		bool present;
+		lookup(key, dirtyP, present);
+		return present;
+	}
+
+	bool insert(T key, dptrtype *dirtyP){
+      CHCK(int n = __atomic_fetch_add(&next, 1, __ATOMIC_SEQ_CST);\
+      buffer[n] = key;)
+		bool present;
+		auto item = lookup(key, dirtyP, present);
+		// will do the actual insert in install phase!
+		if (!present)
+			log_of(item)[key] = true;
+		return !present;
+	}
+
+	bool remove(T key, dptrtype *dirtyP){
+		bool present;
+		auto item = lookup(key, dirtyP, present);
+		if (present)
+			log_of(item)[key] = false;
+		return present;
     }
 
 
 	/* STO callbacks
  	 * -------------
  	 */
-	// pessimistic approach locks every treelet before accessing it,
-	// thus we don't need to lock at commit time
-    bool lock(TransItem&, Transaction&){
-        return true;
+	// modified treelets are locked only at commit time
+    bool lock(TransItem& item, Transaction&){
+		GlobalLockTree* t = item.key<GlobalLockTree*>();
+		for (int i = 0; i != lock_spins; ++i){
+			if (t->try_acquire()){
+				// a rebuild is copying this treelet; our writes would be lost
+				if (t->frozen_){
+					t->release();
+					return false;
+				}
+				return true;
+			}
+			relax_fence();
+		}
+        return false;
     }
-	// there is no tracking set check required
-    bool check(TransItem&, Transaction&){
-        return true;
+	// the treelet must be unchanged, and not being committed by someone else
+    bool check(TransItem& item, Transaction&){
+		GlobalLockTree* t = item.key<GlobalLockTree*>();
+		return (item.has_write() || t->lock != LOCKED)
+			&& t->version_ == item.template read_value<unsigned long>();
     }
 	// modifications will be applied now
-    void install(TransItem& item, Transaction& txn){
-		cout << "STO::install callback"<<endl;
+    void install(TransItem& item, Transaction&){
 		GlobalLockTree* t = item.key<GlobalLockTree*>();
-		bool res;
-		std::map<T, bool>* treelet_log = item.template write_value<std::map<T, bool>*>();
-		for (const auto& log_entry: *treelet_log){
-			if(log_entry.second){
-				res = t->insert(log_entry.first);
-			}
-			else{
-				res = t->remove(log_entry.first);
-			}
-			if (!res)
-				txn.abort();
+		treelet_log* log = item.template write_value<treelet_log*>();
+		for (const auto& log_entry: *log){
+			// validation guarantees these succeed
+			if(log_entry.second)
+				heuristic[stateOff_] += t->insert_locked(log_entry.first);
+			else
+				heuristic[stateOff_] -= t->remove_locked(log_entry.first);
 		}
-		t->release();
-		delete treelet_log;
 	}
 
-    void unlock(TransItem&){
-
+    void unlock(TransItem& item){
+		item.key<GlobalLockTree*>()->release();
     }
 
 
-	void cleanup(TransItem&, bool){
-		
+	void cleanup(TransItem& item, bool committed){
+		delete item.template write_value<treelet_log*>();
+		// our treelet locks are released by now
+		if (committed)
+			resize_heuristic();
 	}
 
 };
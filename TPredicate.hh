@@ -0,0 +1,158 @@
+#pragma once
+#include <vector>
+#include "Interface.hh"
+#include "Transaction.hh"
+#include "TIntRange.hh"
+
+// Aggregate predicates: TIntRange constraints on a value computed from
+// many versioned words, such as the sum of a TArray slice or the number of
+// Hashtable keys in a range. Comparing the value (`sum <= k`, `count == 0`)
+// records only the comparison's outcome, as TIntPredicate does for a
+// single integer, so the transaction survives concurrent changes that
+// leave the outcome alone.
+//
+// A container supports an aggregate by defining
+//   T aggregate(const A& args, TAggregateScan& scan);
+// which computes the committed value of the aggregate that `args` names,
+// passing every version word it depends on to scan.visit() before reading
+// the data that word protects. The container gives each aggregate read its
+// own item, whose predicate value is a TAggregatePredicate, and forwards
+// check_predicate() and check() for those items to TAggregate.
+//
+// Commit re-evaluates the aggregate before taking locks; if the predicate
+// still holds, the item becomes a read of the version words that
+// evaluation saw, which check() validates as usual.
+
+// Collects the version words an aggregate depends on.
+class TAggregateScan {
+public:
+    typedef TransactionTid::type version_type;
+
+    TAggregateScan(Transaction& txn, bool opaque)
+        : txn_(txn), opaque_(opaque), locked_(false) {
+    }
+
+    // Returns the word read; use it rather than re-reading the version.
+    version_type visit(const TVersion& version) {
+        version_type v = version.value();
+        if (opaque_)
+            txn_.check_opacity(v);
+        return record(v);
+    }
+    version_type visit(const TNonopaqueVersion& version) {
+        return record(version.value());
+    }
+
+    Transaction& transaction() const {
+        return txn_;
+    }
+    bool locked_elsewhere() const {
+        return locked_;
+    }
+    std::vector<version_type>& versions() {
+        return versions_;
+    }
+    void clear() {
+        locked_ = false;
+        versions_.clear();
+    }
+    // Versions may since have been locked by this transaction.
+    bool unchanged_since(const std::vector<version_type>& old) const {
+        if (locked_ || versions_.size() != old.size())
+            return false;
+        for (size_t i = 0; i != old.size(); ++i)
+            if (!TransactionTid::check_version(versions_[i], old[i], txn_.threadid()))
+                return false;
+        return true;
+    }
+
+private:
+    Transaction& txn_;
+    bool opaque_;
+    bool locked_;
+    std::vector<version_type> versions_;
+
+    version_type record(version_type v) {
+        if (TransactionTid::is_locked_elsewhere(v, txn_.threadid()))
+            locked_ = true;
+        versions_.push_back(v);
+        return v;
+    }
+};
+
+template <typename T, typename A>
+struct TAggregatePredicate {
+    A args;
+    TIntRange<T> range;
+    // set at commit: the versions the final evaluation saw
+    std::vector<TAggregateScan::version_type> versions;
+};
+
+template <typename T, typename A>
+class TAggregate {
+public:
+    typedef TAggregatePredicate<T, A> pred_type;
+    typedef TIntRangeProxy<T> proxy_type;
+    static constexpr unsigned snapshot_spins = 1 << 10;
+
+    // Evaluate aggregate `args` of `obj` and return it as a proxy whose
+    // comparisons constrain `item`'s predicate. `delta` is this
+    // transaction's own uncommitted contribution, which the proxy adds to
+    // the committed value. Reusing an item narrows its existing predicate.
+    template <typename C>
+    static proxy_type observe(C* obj, TransProxy item, const A& args, T delta = T()) {
+        TAggregateScan scan(item.transaction(), true);
+        T value;
+        if (!snapshot(obj, args, scan, value))
+            Sto::abort();
+        pred_type& pred = item.template predicate_value<pred_type>(pred_type{args, TIntRange<T>::unconstrained(), {}});
+        return proxy_type(&pred.range, value, delta);
+    }
+
+    template <typename C>
+    static bool check_predicate(C* obj, TransItem& item, Transaction& txn, bool committing) {
+        pred_type& pred = item.template predicate_value<pred_type>();
+        TAggregateScan scan(txn, false);
+        T value;
+        if (!snapshot(obj, pred.args, scan, value) || !pred.range.verify(value))
+            return false;
+        if (committing)
+            TransProxy(txn, item).add_read(pred_type{pred.args, pred.range, std::move(scan.versions())});
+        return true;
+    }
+
+    template <typename C>
+    static bool check(C* obj, TransItem& item, Transaction& txn) {
+        const pred_type& pred = item.template read_value<pred_type>();
+        TAggregateScan scan(txn, false);
+        obj->aggregate(pred.args, scan);
+        return scan.unchanged_since(pred.versions);
+    }
+
+    static void print(std::ostream& w, const TransItem& item) {
+        if (item.has_read())
+            w << " R" << item.template read_value<pred_type>().range;
+        else if (item.has_predicate())
+            w << " P" << item.template predicate_value<pred_type>().range;
+    }
+
+private:
+    // Evaluate twice; if no version changed or was locked by someone else
+    // in between, the first evaluation saw one consistent state.
+    template <typename C>
+    static bool snapshot(C* obj, const A& args, TAggregateScan& scan, T& value) {
+        TAggregateScan again(scan.transaction(), false);
+        for (unsigned n = 0; n != snapshot_spins; ++n) {
+            value = obj->aggregate(args, scan);
+            fence();
+            obj->aggregate(args, again);
+            if (!scan.locked_elsewhere() && !again.locked_elsewhere()
+                && again.versions() == scan.versions())
+                return true;
+            scan.clear();
+            again.clear();
+            relax_fence();
+        }
+        return false;
+    }
+};
@@ -0,0 +1,426 @@
+#pragma once
+
+#include <list>
+#include "Transaction.hh"
+#include "TWrapped.hh"
+
+// FIFO queue whose producers never conflict with each other.
+//
+// Pushes are blind: a committing push locks nothing and reserves its slots
+// with a fetch-and-add on tail_ at install time, then fills them and marks
+// them ready. Pops serialize among themselves on headversion_ as in Queue.
+// A pop or front that finds the queue empty remembers the position it saw
+// and fails validation if any push has reserved that position since; pops
+// and fronts of existing elements never validate tail_, so they don't
+// conflict with pushes either.
+//
+// A transaction that saw the queue empty and also pushes must put its
+// elements exactly at the position it saw, so it reserves them at lock time
+// with a CAS on tail_. If it then aborts, the reserved slots are marked
+// skipped, and pops step over them.
+//
+// Storage is a linked list of CHUNK_SIZE-element chunks. Producers extend
+// it with CAS; installed pops free consumed chunks through RCU.
+template <typename T, unsigned CHUNK_SIZE = 256,
+          template <typename> class W = TOpaqueWrapped>
+class TQueue : public TObject {
+public:
+    typedef typename W<T>::version_type version_type;
+
+    static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit;
+    static constexpr TransItem::flags_type read_writes = TransItem::user0_bit<<1;
+    static constexpr TransItem::flags_type list_bit = TransItem::user0_bit<<2;
+    static constexpr TransItem::flags_type empty_bit = TransItem::user0_bit<<3;
+    static constexpr TransItem::flags_type reserved_bit = TransItem::user0_bit<<4;
+
+    TQueue()
+        : head_(0), head_chunk_(nullptr), headversion_(0),
+          tail_(0), tail_chunk_(nullptr) {
+    }
+    ~TQueue() {
+        while (head_chunk_) {
+            chunk* next = head_chunk_->next_;
+            delete head_chunk_;
+            head_chunk_ = next;
+        }
+    }
+
+    // NONTRANSACTIONAL PUSH/POP/EMPTY
+    void nontrans_push(const T& v) {
+        reserve_and_fill(&v, 1);
+    }
+
+    T nontrans_pop() {
+        assert(!nontrans_empty());
+        while (is_hole(head_))
+            step_head(false);
+        T v = ready_slot(head_);
+        step_head(false);
+        return v;
+    }
+
+    bool nontrans_empty() const {
+        uint64_t pos = head_;
+        while (pos != tail_ && is_hole(pos))
+            ++pos;
+        return pos == tail_;
+    }
+
+    void nontrans_clear() {
+        while (!nontrans_empty())
+            nontrans_pop();
+    }
+
+    // TRANSACTIONAL CALLS
+    void transPush(const T& v) {
+        auto item = Sto::item(this, push_key);
+        if (item.has_write()) {
+            if (!is_list(item)) {
+                auto& val = item.template write_value<T>();
+                std::list<T> write_list;
+                if (!is_empty(item)) {
+                    write_list.push_back(val);
+                    item.clear_flags(empty_bit);
+                }
+                write_list.push_back(v);
+                item.clear_write();
+                item.add_write(write_list);
+                item.add_flags(list_bit);
+            }
+            else {
+                auto& write_list = item.template write_value<std::list<T>>();
+                write_list.push_back(v);
+            }
+        }
+        else item.add_write(v);
+    }
+
+    bool transPop() {
+        auto hv = headversion_;
+        fence();
+        uint64_t index = head_;
+        auto item = Sto::item(this, index);
+
+        while (1) {
+            if (index == tail_) {
+                // empty: take from our own pushes, if any
+                auto pushitem = observe_empty(index);
+                if (pushitem.has_write()) {
+                    if (is_list(pushitem)) {
+                        auto& write_list = pushitem.template write_value<std::list<T>>();
+                        if (!write_list.empty()) {
+                            write_list.pop_front();
+                            item.add_flags(read_writes);
+                            return true;
+                        }
+                        else return false;
+                    }
+                    // not a list, has exactly one element
+                    else if (!is_empty(pushitem)) {
+                        pushitem.add_flags(empty_bit);
+                        return true;
+                    }
+                }
+                return false;
+            }
+            // is_hole() waits for the element to be filled, so installing
+            // this pop never frees a chunk a push still needs
+            if (has_delete(item) || is_hole(index)) {
+                ++index;
+                item = Sto::item(this, index);
+            }
+            else break;
+        }
+        // ensure that head is not modified by time of commit
+        auto lockitem = Sto::item(this, pop_key);
+        if (!lockitem.has_read())
+            lockitem.observe(hv);
+        lockitem.add_write(0);
+        item.add_flags(delete_bit);
+        item.add_write(0);
+        return true;
+    }
+
+    bool transFront(T& val) {
+        auto hv = headversion_;
+        fence();
+        uint64_t index = head_;
+        auto item = Sto::item(this, index);
+        while (1) {
+            if (index == tail_) {
+                auto pushitem = observe_empty(index);
+                if (pushitem.has_write()) {
+                    if (is_list(pushitem)) {
+                        auto& write_list = pushitem.template write_value<std::list<T>>();
+                        if (!write_list.empty()) {
+                            val = write_list.front();
+                            return true;
+                        }
+                        else return false;
+                    }
+                    else if (!is_empty(pushitem)) {
+                        val = pushitem.template write_value<T>();
+                        return true;
+                    }
+                }
+                return false;
+            }
+            if (has_delete(item) || is_hole(index)) {
+                ++index;
+                item = Sto::item(this, index);
+            }
+            else break;
+        }
+        val = ready_slot(index);
+        // ensure that head was not modified at time of commit
+        auto lockitem = Sto::item(this, pop_key);
+        if (!lockitem.has_read())
+            lockitem.observe(hv);
+        return true;
+    }
+
+private:
+    // Chunk c holds positions [c->base_, c->base_ + CHUNK_SIZE). A reserved
+    // position is readable once its state_ is slot_ready; slot_skipped marks
+    // a position whose reserving transaction aborted.
+    enum { slot_pending = 0, slot_ready = 1, slot_skipped = 2 };
+    struct chunk {
+        uint64_t base_;
+        chunk* next_;
+        volatile uint8_t state_[CHUNK_SIZE];
+        T slots_[CHUNK_SIZE];
+        explicit chunk(uint64_t base) : base_(base), next_(nullptr) {
+            for (unsigned i = 0; i != CHUNK_SIZE; ++i)
+                state_[i] = slot_pending;
+        }
+    };
+
+    static constexpr intptr_t push_key = -1;
+    static constexpr intptr_t pop_key = -2;
+
+    bool has_delete(const TransItem& item) {
+        return item.flags() & delete_bit;
+    }
+    bool is_rw(const TransItem& item) {
+        return item.flags() & read_writes;
+    }
+    bool is_list(const TransItem& item) {
+        return item.flags() & list_bit;
+    }
+    bool is_empty(const TransItem& item) {
+        return item.flags() & empty_bit;
+    }
+    bool is_reserved(const TransItem& item) {
+        return item.flags() & reserved_bit;
+    }
+
+    // Number of positions a push item takes.
+    uint64_t push_count(TransItem& item) {
+        if (is_list(item))
+            return item.template write_value<std::list<T>>().size();
+        return is_empty(item) ? 0 : 1;
+    }
+
+    // Record that the queue looked empty at position @index: validation
+    // fails if a push reserves @index before we commit.
+    TransProxy observe_empty(uint64_t index) {
+        auto pushitem = Sto::item(this, push_key);
+        if (!pushitem.has_read())
+            pushitem.add_read(index);
+        return pushitem;
+    }
+
+    // First chunk at or after @c that holds @pos, linking new chunks as
+    // needed. Concurrent producers race with CAS; losers free their chunk.
+    static chunk* extend_to(chunk* c, uint64_t pos) {
+        while (pos >= c->base_ + CHUNK_SIZE) {
+            chunk* next = c->next_;
+            if (!next) {
+                chunk* n = new chunk(c->base_ + CHUNK_SIZE);
+                if (bool_cmpxchg(&c->next_, (chunk*) nullptr, n))
+                    next = n;
+                else {
+                    delete n;
+                    next = c->next_;
+                }
+            }
+            c = next;
+        }
+        return c;
+    }
+
+    // Chunk holding position @pos in [head_, tail_), once the transaction
+    // that reserved it has filled or skipped it. Walks from the head chunk
+    // without a lock; if a concurrent pop has already moved the head past
+    // @pos, our headversion_ check would fail anyway, so abort early.
+    chunk* settled_chunk(uint64_t pos) const {
+        chunk* c;
+        while (!(c = head_chunk_))
+            relax_fence();
+        if (pos < c->base_)
+            Sto::abort();
+        while (pos >= c->base_ + CHUNK_SIZE) {
+            chunk* next;
+            while (!(next = c->next_))
+                relax_fence();
+            c = next;
+        }
+        while (c->state_[pos - c->base_] == slot_pending)
+            relax_fence();
+        acquire_fence();
+        return c;
+    }
+
+    bool is_hole(uint64_t pos) const {
+        chunk* c = settled_chunk(pos);
+        return c->state_[pos - c->base_] == slot_skipped;
+    }
+
+    T& ready_slot(uint64_t pos) {
+        chunk* c = settled_chunk(pos);
+        assert(c->state_[pos - c->base_] == slot_ready);
+        return c->slots_[pos - c->base_];
+    }
+
+    // Reserve @n positions and fill them from @vals.
+    template <typename It>
+    void reserve_and_fill(It vals, uint64_t n) {
+        fill(fetch_and_add(&tail_, n), vals, n);
+    }
+
+    // Fill the reserved positions [@pos, @pos + @n) from @vals, or mark them
+    // skipped if @state is slot_skipped.
+    template <typename It>
+    void fill(uint64_t pos, It vals, uint64_t n, uint8_t state = slot_ready) {
+        chunk* c = tail_chunk_;
+        if (!c) {
+            // first push ever: create the first chunk
+            chunk* first = new chunk(0);
+            if (bool_cmpxchg(&tail_chunk_, (chunk*) nullptr, first))
+                head_chunk_ = first;
+            else
+                delete first;
+            while (!head_chunk_)
+                relax_fence();
+            c = tail_chunk_;
+        }
+        // the hint may have moved past @pos; head_chunk_ cannot, since the
+        // head never passes an unfilled position
+        if (c->base_ > pos)
+            c = head_chunk_;
+        c = extend_to(c, pos);
+        for (uint64_t i = 0; i != n; ++i, ++pos) {
+            c = extend_to(c, pos);
+            if (state == slot_ready) {
+                c->slots_[pos - c->base_] = *vals;
+                ++vals;
+                release_fence();
+            }
+            c->state_[pos - c->base_] = state;
+        }
+        // advance the hint; never move it backwards
+        chunk* h = tail_chunk_;
+        while (h->base_ < c->base_ && !bool_cmpxchg(&tail_chunk_, h, c))
+            h = tail_chunk_;
+    }
+
+    // Advance head_ past any skipped positions and then one element. Called
+    // with headversion_ locked; the element is filled.
+    void advance_head(bool transactional) {
+        while (is_hole(head_))
+            step_head(transactional);
+        step_head(transactional);
+    }
+
+    void step_head(bool transactional) {
+        ++head_;
+        if (head_ % CHUNK_SIZE == 0) {
+            chunk* c = head_chunk_;
+            chunk* next = extend_to(c, head_);
+            head_chunk_ = next;
+            // the hint must never point at a retired chunk
+            bool_cmpxchg(&tail_chunk_, c, next);
+            if (transactional)
+                Transaction::rcu_delete(c);
+            else
+                delete c;
+        }
+    }
+
+    bool lock(TransItem& item, Transaction& txn) override {
+        if (item.key<intptr_t>() == pop_key)
+            return txn.try_lock(item, headversion_);
+        // we saw an empty queue at some position and push too: our elements
+        // go exactly there, so reserve them now; a blind push reserving at
+        // install could otherwise take the position after our check
+        if (item.key<intptr_t>() == push_key && item.has_read()) {
+            uint64_t pos = item.template read_value<uint64_t>();
+            if (!bool_cmpxchg(&tail_, pos, pos + push_count(item)))
+                return false;
+            item.add_flags(reserved_bit);
+        }
+        // blind pushes and pops of individual positions need no lock
+        return true;
+    }
+
+    bool check(TransItem& item, Transaction&) override {
+        if (item.key<intptr_t>() == pop_key)
+            return item.check_version(headversion_);
+        // we saw an empty queue: nobody may have pushed since
+        else if (item.key<intptr_t>() == push_key)
+            return is_reserved(item)
+                || tail_ == item.template read_value<uint64_t>();
+        assert(0);
+        return false;
+    }
+
+    void install(TransItem& item, Transaction& txn) override {
+        if (item.key<intptr_t>() == pop_key)
+            return;
+        // install pops
+        if (has_delete(item)) {
+            // only advance head if item popped from actual q
+            if (!is_rw(item))
+                advance_head(true);
+            headversion_.set_version(txn.commit_tid());
+        }
+        // install pushes
+        else if (item.key<intptr_t>() == push_key) {
+            if (is_reserved(item)) {
+                uint64_t pos = item.template read_value<uint64_t>();
+                if (is_list(item)) {
+                    auto& write_list = item.template write_value<std::list<T>>();
+                    fill(pos, write_list.begin(), write_list.size());
+                } else if (!is_empty(item))
+                    fill(pos, &item.template write_value<T>(), 1);
+            } else if (is_list(item)) {
+                auto& write_list = item.template write_value<std::list<T>>();
+                reserve_and_fill(write_list.begin(), write_list.size());
+            } else if (!is_empty(item))
+                reserve_and_fill(&item.template write_value<T>(), 1);
+        }
+    }
+
+    void unlock(TransItem& item) override {
+        if (item.key<intptr_t>() == pop_key)
+            headversion_.unlock();
+    }
+
+    void cleanup(TransItem& item, bool committed) override {
+        // positions we reserved may already have pushes behind them, so
+        // they can't be given back; mark them skipped instead
+        if (!committed && item.key<intptr_t>() == push_key && is_reserved(item))
+            fill(item.template read_value<uint64_t>(), (const T*) nullptr,
+                 push_count(item), slot_skipped);
+    }
+
+    // pop side
+    uint64_t head_;
+    chunk* head_chunk_;
+    version_type headversion_;
+    char pad_[64];
+    // push side: next position to reserve, and a hint at or before the
+    // chunk holding it
+    uint64_t tail_;
+    chunk* tail_chunk_;
+};
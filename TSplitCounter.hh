@@ -0,0 +1,306 @@
+#pragma once
+#include "Interface.hh"
+#include "Transaction.hh"
+#include "TWrapped.hh"
+
+// A counter for hot spots that every transaction increments, such as a
+// global sequence or statistics counter. It behaves like TCounter, but
+// runs in one of two phases (as in Doppel's phase reconciliation):
+//
+// - Joined: the value lives in one word under one version, exactly like
+//   TCounter. Reads are cheap, but every increment locks that version.
+// - Split: transactions that only increment the counter (no read, no
+//   assignment) add their delta to a per-thread slot, locking only that
+//   slot, so they never contend with each other. A read sums the base
+//   value and all slots and observes every slot's version.
+//
+// The counter splits when joined-phase increments start finding the
+// version locked, and joins (folding the slots into the base value) once
+// split-phase reads outnumber split-phase increments. The join runs when
+// the transaction whose read tipped the balance finishes, not inside the
+// read. An increment in a transaction that also read the counter goes to
+// the base value under its version in either phase; an assignment joins
+// the counter at commit. split() and join() force a phase.
+//
+// Phase changes hold the base version locked and give it a new version,
+// so a reader that straddles one fails validation.
+template <typename T, typename W = TWrapped<T> >
+class TSplitCounter : public TObject {
+public:
+    typedef typename W::version_type version_type;
+    static constexpr TransItem::flags_type delta_bit = TransItem::user0_bit;
+    static constexpr TransItem::flags_type assigned_bit = TransItem::user0_bit << 1;
+    // delta was locked into this thread's slot
+    static constexpr TransItem::flags_type slot_bit = TransItem::user0_bit << 2;
+    // key of the item that joins the counter when its transaction ends
+    static constexpr int join_key = -1;
+
+    static constexpr int nslots = MAX_THREADS;
+    // split after this many joined-phase increments find the version locked
+    static constexpr unsigned split_contention = 32;
+    // every join_check_reads split-phase reads, join if there have been
+    // more reads than slot increments since the split
+    static constexpr unsigned join_check_reads = 16;
+    static constexpr unsigned lock_spins = 1 << 12;
+
+    TSplitCounter()
+        : v_(), split_(false), nreads_(0), ncontended_(0) {
+    }
+    explicit TSplitCounter(T x)
+        : v_(x), split_(false), nreads_(0), ncontended_(0) {
+    }
+
+    operator T() const {
+        auto item = Sto::item(this, 0);
+        if (item.has_flag(assigned_bit))
+            return item.template write_value<T>();
+        T result = snapshot(item);
+        if (item.has_write())
+            result += item.template write_value<T>();
+        return result;
+    }
+
+    TSplitCounter<T, W>& operator=(T x) {
+        Sto::item(this, 0).add_write(x).assign_flags(assigned_bit);
+        return *this;
+    }
+    TSplitCounter<T, W>& operator=(const TSplitCounter<T, W>& x) {
+        return *this = x.operator T();
+    }
+
+    TSplitCounter<T, W>& operator+=(T delta) {
+        auto item = Sto::item(this, 0);
+        item.add_write(item.template write_value<T>(T()) + delta);
+        if (!item.has_flag(assigned_bit))
+            item.add_flags(delta_bit);
+        return *this;
+    }
+    TSplitCounter<T, W>& operator-=(T delta) {
+        auto item = Sto::item(this, 0);
+        item.add_write(item.template write_value<T>(T()) - delta);
+        if (!item.has_flag(assigned_bit))
+            item.add_flags(delta_bit);
+        return *this;
+    }
+    TSplitCounter<T, W>& operator++() {
+        return *this += 1;
+    }
+    void operator++(int) {
+        *this += 1;
+    }
+    TSplitCounter<T, W>& operator--() {
+        return *this -= 1;
+    }
+    void operator--(int) {
+        *this -= 1;
+    }
+
+    T nontrans_read() const {
+        T result = v_.access();
+        for (auto& s : slots_)
+            result += s.v.access();
+        return result;
+    }
+    void nontrans_write(T x) {
+        v_.access() = x;
+        for (auto& s : slots_)
+            s.v.access() = T();
+    }
+
+    bool is_split() const {
+        return split_;
+    }
+    // Force a phase. These are not transactional; they fail (returning
+    // false) only if the counter stays locked by committers for too long.
+    bool split() {
+        if (!spin_lock(vers_))
+            return false;
+        if (!split_)
+            split_locked();
+        vers_.unlock();
+        return true;
+    }
+    bool join() {
+        if (!spin_lock(vers_))
+            return false;
+        bool ok = !split_ || join_locked();
+        vers_.unlock();
+        return ok;
+    }
+
+    // transactional methods
+    bool lock(TransItem& item, Transaction& txn) override {
+        if (item.key<int>() == join_key)
+            return true;
+        if (item.has_flag(delta_bit) && !item.has_read()) {
+            if (!split_ && vers_.is_locked_elsewhere(txn)
+                && fetch_and_add(&ncontended_, 1) + 1 >= split_contention)
+                split();
+            if (split_ && lock_slot(item, txn))
+                return true;
+        }
+        if (!txn.try_lock(item, vers_))
+            return false;
+        // an assignment replaces the slots' contents too
+        if (split_ && item.has_flag(assigned_bit) && !join_locked()) {
+            vers_.unlock();
+            return false;
+        }
+        return true;
+    }
+    bool check(TransItem& item, Transaction&) override {
+        auto key = item.key<int>();
+        if (key == 0)
+            return item.check_version(vers_);
+        else
+            return item.check_version(slots_[key - 1].vers);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        if (item.key<int>() == join_key)
+            return;
+        if (item.has_flag(slot_bit)) {
+            slot_type& s = slots_[TThread::id()];
+            s.v.write(s.v.access() + item.template write_value<T>());
+            ++s.nwrites;
+            txn.set_version_unlock(s.vers, item);
+        } else {
+            T result = item.template write_value<T>();
+            if (item.has_flag(delta_bit))
+                result += v_.access();
+            v_.write(result);
+            txn.set_version_unlock(vers_, item);
+        }
+    }
+    void unlock(TransItem& item) override {
+        if (item.key<int>() == join_key)
+            return;
+        if (item.has_flag(slot_bit))
+            slots_[TThread::id()].vers.unlock();
+        else
+            vers_.unlock();
+    }
+    void cleanup(TransItem& item, bool) override {
+        // our locks are gone, so the join can't wait on ourselves
+        if (item.key<int>() == join_key)
+            join();
+    }
+    void print(std::ostream& w, const TransItem& item) const override {
+        auto key = item.key<int>();
+        if (key == join_key) {
+            w << "{SplitCounter " << (void*) this << ".join}";
+            return;
+        }
+        if (key != 0) {
+            w << "{SplitCounter " << (void*) this << ".slot" << key - 1
+              << "=" << slots_[key - 1].v.access() << ".v" << slots_[key - 1].vers.value()
+              << " R" << item.read_value<version_type>() << "}";
+            return;
+        }
+        w << "{SplitCounter " << (void*) this << "=" << v_.access() << ".v" << vers_.value();
+        if (split_)
+            w << " split";
+        if (item.has_read())
+            w << " R" << item.read_value<version_type>();
+        if (item.has_write() && item.has_flag(delta_bit))
+            w << " Δ" << item.template write_value<T>();
+        else if (item.has_write())
+            w << " =" << item.template write_value<T>();
+        w << "}";
+    }
+
+private:
+    struct slot_type {
+        version_type vers;
+        W v;
+        unsigned nwrites;
+
+        slot_type()
+            : v(), nwrites(0) {
+        }
+    } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    version_type vers_;
+    W v_;
+    volatile bool split_;
+    mutable unsigned nreads_;
+    unsigned ncontended_;
+    slot_type slots_[nslots];
+
+    // split_ changes only while vers_ is locked, and vers_ changes with
+    // it, so reading split_ after observing vers_ is consistent.
+    T snapshot(TransProxy item) const {
+        if (split_ && note_split_read())
+            Sto::item(this, join_key).add_write();
+        T result = v_.read(item, vers_);
+        acquire_fence();
+        if (split_)
+            for (int i = 0; i != nslots; ++i)
+                result += slots_[i].v.read(Sto::item(this, i + 1), slots_[i].vers);
+        return result;
+    }
+    // Returns true if it's time to join.
+    bool note_split_read() const {
+        unsigned n = fetch_and_add(&nreads_, 1) + 1;
+        if (n % join_check_reads != 0)
+            return false;
+        unsigned nwrites = 0;
+        for (auto& s : slots_)
+            nwrites += s.nwrites;
+        return n > nwrites;
+    }
+
+    bool lock_slot(TransItem& item, Transaction& txn) {
+        slot_type& s = slots_[TThread::id()];
+        if (!txn.try_lock(item, s.vers))
+            return false;
+        // join_locked() locks every slot before it leaves the split phase
+        if (split_) {
+            item.add_flags(slot_bit);
+            return true;
+        }
+        s.vers.unlock();
+        return false;
+    }
+    static bool spin_lock(version_type& v) {
+        for (unsigned n = 0; n != lock_spins; ++n) {
+            if (v.try_lock())
+                return true;
+            relax_fence();
+        }
+        return false;
+    }
+
+    // Both require vers_ locked here.
+    void split_locked() {
+        split_ = true;
+        nreads_ = 0;
+        vers_.inc_nonopaque_version();
+    }
+    bool join_locked() {
+        int n = 0;
+        while (n != nslots && spin_lock(slots_[n].vers))
+            ++n;
+        if (n != nslots) {
+            while (n--)
+                slots_[n].vers.unlock();
+            return false;
+        }
+        T sum = v_.access();
+        for (auto& s : slots_) {
+            sum += s.v.access();
+            s.v.write(T());
+            s.nwrites = 0;
+        }
+        v_.write(sum);
+        split_ = false;
+        ncontended_ = 0;
+        vers_.inc_nonopaque_version();
+        // readers that saw the split phase may have read some slots
+        // already; make them revalidate
+        for (auto& s : slots_) {
+            s.vers.inc_nonopaque_version();
+            s.vers.unlock();
+        }
+        return true;
+    }
+};
@@ -2,8 +2,10 @@
 #include "TWrapped.hh"
 #include "TArrayProxy.hh"
 #include "TIntPredicate.hh"
+#include "TArrayLayout.hh"
 
-template <typename T, template <typename> class W = TOpaqueWrapped>
+template <typename T, template <typename> class W = TOpaqueWrapped,
+          template <typename, typename, unsigned> class L = TInterleavedLayout>
 class TVector : public TObject {
 public:
     using size_type = int;
@@ -15,6 +17,15 @@ private:
 #else
     static constexpr size_type default_capacity = 128;
 #endif
+    // Elements live in chunks of default_capacity elements, reached through
+    // a directory of chunk pointers. Growing allocates new chunks (and, when
+    // the directory is full, a larger copy of the directory, with the old
+    // one freed through RCU); existing elements never move, so growth needs
+    // no copying and concurrent readers never see a stale element. The L
+    // layout (see TArrayLayout.hh) arranges the elements within a chunk.
+    static constexpr size_type chunk_size = default_capacity;
+    static_assert((chunk_size & (chunk_size - 1)) == 0, "TVector chunk size must be a power of two");
+    static constexpr size_type initial_dir_size = 8;
     using pred_type = TIntRange<size_type>;
     using key_type = int;
     static constexpr key_type size_key = -1;
@@ -26,11 +37,19 @@ private:
          vector.
        Thus, if xwrite_value.first < xwrite_value.second, the vector grew.
        If xwrite_value.first > xwrite_value.second, the vector shrank.
-       Note that the xwrite_value exists even if !has_write(). */
+       Note that the xwrite_value exists even if !has_write().
+
+       A transaction whose only size effect is push_back (its predicate is
+       unconstrained and it popped nothing it did not push) is an append.
+       Appends don't lock size_vers_ in lock(); their elements are placed at
+       the end of the vector during install, which takes size_vers_ only
+       for as long as it takes to copy them in. Concurrent appends therefore
+       serialize on the install step, not on each other's whole commit. */
 
     static constexpr TransItem::flags_type pop_bit = TransItem::user0_bit;
     static constexpr TransItem::flags_type onlyexists_bit = pop_bit << 1;
     static constexpr TransItem::flags_type indexed_bit = pop_bit << 2;
+    static constexpr TransItem::flags_type append_bit = pop_bit << 3;
     static constexpr typename version_type::type dead_bit = version_type::user_bit;
 public:
     class iterator;
@@ -39,22 +58,23 @@ public:
     using difference_proxy = TIntRangeDifferenceProxy<size_type>;
     typedef T value_type;
     typedef typename W<T>::read_type get_type;
-    typedef TConstArrayProxy<TVector<T, W> > const_proxy_type;
-    typedef TArrayProxy<TVector<T, W> > proxy_type;
+    typedef TConstArrayProxy<TVector<T, W, L> > const_proxy_type;
+    typedef TArrayProxy<TVector<T, W, L> > proxy_type;
     typedef proxy_type reference;
     typedef const_proxy_type const_reference;
 
     TVector()
-        : size_(0), max_size_(0), capacity_(default_capacity) {
-        data_ = reinterpret_cast<elem*>(new char[sizeof(elem) * capacity_]);
-        for (size_type i = 0; i != capacity_; ++i)
-            data_[i].vers = dead_bit;
+        : size_(0), max_size_(0), capacity_(0) {
+        dir_ = make_dir(initial_dir_size);
+        grow(default_capacity);
     }
     ~TVector() {
         using WT = W<T>;
         for (size_type i = 0; i != max_size_; ++i)
-            data_[i].v.~WT();
-        delete[] reinterpret_cast<char*>(data_);
+            value_at(i).~WT();
+        for (size_type c = 0; c != capacity_ / chunk_size; ++c)
+            free(dir_->chunks[c]);
+        free(dir_);
     }
 
     size_proxy size() const {
@@ -115,6 +135,8 @@ public:
         if (!wval.second)
             version_type::opaque_throw(std::out_of_range("TVector::pop_back"));
         --wval.second;
+        if (wval.second < wval.first)
+            sitem.add_flags(pop_bit);
         Sto::item(this, wval.second).add_write().add_flags(pop_bit);
     }
 
@@ -126,12 +148,12 @@ public:
     void nontrans_reserve(size_type size);
     void nontrans_push_back(T x) {
         size_type& sz = size_.access();
-        assert(sz < capacity_);
+        grow(sz + 1);
         if (sz == max_size_) {
-            new(reinterpret_cast<void*>(&data_[sz].v)) W<T>(std::move(x));
+            new(reinterpret_cast<void*>(&value_at(sz))) W<T>(std::move(x));
             ++max_size_;
         } else
-            data_[sz].v.write(std::move(x));
+            value_at(sz).write(std::move(x));
         ++sz;
     }
 
@@ -150,8 +172,15 @@ public:
             item.add_flags(indexed_bit);
             return item.write_value<T>();
         } else {
+            if (i < 0 || i >= capacity_) {
+                // the size can't have reached i yet
+                auto sitem = size_item();
+                size_predicate(sitem).observe_le(i);
+                goto out_of_range;
+            }
+            acquire_fence();
             item.add_flags(indexed_bit);
-            get_type result = data_[i].v.read(item, data_[i].vers);
+            get_type result = value_at(i).read(item, vers_at(i));
             if (item.read_value<version_type>().value() & dead_bit)
                 goto out_of_range;
             return result;
@@ -174,19 +203,21 @@ public:
     }
     get_type nontrans_get(size_type i) const {
         assert(i < size_.access());
-        return data_[i].v.access();
+        return value_at(i).access();
     }
     void nontrans_put(size_type i, const T& x) {
         assert(i < size_.access());
-        data_[i].v.access() = x;
+        value_at(i).access() = x;
     }
     void nontrans_put(size_type i, T&& x) {
         assert(i < size_.access());
-        data_[i].v.access() = std::move(x);
+        value_at(i).access() = std::move(x);
     }
 
     // transactional methods
     bool check_predicate(TransItem& item, Transaction& txn, bool committing) override {
+        if (is_append(item))
+            return true; // nothing to check; don't wait on appenders
         TransProxy p(txn, item);
         pred_type pred = item.template predicate_value<pred_type>();
         size_type value = size_.wait_snapshot(p, size_vers_, committing);
@@ -195,15 +226,27 @@ public:
     bool lock(TransItem& item, Transaction& txn) override {
         auto key = item.template key<key_type>();
         if (key == size_key) {
+            if (is_append(item)) {
+                TransProxy(txn, item).add_flags(append_bit);
+                return true;
+            }
             if (!txn.try_lock(item, size_vers_))
                 return false;
             size_delta_ = size_.access() - size_info(item).first;
+            // make room for our pushes before their elements are locked
+            grow(size_info(item).second + size_delta_);
             return true;
         } else {
+            if (!item.has_flag(indexed_bit)
+                && is_append(txn.check_item(this, size_key)->item())) {
+                // placed and installed with the size item
+                TransProxy(txn, item).add_flags(append_bit);
+                return true;
+            }
             key += item.has_flag(indexed_bit) ? 0 : size_delta_;
             if (key < 0)
                 return false; // popped too much!
-            return txn.try_lock(item, data_[key].vers);
+            return txn.try_lock(item, vers_at(key));
         }
     }
     bool check(TransItem& item, Transaction& txn) override {
@@ -211,13 +254,18 @@ public:
         if (key == size_key)
             return item.check_version(size_vers_);
         else if (item.has_flag(onlyexists_bit))
-            return !(data_[key].vers.snapshot(item, txn) & dead_bit);
+            return !(vers_at(key).snapshot(item, txn) & dead_bit);
         else {
             assert(item.has_flag(indexed_bit));
-            return item.check_version(data_[key].vers);
+            return item.check_version(vers_at(key));
         }
     }
     void install(TransItem& item, Transaction& txn) override {
+        if (item.has_flag(append_bit)) {
+            if (item.template key<key_type>() == size_key)
+                install_append(item, txn);
+            return;
+        }
         auto key = item.template key<key_type>();
         if (key == size_key) {
             pred_type& wval = size_info(item);
@@ -230,20 +278,22 @@ public:
         if (!item.has_flag(pop_bit)) {
             assert(key <= max_size_ && key < capacity_);
             if (key == max_size_) {
-                new(reinterpret_cast<void*>(&data_[key].v)) W<T>(std::move(item.write_value<T>()));
+                new(reinterpret_cast<void*>(&value_at(key))) W<T>(std::move(item.write_value<T>()));
                 ++max_size_;
             } else
-                data_[key].v.write(std::move(item.write_value<T>()));
+                value_at(key).write(std::move(item.write_value<T>()));
         }
-        txn.set_version_unlock(data_[key].vers, item, item.has_flag(pop_bit) ? dead_bit : 0);
+        txn.set_version_unlock(vers_at(key), item, item.has_flag(pop_bit) ? dead_bit : 0);
     }
     void unlock(TransItem& item) override {
+        if (item.has_flag(append_bit))
+            return;
         auto key = item.template key<key_type>();
         if (key == size_key)
             size_vers_.unlock();
         else {
             key += item.has_flag(indexed_bit) ? 0 : size_delta_;
-            data_[key].vers.unlock();
+            vers_at(key).unlock();
         }
     }
     void print(std::ostream& w, const TransItem& item) const override {
@@ -276,23 +326,39 @@ public:
             return false;
         size_type max_size = max_size_;
         for (size_type i = 0; i != max_size; ++i)
-            if (data_[i].vers.is_locked_here(here))
+            if (vers_at(i).is_locked_here(here))
                 return false;
         return true;
     }
     void print(std::ostream& w) const;
 
 private:
-    struct elem {
-        version_type vers;
-        W<T> v;
+    typedef L<version_type, W<T>, chunk_size> chunk_type;
+    struct chunk_dir {
+        size_type nslots;
+        chunk_type* chunks[1];
     };
-    elem* data_;
+    chunk_dir* dir_;
     W<size_type> size_;
     version_type size_vers_;
     size_type size_delta_; // protected by size_vers_ lock
     size_type max_size_; // protected by size_vers_ lock
-    size_type capacity_;
+    size_type capacity_; // protected by size_vers_ lock; grows only
+
+    // element helpers
+    version_type& vers_at(size_type i) const {
+        return dir_->chunks[unsigned(i) / chunk_size]->vers(unsigned(i) % chunk_size);
+    }
+    W<T>& value_at(size_type i) const {
+        return dir_->chunks[unsigned(i) / chunk_size]->value(unsigned(i) % chunk_size);
+    }
+    static chunk_dir* make_dir(size_type nslots) {
+        chunk_dir* d = reinterpret_cast<chunk_dir*>(malloc(sizeof(chunk_dir) + (nslots - 1) * sizeof(chunk_type*)));
+        d->nslots = nslots;
+        return d;
+    }
+    void grow(size_type size);
+    void install_append(TransItem& sitem, Transaction& txn);
 
     // size helpers
     TransProxy size_item() const {
@@ -328,17 +394,25 @@ private:
     pred_type& size_info() const {
         return size_info(size_item());
     }
+    static bool is_append(const TransItem& sitem) {
+        if (sitem.has_read() || sitem.has_flag(pop_bit))
+            return false;
+        const pred_type& pred = sitem.template predicate_value<pred_type>();
+        pred_type u = pred_type::unconstrained();
+        return pred.first == u.first && pred.second == u.second;
+    }
 
     get_type transGet(size_type i, TransProxy item) const {
         if (item.has_write())
             return item.template write_value<T>();
         else
-            return data_[i].v.read(item, data_[i].vers);
+            return value_at(i).read(item, vers_at(i));
     }
     bool put_in_range(TransProxy& item, size_type i) const {
-        if (i >= capacity_)
+        if (i < 0 || i >= capacity_)
             return false;
-        item.observe(data_[i].vers).add_flags(onlyexists_bit);
+        acquire_fence();
+        item.observe(vers_at(i)).add_flags(onlyexists_bit);
         return !(item.read_value<version_type>().value() & dead_bit);
     }
 
@@ -347,10 +421,11 @@ private:
 };
 
 
-template <typename T, template <typename> class W>
-class TVector<T, W>::const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+class TVector<T, W, L>::const_iterator : public std::iterator<std::random_access_iterator_tag, T> {
 public:
-    typedef TVector<T, W> vector_type;
+    typedef TVector<T, W, L> vector_type;
     typedef typename vector_type::size_type size_type;
     typedef typename vector_type::difference_type difference_type;
     typedef typename vector_type::pred_type pred_type;
@@ -359,7 +434,7 @@ public:
     const_iterator()
         : a_() {
     }
-    const_iterator(const TVector<T, W>* a, size_type i, TransItem* eitem)
+    const_iterator(const TVector<T, W, L>* a, size_type i, TransItem* eitem)
         : a_(const_cast<vector_type*>(a)), i_(i), eitem_(eitem) {
     }
 
@@ -451,19 +526,20 @@ protected:
     bool different_end(const const_iterator& x) const {
         return eitem_ != x.eitem_;
     }
-    friend class TVector<T, W>;
+    friend class TVector<T, W, L>;
 };
 
-template <typename T, template <typename> class W>
-class TVector<T, W>::iterator : public const_iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+class TVector<T, W, L>::iterator : public const_iterator {
 public:
-    typedef TVector<T, W> vector_type;
+    typedef TVector<T, W, L> vector_type;
     typedef typename vector_type::size_type size_type;
     typedef typename vector_type::difference_type difference_type;
 
     iterator() {
     }
-    iterator(const TVector<T, W>* a, size_type i, TransItem* eitem)
+    iterator(const TVector<T, W, L>* a, size_type i, TransItem* eitem)
         : const_iterator(a, i, eitem) {
     }
 
@@ -507,45 +583,52 @@ public:
     }
 
 private:
-    friend class TVector<T, W>;
+    friend class TVector<T, W, L>;
 };
 
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::begin() -> iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TVector<T, W, L>::begin() -> iterator {
     return iterator(this, 0, 0);
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::end() -> iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TVector<T, W, L>::end() -> iterator {
     TransProxy sitem = size_item();
     return iterator(this, size_info(sitem).second, &sitem.item());
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::cbegin() const -> const_iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TVector<T, W, L>::cbegin() const -> const_iterator {
     return const_iterator(this, 0, 0);
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::cend() const -> const_iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TVector<T, W, L>::cend() const -> const_iterator {
     TransProxy sitem = size_item();
     return const_iterator(this, size_info(sitem).second, &sitem.item());
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::begin() const -> const_iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TVector<T, W, L>::begin() const -> const_iterator {
     return cbegin();
 }
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::end() const -> const_iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TVector<T, W, L>::end() const -> const_iterator {
     return cend();
 }
 
 
-template <typename T, template <typename> class W>
-inline auto TVector<T, W>::const_iterator::operator-(const const_iterator& x) const -> difference_proxy {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+inline auto TVector<T, W, L>::const_iterator::operator-(const const_iterator& x) const -> difference_proxy {
     assert(a_ == x.a_);
     if (different_end(x)) {
         TransItem* eitem = eitem_ ? eitem_ : x.eitem_;
@@ -556,17 +639,21 @@ inline auto TVector<T, W>::const_iterator::operator-(const const_iterator& x) co
 }
 
 
-template <typename T, template <typename> class W>
-void TVector<T, W>::clear() {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+void TVector<T, W, L>::clear() {
     auto sitem = size_item().add_write();
     pred_type& wval = size_info(sitem);
     for (size_type i = 0; i != wval.second; ++i)
         Sto::item(this, i).add_write().add_flags(pop_bit);
+    if (wval.first)
+        sitem.add_flags(pop_bit);
     wval.second = 0;
 }
 
-template <typename T, template <typename> class W>
-auto TVector<T, W>::erase(iterator pos) -> iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+auto TVector<T, W, L>::erase(iterator pos) -> iterator {
     auto sitem = size_item().add_write();
     pred_type& wval = size_info(sitem);
     if (pos.i_ >= wval.second)
@@ -583,8 +670,9 @@ auto TVector<T, W>::erase(iterator pos) -> iterator {
     return pos;
 }
 
-template <typename T, template <typename> class W>
-auto TVector<T, W>::insert(iterator pos, T value) -> iterator {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+auto TVector<T, W, L>::insert(iterator pos, T value) -> iterator {
     auto sitem = size_item().add_write();
     pred_type& wval = size_info(sitem);
     if (pos.i_ > wval.second)
@@ -601,8 +689,9 @@ auto TVector<T, W>::insert(iterator pos, T value) -> iterator {
     return pos;
 }
 
-template <typename T, template <typename> class W>
-void TVector<T, W>::resize(size_type size, T value) {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+void TVector<T, W, L>::resize(size_type size, T value) {
     auto sitem = size_item().add_write();
     pred_type& wval = size_info(sitem);
     size_predicate(sitem).observe(wval.first);
@@ -615,24 +704,70 @@ void TVector<T, W>::resize(size_type size, T value) {
             .add_write(value);
 }
 
-template <typename T, template <typename> class W>
-void TVector<T, W>::nontrans_reserve(size_type size) {
-    size_type new_capacity = capacity_;
-    while (size > new_capacity)
-        new_capacity <<= 1;
-    if (new_capacity > capacity_) {
-        elem* new_data = reinterpret_cast<elem*>(new char[sizeof(elem) * new_capacity]);
-        memcpy(new_data, data_, sizeof(elem) * capacity_);
-        for (size_type i = capacity_; i != new_capacity; ++i)
-            new_data[i].vers = dead_bit;
-        Transaction::rcu_delete_array(reinterpret_cast<char*>(data_));
-        data_ = new_data;
-        capacity_ = new_capacity;
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+void TVector<T, W, L>::nontrans_reserve(size_type size) {
+    grow(size);
+}
+
+// Installs an append's elements after the current last element. The
+// elements' own items were never locked; each slot is locked here so
+// readers never see a half-written value.
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+void TVector<T, W, L>::install_append(TransItem& sitem, Transaction& txn) {
+    pred_type& wval = size_info(sitem);
+    size_vers_.lock();
+    size_type base = size_.access() - wval.first;
+    grow(wval.second + base);
+    for (size_type i = wval.first; i != wval.second; ++i) {
+        TransProxy item = txn.check_item(this, i).get();
+        size_type key = i + base;
+        vers_at(key).lock();
+        if (key == max_size_) {
+            new(reinterpret_cast<void*>(&value_at(key))) W<T>(std::move(item.write_value<T>()));
+            ++max_size_;
+        } else
+            value_at(key).write(std::move(item.write_value<T>()));
+        txn.set_version_unlock(vers_at(key), item.item());
+    }
+    size_.write(wval.second + base);
+    txn.set_version_unlock(size_vers_, sitem);
+}
+
+// Called with size_vers_ locked, or nontransactionally. Readers load
+// capacity_ before dir_, so every slot below capacity_ is reachable from
+// the directory they see.
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+void TVector<T, W, L>::grow(size_type size) {
+    while (capacity_ < size) {
+        size_type c = capacity_ / chunk_size;
+        chunk_dir* d = dir_;
+        if (c == d->nslots) {
+            chunk_dir* nd = make_dir(2 * d->nslots);
+            memcpy(nd->chunks, d->chunks, sizeof(chunk_type*) * c);
+            release_fence();
+            dir_ = nd;
+            Transaction::rcu_free(d);
+            d = nd;
+        }
+        // values are constructed as elements are first installed
+        void* p;
+        if (posix_memalign(&p, CACHE_LINE_SIZE, sizeof(chunk_type)) != 0)
+            throw std::bad_alloc();
+        chunk_type* chunk = reinterpret_cast<chunk_type*>(p);
+        for (size_type i = 0; i != chunk_size; ++i)
+            chunk->vers(i) = dead_bit;
+        d->chunks[c] = chunk;
+        release_fence();
+        capacity_ += chunk_size;
     }
 }
 
-template <typename T, template <typename> class W>
-void TVector<T, W>::print(std::ostream& w) const {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+void TVector<T, W, L>::print(std::ostream& w) const {
     size_type sz = size_.access();
     w << "TVector<" << typeid(T).name() << ">{" << (void*) this
       << "size=" << sz << '@' << size_vers_ << " [";
@@ -641,22 +776,23 @@ void TVector<T, W>::print(std::ostream& w) const {
             w << ", ";
         if (i >= 10)
             w << '[' << i << ']';
-        w << data_[i].v.access() << '@' << data_[i].vers;
+        w << value_at(i).access() << '@' << vers_at(i);
     }
     w << "]";
     for (size_type i = sz; i < max_size_ && i < sz + 10; ++i) {
         w << ", ";
         if (i >= 10)
             w << '[' << i << ']';
-        w << '@' << data_[i].vers;
+        w << '@' << vers_at(i);
     }
     if (sz + 10 < max_size_)
         w << "...";
     w << "}";
 }
 
-template <typename T, template <typename> class W>
-std::ostream& operator<<(std::ostream& w, const TVector<T, W>& v) {
+template <typename T, template <typename> class W,
+          template <typename, typename, unsigned> class L>
+std::ostream& operator<<(std::ostream& w, const TVector<T, W, L>& v) {
     v.print(w);
     return w;
 }
@@ -1,72 +1,182 @@
 #pragma once
 
+#include <stdio.h>
+#include <vector>
 #include "Boosting_locks.hh"
+#include "Boosting_fastset.hh"
 
 // TODO: kind of an awkward name :)
+// Locks taken here are held until the transaction ends. They are recorded
+// in per-thread lists rather than one TransItem each; a single TransItem
+// releases them all in one batch at commit or abort.
+//
+// Besides caller-owned RWLocks and SpinLocks, keys can be locked through a
+// built-in striped lock table (transReadLockKey/transWriteLockKey), whose
+// read locks don't share a written cache line between readers.
 class TransPessimisticLocking : public TObject {
-  typedef uint64_t bit_type;
-  // constexprs are too strange to use :|
-  static inline bit_type spin_lock() { return 1<<0; }
-  static inline bit_type read_lock() { return 1<<1; }
-  static inline bit_type write_lock() { return 1<<2; }
-
 public:
+  typedef StripedRWLockTable<4096, MAX_THREADS> stripe_table;
+
+  struct lock_stats {
+    uint64_t acquired;   // successful acquisitions and upgrades
+    uint64_t waited;     // stripe acquisitions that found the stripe busy
+    uint64_t spins;      // total stripe wait iterations
+    uint64_t failed;     // acquisitions given up on (the transaction aborted)
+    lock_stats() : acquired(0), waited(0), spins(0), failed(0) {}
+  };
+
   // XXX: it might be cleaner if we had 1 method that took a lock and its
   // unlock method. But this specificity allows us to inline the unlock methods.
   // We could potentially also make RWLock and SpinLock shared objects
   void transReadLock(RWLock *lock) {
-    auto item = Sto::item(this, lock);
+    thread_state& ts = start();
     // if we have the lock already (whether as a read lock or write lock), we're done.
-    if (!item.has_write()) {
-      if (!lock->tryReadLock(READ_SPIN)) {
-        Sto::abort();
-        return;
-      }
-      item.add_write(read_lock());
+    if (!ts.rwlocks.exists(lock)) {
+      if (!lock->tryReadLock(READ_SPIN))
+        fail(ts);
+      ts.rwlocks.push(lock);
+      ++ts.stats.acquired;
     }
   }
   void transWriteLock(RWLock *lock) {
-    auto item = Sto::item(this, lock);
-    if (!item.has_write()) {
-      if (!lock->tryWriteLock(WRITE_SPIN)) {
-        Sto::abort();
-        return;
-      }
-      item.add_write(write_lock());
-    } else if (item.template write_value<bit_type>() == read_lock()) {
-      if (!lock->tryUpgrade(WRITE_SPIN)) {
-        Sto::abort();
-        return;
-      }
-      item.add_write(write_lock());
+    thread_state& ts = start();
+    if (!ts.rwlocks.exists(lock)) {
+      if (!lock->tryWriteLock(WRITE_SPIN))
+        fail(ts);
+      ts.rwlocks.push(lock);
+      ++ts.stats.acquired;
+    } else if (!lock->isWriteLocked()) {
+      if (!lock->tryUpgrade(WRITE_SPIN))
+        fail(ts);
+      ++ts.stats.acquired;
     }
   }
   void transSpinLock(SpinLock *lock) {
-    auto item = Sto::item(this, lock);
-    if (!item.has_write()) {
-      if (!lock->tryLock(WRITE_SPIN)) {
-        Sto::abort();
-        return;
-      }
-      item.add_write(spin_lock());
+    thread_state& ts = start();
+    if (!ts.spinlocks.exists(lock)) {
+      if (!lock->tryLock(WRITE_SPIN))
+        fail(ts);
+      ts.spinlocks.push(lock);
+      ++ts.stats.acquired;
     }
   }
 
+  template <typename K, typename Hash = std::hash<K>>
+  void transReadLockKey(const K& key, Hash h = Hash()) {
+    thread_state& ts = start();
+    int tid = TThread::id();
+    unsigned s = stripe_table::stripe(h(key));
+    if (stripes_.readHeld(s, tid) || stripes_.writeHeld(s, tid))
+      return;
+    long spins;
+    bool ok = stripes_.tryReadLock(s, tid, READ_SPIN, spins);
+    account(ts, spins);
+    if (!ok)
+      fail(ts);
+    ts.stripes.push_back(s);
+    ++ts.stats.acquired;
+  }
+  template <typename K, typename Hash = std::hash<K>>
+  void transWriteLockKey(const K& key, Hash h = Hash()) {
+    thread_state& ts = start();
+    int tid = TThread::id();
+    unsigned s = stripe_table::stripe(h(key));
+    if (stripes_.writeHeld(s, tid))
+      return;
+    long spins;
+    bool ok;
+    if (stripes_.readHeld(s, tid))
+      ok = stripes_.tryUpgrade(s, tid, WRITE_SPIN, spins);
+    else {
+      ok = stripes_.tryWriteLock(s, tid, WRITE_SPIN, spins);
+      if (ok)
+        ts.stripes.push_back(s);
+    }
+    account(ts, spins);
+    if (!ok)
+      fail(ts);
+    ++ts.stats.acquired;
+  }
+
+  lock_stats stats() const {
+    lock_stats sum;
+    for (auto& ts : threads_) {
+      sum.acquired += ts.stats.acquired;
+      sum.waited += ts.stats.waited;
+      sum.spins += ts.stats.spins;
+      sum.failed += ts.stats.failed;
+    }
+    return sum;
+  }
+  void clear_stats() {
+    for (auto& ts : threads_)
+      ts.stats = lock_stats();
+  }
+  void print_stats(FILE* f = stderr) const {
+    lock_stats s = stats();
+    fprintf(f, "locks: %llu acquired, %llu waited (%llu spins), %llu failed\n",
+            (unsigned long long) s.acquired, (unsigned long long) s.waited,
+            (unsigned long long) s.spins, (unsigned long long) s.failed);
+  }
+
   bool lock(TransItem&, Transaction&) override { return true; }
-  bool check(const TransItem&, const Transaction&) override { return false; }
-  void install(TransItem&, const Transaction&) override {}
+  bool check(TransItem&, Transaction&) override { return false; }
+  void install(TransItem&, Transaction&) override {}
   void unlock(TransItem&) override {}
-  void cleanup(TransItem& item, bool committed) override {
-    auto type = item.template write_value<bit_type>();
-    if (type == spin_lock()) {
-      item.template key<SpinLock*>()->unlock();
-      return;
+  void cleanup(TransItem&, bool) override {
+    release_all(threads_[TThread::id()], TThread::id());
+  }
+
+private:
+  struct thread_state {
+    FastSet<RWLock*> rwlocks;
+    FastSet<SpinLock*> spinlocks;
+    std::vector<unsigned> stripes;
+    bool registered;
+    lock_stats stats;
+    thread_state() : registered(false) {}
+  } __attribute__((aligned(CACHE_LINE_SIZE)));
+
+  stripe_table stripes_;
+  thread_state threads_[MAX_THREADS];
+
+  // The one item that releases this thread's locks is added by the
+  // first acquisition in a transaction; later ones skip the tset lookup.
+  thread_state& start() {
+    thread_state& ts = threads_[TThread::id()];
+    if (!ts.registered) {
+      Sto::item(this, 0).add_write(0);
+      ts.registered = true;
     }
-    auto *lock = item.template key<RWLock*>();
-    if (type == read_lock()) {
-      lock->readUnlock();
-    } else if (type == write_lock()) {
-      lock->writeUnlock();
+    return ts;
+  }
+
+  void account(thread_state& ts, long spins) {
+    if (spins) {
+      ++ts.stats.waited;
+      ts.stats.spins += spins;
+    }
+  }
+
+  void fail(thread_state& ts) {
+    ++ts.stats.failed;
+    Sto::abort();
+  }
+
+  void release_all(thread_state& ts, int tid) {
+    for (auto *lock : ts.spinlocks)
+      lock->unlock();
+    for (auto *lock : ts.rwlocks) {
+      if (lock->isWriteLocked())
+        lock->writeUnlock();
+      else
+        lock->readUnlock();
     }
+    for (unsigned s : ts.stripes)
+      stripes_.unlock(s, tid);
+    ts.spinlocks.unsafe_clear();
+    ts.rwlocks.unsafe_clear();
+    ts.stripes.clear();
+    ts.registered = false;
   }
 };
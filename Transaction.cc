@@ -21,27 +21,84 @@ void Transaction::initialize() {
     hash_base_ = 32768;
     tset_size_ = 0;
     lrng_state_ = 12897;
+    tset_ = tset_chunks0_;
+    tset_nchunks_ = tset_initial_nchunks;
     for (unsigned i = 0; i != tset_initial_capacity / tset_chunk; ++i)
         tset_[i] = &tset0_[i * tset_chunk];
-    for (unsigned i = tset_initial_capacity / tset_chunk; i != arraysize(tset_); ++i)
+    for (unsigned i = tset_initial_capacity / tset_chunk; i != tset_nchunks_; ++i)
         tset_[i] = nullptr;
+    big_writeset_ = nullptr;
+    big_writeset_size_ = 0;
+#if TRANSACTION_HASHTABLE
+    big_hash_ = nullptr;
+    big_hash_mask_ = 0;
+    big_hash_gen_ = 0;
+#endif
 }
 
 Transaction::~Transaction() {
     if (in_progress())
         silent_abort();
-    TransItem* live = tset0_;
-    for (unsigned i = 0; i != arraysize(tset_); ++i, live += tset_chunk)
-        if (live != tset_[i])
-            delete[] tset_[i];
+    for (unsigned i = tset_initial_capacity / tset_chunk; i != tset_nchunks_; ++i)
+        delete[] tset_[i];
+    if (tset_ != tset_chunks0_)
+        delete[] tset_;
+    delete[] big_writeset_;
+#if TRANSACTION_HASHTABLE
+    delete[] big_hash_;
+#endif
 }
 
+// Chunks stay allocated for later transactions, so a thread stops
+// allocating once it has run its biggest transaction.
 void Transaction::refresh_tset_chunk() {
     assert(tset_size_ % tset_chunk == 0);
-    assert(tset_size_ < tset_max_capacity);
-    if (!tset_[tset_size_ / tset_chunk])
-        tset_[tset_size_ / tset_chunk] = new TransItem[tset_chunk];
-    tset_next_ = tset_[tset_size_ / tset_chunk];
+    unsigned ci = tset_size_ / tset_chunk;
+    // stop() looks at the entry after the last chunk in use, so keep one
+    if (ci + 1 >= tset_nchunks_) {
+        TransItem** chunks = new TransItem*[tset_nchunks_ * 2]();
+        std::copy(tset_, tset_ + tset_nchunks_, chunks);
+        if (tset_ != tset_chunks0_)
+            delete[] tset_;
+        tset_ = chunks;
+        tset_nchunks_ *= 2;
+    }
+    if (!tset_[ci])
+        tset_[ci] = new TransItem[tset_chunk];
+    tset_next_ = tset_[ci];
+}
+
+#if TRANSACTION_HASHTABLE
+// Indexes every item in big_hash_, growing it first if it's over half
+// full. Like the tset, big_hash_ stays allocated for later transactions;
+// bumping big_hash_gen_ empties it.
+void Transaction::rebuild_big_hash() {
+    unsigned capacity = big_hash_ ? big_hash_mask_ + 1 : 0;
+    if (tset_size_ * 2 > capacity) {
+        capacity = std::max(capacity, 4 * tset_hash_limit);
+        while (tset_size_ * 4 > capacity)
+            capacity *= 2;
+        delete[] big_hash_;
+        big_hash_ = new big_hash_slot[capacity]();
+        big_hash_mask_ = capacity - 1;
+        big_hash_gen_ = 0;
+    }
+    if (++big_hash_gen_ == 0) {
+        std::fill(big_hash_, big_hash_ + capacity, big_hash_slot());
+        big_hash_gen_ = 1;
+    }
+    for (unsigned tidx = 0; tidx != tset_size_; ++tidx)
+        big_hash_insert(tidx);
+}
+#endif
+
+unsigned* Transaction::big_writeset(unsigned n) {
+    if (n > big_writeset_size_) {
+        delete[] big_writeset_;
+        big_writeset_size_ = std::max(n, 2 * big_writeset_size_);
+        big_writeset_ = new unsigned[big_writeset_size_];
+    }
+    return big_writeset_;
 }
 
 void* Transaction::epoch_advancer(void*) {
@@ -247,7 +304,10 @@ bool Transaction::try_commit() {
 
     state_ = s_committing;
 
-    unsigned writeset[tset_size_];
+    unsigned writeset_space[tset_size_ <= writeset_stack_max ? tset_size_ : 1];
+    unsigned* writeset = writeset_space;
+    if (tset_size_ > writeset_stack_max)
+        writeset = big_writeset(tset_size_);
     unsigned nwriteset = 0;
     writeset[0] = tset_size_;
 
@@ -505,7 +505,14 @@ public:
 
 private:
     static constexpr unsigned tset_chunk = 512;
-    static constexpr unsigned tset_max_capacity = 32768;
+    // tset_ starts out with room for this many chunks and doubles as needed
+    static constexpr unsigned tset_initial_nchunks = 64;
+    // hashtable_ has hash_size slots, so it misses most items of big
+    // transactions. Once a transaction has more items than this, every
+    // item is indexed in big_hash_ instead, which grows as needed.
+    static constexpr unsigned tset_hash_limit = 4096;
+    // commits with more items than this keep their write set on the heap
+    static constexpr unsigned writeset_stack_max = 8192;
 
     void initialize();
 
@@ -545,15 +552,16 @@ private:
         thr.rcu_set.clean_until(global_epochs.active_epoch);
         if (thr.trans_start_callback)
             thr.trans_start_callback();
-        hash_base_ += tset_size_ + 1;
-        tset_size_ = 0;
-        tset_next_ = tset0_;
+        unsigned next_hash_base = hash_base_ + tset_size_ + 1;
 #if TRANSACTION_HASHTABLE
-        if (hash_base_ >= 32768) {
+        if (next_hash_base >= 32768) {
             memset(hashtable_, 0, sizeof(hashtable_));
-            hash_base_ = 0;
+            next_hash_base = 0;
         }
 #endif
+        hash_base_ = next_hash_base;
+        tset_size_ = 0;
+        tset_next_ = tset0_;
         any_writes_ = any_nonopaque_ = may_duplicate_items_ = false;
         first_write_ = 0;
         start_tid_ = commit_tid_ = 0;
@@ -574,9 +582,35 @@ private:
         //2654435761
         return (n + (n >> 16) * 9) % hash_size;
     }
+    static unsigned big_hash(const TObject* obj, void* key) {
+        uint64_t n = reinterpret_cast<uintptr_t>(key) * 0x9E3779B97F4A7C15ULL;
+        n = (n ^ (reinterpret_cast<uintptr_t>(obj) >> 4)) * 0x9E3779B97F4A7C15ULL;
+        return n >> 32;
+    }
+
+    void rebuild_big_hash();
+    void big_hash_insert(unsigned tidx) {
+        const TransItem& ti = tset_[tidx / tset_chunk][tidx % tset_chunk];
+        unsigned hi = big_hash(ti.owner(), ti.key_);
+        while (big_hash_[hi & big_hash_mask_].gen == big_hash_gen_)
+            ++hi;
+        big_hash_[hi & big_hash_mask_] = big_hash_slot{big_hash_gen_, tidx};
+    }
+    TransItem* big_hash_find(TObject* obj, void* xkey) const {
+        for (unsigned hi = big_hash(obj, xkey); ; ++hi) {
+            const big_hash_slot& slot = big_hash_[hi & big_hash_mask_];
+            if (slot.gen != big_hash_gen_)
+                return nullptr;
+            TransItem* ti = &tset_[slot.tidx / tset_chunk][slot.tidx % tset_chunk];
+            TXP_INCREMENT(txp_total_searched);
+            if (ti->owner() == obj && ti->key_ == xkey)
+                return ti;
+        }
+    }
 #endif
 
     void refresh_tset_chunk();
+    unsigned* big_writeset(unsigned n);
 
     TransItem* allocate_item(const TObject* obj, void* xkey) {
         if (tset_size_ && tset_size_ % tset_chunk == 0)
@@ -584,6 +618,14 @@ private:
         ++tset_size_;
         new(reinterpret_cast<void*>(tset_next_)) TransItem(const_cast<TObject*>(obj), xkey);
 #if TRANSACTION_HASHTABLE
+        if (unlikely(tset_size_ > tset_hash_limit)) {
+            // keep big_hash_ at most half full
+            if (tset_size_ == tset_hash_limit + 1 || tset_size_ * 2 > big_hash_mask_ + 1)
+                rebuild_big_hash();
+            else
+                big_hash_insert(tset_size_ - 1);
+            return tset_next_++;
+        }
         unsigned hi = hash(obj, xkey);
 # if TRANSACTION_HASHTABLE > 1
         if (hashtable_[hi] > hash_base_)
@@ -600,6 +642,11 @@ public:
         return threadid_;
     }
 
+    // true if this transaction has added any writes so far
+    bool any_writes() const {
+        return any_writes_;
+    }
+
     // adds item for a key that is known to be new (must NOT exist in the set)
     template <typename T>
     TransProxy new_item(const TObject* obj, T key) {
@@ -655,6 +702,8 @@ private:
 #endif
 #if TRANSACTION_HASHTABLE
         TXP_INCREMENT(txp_hash_find);
+        if (unlikely(tset_size_ > tset_hash_limit))
+            return big_hash_find(obj, xkey);
         unsigned hi = hash(obj, xkey);
         for (int steps = 0; steps < TRANSACTION_HASHTABLE; ++steps) {
             if (hashtable_[hi] <= hash_base_)
@@ -873,7 +922,6 @@ private:
 
     int threadid_;
     uint16_t hash_base_;
-    uint16_t first_write_;
     uint8_t state_;
     bool any_writes_;
     bool any_nonopaque_;
@@ -881,6 +929,8 @@ private:
     bool is_test_;
     TransItem* tset_next_;
     unsigned tset_size_;
+    unsigned first_write_;
+    unsigned tset_nchunks_;
     mutable tid_type start_tid_;
     mutable tid_type commit_tid_;
     mutable TransactionBuffer buf_;
@@ -893,10 +943,20 @@ private:
 #if STO_TSC_PROFILE
     mutable tc_counter_type start_tsc_;
 #endif
-    TransItem* tset_[tset_max_capacity / tset_chunk];
+    TransItem** tset_;
+    unsigned* big_writeset_;
+    unsigned big_writeset_size_;
 #if TRANSACTION_HASHTABLE
     uint16_t hashtable_[hash_size];
+    struct big_hash_slot {
+        unsigned gen;           // slot is empty unless gen == big_hash_gen_
+        unsigned tidx;
+    };
+    big_hash_slot* big_hash_;
+    unsigned big_hash_mask_;
+    unsigned big_hash_gen_;
 #endif
+    TransItem* tset_chunks0_[tset_initial_nchunks];
     TransItem tset0_[tset_initial_capacity];
 
     void hard_check_opacity(TransItem* item, TransactionTid::type t);
@@ -972,6 +1032,11 @@ public:
         TThread::txn->check_opacity();
     }
 
+    static bool any_writes() {
+        always_assert(in_progress());
+        return TThread::txn->any_writes();
+    }
+
     template <typename T>
     static OptionalTransProxy check_item(const TObject* s, T key) {
         always_assert(in_progress());
@@ -1030,7 +1095,9 @@ public:
         if (base_ && !base_->is_test_) {
             TThread::txn = base_;
             TThread::set_id(base_->threadid_);
-        }
+        } else if (TThread::txn == &t_)
+            // don't leave the thread pointing at a dead transaction
+            TThread::txn = nullptr;
     }
     void use() {
         TThread::txn = &t_;
@@ -0,0 +1,234 @@
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include <random>
+#include <sys/time.h>
+#include "Transaction.hh"
+#include "TArray.hh"
+#include "clp.h"
+#include "randgen.hh"
+
+// Compare TArray element layouts (see TArrayLayout.hh) across element
+// sizes and access patterns:
+//   scan      nontransactional sum over the whole array
+//   tscan     read-only transactions scanning scan_length elements each
+//   rw        transactions reading and writing random elements
+//   neighbour each thread writes only elements i with i % nthreads == me,
+//             so threads write adjacent elements but never conflict
+
+#define ARRAY_SZ (1 << 18)
+
+int nthreads = 4;
+int ntrans = 1000000;
+int opspertrans = 4;
+int scan_length = 64;
+int global_seed = 11;
+std::string only_pattern;
+
+template <unsigned S>
+struct blob {
+    uint64_t x[S / sizeof(uint64_t)];
+    blob() {
+        for (auto& y : x)
+            y = 0;
+    }
+    blob(uint64_t v) {
+        for (auto& y : x)
+            y = v;
+    }
+};
+
+template <unsigned S>
+std::ostream& operator<<(std::ostream& w, const blob<S>& b) {
+    return w << b.x[0];
+}
+
+enum { p_scan, p_tscan, p_rw, p_neighbour };
+static const char* const pattern_names[] = {"scan", "tscan", "rw", "neighbour"};
+
+template <typename A>
+struct Tester {
+    A* a;
+    int pattern;
+    int me;
+};
+
+template <typename A>
+void run(A* a, int pattern, int me) {
+    TThread::set_id(me);
+    Sto::update_threadid();
+    Rand transgen(global_seed + me, global_seed + me * 7);
+    std::uniform_int_distribution<long> slotdist(0, ARRAY_SZ - 1);
+    int N = ntrans / nthreads;
+    uint64_t sum = 0;
+
+    for (int i = 0; i < N; ++i) {
+        Rand transgen_snap = transgen;
+        TRANSACTION {
+            transgen = transgen_snap;
+            if (pattern == p_tscan) {
+                unsigned start = slotdist(transgen) % (ARRAY_SZ - scan_length);
+                for (int j = 0; j < scan_length; ++j)
+                    sum += a->transGet(start + j).x[0];
+            } else {
+                for (int j = 0; j < opspertrans; ++j) {
+                    unsigned slot = slotdist(transgen);
+                    if (pattern == p_neighbour)
+                        slot = slot - slot % nthreads + me;
+                    if (slot >= ARRAY_SZ)
+                        slot = me;
+                    if (pattern == p_rw && j % 2 == 0)
+                        sum += a->transGet(slot).x[0];
+                    else
+                        a->transPut(slot, typename A::value_type(i));
+                }
+            }
+        } RETRY(true);
+    }
+    (void) sum;
+}
+
+template <typename A>
+void* runFunc(void* x) {
+    Tester<A>* t = (Tester<A>*) x;
+    run(t->a, t->pattern, t->me);
+    return nullptr;
+}
+
+double elapsed(struct timeval tv1, struct timeval tv2) {
+    return (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+}
+
+template <typename T, template <typename, typename, unsigned> class L>
+void bench(const char* layout) {
+    typedef TArray<T, ARRAY_SZ, TOpaqueWrapped, L> array_type;
+    // plain new ignores the padded layout's alignment
+    void* p;
+    if (posix_memalign(&p, CACHE_LINE_SIZE, sizeof(array_type)) != 0)
+        abort();
+    array_type* a = new(p) array_type;
+    for (unsigned i = 0; i != ARRAY_SZ; ++i)
+        a->nontrans_put(i, T(i));
+
+    for (int pattern = p_scan; pattern <= p_neighbour; ++pattern) {
+        if (!only_pattern.empty() && only_pattern != pattern_names[pattern])
+            continue;
+        struct timeval tv1, tv2;
+        gettimeofday(&tv1, NULL);
+        if (pattern == p_scan) {
+            uint64_t sum = 0;
+            for (int rep = 0; rep != 100; ++rep) {
+                for (unsigned i = 0; i != ARRAY_SZ; ++i)
+                    sum += a->nontrans_get(i).x[0];
+                fence();
+            }
+            assert(sum != 1);
+        } else {
+            pthread_t tids[nthreads];
+            Tester<array_type> testers[nthreads];
+            for (int i = 0; i < nthreads; ++i) {
+                testers[i] = Tester<array_type>{a, pattern, i};
+                pthread_create(&tids[i], NULL, runFunc<array_type>, &testers[i]);
+            }
+            for (int i = 0; i < nthreads; ++i)
+                pthread_join(tids[i], NULL);
+        }
+        gettimeofday(&tv2, NULL);
+
+        printf("%-12s %4zu %-10s %f", layout, sizeof(T), pattern_names[pattern], elapsed(tv1, tv2));
+#if STO_PROFILE_COUNTERS
+        if (pattern != p_scan) {
+            txp_counters tc = Transaction::txp_counters_combined();
+            printf(" (%llu aborts)", tc.p(txp_total_aborts));
+            Transaction::clear_stats();
+        }
+#endif
+        printf("\n");
+    }
+    a->~array_type();
+    free(a);
+}
+
+template <typename T>
+void bench_size() {
+    bench<T, TInterleavedLayout>("interleaved");
+    bench<T, TSplitLayout>("split");
+    bench<T, TPaddedLayout>("padded");
+}
+
+enum {
+    opt_nthreads, opt_ntrans, opt_opspertrans, opt_scanlength, opt_seed, opt_pattern, opt_elemsize
+};
+
+static const Clp_Option options[] = {
+    { "nthreads", 0, opt_nthreads, Clp_ValInt, Clp_Optional },
+    { "ntrans", 0, opt_ntrans, Clp_ValInt, Clp_Optional },
+    { "opspertrans", 0, opt_opspertrans, Clp_ValInt, Clp_Optional },
+    { "scanlength", 0, opt_scanlength, Clp_ValInt, Clp_Optional },
+    { "seed", 0, opt_seed, Clp_ValInt, Clp_Optional },
+    { "pattern", 0, opt_pattern, Clp_ValString, Clp_Optional },
+    { "elemsize", 0, opt_elemsize, Clp_ValInt, Clp_Optional }
+};
+
+static void help() {
+    printf("Usage: [OPTIONS]\n\
+           Options:\n\
+           --nthreads=NTHREADS (default %d)\n\
+           --ntrans=NTRANS, how many total transactions to run (they'll be split between threads) (default %d)\n\
+           --opspertrans=OPSPERTRANS, operations per rw/neighbour transaction (default %d)\n\
+           --scanlength=SCANLENGTH, elements per tscan transaction (default %d)\n\
+           --seed=SEED, global seed to run the experiment\n\
+           --pattern=scan|tscan|rw|neighbour, run only one access pattern\n\
+           --elemsize=8|32|128, run only one element size in bytes\n",
+           nthreads, ntrans, opspertrans, scan_length);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    int elemsize = 0;
+
+    Clp_Parser *clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+            case opt_nthreads:
+                nthreads = clp->val.i;
+                break;
+            case opt_ntrans:
+                ntrans = clp->val.i;
+                break;
+            case opt_opspertrans:
+                opspertrans = clp->val.i;
+                break;
+            case opt_scanlength:
+                scan_length = clp->val.i;
+                break;
+            case opt_seed:
+                global_seed = clp->val.i;
+                break;
+            case opt_pattern:
+                only_pattern = clp->vstr;
+                break;
+            case opt_elemsize:
+                elemsize = clp->val.i;
+                break;
+            default:
+                help();
+        }
+    }
+    Clp_DeleteParser(clp);
+
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+
+    printf("layout       size pattern    time\n");
+    if (!elemsize || elemsize == 8)
+        bench_size<blob<8>>();
+    if (!elemsize || elemsize == 32)
+        bench_size<blob<32>>();
+    if (!elemsize || elemsize == 128)
+        bench_size<blob<128>>();
+    return 0;
+}
@@ -13,9 +13,14 @@
 #include "TArray.hh"
 #include "TGeneric.hh"
 #include "Hashtable.hh"
+#include "TBoosting.hh"
+#include "RBTree.hh"
+#include "SkipList.hh"
 #include "Queue.hh"
 #include "Vector.hh"
 #include "TVector.hh"
+#include "TCounter.hh"
+#include "TSplitCounter.hh"
 #include "Transaction.hh"
 #include "IntStr.hh"
 #include "clp.h"
@@ -41,6 +46,9 @@
 #define USE_MASSTREE_STR 8
 #define USE_HASHTABLE_STR 9
 #define USE_ARRAY_NONOPAQUE 10
+#define USE_RBTREE 11
+#define USE_SKIPLIST 12
+#define USE_BOOSTED_HASHTABLE 13
 
 // set this to USE_DATASTRUCTUREYOUWANT
 #define DATA_STRUCTURE USE_HASHTABLE
@@ -57,6 +65,10 @@
 // use unboxed strings in Masstree (only used if STRING_VALUES is set)
 #define UNBOXED_STRINGS 0
 
+// use pool-allocated compact_versioned_value boxes in Masstree (only used if
+// STRING_VALUES is not set)
+#define COMPACT_VALUES 0
+
 // if 1 we just print the runtime, no diagnostic information or strings
 // (makes it easier to collect data using a script)
 #define DATA_COLLECT 0
@@ -273,6 +285,8 @@ private:
 template <> struct Container<USE_MASSTREE> {
 #if STRING_VALUES && UNBOXED_STRINGS
     typedef MassTrans<value_type, versioned_str_struct> type;
+#elif !STRING_VALUES && COMPACT_VALUES
+    typedef MassTrans<value_type, compact_versioned_value<value_type>> type;
 #else
     typedef MassTrans<value_type> type;
 #endif
@@ -428,8 +442,116 @@ private:
     type v_;
 };
 
+template <> struct Container<USE_RBTREE> {
+    typedef RBTree<int, value_type, false> type;
+    typedef int index_type;
+    static constexpr bool has_delete = true;
+    value_type nontrans_get(index_type key) {
+        return v_.nontrans_find(key);
+    }
+    value_type transGet(index_type key) {
+        // operator[] would insert a missing key
+        if (!v_.count(key))
+            return value_type();
+        return v_[key];
+    }
+    void transPut(index_type key, value_type value) {
+        v_[key] = value;
+    }
+    bool transDelete(index_type key) {
+        return v_.erase(key);
+    }
+    bool transInsert(index_type key, value_type value) {
+        if (v_.count(key))
+            return false;
+        v_[key] = value;
+        return true;
+    }
+    bool transUpdate(index_type key, value_type value) {
+        if (!v_.count(key))
+            return false;
+        v_[key] = value;
+        return true;
+    }
+    static void init() {
+    }
+    static void thread_init(Container<USE_RBTREE>&) {
+    }
+private:
+    type v_;
+};
+
+// Hashtable boosted with abstract key locks (see TBoosting.hh), to compare
+// with its own OCC interface above.
+template <> struct Container<USE_BOOSTED_HASHTABLE> {
+    static constexpr unsigned nbuckets = static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR);
+    typedef TBoostedMap<int, value_type, Hashtable<int, value_type, true, nbuckets, value_type>> type;
+    typedef int index_type;
+    static constexpr bool has_delete = true;
+    value_type nontrans_get(index_type key) {
+        value_type v = value_type();
+        v_.nontrans_find(key, v);
+        return v;
+    }
+    value_type transGet(index_type key) {
+        value_type v = value_type();
+        v_.transGet(key, v);
+        return v;
+    }
+    void transPut(index_type key, value_type value) {
+        v_.transPut(key, value);
+    }
+    bool transDelete(index_type key) {
+        return v_.transDelete(key);
+    }
+    bool transInsert(index_type key, value_type value) {
+        return v_.transInsert(key, value);
+    }
+    bool transUpdate(index_type key, value_type value) {
+        return v_.transUpdate(key, value);
+    }
+    static void init() {
+    }
+    static void thread_init(Container<USE_BOOSTED_HASHTABLE>&) {
+    }
+private:
+    type v_{nbuckets};
+};
+
+template <> struct Container<USE_SKIPLIST> {
+    typedef SkipList<int, value_type> type;
+    typedef int index_type;
+    static constexpr bool has_delete = true;
+    value_type nontrans_get(index_type key) {
+        return v_.nontrans_get(key);
+    }
+    value_type transGet(index_type key) {
+        value_type v = value_type();
+        v_.transGet(key, v);
+        return v;
+    }
+    void transPut(index_type key, value_type value) {
+        v_.transPut(key, value);
+    }
+    bool transDelete(index_type key) {
+        return v_.transDelete(key);
+    }
+    bool transInsert(index_type key, value_type value) {
+        return v_.transInsert(key, value);
+    }
+    bool transUpdate(index_type key, value_type value) {
+        return v_.transUpdate(key, value);
+    }
+    static void init() {
+    }
+    static void thread_init(Container<USE_SKIPLIST>&) {
+    }
+private:
+    type v_;
+};
+
 #if DATA_STRUCTURE == USE_QUEUE
-typedef Queue<value_type, ARRAY_SZ> QueueType;
+typedef Queue<value_type> QueueType;
 QueueType* q;
 QueueType* q2;
 #endif
@@ -590,7 +712,7 @@ template <int DS> void DSTester<DS>::initialize() {
 }
 
 // New test: Random R/W with zipf distribution to simulate skewed contention
-enum class OpType : int {read, write, inc};
+enum class OpType : int {read, write, inc, count_read, count_inc};
 
 struct RWOperation {
     RWOperation() : type(OpType::read), key(), value() {}
@@ -606,6 +728,10 @@ inline std::ostream& operator<<(std::ostream& os, const RWOperation& op) {
     os << "[";
     if (op.type == OpType::read) {
         os << "r,k=" << op.key;
+    } else if (op.type == OpType::count_read) {
+        os << "cr";
+    } else if (op.type == OpType::count_inc) {
+        os << "c++";
     } else {
         assert(op.type == OpType::write);
         os << "w,k=" << op.key << ",v=" << op.value;
@@ -911,6 +1037,105 @@ void SingleRW<DS>::per_thread_workload_init(int thread_id) {
         dump_thread_trace(thread_id, thread_workload);
 }
 
+// Test: HotCounterRW. Like SingleRW, but every transaction also increments
+// one global counter, as a sequence or statistics counter would; a
+// readonly_percent fraction of transactions read the counter instead.
+// Split uses TSplitCounter rather than TCounter, so comparing the two
+// shows what serializing on the counter's version costs.
+template <int DS, bool Split>
+struct HotCounterRW : public HotspotRW<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    typedef std::vector<RWOperation> query_type;
+    typedef typename std::conditional<Split, TSplitCounter<int64_t>,
+                                      TCounter<int64_t> >::type counter_type;
+    HotCounterRW() {
+        // TSplitCounter is cache-line aligned, which plain new does not guarantee
+        void* mem;
+        if (posix_memalign(&mem, CACHE_LINE_SIZE, sizeof(counter_type)) != 0)
+            abort();
+        counter = new (mem) counter_type;
+    }
+    ~HotCounterRW() {
+        counter->~counter_type();
+        free(counter);
+    }
+    void per_thread_workload_init(int thread_id) override;
+    void run(int me) override;
+    bool check() override;
+
+    counter_type* counter;
+};
+
+template <int DS, bool Split>
+void HotCounterRW<DS, Split>::per_thread_workload_init(int thread_id) {
+    StoSampling::StoUniformDistribution ud(thread_id, 0, std::numeric_limits<uint32_t>::max());
+
+    auto& thread_workload = this->workloads[thread_id];
+
+    int trans_per_thread = ntrans / nthreads;
+    uint32_t ro_threshold = (uint32_t)(std::numeric_limits<uint32_t>::max() * readonly_percent);
+
+    for (int i = 0; i < trans_per_thread; ++i) {
+        query_type query;
+        if (ud.sample() < ro_threshold) {
+            query.emplace_back(OpType::count_read, 0);
+            query.emplace_back(OpType::read, ud.sample() % ARRAY_SZ);
+        } else {
+            query.emplace_back(OpType::count_inc, 0);
+            query.emplace_back(OpType::inc, ud.sample() % ARRAY_SZ);
+        }
+        thread_workload.push_back(query);
+    }
+
+    if (dump_trace)
+        dump_thread_trace(thread_id, thread_workload);
+}
+
+template <int DS, bool Split>
+void HotCounterRW<DS, Split>::run(int me) {
+    TThread::set_id(me);
+    container_type* a = this->a;
+    container_type::thread_init(*a);
+
+    for (auto& query : this->workloads[me]) {
+        TRANSACTION {
+            for (auto& req : query) {
+                switch (req.type) {
+                case OpType::read:
+                    doRead(*a, req.key);
+                    break;
+                case OpType::inc: {
+                    value_type r = doRead(*a, req.key);
+                    ++r;
+                    doWrite(*a, req.key, r);}
+                    break;
+                case OpType::count_read: {
+                    int64_t c = *counter;
+                    (void) c;}
+                    break;
+                case OpType::count_inc:
+                    ++*counter;
+                    break;
+                default:
+                    std::cerr << "unkown OpType: " << (int)req.type << std::endl;
+                    abort();
+                    break;
+                }
+            }
+        } RETRY(true);
+    }
+}
+
+template <int DS, bool Split>
+bool HotCounterRW<DS, Split>::check() {
+    int64_t n = 0;
+    for (auto& tw : this->workloads)
+        for (auto& query : tw)
+            n += query[0].type == OpType::count_inc;
+    assert(counter->nontrans_read() == n);
+    return true;
+}
+
 // Test: ZipfRW
 template <int DS>
 struct ZipfRW : public HotspotRW<DS> {
@@ -1507,7 +1732,10 @@ void print_time(double time) {
     {name, desc, 7, new type<7, ## __VA_ARGS__>},     \
     {name, desc, 8, new type<8, ## __VA_ARGS__>},     \
     {name, desc, 9, new type<9, ## __VA_ARGS__>},     \
-    {name, desc, 10, new type<10, ## __VA_ARGS__>}
+    {name, desc, 10, new type<10, ## __VA_ARGS__>},    \
+    {name, desc, 11, new type<11, ## __VA_ARGS__>},    \
+    {name, desc, 12, new type<12, ## __VA_ARGS__>},    \
+    {name, desc, 13, new type<13, ## __VA_ARGS__>}
 
 struct Test {
     const char* name;
@@ -1526,6 +1754,8 @@ struct Test {
     MAKE_TESTER("hotspot", "contending hotspot", HotspotRW),
     MAKE_TESTER("hotspot2", "contending hotspot (less stupid)", Hotspot2RW),
     MAKE_TESTER("singlerw", "increment a single random element", SingleRW),
+    MAKE_TESTER("hotcounter", "singlerw plus a global TCounter increment", HotCounterRW, false),
+    MAKE_TESTER("hotcounter-split", "singlerw plus a global TSplitCounter increment", HotCounterRW, true),
     MAKE_TESTER("zipfrw", "Zipf random rw", ZipfRW)
 };
 
@@ -1544,7 +1774,10 @@ struct {
     {"tgeneric", USE_TGENERICARRAY},
     {"queue", USE_QUEUE},
     {"vector", USE_VECTOR},
-    {"tvector", USE_TVECTOR}
+    {"tvector", USE_TVECTOR},
+    {"rbtree", USE_RBTREE},
+    {"skiplist", USE_SKIPLIST},
+    {"boosted-hash", USE_BOOSTED_HASHTABLE}
 };
 
 enum {
@@ -8,11 +8,15 @@
 #include "Transaction.hh"
 #include "clp.h"
 #include "Queue.hh"
+#include "TQueue.hh"
 #include "randgen.hh"
 
 // size of queue
 #define QUEUE_SZ 4096
 
+// use TQueue, whose producers do not conflict, instead of Queue
+#define SCALABLE_QUEUE 1
+
 // only used for randomRWs test
 #define GLOBAL_SEED 0
 #define TRY_READ_MY_WRITES 0
@@ -38,7 +42,11 @@ typedef std::string value_type;
 typedef int value_type;
 #endif
 
+#if SCALABLE_QUEUE
+typedef TQueue<value_type> QueueType;
+#else
 typedef Queue<value_type> QueueType;
+#endif
 QueueType* q;
 QueueType* q2;
 
@@ -50,6 +58,7 @@ int opspertrans = 10;
 int prepopulate = QUEUE_SZ/8;
 double write_percent = 0.5;
 bool blindRandomWrite = false;
+volatile bool populated = false;
 
 using namespace std;
 
@@ -71,33 +80,34 @@ inline int unval(const value_type& v) {
 #endif
 }
 
-static void doRead(Transaction& t) {
+static void doRead() {
   if (readMyWrites) {
     value_type v;
-    q->transFront(t, v);
-    q->transPop(t);
+    q->transFront(v);
+    q->transPop();
   }
 }
 
-static void doWrite(Transaction& t, int& ctr) {
-    q->transPush(t, val(ctr));
+static void doWrite(int& ctr) {
+    q->transPush(val(ctr));
     ++ctr; // because we've done a read and a write
 }
   
-static inline void nreads(int n, Transaction& t) {
+static inline void nreads(int n) {
   for (int i = 0; i < n; ++i) {
-    doRead(t);
+    doRead();
   }
 }
-static inline void nwrites(int n, Transaction& t) {
+static inline void nwrites(int n) {
   for (int i = 0; i < n; ++i) {
-    doWrite(t, i);
+    doWrite(i);
   }
 }
 
 void *randomRWs(void *p) {
   int me = (intptr_t)p;
-  TThread::id = me;
+  TThread::set_id(me);
+  Sto::update_threadid();
   
   // randomness to determine write or read (push or pop)
   uint32_t write_thresh = (uint32_t) (write_percent * Rand::max());
@@ -116,17 +126,17 @@ void *randomRWs(void *p) {
       auto seedhigh = seed >> 16;
       Rand transgen(seed, seedlow << 16 | seedhigh);
 
-      Transaction t;
+      Sto::start_transaction();
       for (int j = 0; j < OPS; ++j) {
         // can call transgen to generate numbers 0-randmax
         auto r = transgen();
         if (r > write_thresh) {
-          doRead(t);
+          doRead();
         } else {
-          doWrite(t, j);
+          doWrite(j);
         }
       }
-      if (t.commit())
+      if (Sto::try_commit())
         break;
       } catch (Transaction::Abort E) {}
       if (!done) {
@@ -143,9 +153,9 @@ void checkRandomRWs() {
     q = &check;
 
     for (int i = 0; i < prepopulate; ++i) {
-        Transaction t;
-        q->transPush(t, val(0));
-        t.commit();
+        Sto::start_transaction();
+        q->transPush(val(0));
+        Sto::try_commit();
     }
     
     for (int i = 0; i < nthreads; ++i) {
@@ -153,45 +163,50 @@ void checkRandomRWs() {
     }
 
     q = old;
-    while (!q->empty()) {
-        if (unval(q->pop()) != unval(check.pop()))
-            fprintf(stderr, "parallel %d, sequential %d\n", unval(q->pop()), unval(check.pop()));
+    while (!q->nontrans_empty()) {
+        if (unval(q->nontrans_pop()) != unval(check.nontrans_pop()))
+            fprintf(stderr, "parallel %d, sequential %d\n", unval(q->nontrans_pop()), unval(check.nontrans_pop()));
     }
-    assert(check.empty() == q->empty());
+    assert(check.nontrans_empty() == q->nontrans_empty());
 }
 
 
 void *xorDelete(void *p) {
   int me = (intptr_t)p;
-  TThread::id = me;
+  TThread::set_id(me);
+  Sto::update_threadid();
 
   int N = ntrans/nthreads;
   int OPS = opspertrans;
 
   if (me == 0) {
     // populate
-    Transaction t;
+    Sto::start_transaction();
     for (int i = 0; i < prepopulate; ++i) {
-      q->transPush(t, val(i));
+      q->transPush(val(i));
     }
-    assert(t.commit());
+    bool ok = Sto::try_commit();
+    assert(ok);
+    (void) ok;
+    populated = true;
   } else {
-        // wait for populated
-        while (q->empty()) {}
+        // wait for populated (the queue may already have been drained)
+        while (!populated)
+          relax_fence();
   }
 
   for (int i = 0; i < N; ++i) {
     while (1) {
       try {
-        Transaction t;
+        Sto::start_transaction();
         for (int j = 0; j < OPS; ++j) {
           value_type v = val(1);
-          if (!q->transPop(t)) {
+          if (!q->transPop()) {
             // we pop if the q is nonempty, push if it's empty
-            q->transPush(t, v);
+            q->transPush(v);
           }
         }
-        if (t.commit())
+        if (Sto::try_commit())
             break;
       } catch (Transaction::Abort E) {}
     }
@@ -209,46 +224,51 @@ void checkXorDelete() {
   }
   q = old;
   
-  while (!q->empty()) {
-    if (unval(q->pop()) != unval(check.pop()))
-        fprintf(stderr, "parallel %d, sequential %d\n", unval(q->pop()), unval(check.pop()));
+  while (!q->nontrans_empty()) {
+    if (unval(q->nontrans_pop()) != unval(check.nontrans_pop()))
+        fprintf(stderr, "parallel %d, sequential %d\n", unval(q->nontrans_pop()), unval(check.nontrans_pop()));
   }
-  assert(check.empty() == q->empty());
+  assert(check.nontrans_empty() == q->nontrans_empty());
 }
 
 
 void *queueTransfer(void *p) {
   int me = (intptr_t)p;
-  TThread::id = me;
+  TThread::set_id(me);
+  Sto::update_threadid();
 
   int N = ntrans/nthreads;
   int OPS = opspertrans;
 
   if (me == 0) {
     // populate
-    Transaction t;
+    Sto::start_transaction();
     for (int i = 0; i < prepopulate; ++i) {
-      q->transPush(t, val(i));
+      q->transPush(val(i));
     }
-    assert(t.commit());
+    bool ok = Sto::try_commit();
+    assert(ok);
+    (void) ok;
+    populated = true;
   } else {
-        // wait for populated
-        while (q->empty()) {}
+        // wait for populated (the queue may already have been drained)
+        while (!populated)
+          relax_fence();
   }
 
   for (int i = 0; i < N; ++i) {
     while (1) {
       try {
-        Transaction t;
+        Sto::start_transaction();
         for (int j = 0; j < OPS; ++j) {
           value_type v;
           // if q is nonempty, pop from q, push onto q2
-          if (q->transFront(t, v)) {
-            q->transPop(t);
-            q2->transPush(t, v);
+          if (q->transFront(v)) {
+            q->transPop();
+            q2->transPush(v);
           }
         }
-        if (t.commit())
+        if (Sto::try_commit())
             break;
       } catch (Transaction::Abort E) {}
     }
@@ -259,7 +279,7 @@ void *queueTransfer(void *p) {
 void checkQueueTransfer() {
   // prepopulate
   for (int i = 0; i < prepopulate; ++i) {
-      q->push(val(i));
+      q->nontrans_push(val(i));
   }
   
   for (int i = 0; i < nthreads; ++i) {
@@ -268,14 +288,48 @@ void checkQueueTransfer() {
   
   // prepopulate
   for (int i = 0; i < prepopulate; ++i) {
-      q->push(val(i));
+      q->nontrans_push(val(i));
   }
   
-  while (!q->empty()) {
-    if (unval(q->pop()) != unval(q2->pop()))
-        fprintf(stderr, "parallel %d, sequential %d\n", unval(q->pop()), unval(q2->pop()));
+  while (!q->nontrans_empty()) {
+    if (unval(q->nontrans_pop()) != unval(q2->nontrans_pop()))
+        fprintf(stderr, "parallel %d, sequential %d\n", unval(q->nontrans_pop()), unval(q2->nontrans_pop()));
   }
-  assert(q->empty() == q2->empty());
+  assert(q->nontrans_empty() == q2->nontrans_empty());
+}
+
+// producers only: every transaction pushes OPS elements, so Queue
+// serializes on its tail while TQueue's pushes never conflict
+void *pushOnly(void *p) {
+  int me = (intptr_t)p;
+  TThread::set_id(me);
+  Sto::update_threadid();
+
+  int N = ntrans/nthreads;
+  int OPS = opspertrans;
+  for (int i = 0; i < N; ++i) {
+    while (1) {
+      try {
+        Sto::start_transaction();
+        for (int j = 0; j < OPS; ++j)
+          q->transPush(val(me));
+        if (Sto::try_commit())
+          break;
+      } catch (Transaction::Abort E) {}
+    }
+  }
+  return NULL;
+}
+
+void checkPushOnly() {
+  // the queue holds exactly the elements that were pushed
+  int n = 0;
+  while (!q->nontrans_empty()) {
+    q->nontrans_pop();
+    ++n;
+  }
+  if (n != (ntrans/nthreads) * nthreads * opspertrans)
+    fprintf(stderr, "pushed %d, expected %d\n", n, (ntrans/nthreads) * nthreads * opspertrans);
 }
 
 void startAndWait(int n, void *(*start_routine) (void *)) {
@@ -304,7 +358,8 @@ struct Test {
 Test tests[] = {
   {randomRWs, checkRandomRWs},
   {xorDelete, checkXorDelete},
-  {queueTransfer, checkQueueTransfer}
+  {queueTransfer, checkQueueTransfer},
+  {pushOnly, checkPushOnly}
 };
 
 enum {
@@ -387,6 +442,9 @@ int main(int argc, char *argv[]) {
     exit(1);
   }
 
+  q = new QueueType;
+  q2 = new QueueType;
+
   struct timeval tv1,tv2;
   struct rusage ru1,ru2;
   gettimeofday(&tv1, NULL);
@@ -410,12 +468,7 @@ int main(int argc, char *argv[]) {
 #endif
 
 #if STO_PROFILE_COUNTERS
-#define LLU(x) ((long long unsigned)x)
-  printf("total_n: %llu, total_r: %llu, total_w: %llu, total_searched: %llu, total_aborts: %llu (%llu aborts at commit time)\n", LLU(Transaction::total_n), LLU(Transaction::total_r), LLU(Transaction::total_w), LLU(Transaction::total_searched), LLU(Transaction::total_aborts), LLU(Transaction::commit_time_aborts));
-#if MASSTREE
-  printf("node aborts: %llu\n", LLU(node_aborts));
-#endif
-#undef LLU
+  Transaction::print_stats();
 #endif
 
   if (runCheck)
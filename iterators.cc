@@ -6,6 +6,7 @@
 #include <map>
 #include "Transaction.hh"
 #include "Vector.hh"
+#include "RBTree.hh"
 #include "clp.h"
 #include "randgen.hh"
 
@@ -19,11 +20,14 @@ int max_key = 1000;
 double search_percent = 0.3;
 double update_percent = 0.3;
 bool use_iterators = false;
+bool use_rbtree = false;
+int scan_length = 10;
 
 
 TransactionTid::type lock;
 
 typedef Vector<int> data_structure;
+typedef RBTree<int, int, false> tree_type;
 
 template <typename T>
 struct TesterPair {
@@ -51,6 +55,39 @@ int findK(T* q, int val) {
     }
 }
 
+template <typename T>
+void search(T* q, Rand& transgen, std::uniform_int_distribution<long>& slotdist) {
+    findK(q, slotdist(transgen));
+}
+
+template <typename T>
+void update(T* q, int key, int val) {
+    q->transUpdate(key, val);
+}
+
+template <typename T>
+void get(T* q, int key) {
+    q->transGet(key);
+}
+
+// RBTree mode: searches are range scans of up to scan_length elements
+// starting at a random key
+void search(tree_type* t, Rand& transgen, std::uniform_int_distribution<long>& slotdist) {
+    int sum = 0, n = 0;
+    for (auto it = t->lower_bound(slotdist(transgen) % max_key);
+         it != t->end() && n < scan_length; ++it, ++n)
+        sum += it->second;
+    (void) sum;
+}
+
+void update(tree_type* t, int key, int val) {
+    (*t)[key] = val;
+}
+
+void get(tree_type* t, int key) {
+    t->count(key);
+}
+
 template <typename T>
 void run(T* q, int me) {
     TThread::set_id(me);
@@ -73,15 +110,14 @@ void run(T* q, int me) {
             for (int j = 0; j < OPS; ++j) {
                 int op = slotdist(transgen) % 100;
                 if (op < search_percent * 100) {
-                    int val = slotdist(transgen);
-                    findK(q, val);
+                    search(q, transgen, slotdist);
                 } else if (op < (search_percent + update_percent) *100){
                     int key = slotdist(transgen) % max_key;
                     int val = slotdist(transgen) % max_value;
-                    q->transUpdate(key, val);
+                    update(q, key, val);
                 } else {
                     int key = slotdist(transgen) % max_key;
-                    q->transGet(key);
+                    get(q, key);
                 }
 
             }
@@ -125,7 +161,7 @@ void print_time(struct timeval tv1, struct timeval tv2) {
 }
 
 enum {
-    opt_nthreads, opt_ntrans, opt_opspertrans, opt_searchpercent, opt_updatepercent, opt_prepopulate, opt_seed, opt_useiterators
+    opt_nthreads, opt_ntrans, opt_opspertrans, opt_searchpercent, opt_updatepercent, opt_prepopulate, opt_seed, opt_useiterators, opt_rbtree, opt_scanlength
 };
 
 static const Clp_Option options[] = {
@@ -136,7 +172,9 @@ static const Clp_Option options[] = {
     { "updatepercent", 0, opt_updatepercent, Clp_ValDouble, Clp_Optional },
     { "prepopulate", 0, opt_prepopulate, Clp_ValInt, Clp_Optional },
     { "seed", 0, opt_seed, Clp_ValInt, Clp_Optional },
-    { "useiterators", 0, opt_useiterators, Clp_ValInt, Clp_Optional}
+    { "useiterators", 0, opt_useiterators, Clp_ValInt, Clp_Optional},
+    { "rbtree", 0, opt_rbtree, Clp_ValInt, Clp_Optional },
+    { "scanlength", 0, opt_scanlength, Clp_ValInt, Clp_Optional }
 };
 
 static void help() {
@@ -148,8 +186,10 @@ static void help() {
            --searchpercent=SEARCHPERCENT, probability with which to do searches (default %f)\n\
            --updatepercent=UPDATEPERCENT, probability with which to do updates (default %f)\n\
            --prepopulate=PREPOPULATE, prepopulate table with given number of items (default %d)\n\
-           --seed=SEED, global seed to run the experiment \n",
-            nthreads, ntrans, opspertrans, search_percent, update_percent, prepopulate);
+           --seed=SEED, global seed to run the experiment \n\
+           --rbtree=1, run range scans over an RBTree instead of searching a Vector\n\
+           --scanlength=SCANLENGTH, elements per RBTree range scan (default %d)\n",
+            nthreads, ntrans, opspertrans, search_percent, update_percent, prepopulate, scan_length);
     exit(1);
 }
 
@@ -167,6 +207,14 @@ void init(T* q) {
     }
 }
 
+void init(tree_type* t) {
+    for (int i = 0; i < prepopulate; i++) {
+        TRANSACTION {
+            (*t)[i * max_key / prepopulate] = i;
+        } RETRY(false);
+    }
+}
+
 int main(int argc, char *argv[]) {
     lock = 0;
     struct timeval tv1,tv2;
@@ -200,13 +248,38 @@ int main(int argc, char *argv[]) {
             case opt_useiterators:
                 use_iterators = clp->val.i == 1;
                 break;
+            case opt_rbtree:
+                use_rbtree = clp->val.i == 1;
+                break;
+            case opt_scanlength:
+                scan_length = clp->val.i;
+                break;
             default:
                 help();
         }
     }
     Clp_DeleteParser(clp);
 
-    if (!use_iterators) {
+    if (use_rbtree) {
+    tree_type t;
+    init(&t);
+    gettimeofday(&tv1, NULL);
+
+    startAndWait(nthreads, &t);
+
+    gettimeofday(&tv2, NULL);
+    printf("RBTree range scan time: ");
+    print_time(tv1, tv2);
+
+#if STO_PROFILE_COUNTERS
+    Transaction::print_stats();
+    {
+        txp_counters tc = Transaction::txp_counters_combined();
+        printf("total_n: %llu, total_r: %llu, total_w: %llu, total_searched: %llu, total_aborts: %llu (%llu aborts at commit time)\n", tc.p(txp_total_n), tc.p(txp_total_r), tc.p(txp_total_w), tc.p(txp_total_searched), tc.p(txp_total_aborts), tc.p(txp_commit_time_aborts));
+    }
+    Transaction::clear_stats();
+#endif
+    } else if (!use_iterators) {
     // Run a parallel test with lots of transactions doing pushes and pops
     data_structure q;
     init(&q);
@@ -31,14 +31,38 @@ public:
 	tatas_lock_t lock;
 	unsigned key_;
 	void *data;
+	//bumped, under the lock, by every change, so optimistic readers can validate.
+	unsigned long version_;
+	//set by a backbone rebuild: a frozen treelet no longer changes (it is
+	//being copied), a retired one has been replaced and is empty.
+	volatile bool frozen_, retired_;
 	NoLockHelper left, right;
 	void acquire(){
 		SYNC(tatas_acquire(&lock);)
 	}
+	bool try_acquire(){
+		return lock==UNLOCKED && !tas(&lock);
+	}
 	void release(){
 		SYNC(tatas_release(&lock);)
 	}
 	bool search(unsigned key){
+		bool res=search_locked(key);
+		release();
+		return res;
+	}
+	bool insert(unsigned key){
+		bool res=insert_locked(key);
+		release();
+		return res;
+	}
+	bool remove(unsigned key){
+		bool res=remove_locked(key);
+		release();
+		return res;
+	}
+	//the *_locked variants leave the lock held.
+	bool search_locked(unsigned key){
 		bool res=false;
 		if(key==key_)
 			res=true;
@@ -46,10 +70,9 @@ public:
 			res=left.search(key);
 		else
 			res=right.search(key);
-		release();
 		return res;
 	}
-	bool insert(unsigned key){
+	bool insert_locked(unsigned key){
 		bool res = true;
 		if(key_==INVALID_KEY_SMALL)
 			key_=key;
@@ -61,10 +84,10 @@ public:
 		else{
 			res=right.insert(key);
 		}
-		release();
+		if(res) ++version_;
 		return res;
 	}
-	bool remove(unsigned key){
+	bool remove_locked(unsigned key){
 		bool res = true;
 		if(key<key_)
 			res=left.remove(key);
@@ -87,7 +110,7 @@ public:
 				}
 			}
 		}
-		release();
+		if(res) ++version_;
 		return res;
 	}
 	int addItems(std::vector<unsigned> &v){
@@ -102,8 +125,21 @@ public:
 		right.destroy(right.head);
 		left.head=NULL;
 		right.head=NULL;
+		++version_;
 		//we do NOT free ourselves (delete this) because that would create a race on the lock.
 	}
+	void freeze(){
+		acquire();
+		frozen_=true;
+		release();
+	}
+	//the caller frees the treelet once no thread can still be looking at it.
+	void retire(){
+		acquire();
+		retired_=true;
+		destroy();
+		release();
+	}
 	bool isEmpty(){
 		return key_==INVALID_KEY_SMALL;
 	}
@@ -111,11 +147,11 @@ public:
 		if(key_==INVALID_KEY_SMALL) return 0;
 		return left.size(left.head)+1+right.size(right.head);
 	}
-	GlobalLockTree():lock(UNLOCKED),key_(INVALID_KEY_SMALL), data(NULL), left(0), right(0){}
+	GlobalLockTree():lock(UNLOCKED),key_(INVALID_KEY_SMALL), data(NULL), version_(0), frozen_(false), retired_(false), left(0), right(0){}
 	//assume that [begin,end) is already sorted.
 	GlobalLockTree(std::vector<unsigned>::iterator begin, std::vector<unsigned>::iterator end):lock(UNLOCKED)
 		,key_( ((end-begin)==0)?INVALID_KEY_SMALL:*((begin+(end-begin)/2))),
-		data(NULL), left(begin, begin+(end-begin)/2), right(begin+(end-begin)/2+1, end){}
+		data(NULL), version_(0), frozen_(false), retired_(false), left(begin, begin+(end-begin)/2), right(begin+(end-begin)/2+1, end){}
 	void print(){
 		printf("[");
 		left.print(left.head);
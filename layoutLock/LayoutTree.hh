@@ -27,10 +27,16 @@
 #include <map>
 #include <stdio.h>
 #include "llock.hh"
-#ifndef RWLOCK
-typedef LayoutLock_DefaultImpl_<ScalableRWLock<64>> Layout_Lock;
-#else
+#include "Transaction.hh"
+//Every treelet access takes the base lock's read side (startWrite) and every
+//backbone rebuild its write side (drainReaders), so the choice below is on
+//each operation's path. -DNUMA_RWLOCK selects NumaRWLock.
+#if defined(RWLOCK)
 typedef LayoutRWLOCK Layout_Lock;
+#elif defined(NUMA_RWLOCK)
+typedef LayoutLock_DefaultImpl_<NumaRWLock<64>> Layout_Lock;
+#else
+typedef LayoutLock_DefaultImpl_<ScalableRWLock<64>> Layout_Lock;
 #endif
 using namespace std;
 enum NODE_TYPES {NORMAL_NODE=0XDE, DATA_NODE_T=1};
@@ -39,6 +45,7 @@ __thread bool tidSet_;
 __thread pid_t tid_;
 __thread int stateOff_;
 __thread int dirtyOff_;
+__thread int numaNode_;
 pid_t nextThread;
 GlobalLockTree NULL_TREE;
 int Rand();
@@ -53,10 +60,12 @@ class LayoutTree{
 public:
 	struct cacheKeys{
 		union{
-			unsigned type;
-			unsigned dummyKeys[];//keys starts at 1.
+			struct{
+				unsigned type;
+				unsigned keys[15];
+			};
+			unsigned dummyKeys[16];//keys starts at 1.
 		};
-		unsigned keys[15];
 	} __attribute__ ((aligned (64)));
 	struct node{
 		cacheKeys keys;
@@ -71,8 +80,10 @@ public:
 			this->key=key; this->data=data; this->type=DATA_NODE_T;
 		}
 	};
-	node *head;
+	node * volatile head;
 	SYNC(Layout_Lock llock_;)
+	//nonzero while a thread rebuilds the backbone; rebuilds never overlap.
+	volatile int rebuilding_=0;
 	int fuzzySize=0;
 	int enlargeWhen=16, shrinkWhen=-1, backboneSize=0;
 	int heuristic[PADDING(int)*64]={0};
@@ -162,8 +173,14 @@ public:
 		return (GlobalLockTree*) cur;
 	}
 
-	GlobalLockTree *getTreelet(unsigned key, dptrtype *dirtyP){
-		SYNC(start: llock_.startRead();)
+	//Returns the treelet for key, locked. A rebuild does not stop readers:
+	//a frozen treelet can still be searched, and a retired one sends us
+	//back to the (new) head. Writers wait until a frozen treelet is retired.
+	//Callers hold llock_ for data access (startWrite) until they release the
+	//treelet; a rebuild drains them before freeing old nodes and treelets.
+	GlobalLockTree *getTreelet(unsigned key, dptrtype *dirtyP, bool forWrite=true){
+		(void)dirtyP;
+	start:
 		node *cur = head;
 		while(cur->keys.type==NORMAL_NODE){
 			unsigned idx = asmsearch(key, (unsigned *)cur);
@@ -172,12 +189,16 @@ public:
 		}
 		GlobalLockTree *res = (GlobalLockTree*)cur;
 		res->acquire();
-#ifndef NOSYNC
-		if(llock_.finishRead(dirtyP)==false){
+		if(res->retired_){
 			res->release();
 			goto start;
 		}
-#endif
+		if(forWrite && res->frozen_){
+			res->release();
+			while(!res->retired_)
+				relax_fence();
+			goto start;
+		}
 		return res;
 	}
 	void free_treelet(GlobalLockTree *t){
@@ -187,9 +208,10 @@ public:
 	}
 	void NOINLINE enlarge_tree(unsigned sz){
 		auto start = std::chrono::system_clock::now();
-		SYNC(llock_.startLayoutChange();)
+		if(!__sync_bool_compare_and_swap(&rebuilding_, 0, 1))
+			return; //someone else is rebuilding already
 		if(sz<enlargeWhen){
-			SYNC(llock_.finishLayoutChange();) 
+			rebuilding_=0;
 			return;
 		}
 		//if(backboneSize==0) backboneSize=1;
@@ -208,16 +230,22 @@ public:
 			printf("ConsolidateAll(#%d) by thread %d. "
 					"EnlargeWhen=%d, shrinkWhen=%d, backboneSize=%d. Time=%f\n", ctr, tid_,
 					enlargeWhen, shrinkWhen, backboneSize, ctime.count());*/
-		SYNC(llock_.finishLayoutChange();)
+		release_fence();
+		rebuilding_=0;
 	}
 	bool NOINLINE search(unsigned key, dptrtype *dirtyP){
-		return getTreelet(key, dirtyP)->search(key);
+		SYNC(llock_.startWrite();)
+		bool res = getTreelet(key, dirtyP, false)->search(key);
+		SYNC(llock_.finishWrite();)
+		return res;
 	}
 	bool insert(unsigned key, dptrtype *dirtyP){
       CHCK(int n = __atomic_fetch_add(&next, 1, __ATOMIC_SEQ_CST);\
       buffer[n] = key;)
 		bool res;
+		SYNC(llock_.startWrite();)
 		res = getTreelet(key, dirtyP)->insert(key);
+		SYNC(llock_.finishWrite();)
 		if(unlikely((heuristic[stateOff_]+=res)>=200))
 		{
 			int res = __sync_add_and_fetch(&fuzzySize, heuristic[stateOff_]);
@@ -230,17 +258,15 @@ public:
 		return res;
 	}
 	void NOINLINE shrink_tree(unsigned sz){
-		SYNC(llock_.startLayoutChange();)
-		if(sz>shrinkWhen){
-			SYNC(llock_.finishLayoutChange();)
+		if(sz>shrinkWhen)
 			return;
-		}
 		enlarge_tree(sz/16);
-		SYNC(llock_.finishLayoutChange();)
 	}
 	bool remove(unsigned key, dptrtype *dirtyP){
 		bool res;//, shrink=false;
+		SYNC(llock_.startWrite();)
 		res = getTreelet(key, dirtyP)->remove(key);
+		SYNC(llock_.finishWrite();)
 		if(unlikely((heuristic[stateOff_]-=res)<-200))
       {
          int res = __sync_add_and_fetch(&fuzzySize, heuristic[stateOff_]);
@@ -269,6 +295,16 @@ public:
 			}
 		}
 	}
+	//Rebuilds the backbone without blocking readers:
+	//1. freeze every treelet (writers wait, readers go on) and gather its
+	//   keys; once all are frozen the keys are a consistent snapshot.
+	//2. build a new, one level deeper backbone off to the side.
+	//3. publish it with a single store to head.
+	//4. retire the old treelets, which sends anyone still holding one back
+	//   to the new head.
+	//5. wait for threads still inside llock_ to leave (drainReaders), then
+	//   free the old backbone. Old treelets also wait for an RCU epoch:
+	//   transactions (TLayoutBT) keep pointers to them until they commit.
 	void consolidateAllOptimal(){
 		node *root = head;
 		if(!isNormalNode(root)){
@@ -277,51 +313,74 @@ public:
 		}
 		std::vector<unsigned> v(0);
 		v.reserve(backboneSize+200*64); //64 threads * 200 is the maximum inpercision of the counter. 
-		int total_len = gatherAll(root, v);
-		buildFromV(root, v, 0, total_len);
+		std::vector<GlobalLockTree*> old;
+		gatherAll(root, v, old);
+		node *newroot = buildFromV(root, v, 0, v.size());
+		release_fence();
+		head = newroot;
+		for(GlobalLockTree *t: old)
+			t->retire();
+		drainReaders();
+		for(GlobalLockTree *t: old)
+			Transaction::rcu_delete(t);
+		freeBackbone(root);
+	}
+	//Waits until no thread can still be using nodes or treelets it found
+	//through the old head. Readers are not stopped for the rebuild itself,
+	//only for as long as the layout change takes to acquire.
+	void drainReaders(){
+		SYNC(llock_.startLayoutChange();)
+		SYNC(llock_.finishLayoutChange();)
 	}
-	//Task: gather all nodes from all treelets into v. Destroy all treelets.
-	//TODO: disconnect treelets.
+	//Task: freeze all treelets under root, in key order, and gather their keys into v.
 	//assume: v is large enough.
-	int gatherAll(node *root, std::vector<unsigned> &v){
+	int gatherAll(node *root, std::vector<unsigned> &v, std::vector<GlobalLockTree*> &treelets){
 		assert(root->keys.type==NORMAL_NODE);
 		int sum=0;
 		if(root->next[0]->keys.type!=NORMAL_NODE){
 			for(int c=0; c<16; ++c){
 				GlobalLockTree *ch = (GlobalLockTree*)root->next[c];
-				ch->acquire();
+				ch->freeze();
 				sum += ch->addItems(v);
-				root->next[c]=(node*)&NULL_TREE;
-				free_treelet(ch);
+				treelets.push_back(ch);
 			}
 			return sum;
 		}
 		else{
 			for(int c=0; c<16; ++c)
-				sum+=gatherAll(root->next[c], v);
+				sum+=gatherAll(root->next[c], v, treelets);
 			return sum;
 		}
 	}
-	void buildFromV(node *root, std::vector<unsigned> &v, int first, int len){
+	//Returns a new backbone shaped like root plus one level, holding v[first, first+len).
+	node *buildFromV(node *root, std::vector<unsigned> &v, int first, int len){
 		assert(root->keys.type==NORMAL_NODE); //HANLDE either in consolidateRoot or catch if child is like this.
-		constructBigNode(root, v, first, len);
+		node *n = new node();
 		if(root->next[0]->keys.type!=NORMAL_NODE){
-			expandLeafBigNode(root, v, first, len);
+			expandLeafBigNode(n, v, first, len);
 			//leaf node. Need to allocate a lot of big nodes and a lot of treelets.
 			//use a version of consolidate.
 		}
 		else{
+			constructBigNode(n, v, first, len);
 			for(int c=0; c<16; ++c){
 				int firstc=first+(c*len)/16, lastc=first+((c+1)*len/16), lenc=lastc-firstc;
 				if(c==15) assert(firstc+lenc==first+len);
-				buildFromV(root->next[c], v, firstc, lenc);
+				n->next[c]=buildFromV(root->next[c], v, firstc, lenc);
 			}
 		}
+		return n;
+	}
+	//Frees the backbone nodes under root (not the treelets). Readers must have been drained.
+	void freeBackbone(node *root){
+		if(root->next[0]->keys.type==NORMAL_NODE)
+			for(int c=0; c<16; ++c)
+				freeBackbone(root->next[c]);
+		delete root;
 	}
 	void expandLeafBigNode(node *cur, std::vector<unsigned> &v, int first, int len){
 		constructBigNode(cur, v, first, len);
 		assert(cur->keys.type==NORMAL_NODE);
-		assert(cur->next[0]->keys.type!=NORMAL_NODE);//and all other children..
 		for(int c=0; c<16; ++c){
 			node *curc = new node();
 			int firstc=first+(c*len)/16, lastc=first+((c+1)*len/16), lenc=lastc-firstc;
@@ -377,7 +436,7 @@ public:
 	}
 	void consolidateRoot(GlobalLockTree *root){
 		std::vector<unsigned> v(0);
-		root->acquire();
+		root->freeze();
 		int elems=root->size();
 		v.reserve(elems);
 		root->addItems(v);
@@ -395,8 +454,11 @@ public:
 			std::vector<unsigned>::iterator enit=v.begin()+end;
 			newroot->next[c]=(node*)new GlobalLockTree(stit, enit);
 		}
+		release_fence();
 		this->head=newroot;
-		free_treelet(root);
+		root->retire();
+		drainReaders();
+		Transaction::rcu_delete(root);
 	}
 	void consolidateAll(node *root){
 		static int ctr=0;
@@ -159,6 +159,88 @@ public:
 	}
 };
 
+extern __thread int numaNode_;
+
+// Reader indicators are per NUMA node rather than per thread (as in
+// ScalableRWLock) or global (as in ScalarRPRWLockImpl_): readers on a node
+// share one padded counter, so they never touch another node's lines, and
+// a writer checks one counter per node instead of CASing every thread's
+// slot. Nodes with no readers cost the writer a single load.
+template <int maxNumberOfThreads, int maxNodes = 8>
+class NumaRWLock {
+	struct node_state {
+		volatile int readers;
+	} __attribute__((aligned(CACHE_LINE_SIZE)));
+	node_state nodes_[maxNodes];
+	volatile int writer_ __attribute__((aligned(CACHE_LINE_SIZE)));
+protected:
+	enum {
+		maxNumberOfThreads_ = maxNumberOfThreads
+	};
+public:
+	static const bool ACTIVE=true;
+	NumaRWLock() : writer_(0) {
+		for (int i=0; i < maxNodes; i++) {
+			nodes_[i].readers = 0;
+		}
+	}
+
+	bool isActive() { return true; }
+
+	static void setup() {
+		if (!tidSet_) {
+			int tid = __atomic_fetch_add(&nextThread, 1, __ATOMIC_SEQ_CST);
+			tid_=tid;
+			stateOff_ = tid * PADDING(int);
+			unsigned cpu, node;
+			if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+				node = 0;
+			numaNode_ = node % maxNodes;
+			tidSet_ = true;
+		}
+	}
+
+	static void reset() {
+		nextThread=0;
+	}
+
+	void read_lock() {
+		volatile int* readers = &nodes_[numaNode_].readers;
+		while (1) {
+			while (writer_) ;
+			__atomic_fetch_add(readers, 1, __ATOMIC_SEQ_CST);
+			if (likely(!writer_))
+				return;
+			// a writer got in first: back off so it can drain our node
+			__atomic_fetch_sub(readers, 1, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	void read_unlock() {
+		__atomic_fetch_sub(&nodes_[numaNode_].readers, 1, __ATOMIC_RELEASE);
+	}
+
+	void write_lock() {
+		while (!__sync_bool_compare_and_swap(&writer_, 0, 1)) ;
+		__sync_synchronize();
+		for (int i=0; i < maxNodes; i++) {
+			while (nodes_[i].readers) ;
+		}
+	}
+
+	void write_unlock() {
+		__atomic_store_n(&writer_, 0, __ATOMIC_RELEASE);
+	}
+
+	int getMaxNumberOfThreads() const {
+		return maxNumberOfThreads_;
+	}
+
+	inline bool isWriterActive() {
+		return writer_ != 0;
+	}
+};
+
 template <typename BaseRWLock>
 class LayoutLock_DefaultImpl_ : BaseRWLock {
 	volatile int dirty_[BaseRWLock::maxNumberOfThreads_ * PADDING(int)];
@@ -2,8 +2,10 @@
 #include <iostream>
 #include <assert.h>
 #include <vector>
+#include <sys/time.h>
 #include "Transaction.hh"
 #include "List1.hh"
+#include "randgen.hh"
 
 void testSimpleInt() {
     List1<int> f;
@@ -162,8 +164,170 @@ void testConflictingModifyIter3() {
     printf("PASS: array conflicting replace test3\n");
 }
 
+void testListIndex() {
+    // a small stride so the index gets rebuilt as the list grows
+    List<int> l(DefaultCompare<int>(), 4);
+    for (int i = 0; i < 2000; i += 2)
+        l.insert(i);
+
+    for (int i = 1; i < 2000; i += 4) {
+        TRANSACTION {
+            assert(l.transInsert(i));
+        } RETRY(false);
+    }
+    for (int i = 0; i < 2000; i += 8) {
+        TRANSACTION {
+            assert(l.transDelete(i));
+        } RETRY(false);
+    }
+
+    TRANSACTION {
+        for (int i = 0; i < 2000; ++i) {
+            bool present = (i % 2 == 0 && i % 8 != 0) || i % 4 == 1;
+            assert(!!l.transFind(i) == present);
+        }
+        assert(l.size() == 1000 - 250 + 500);
+        int n = 0, last = -1;
+        auto it = l.transIter();
+        while (it.transHasNext()) {
+            int v = *it.transNext();
+            assert(v > last);
+            last = v;
+            ++n;
+        }
+        assert(n == 1250);
+    } RETRY(false);
+
+    printf("PASS: list index test\n");
+}
+
+void testListGapConflict() {
+    List<int> l;
+    l.insert(1);
+    l.insert(9);
+
+    {
+        // a miss conflicts with a committed insert into the same gap...
+        TestTransaction t1(1);
+        assert(!l.transFind(5));
+        TestTransaction t2(2);
+        assert(l.transInsert(6));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    {
+        // ...but not with inserts into other gaps
+        TestTransaction t1(1);
+        assert(!l.transFind(5));
+        TestTransaction t2(2);
+        assert(l.transInsert(10));
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+
+    {
+        // our own insert-then-delete leaves our view of the gap intact
+        TestTransaction t1(1);
+        assert(!l.transFind(5));
+        assert(l.transInsert(5));
+        assert(l.transDelete(5));
+        assert(!l.transFind(5));
+        assert(t1.try_commit());
+    }
+
+    {
+        // inserting into a gap we saw empty still conflicts with inserts
+        // that land behind our node
+        TestTransaction t1(1);
+        assert(!l.transFind(8));
+        assert(l.transInsert(7));
+        TestTransaction t2(2);
+        assert(l.transInsert(8));
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    printf("PASS: list gap conflict test\n");
+}
+
+// Scaling benchmark for List: threads run transactions of list_ops random
+// finds, inserts, and deletes over list_keys keys (about half present),
+// with and without the index.
+static const int list_keys = 4096;
+static const int list_ops = 4;
+static const int list_ntrans = 40000;
+
+template <typename L>
+struct ListBench {
+    L* l;
+    int me;
+    int ntrans;
+};
+
+template <typename L>
+void* listBenchThread(void* x) {
+    ListBench<L>* b = (ListBench<L>*) x;
+    TThread::set_id(b->me);
+    Sto::update_threadid();
+    Rand r(b->me + 1);
+    for (int i = 0; i < b->ntrans; ++i) {
+        Rand r_snap = r;
+        TRANSACTION {
+            r = r_snap;
+            for (int j = 0; j < list_ops; ++j) {
+                int k = r() % list_keys;
+                int op = r() % 4;
+                if (op == 0)
+                    b->l->transInsert(k);
+                else if (op == 1)
+                    b->l->transDelete(k);
+                else
+                    b->l->transFind(k);
+            }
+        } RETRY(true);
+    }
+    return nullptr;
+}
+
+void listScalingBench() {
+    typedef List<int> list_type;
+    printf("list scaling (%d keys, %d ops/txn, %d txns)\n", list_keys, list_ops, list_ntrans);
+    for (unsigned stride : {0, 16}) {
+        for (int nthreads = 1; nthreads <= 8; nthreads *= 2) {
+            list_type l(DefaultCompare<int>(), stride);
+            for (int k = 0; k < list_keys; k += 2)
+                l.insert(k);
+            pthread_t tids[nthreads];
+            ListBench<list_type> bs[nthreads];
+            struct timeval tv1, tv2;
+            gettimeofday(&tv1, NULL);
+            for (int i = 0; i < nthreads; ++i) {
+                bs[i] = ListBench<list_type>{&l, i, list_ntrans / nthreads};
+                pthread_create(&tids[i], NULL, listBenchThread<list_type>, &bs[i]);
+            }
+            for (int i = 0; i < nthreads; ++i)
+                pthread_join(tids[i], NULL);
+            gettimeofday(&tv2, NULL);
+            double t = (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+            printf("  %-8s %d threads: %f s, %.0f txns/s",
+                   stride ? "indexed" : "plain", nthreads, t, list_ntrans / t);
+#if STO_PROFILE_COUNTERS
+            txp_counters tc = Transaction::txp_counters_combined();
+            printf(" (%llu aborts)", tc.p(txp_total_aborts));
+            Transaction::clear_stats();
+#endif
+            printf("\n");
+        }
+    }
+}
+
 
 int main() {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+
 	testSimpleInt();
 	testSimpleString();
     testIter();
@@ -172,5 +336,8 @@ int main() {
     testConflictingModifyIter1();
     testConflictingModifyIter2();
     testConflictingModifyIter3();
+    testListIndex();
+    testListGapConflict();
+    listScalingBench();
 	return 0;
 }
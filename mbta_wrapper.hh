@@ -1,98 +1,47 @@
 #pragma once
 
+// abstract_db backend for the Silo/DBx1000 benchmark harness. Include this
+// after Silo's abstract_db.h/abstract_ordered_index.h. In this tree only
+// mbtabench uses it; `make check-mbta-wrapper SILO=path/to/silo` checks that
+// it still compiles against a Silo tree.
+
+#include <set>
 #include "Transaction.hh"
 #include "MassTrans.hh"
+#include "Hashtable.hh"
 
-#define STD_OP(f) auto& t = *unpack<Transaction*>(txn); \
+#define STD_OP(f) \
   try { \
     f; \
   } catch (Transaction::Abort E) { \
     throw abstract_db::abstract_abort_exception(); \
   }
 
+// ordered index over MassTrans; supports scans
+class mbta_ordered_index : public abstract_ordered_index {
+public:
+  typedef MassTrans<std::string> mbta_type;
+  typedef mbta_type::Str Str;
 
-class mbta_wrapper : public abstract_db {
-  ssize_t txn_max_batch_size() const OVERRIDE { return 100; }
-  
-  void
-  do_txn_epoch_sync() const
-  {
-    //txn_epoch_sync<Transaction>::sync();
-  }
-
-  void
-  do_txn_finish() const
-  {
-    //txn_epoch_sync<Transaction>::finish();
-  }
-
-  void
-  thread_init(bool loader)
-  {
+  mbta_ordered_index(const std::string &name) : mbta(), name(name) {}
 
+  void thread_init() {
+    mbta_type::thread_init();
   }
 
-  void
-  thread_end()
-  {
-
+  bool get(void *txn, const std::string &key, std::string &value, size_t max_bytes_read) {
+    (void)txn, (void)max_bytes_read;
+    STD_OP(return mbta.transGet(key, value));
   }
 
-  size_t
-  ndb_wrapper<Transaction>::sizeof_txn_object(uint64_t txn_flags) const
+  // batched point lookups; @found has room for keys.size() flags, and
+  // values[i] is only meaningful if found[i]
+  size_t multi_get(void *txn, const std::vector<std::string> &keys,
+                   std::vector<std::string> &values, bool *found)
   {
-    return sizeof(Transaction);
-  }
-
-  void *new_txn(
-                uint64_t txn_flags,
-                str_arena &arena,
-                void *buf,
-                TxnProfileHint hint = HINT_DEFAULT) {
-    Transaction *txn = new (buf) Transaction;
-    return txn;
-  }
-
-  bool commit_txn(void *txn) {
-    STD_OP(return t.commit());
-    return false;
-  }
-
-  void abort_txn(void *txn) {
-    STD_OP(t.abort());
-  }
-
-  abstract_ordered_index *
-  open_index(const std::string &name,
-             size_t value_size_hint,
-             bool mostly_append = false) {
-    auto ret = new mbta_ordered_index(name);
-    ret->thread_init();
-    return ret;
-  }
-
- void
- close_index(abstract_ordered_index *idx) {
-   delete idx;
- }
-
-};
-
-class mbta_ordered_index : public abstract_ordered_index {
-public:
-  mbta_ordered_index(const std::string &name) : mbta(), name(name) {}
-
-  bool get(void *txn, const std::string &key, std::string &value, size_t max_bytes_read) {
-    (void)max_bytes_read;
-#if 0
-    auto& t = *unpack<Transaction*>(txn);
-    try {
-      return mbta.transGet(t, key, value);
-    } catch (Transaction::Abort E) {
-      throw abstract_db::abstract_abort_exception();
-    }
-#endif
-    STD_OP(return mbta.transGet(t, key, value));
+    (void)txn;
+    values.resize(keys.size());
+    STD_OP(return mbta.transMultiGet(keys.data(), keys.size(), values.data(), found));
   }
 
   const char *put(
@@ -100,34 +49,40 @@ public:
       const std::string &key,
       const std::string &value)
   {
+    (void)txn;
     // TODO: there's an overload of put that takes non-const std::string and silo seems to use move for those.
     // may be worth investigating if we can use that optimization to avoid copying keys
     STD_OP({
-        mbta.transPut(t, key, value);
+        mbta.transPut(key, value);
         return 0;
           });
   }
-  
+
   const char *insert(
                                          void *txn,
                                          const std::string &key,
                                          const std::string &value)
   {
-    STD_OP(mbta.transInsert(t, key, value); return 0;)
+    (void)txn;
+    STD_OP(mbta.transInsert(key, value); return 0;)
   }
 
   void remove(void *txn, const std::string &key) {
-    STD_OP(mbta.remove(t, key));
+    (void)txn;
+    STD_OP(mbta.transDelete(key));
   }
 
+  // Values are handed to the callback in place (see MassTrans::transScan),
+  // so the arena is not needed.
   void scan(
             void *txn,
             const std::string &start_key,
             const std::string *end_key,
             scan_callback &callback,
             str_arena *arena = nullptr) {
-    Str end = end_key ? *end_key : Str();
-    STD_OP(mbta.transQuery(t, start_key, end, [&] (Str key, mbta_type::value_type& value) {
+    (void)txn, (void)arena;
+    Str end = end_key ? Str(*end_key) : Str();
+    STD_OP(mbta.transScan(start_key, end, [&] (Str key, const std::string& value) {
           return callback.invoke(key.data(), key.length(), value);
         }));
   }
@@ -138,13 +93,11 @@ public:
              const std::string *end_key,
              scan_callback &callback,
              str_arena *arena = nullptr) {
-#if 0
-    Str end = end_key ? *end_key : Str();
-    STD_OP(mbta.transRQuery(t, start_key, end, [&] (Str key, mbta_type::value_type& value) {
+    (void)txn, (void)arena;
+    Str end = end_key ? Str(*end_key) : Str();
+    STD_OP(mbta.transRScan(start_key, end, [&] (Str key, const std::string& value) {
           return callback.invoke(key.data(), key.length(), value);
         }));
-#endif
-    throw "rscan unimplemented";
   }
 
   size_t size() const
@@ -159,9 +112,173 @@ public:
   }
 
 private:
-  typedef MassTrans<std::string> mbta_type;
   mbta_type mbta;
 
   const std::string name;
 
 };
+
+// point-access index over Hashtable; scans are not supported
+class mbta_hash_index : public abstract_ordered_index {
+public:
+  typedef Hashtable<std::string, std::string> ht_type;
+
+  mbta_hash_index(const std::string &name, size_t nbuckets) : ht(nbuckets), name(name) {}
+
+  bool get(void *txn, const std::string &key, std::string &value, size_t max_bytes_read) {
+    (void)txn, (void)max_bytes_read;
+    STD_OP(return ht.transGet(key, value));
+  }
+
+  const char *put(void *txn, const std::string &key, const std::string &value) {
+    (void)txn;
+    STD_OP(ht.transPut(key, value); return 0;)
+  }
+
+  const char *insert(void *txn, const std::string &key, const std::string &value) {
+    (void)txn;
+    STD_OP(ht.transInsert(key, value); return 0;)
+  }
+
+  void remove(void *txn, const std::string &key) {
+    (void)txn;
+    STD_OP(ht.transDelete(key));
+  }
+
+  void scan(void *, const std::string &, const std::string *,
+            scan_callback &, str_arena * = nullptr) {
+    throw "scan unsupported on hash index " + name;
+  }
+
+  void rscan(void *, const std::string &, const std::string *,
+             scan_callback &, str_arena * = nullptr) {
+    throw "rscan unsupported on hash index " + name;
+  }
+
+  size_t size() const {
+    return ht.approx_size();
+  }
+
+  // not safe against concurrent transactions on this index
+  std::map<std::string, uint64_t>
+  clear() {
+    ht.nontrans_clear();
+    return std::map<std::string, uint64_t>();
+  }
+
+private:
+  ht_type ht;
+
+  const std::string name;
+};
+
+
+class mbta_wrapper : public abstract_db {
+public:
+  // Indexes named in `hash_indexes` are backed by a Hashtable with
+  // `hash_buckets` buckets (the workload must never scan them); all others
+  // are MassTrans trees. Loaders batch `max_batch_size` inserts per
+  // transaction.
+  mbta_wrapper(std::set<std::string> hash_indexes = std::set<std::string>(),
+               size_t hash_buckets = 1 << 20,
+               ssize_t max_batch_size = 1000)
+    : hash_indexes_(std::move(hash_indexes)), hash_buckets_(hash_buckets),
+      max_batch_size_(max_batch_size) {
+    mbta_ordered_index::mbta_type::static_init();
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+  }
+
+  // STO puts no limit on transaction size; larger batches only trade fewer
+  // loader commits against more work lost to an abort.
+  ssize_t txn_max_batch_size() const OVERRIDE { return max_batch_size_; }
+
+  // STO does not log, so there is nothing to wait for to make committed
+  // transactions durable.
+  void
+  do_txn_epoch_sync() const
+  {
+  }
+
+  void
+  do_txn_finish() const
+  {
+    Transaction::global_epochs.run = false;
+  }
+
+  // Each worker (and loader) thread gets its own STO thread id, which selects
+  // its Transaction, RCU set and Masstree threadinfo arena.
+  void
+  thread_init(bool loader)
+  {
+    (void)loader;
+    int id = fetch_and_add(&next_thread_id_, 1);
+    always_assert(id < MAX_THREADS);
+    TThread::set_id(id);
+    Sto::update_threadid();
+    mbta_ordered_index::mbta_type::thread_init();
+  }
+
+  void
+  thread_end()
+  {
+    Sto::silent_abort();
+    Transaction::rcu_quiesce();
+  }
+
+  size_t
+  sizeof_txn_object(uint64_t txn_flags) const
+  {
+    (void)txn_flags;
+    return sizeof(Transaction*);
+  }
+
+  // STO keeps one Transaction per thread, so the caller's buffer only holds
+  // a pointer to it.
+  void *new_txn(
+                uint64_t txn_flags,
+                str_arena &arena,
+                void *buf,
+                TxnProfileHint hint = HINT_DEFAULT) {
+    (void)txn_flags, (void)arena, (void)hint;
+    Sto::start_transaction();
+    *reinterpret_cast<Transaction**>(buf) = Sto::transaction();
+    return buf;
+  }
+
+  bool commit_txn(void *txn) {
+    (void)txn;
+    if (!Sto::try_commit())
+      throw abstract_db::abstract_abort_exception();
+    return true;
+  }
+
+  void abort_txn(void *txn) {
+    (void)txn;
+    Sto::silent_abort();
+  }
+
+  abstract_ordered_index *
+  open_index(const std::string &name,
+             size_t value_size_hint,
+             bool mostly_append = false) {
+    (void)value_size_hint, (void)mostly_append;
+    if (hash_indexes_.count(name))
+      return new mbta_hash_index(name, hash_buckets_);
+    auto ret = new mbta_ordered_index(name);
+    ret->thread_init();
+    return ret;
+  }
+
+ void
+ close_index(abstract_ordered_index *idx) {
+   delete idx;
+ }
+
+private:
+  std::set<std::string> hash_indexes_;
+  size_t hash_buckets_;
+  ssize_t max_batch_size_;
+  int next_thread_id_ = 0;
+};
@@ -0,0 +1,168 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <stdio.h>
+#include <sys/time.h>
+#include "abstract_db.h"
+#include "abstract_ordered_index.h"
+#include "mbta_wrapper.hh"
+#include "clp.h"
+
+// Point lookups through the abstract_db interface that the Silo/DBx1000
+// harness uses: every transaction reads `gets` random keys from one
+// MassTrans-backed index, either with one mbta_ordered_index::multi_get
+// call or with `gets` get calls. Build with `make mbtabench SILO=path`.
+
+int nkeys = 1000000;
+int ntrans = 1000000;
+int gets = 12;
+int nthreads = 1;
+
+mbta_wrapper* db;
+mbta_ordered_index* idx;
+
+static std::string key_of(unsigned k) {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%010u", k);
+    return std::string(buf, 10);
+}
+
+// Runs @f in a transaction until it commits.
+template <typename F>
+void run_txn(F f) {
+    str_arena arena;
+    std::unique_ptr<char[]> buf(new char[db->sizeof_txn_object(0)]);
+    while (1) {
+        void* txn = db->new_txn(0, arena, buf.get());
+        try {
+            f(txn);
+            db->commit_txn(txn);
+            return;
+        } catch (abstract_db::abstract_abort_exception&) {
+            db->abort_txn(txn);
+        }
+    }
+}
+
+void load() {
+    db->thread_init(true);
+    std::string value(100, 'a');
+    int batch = db->txn_max_batch_size();
+    for (int k = 0; k < nkeys; k += batch)
+        run_txn([&] (void* txn) {
+                for (int i = k; i < std::min(k + batch, nkeys); ++i)
+                    idx->insert(txn, key_of(i), value);
+            });
+    db->thread_end();
+}
+
+struct Runner {
+    int me;
+    bool multi;
+    long nfound;
+};
+
+void* runFunc(void* x) {
+    Runner* r = (Runner*) x;
+    db->thread_init(false);
+    idx->thread_init();
+    unsigned seed = r->me + 1;
+    std::vector<std::string> keys(gets), values(gets);
+    std::unique_ptr<bool[]> found(new bool[gets]);
+    for (int i = 0; i < ntrans / nthreads; ++i) {
+        for (auto& k : keys)
+            k = key_of(rand_r(&seed) % nkeys);
+        run_txn([&] (void* txn) {
+                if (r->multi)
+                    r->nfound += idx->multi_get(txn, keys, values, found.get());
+                else
+                    for (int g = 0; g < gets; ++g)
+                        r->nfound += idx->get(txn, keys[g], values[g], std::string::npos);
+            });
+    }
+    db->thread_end();
+    return nullptr;
+}
+
+double bench(bool multi) {
+    std::vector<pthread_t> tids(nthreads);
+    std::vector<Runner> runners(nthreads);
+    struct timeval tv1, tv2;
+    gettimeofday(&tv1, NULL);
+    for (int i = 0; i < nthreads; ++i) {
+        runners[i] = Runner{i, multi, 0};
+        pthread_create(&tids[i], NULL, runFunc, &runners[i]);
+    }
+    long nfound = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+        nfound += runners[i].nfound;
+    }
+    gettimeofday(&tv2, NULL);
+    always_assert(nfound == (long) (ntrans / nthreads) * nthreads * gets);
+    return (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+}
+
+enum {
+    opt_nkeys, opt_ntrans, opt_gets, opt_nthreads
+};
+
+static const Clp_Option options[] = {
+    { "nkeys", 0, opt_nkeys, Clp_ValInt, Clp_Optional },
+    { "ntrans", 0, opt_ntrans, Clp_ValInt, Clp_Optional },
+    { "gets", 0, opt_gets, Clp_ValInt, Clp_Optional },
+    { "nthreads", 0, opt_nthreads, Clp_ValInt, Clp_Optional }
+};
+
+static void help() {
+    printf("Usage: [OPTIONS]\n\
+           Options:\n\
+           --nkeys=NKEYS, keys loaded into the index (default %d)\n\
+           --ntrans=NTRANS, transactions per run, split between threads (default %d)\n\
+           --gets=N, keys read per transaction (default %d)\n\
+           --nthreads=NTHREADS (default %d)\n",
+           nkeys, ntrans, gets, nthreads);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Clp_Parser *clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+            case opt_nkeys:
+                nkeys = clp->val.i;
+                break;
+            case opt_ntrans:
+                ntrans = clp->val.i;
+                break;
+            case opt_gets:
+                gets = clp->val.i;
+                break;
+            case opt_nthreads:
+                nthreads = clp->val.i;
+                break;
+            default:
+                help();
+        }
+    }
+    Clp_DeleteParser(clp);
+    // each run's threads take fresh STO thread ids, after the loader's
+    if (nkeys <= 0 || gets <= 0 || nthreads <= 0 || 2 * nthreads >= MAX_THREADS)
+        help();
+
+    db = new mbta_wrapper;
+    idx = static_cast<mbta_ordered_index*>(db->open_index("bench", 100));
+    load();
+    always_assert(idx->size() == (size_t) nkeys);
+
+    printf("mode      thr time     ns/get\n");
+    for (bool multi : {false, true}) {
+        double t = bench(multi);
+        printf("%-9s %3d %f %8.1f\n", multi ? "multi_get" : "get",
+               nthreads, t, t * 1e9 / ((double) ntrans * gets));
+    }
+    db->do_txn_finish();
+    return 0;
+}
@@ -0,0 +1,907 @@
+// Standalone TPC-C and YCSB drivers over MassTrans (and Hashtable for YCSB).
+// Reports throughput plus commits, aborts and p50/p99 latency for each
+// transaction type.
+//
+//   ./oltp tpcc --nthreads=8 --warehouses=8 --ntrans=100000
+//   ./oltp ycsb --ycsb=a --skew=0.99 --records=1000000 [--hash]
+//
+// The TPC-C implementation follows Silo's: Payment and OrderStatus select
+// 60% of their customers by last name through a customer-name index, and
+// the 1% of NewOrders with an invalid item check their items before
+// writing anything, so they commit read-only instead of rolling back
+// (Silo aborts them instead).
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <memory>
+#include <functional>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "Transaction.hh"
+#include "MassTrans.hh"
+#include "Hashtable.hh"
+#include "sampling.hh"
+#include "clp.h"
+
+volatile mrcu_epoch_type active_epoch = 1;
+
+typedef MassTrans<std::string> table_type;
+typedef table_type::Str Str;
+typedef Hashtable<std::string, std::string> hash_table_type;
+
+int nthreads = 4;
+int ntrans = 100000;            // per thread
+unsigned seed = 0;
+
+// keys are big-endian so that Masstree order is numeric order
+class key_builder {
+public:
+    key_builder& u32(uint32_t x) {
+        x = htonl(x);
+        s_.append(reinterpret_cast<const char*>(&x), sizeof(x));
+        return *this;
+    }
+    // fixed-width, so that later fields stay aligned
+    key_builder& str(const char* x, size_t n) {
+        s_.append(x, n);
+        return *this;
+    }
+    operator const std::string&() const {
+        return s_;
+    }
+private:
+    std::string s_;
+};
+
+template <typename Row>
+inline std::string encode(const Row& r) {
+    return std::string(reinterpret_cast<const char*>(&r), sizeof(Row));
+}
+
+template <typename Row>
+inline Row decode(const std::string& s) {
+    Row r;
+    assert(s.size() == sizeof(Row));
+    memcpy(&r, s.data(), sizeof(Row));
+    return r;
+}
+
+template <typename Row>
+inline Row decode(Str s) {
+    Row r;
+    assert(size_t(s.length()) == sizeof(Row));
+    memcpy(&r, s.data(), sizeof(Row));
+    return r;
+}
+
+inline uint32_t key_u32(Str key, int field) {
+    uint32_t x;
+    memcpy(&x, key.data() + 4 * field, sizeof(x));
+    return ntohl(x);
+}
+
+
+// per-thread statistics
+struct txn_type_stats {
+    const char* name;
+    uint64_t commits;
+    uint64_t aborts;
+    std::vector<double> latencies; // microseconds, one per commit
+};
+
+class thread_stats {
+public:
+    thread_stats(std::vector<const char*> names) {
+        for (auto n : names)
+            types_.push_back(txn_type_stats{n, 0, 0, {}});
+    }
+    void record(int type, unsigned aborts, double usec) {
+        ++types_[type].commits;
+        types_[type].aborts += aborts;
+        types_[type].latencies.push_back(usec);
+    }
+    std::vector<txn_type_stats>& types() {
+        return types_;
+    }
+private:
+    std::vector<txn_type_stats> types_;
+};
+
+// runs `body` until it commits, recording retries and end-to-end latency
+template <typename F>
+void run_txn(thread_stats& st, int type, F body) {
+    auto start = std::chrono::steady_clock::now();
+    unsigned attempts = 0;
+    TRANSACTION {
+        ++attempts;
+        body();
+    } RETRY(true);
+    std::chrono::duration<double, std::micro> d = std::chrono::steady_clock::now() - start;
+    st.record(type, attempts - 1, d.count());
+}
+
+static double percentile(std::vector<double>& v, double p) {
+    if (v.empty())
+        return 0;
+    size_t idx = std::min(v.size() - 1, size_t(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+
+static void report(std::vector<thread_stats>& stats, double seconds) {
+    auto& first = stats[0].types();
+    uint64_t total_commits = 0;
+    printf("%-14s %12s %12s %8s %10s %10s\n", "txn", "commits", "aborts", "abort%", "p50(us)", "p99(us)");
+    for (size_t t = 0; t != first.size(); ++t) {
+        uint64_t commits = 0, aborts = 0;
+        std::vector<double> lat;
+        for (auto& s : stats) {
+            auto& ts = s.types()[t];
+            commits += ts.commits;
+            aborts += ts.aborts;
+            lat.insert(lat.end(), ts.latencies.begin(), ts.latencies.end());
+        }
+        total_commits += commits;
+        double abort_rate = commits + aborts ? 100.0 * aborts / (commits + aborts) : 0;
+        double p50 = percentile(lat, 0.50);
+        double p99 = percentile(lat, 0.99);
+        printf("%-14s %12llu %12llu %8.3f %10.2f %10.2f\n", first[t].name,
+               (unsigned long long) commits, (unsigned long long) aborts,
+               abort_rate, p50, p99);
+    }
+    printf("real time: %f\nthroughput: %.0f txn/s\n", seconds, total_commits / seconds);
+}
+
+
+// TPC-C
+namespace tpcc {
+
+int nwarehouses = 0;            // defaults to nthreads
+int nitems = 100000;
+int ncustomers = 3000;          // per district
+constexpr int ndistricts = 10;
+int ninitial_orders = 3000;     // per district; the last 900 are undelivered
+
+struct warehouse_row {
+    int32_t w_tax;              // basis points
+    int64_t w_ytd;              // cents
+};
+struct district_row {
+    int32_t d_tax;
+    int64_t d_ytd;
+    uint32_t d_next_o_id;
+};
+struct customer_row {
+    int32_t c_discount;
+    int64_t c_balance;
+    int64_t c_ytd_payment;
+    uint32_t c_payment_cnt;
+    uint32_t c_delivery_cnt;
+    char c_credit[2];
+    char c_last[16];
+    char c_first[16];
+    char c_data[64];
+};
+struct history_row {
+    int64_t h_amount;
+    uint32_t h_date;
+};
+struct item_row {
+    int32_t i_price;
+    char i_name[24];
+    char i_data[50];
+};
+struct stock_row {
+    int32_t s_quantity;
+    int32_t s_ytd;
+    uint32_t s_order_cnt;
+    uint32_t s_remote_cnt;
+    char s_dist[24];
+};
+struct oorder_row {
+    uint32_t o_c_id;
+    uint32_t o_entry_d;
+    uint32_t o_carrier_id;
+    uint8_t o_ol_cnt;
+    uint8_t o_all_local;
+};
+struct order_line_row {
+    uint32_t ol_i_id;
+    uint32_t ol_supply_w_id;
+    uint32_t ol_delivery_d;
+    uint8_t ol_quantity;
+    int32_t ol_amount;
+};
+
+struct tables {
+    table_type warehouse, district, customer, customer_name_idx, history,
+        new_order, oorder, oorder_c_idx, order_line, item, stock;
+};
+tables* db;
+
+enum { t_new_order = 0, t_payment, t_order_status, t_delivery, t_stock_level };
+
+inline std::string wkey(uint32_t w) { return key_builder().u32(w); }
+inline std::string dkey(uint32_t w, uint32_t d) { return key_builder().u32(w).u32(d); }
+inline std::string ckey(uint32_t w, uint32_t d, uint32_t c) { return key_builder().u32(w).u32(d).u32(c); }
+inline std::string okey(uint32_t w, uint32_t d, uint32_t o) { return key_builder().u32(w).u32(d).u32(o); }
+inline std::string olkey(uint32_t w, uint32_t d, uint32_t o, uint32_t ol) {
+    return key_builder().u32(w).u32(d).u32(o).u32(ol);
+}
+inline std::string cidxkey(uint32_t w, uint32_t d, uint32_t c, uint32_t o) {
+    return key_builder().u32(w).u32(d).u32(c).u32(o);
+}
+inline std::string cnameprefix(uint32_t w, uint32_t d, const char* last) {
+    return key_builder().u32(w).u32(d).str(last, 16);
+}
+inline std::string cnamekey(uint32_t w, uint32_t d, const char* last, const char* first, uint32_t c) {
+    return key_builder().u32(w).u32(d).str(last, 16).str(first, 16).u32(c);
+}
+inline std::string ikey(uint32_t i) { return key_builder().u32(i); }
+
+// C_LAST is three syllables picked by the digits of a number in [0, 999]
+inline void make_last_name(uint32_t n, char* out) {
+    static const char* const syllables[] = {
+        "BAR", "OUGHT", "ABLE", "PRI", "PRES", "ESE", "ANTI", "CALLY", "ATION", "EING"
+    };
+    memset(out, 0, 16);
+    snprintf(out, 16, "%s%s%s", syllables[n / 100], syllables[n / 10 % 10], syllables[n % 10]);
+}
+
+// NURand(A, x, y) from the TPC-C spec, with one fixed C per field
+template <typename Rand>
+inline uint32_t nurand(Rand& rand, uint32_t a, uint32_t c, uint32_t x, uint32_t y) {
+    return (((rand(0, a) | rand(x, y)) + c) % (y - x + 1)) + x;
+}
+constexpr uint32_t c_last_c = 173, c_id_c = 259;
+inline std::string skey(uint32_t w, uint32_t i) { return key_builder().u32(w).u32(i); }
+
+class worker {
+public:
+    worker(int id)
+        : id_(id), gen_(seed * 7919 + id), history_seq_(0),
+          home_w_(id % nwarehouses + 1) {
+    }
+
+    uint32_t rand(uint32_t lo, uint32_t hi) {
+        return std::uniform_int_distribution<uint32_t>(lo, hi)(gen_);
+    }
+    uint32_t operator()(uint32_t lo, uint32_t hi) {
+        return rand(lo, hi);
+    }
+
+    // 60% of Payment and OrderStatus customers are selected by last name
+    bool pick_customer(uint32_t& c, char* last) {
+        if (rand(1, 100) <= 60) {
+            make_last_name(nurand(*this, 255, c_last_c, 0, 999), last);
+            return true;
+        }
+        c = nurand(*this, 1023, c_id_c, 1, ncustomers);
+        return false;
+    }
+
+    // The customer with the median first name among those with this last
+    // name (TPC-C 2.5.2.2), or 0 if there are none.
+    static uint32_t customer_by_name(uint32_t w, uint32_t d, const char* last) {
+        std::vector<uint32_t> ids;
+        db->customer_name_idx.transPrefixScan(cnameprefix(w, d, last),
+                                              [&] (Str key, const std::string&) {
+                                                  ids.push_back(key_u32(key, 10)); // after w, d, c_last, c_first
+                                                  return true;
+                                              });
+        return ids.empty() ? 0 : ids[(ids.size() + 1) / 2 - 1];
+    }
+
+    void new_order(thread_stats& st) {
+        uint32_t w = home_w_;
+        uint32_t d = rand(1, ndistricts);
+        uint32_t c = nurand(*this, 1023, c_id_c, 1, ncustomers);
+        unsigned ol_cnt = rand(5, 15);
+        bool invalid = rand(1, 100) == 1;
+        std::string ikeys[15], skeys[15];
+        uint32_t supply_w[15], qty[15];
+        bool all_local = true;
+        for (unsigned i = 0; i != ol_cnt; ++i) {
+            uint32_t iid = (invalid && i == ol_cnt - 1) ? nitems + 1 : rand(1, nitems);
+            supply_w[i] = w;
+            if (nwarehouses > 1 && rand(1, 100) == 1) {
+                do {
+                    supply_w[i] = rand(1, nwarehouses);
+                } while (supply_w[i] == w);
+                all_local = false;
+            }
+            ikeys[i] = ikey(iid);
+            skeys[i] = skey(supply_w[i], iid);
+            qty[i] = rand(1, 10);
+        }
+
+        run_txn(st, t_new_order, [&] {
+            std::string items[15];
+            bool found[15];
+            if (db->item.transMultiGet(ikeys, ol_cnt, items, found) != ol_cnt)
+                return; // invalid item: nothing has been written yet
+
+            std::string v;
+            db->warehouse.transGet(wkey(w), v);
+            auto wr = decode<warehouse_row>(v);
+            db->district.transGet(dkey(w, d), v);
+            auto dr = decode<district_row>(v);
+            uint32_t o = dr.d_next_o_id++;
+            db->district.transPut(dkey(w, d), encode(dr));
+            db->customer.transGet(ckey(w, d, c), v);
+            auto cr = decode<customer_row>(v);
+
+            oorder_row orow = {c, uint32_t(time(nullptr)), 0, uint8_t(ol_cnt), all_local};
+            db->oorder.transInsert(okey(w, d, o), encode(orow));
+            db->oorder_c_idx.transInsert(cidxkey(w, d, c, o), std::string());
+            db->new_order.transInsert(okey(w, d, o), std::string());
+
+            std::string stocks[15];
+            db->stock.transMultiGet(skeys, ol_cnt, stocks, found);
+            for (unsigned i = 0; i != ol_cnt; ++i) {
+                auto ir = decode<item_row>(items[i]);
+                auto sr = decode<stock_row>(stocks[i]);
+                if (sr.s_quantity >= int32_t(qty[i]) + 10)
+                    sr.s_quantity -= qty[i];
+                else
+                    sr.s_quantity += 91 - qty[i];
+                sr.s_ytd += qty[i];
+                ++sr.s_order_cnt;
+                sr.s_remote_cnt += supply_w[i] != w;
+                db->stock.transPut(skeys[i], encode(sr));
+
+                int64_t amount = int64_t(qty[i]) * ir.i_price
+                    * (10000 + wr.w_tax + dr.d_tax) / 10000
+                    * (10000 - cr.c_discount) / 10000;
+                order_line_row ol = {key_u32(Str(ikeys[i]), 0), supply_w[i], 0,
+                                     uint8_t(qty[i]), int32_t(amount)};
+                db->order_line.transInsert(olkey(w, d, o, i + 1), encode(ol));
+            }
+        });
+    }
+
+    void payment(thread_stats& st) {
+        uint32_t w = home_w_;
+        uint32_t d = rand(1, ndistricts);
+        uint32_t cw = w, cd = d;
+        if (nwarehouses > 1 && rand(1, 100) <= 15) {
+            do {
+                cw = rand(1, nwarehouses);
+            } while (cw == w);
+            cd = rand(1, ndistricts);
+        }
+        uint32_t c;
+        char last[16];
+        bool by_name = pick_customer(c, last);
+        int64_t amount = rand(100, 500000);
+        uint64_t hseq = ++history_seq_;
+
+        run_txn(st, t_payment, [&] {
+            if (by_name && !(c = customer_by_name(cw, cd, last)))
+                return;
+            std::string v;
+            db->warehouse.transGet(wkey(w), v);
+            auto wr = decode<warehouse_row>(v);
+            wr.w_ytd += amount;
+            db->warehouse.transPut(wkey(w), encode(wr));
+
+            db->district.transGet(dkey(w, d), v);
+            auto dr = decode<district_row>(v);
+            dr.d_ytd += amount;
+            db->district.transPut(dkey(w, d), encode(dr));
+
+            db->customer.transGet(ckey(cw, cd, c), v);
+            auto cr = decode<customer_row>(v);
+            cr.c_balance -= amount;
+            cr.c_ytd_payment += amount;
+            ++cr.c_payment_cnt;
+            if (cr.c_credit[0] == 'B')
+                snprintf(cr.c_data, sizeof(cr.c_data), "%u %u %u %u %u %lld",
+                         c, cd, cw, d, w, (long long) amount);
+            db->customer.transPut(ckey(cw, cd, c), encode(cr));
+
+            history_row hr = {amount, uint32_t(time(nullptr))};
+            std::string hkey = key_builder().u32(cw).u32(cd).u32(c).u32(id_).u32(uint32_t(hseq));
+            db->history.transInsert(hkey, encode(hr));
+        });
+    }
+
+    void order_status(thread_stats& st) {
+        uint32_t w = home_w_;
+        uint32_t d = rand(1, ndistricts);
+        uint32_t c;
+        char last[16];
+        bool by_name = pick_customer(c, last);
+
+        run_txn(st, t_order_status, [&] {
+            if (by_name && !(c = customer_by_name(w, d, last)))
+                return;
+            std::string v;
+            db->customer.transGet(ckey(w, d, c), v);
+            (void) decode<customer_row>(v);
+
+            // most recent order of this customer
+            uint32_t o = 0;
+            db->oorder_c_idx.transRScan(cidxkey(w, d, c, ~0U),
+                                        ckey(w, d, c),
+                                        [&] (Str key, const std::string&) {
+                                            o = key_u32(key, 3);
+                                            return false;
+                                        }, 1);
+            if (!o)
+                return;
+            db->oorder.transGet(okey(w, d, o), v);
+            int64_t total = 0;
+            db->order_line.transScan(okey(w, d, o), okey(w, d, o + 1),
+                                     [&] (Str, const std::string& val) {
+                                         total += decode<order_line_row>(val).ol_amount;
+                                         return true;
+                                     });
+            (void) total;
+        });
+    }
+
+    void delivery(thread_stats& st) {
+        uint32_t w = home_w_;
+        uint32_t carrier = rand(1, 10);
+
+        run_txn(st, t_delivery, [&] {
+            for (uint32_t d = 1; d <= ndistricts; ++d) {
+                uint32_t o = 0;
+                db->new_order.transScan(okey(w, d, 0), okey(w, d + 1, 0),
+                                        [&] (Str key, const std::string&) {
+                                            o = key_u32(key, 2);
+                                            return false;
+                                        }, 1);
+                if (!o)
+                    continue;
+                db->new_order.transDelete(okey(w, d, o));
+
+                std::string v;
+                db->oorder.transGet(okey(w, d, o), v);
+                auto orow = decode<oorder_row>(v);
+                orow.o_carrier_id = carrier;
+                db->oorder.transPut(okey(w, d, o), encode(orow));
+
+                std::vector<std::pair<std::string, order_line_row>> lines;
+                db->order_line.transScan(okey(w, d, o), okey(w, d, o + 1),
+                                         [&] (Str key, const std::string& val) {
+                                             lines.emplace_back(std::string(key.data(), key.length()),
+                                                                decode<order_line_row>(val));
+                                             return true;
+                                         });
+                int64_t total = 0;
+                for (auto& l : lines) {
+                    total += l.second.ol_amount;
+                    l.second.ol_delivery_d = uint32_t(time(nullptr));
+                    db->order_line.transPut(l.first, encode(l.second));
+                }
+
+                db->customer.transGet(ckey(w, d, orow.o_c_id), v);
+                auto cr = decode<customer_row>(v);
+                cr.c_balance += total;
+                ++cr.c_delivery_cnt;
+                db->customer.transPut(ckey(w, d, orow.o_c_id), encode(cr));
+            }
+        });
+    }
+
+    void stock_level(thread_stats& st) {
+        uint32_t w = home_w_;
+        uint32_t d = rand(1, ndistricts);
+        int32_t threshold = rand(10, 20);
+
+        run_txn(st, t_stock_level, [&] {
+            std::string v;
+            db->district.transGet(dkey(w, d), v);
+            auto dr = decode<district_row>(v);
+            uint32_t lo = dr.d_next_o_id > 20 ? dr.d_next_o_id - 20 : 1;
+            std::vector<std::string> skeys;
+            db->order_line.transScan(okey(w, d, lo), okey(w, d, dr.d_next_o_id),
+                                     [&] (Str, const std::string& val) {
+                                         skeys.push_back(skey(w, decode<order_line_row>(val).ol_i_id));
+                                         return true;
+                                     });
+            std::sort(skeys.begin(), skeys.end());
+            skeys.erase(std::unique(skeys.begin(), skeys.end()), skeys.end());
+            std::vector<std::string> stocks(skeys.size());
+            std::unique_ptr<bool[]> found(new bool[skeys.size()]);
+            db->stock.transMultiGet(skeys.data(), skeys.size(), stocks.data(), found.get());
+            unsigned low = 0;
+            for (size_t i = 0; i != skeys.size(); ++i)
+                low += found[i] && decode<stock_row>(stocks[i]).s_quantity < threshold;
+            (void) low;
+        });
+    }
+
+    void run(thread_stats& st) {
+        for (int i = 0; i != ntrans; ++i) {
+            uint32_t x = rand(1, 100);
+            if (x <= 45)
+                new_order(st);
+            else if (x <= 88)
+                payment(st);
+            else if (x <= 92)
+                order_status(st);
+            else if (x <= 96)
+                delivery(st);
+            else
+                stock_level(st);
+        }
+    }
+
+private:
+    int id_;
+    std::mt19937 gen_;
+    uint64_t history_seq_;
+    uint32_t home_w_;
+};
+
+// one loader thread per warehouse; items are loaded by the first
+void load_warehouse(uint32_t w) {
+    std::mt19937 gen(seed * 31 + w);
+    auto rand = [&] (uint32_t lo, uint32_t hi) {
+        return std::uniform_int_distribution<uint32_t>(lo, hi)(gen);
+    };
+    auto batch = [] (int n, std::function<void(int)> f) {
+        for (int base = 0; base < n; base += 1000)
+            TRANSACTION {
+                for (int i = base; i < std::min(n, base + 1000); ++i)
+                    f(i);
+            } RETRY(true);
+    };
+
+    if (w == 1)
+        batch(nitems, [&] (int i) {
+            item_row r = {int32_t(rand(100, 10000)), {}, {}};
+            snprintf(r.i_name, sizeof(r.i_name), "item-%d", i + 1);
+            db->item.transInsert(ikey(i + 1), encode(r));
+        });
+    TRANSACTION {
+        warehouse_row wr = {int32_t(rand(0, 2000)), 30000000};
+        db->warehouse.transInsert(wkey(w), encode(wr));
+    } RETRY(true);
+    batch(nitems, [&] (int i) {
+        stock_row r = {int32_t(rand(10, 100)), 0, 0, 0, {}};
+        db->stock.transInsert(skey(w, i + 1), encode(r));
+    });
+    for (uint32_t d = 1; d <= ndistricts; ++d) {
+        TRANSACTION {
+            district_row dr = {int32_t(rand(0, 2000)), 3000000, uint32_t(ninitial_orders + 1)};
+            db->district.transInsert(dkey(w, d), encode(dr));
+        } RETRY(true);
+        batch(ncustomers, [&] (int i) {
+            customer_row cr = {int32_t(rand(0, 5000)), -1000, 1000, 1, 0,
+                               {rand(1, 10) == 1 ? 'B' : 'G', 'C'}, {}, {}, {}};
+            // the first 1000 customers cover every last name
+            make_last_name(i < 1000 ? i : nurand(rand, 255, c_last_c, 0, 999), cr.c_last);
+            unsigned nfirst = rand(8, 15);
+            for (unsigned j = 0; j != nfirst; ++j)
+                cr.c_first[j] = 'a' + rand(0, 25);
+            db->customer.transInsert(ckey(w, d, i + 1), encode(cr));
+            db->customer_name_idx.transInsert(cnamekey(w, d, cr.c_last, cr.c_first, i + 1), std::string());
+        });
+        std::vector<uint32_t> cids(ncustomers);
+        for (int i = 0; i != ncustomers; ++i)
+            cids[i] = i + 1;
+        std::shuffle(cids.begin(), cids.end(), gen);
+        // orders have up to 15 lines, so keep order batches small
+        for (int base = 0; base < ninitial_orders; base += 50)
+            TRANSACTION {
+                for (int i = base; i < std::min(ninitial_orders, base + 50); ++i) {
+                    uint32_t o = i + 1;
+                    bool delivered = o <= uint32_t(ninitial_orders * 7 / 10);
+                    uint8_t ol_cnt = rand(5, 15);
+                    uint32_t c = cids[i % ncustomers];
+                    oorder_row orow = {c, 0, delivered ? rand(1, 10) : 0, ol_cnt, 1};
+                    db->oorder.transInsert(okey(w, d, o), encode(orow));
+                    db->oorder_c_idx.transInsert(cidxkey(w, d, c, o), std::string());
+                    if (!delivered)
+                        db->new_order.transInsert(okey(w, d, o), std::string());
+                    for (uint32_t ol = 1; ol <= ol_cnt; ++ol) {
+                        order_line_row r = {rand(1, nitems), w, delivered ? 1U : 0U, 5,
+                                            int32_t(delivered ? 0 : rand(1, 999999))};
+                        db->order_line.transInsert(olkey(w, d, o, ol), encode(r));
+                    }
+                }
+            } RETRY(true);
+    }
+}
+
+} // namespace tpcc
+
+
+// YCSB
+namespace ycsb {
+
+int nrecords = 1000000;
+int opspertrans = 16;
+int value_size = 100;
+int scan_length = 100;
+double skew = 0.99;
+char workload = 'a';
+bool use_hash = false;
+
+table_type* tree;
+hash_table_type* hash;
+
+enum { t_read_only = 0, t_read_write };
+
+inline std::string rkey(uint32_t r) {
+    return key_builder().u32(r);
+}
+
+class worker {
+public:
+    worker(int id)
+        : gen_(seed * 7919 + id) {
+        if (skew > 0)
+            dist_.reset(new StoSampling::StoZipfDistribution(seed * 7919 + id, 0, nrecords - 1, skew));
+        else
+            dist_.reset(new StoSampling::StoUniformDistribution(seed * 7919 + id, 0, nrecords - 1));
+        value_.assign(value_size, 'a' + id % 26);
+    }
+
+    // fraction of operations that write, and of reads that scan
+    void mix(double& write_frac, double& scan_frac, bool& rmw) {
+        write_frac = scan_frac = 0;
+        rmw = false;
+        switch (workload) {
+        case 'a': write_frac = 0.5; break;
+        case 'b': write_frac = 0.05; break;
+        case 'c': break;
+        case 'e': write_frac = 0.05; scan_frac = 1.0; break;
+        case 'f': write_frac = 0.5; rmw = true; break;
+        }
+    }
+
+    void run(thread_stats& st) {
+        double write_frac, scan_frac;
+        bool rmw;
+        mix(write_frac, scan_frac, rmw);
+        std::uniform_real_distribution<double> coin(0, 1);
+        struct op {
+            uint32_t key;
+            bool write;
+            bool scan;
+        };
+        std::vector<op> ops(opspertrans);
+        for (int i = 0; i != ntrans; ++i) {
+            bool any_write = false;
+            for (auto& o : ops) {
+                o.key = dist_->sample();
+                o.write = coin(gen_) < write_frac;
+                o.scan = !o.write && coin(gen_) < scan_frac;
+                any_write |= o.write;
+            }
+            run_txn(st, any_write ? t_read_write : t_read_only, [&] {
+                std::string v;
+                for (auto& o : ops) {
+                    std::string k = rkey(o.key);
+                    if (o.scan)
+                        tree->transScan(k, Str(), [] (Str, const std::string&) {
+                                return true;
+                            }, scan_length);
+                    else if (o.write && !rmw)
+                        put(k, value_);
+                    else {
+                        get(k, v);
+                        if (o.write)
+                            put(k, value_);
+                    }
+                }
+            });
+        }
+    }
+
+    static void get(const std::string& k, std::string& v) {
+        if (use_hash)
+            hash->transGet(k, v);
+        else
+            tree->transGet(k, v);
+    }
+    static void put(const std::string& k, const std::string& v) {
+        if (use_hash)
+            hash->transPut(k, v);
+        else
+            tree->transPut(k, v);
+    }
+
+private:
+    std::mt19937 gen_;
+    std::unique_ptr<StoSampling::StoRandomDistribution> dist_;
+    std::string value_;
+};
+
+void load(int id) {
+    std::string value(value_size, 'x');
+    for (int base = id * 1000; base < nrecords; base += nthreads * 1000)
+        TRANSACTION {
+            for (int r = base; r < std::min(nrecords, base + 1000); ++r)
+                if (use_hash)
+                    hash->transInsert(rkey(r), value);
+                else
+                    tree->transInsert(rkey(r), value);
+        } RETRY(true);
+}
+
+} // namespace ycsb
+
+
+enum { bench_tpcc, bench_ycsb };
+int bench = bench_tpcc;
+std::vector<thread_stats> stats;
+
+template <typename F>
+void run_threads(int n, F f) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i != n; ++i)
+        threads.emplace_back([=] {
+            TThread::set_id(i);
+            Sto::update_threadid();
+            table_type::thread_init();
+            f(i);
+        });
+    for (auto& t : threads)
+        t.join();
+}
+
+enum {
+    opt_nthreads = 1, opt_ntrans, opt_seed, opt_warehouses, opt_small,
+    opt_ycsb, opt_records, opt_opspertrans, opt_skew, opt_hash, opt_value_size
+};
+
+static const Clp_Option options[] = {
+  { "nthreads", 'j', opt_nthreads, Clp_ValInt, Clp_Optional },
+  { "ntrans", 0, opt_ntrans, Clp_ValInt, Clp_Optional },
+  { "seed", 's', opt_seed, Clp_ValUnsigned, 0 },
+  { "warehouses", 'w', opt_warehouses, Clp_ValInt, Clp_Optional },
+  { "small", 0, opt_small, 0, Clp_Negate },
+  { "ycsb", 0, opt_ycsb, Clp_ValString, Clp_Optional },
+  { "records", 0, opt_records, Clp_ValInt, Clp_Optional },
+  { "opspertrans", 0, opt_opspertrans, Clp_ValInt, Clp_Optional },
+  { "skew", 0, opt_skew, Clp_ValDouble, Clp_Optional },
+  { "hash", 0, opt_hash, 0, Clp_Negate },
+  { "value-size", 0, opt_value_size, Clp_ValInt, Clp_Optional },
+};
+
+static void help(const char* name) {
+    printf("Usage: %s tpcc|ycsb [OPTIONS]\n\
+Options:\n\
+ --nthreads=NTHREADS (default %d)\n\
+ --ntrans=NTRANS, transactions per thread (default %d)\n\
+ --seed=SEED\n\
+TPC-C:\n\
+ --warehouses=W (default NTHREADS)\n\
+ --small, load 10x fewer items, customers and orders\n\
+YCSB:\n\
+ --ycsb=a|b|c|e|f, workload (default %c)\n\
+ --records=N (default %d)\n\
+ --opspertrans=N (default %d)\n\
+ --skew=THETA, zipf skew, 0 for uniform (default %f)\n\
+ --value-size=BYTES (default %d)\n\
+ --hash, use Hashtable instead of MassTrans (not with workload e)\n",
+           name, nthreads, ntrans, ycsb::workload, ycsb::nrecords,
+           ycsb::opspertrans, ycsb::skew, ycsb::value_size);
+    exit(1);
+}
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case Clp_NotOption:
+            if (strcmp(clp->vstr, "tpcc") == 0)
+                bench = bench_tpcc;
+            else if (strcmp(clp->vstr, "ycsb") == 0)
+                bench = bench_ycsb;
+            else
+                help(argv[0]);
+            break;
+        case opt_nthreads:
+            nthreads = clp->val.i;
+            break;
+        case opt_ntrans:
+            ntrans = clp->val.i;
+            break;
+        case opt_seed:
+            seed = clp->val.u;
+            break;
+        case opt_warehouses:
+            tpcc::nwarehouses = clp->val.i;
+            break;
+        case opt_small:
+            if (!clp->negated) {
+                tpcc::nitems /= 10;
+                tpcc::ncustomers /= 10;
+                tpcc::ninitial_orders /= 10;
+            }
+            break;
+        case opt_ycsb:
+            bench = bench_ycsb;
+            ycsb::workload = clp->vstr[0];
+            if (!strchr("abcef", ycsb::workload))
+                help(argv[0]);
+            break;
+        case opt_records:
+            ycsb::nrecords = clp->val.i;
+            break;
+        case opt_opspertrans:
+            ycsb::opspertrans = clp->val.i;
+            break;
+        case opt_skew:
+            ycsb::skew = clp->val.d;
+            break;
+        case opt_hash:
+            ycsb::use_hash = !clp->negated;
+            break;
+        case opt_value_size:
+            ycsb::value_size = clp->val.i;
+            break;
+        default:
+            help(argv[0]);
+        }
+    }
+    Clp_DeleteParser(clp);
+
+    if (nthreads > MAX_THREADS) {
+        printf("Asked for %d threads but MAX_THREADS is %d\n", nthreads, MAX_THREADS);
+        exit(1);
+    }
+    if (bench == bench_ycsb && ycsb::use_hash && ycsb::workload == 'e') {
+        printf("YCSB workload e scans and needs MassTrans\n");
+        exit(1);
+    }
+
+    table_type::static_init();
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+
+    std::vector<const char*> names;
+    if (bench == bench_tpcc) {
+        if (!tpcc::nwarehouses)
+            tpcc::nwarehouses = nthreads;
+        tpcc::db = new tpcc::tables;
+        run_threads(std::min(nthreads, tpcc::nwarehouses), [] (int id) {
+                for (int w = id + 1; w <= tpcc::nwarehouses; w += nthreads)
+                    tpcc::load_warehouse(w);
+            });
+        names = {"new-order", "payment", "order-status", "delivery", "stock-level"};
+    } else {
+        if (ycsb::use_hash)
+            ycsb::hash = new hash_table_type(ycsb::nrecords);
+        else
+            ycsb::tree = new table_type;
+        run_threads(nthreads, ycsb::load);
+        names = {"ycsb-ro", "ycsb-rw"};
+    }
+    Transaction::clear_stats();
+
+    for (int i = 0; i != nthreads; ++i)
+        stats.emplace_back(names);
+    auto start = std::chrono::steady_clock::now();
+    run_threads(nthreads, [] (int id) {
+            if (bench == bench_tpcc)
+                tpcc::worker(id).run(stats[id]);
+            else
+                ycsb::worker(id).run(stats[id]);
+        });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    report(stats, elapsed.count());
+#if STO_PROFILE_COUNTERS
+    Transaction::print_stats();
+#endif
+    Transaction::global_epochs.run = false;
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include "TVector_nopred.hh"
 #include "PriorityQueue.hh"
 #include "PriorityQueue1.hh"
+#include "RBTree.hh"
 #include "clp.h"
 #include "randgen.hh"
 int waiting = 5000;
@@ -37,6 +38,23 @@ int ntrans = 300000;
 
 TransactionTid::type lock;
 
+// Max-priority queue over an RBTree: pop() takes the largest key with a
+// reverse scan, so every pop exercises the tree's range validation.
+class RBTreePQ {
+public:
+    void push(int v) {
+        tree_[v] = v;
+    }
+    void pop() {
+        auto it = tree_.rbegin();
+        if (it == tree_.rend())
+            throw std::out_of_range("RBTreePQ::pop");
+        tree_.erase(it->first);
+    }
+private:
+    RBTree<int, int, false> tree_;
+};
+
 template <typename T>
 struct TesterPair {
     T* t;
@@ -287,6 +305,8 @@ int main(int argc, char *argv[]) {
             run_and_report<std::priority_queue<int, TVector<int>>>("std");
         else if (strcmp(test, "std-nopred") == 0)
             run_and_report<std::priority_queue<int, TVector_nopred<int>>>("std-nopred");
+        else if (strcmp(test, "rbtree") == 0)
+            run_and_report<RBTreePQ>("rbtree");
         else
             assert(false);
     }
@@ -8,12 +8,14 @@
 #include "Vector.hh"
 #include "PriorityQueue.hh"
 #include "PriorityQueue1.hh"
+#include "MultiPriorityQueue.hh"
 #include "randgen.hh"
 
 #define GLOBAL_SEED 0
 #define MAX_VALUE  100000
 #define NTRANS 1000
 #define N_THREADS 4
+#define NTRANS_THROUGHPUT 20000
 
 typedef PriorityQueue<int> data_structure;
 unsigned initial_seeds[128];
@@ -168,6 +170,69 @@ void startAndWait(T* queue, bool parallel = true) {
     }
 }
 
+void print_time(struct timeval tv1, struct timeval tv2) {
+    printf("%f\n", (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0);
+}
+
+// Throughput workload: every transaction pushes two values and pops one.
+// An exact PriorityQueue serializes every pop; MultiPriorityQueue spreads
+// pops over its sub-heaps.
+unsigned throughput_aborts[N_THREADS];
+
+template <typename T>
+void run_throughput(T* q, int me) {
+    TThread::set_id(me);
+
+    std::uniform_int_distribution<long> slotdist(0, MAX_VALUE);
+    Rand transgen(initial_seeds[2*me], initial_seeds[2*me + 1]);
+
+    for (int i = 0; i < NTRANS_THROUGHPUT; ++i) {
+        int val1 = slotdist(transgen);
+        int val2 = slotdist(transgen);
+        while (1) {
+            Sto::start_transaction();
+            try {
+                q->push(val1);
+                q->push(val2);
+                q->pop();
+                if (Sto::try_commit())
+                    break;
+            } catch (Transaction::Abort e) {
+            }
+            ++throughput_aborts[me];
+        }
+    }
+}
+
+template <typename T>
+void* throughputFunc(void* x) {
+    TesterPair<T>* tp = (TesterPair<T>*) x;
+    run_throughput(tp->t, tp->me);
+    return nullptr;
+}
+
+template <typename T>
+void throughput(T* q, const char* name) {
+    pthread_t tids[N_THREADS];
+    TesterPair<T> testers[N_THREADS];
+    struct timeval tv1,tv2;
+    gettimeofday(&tv1, NULL);
+    for (int i = 0; i < N_THREADS; ++i) {
+        throughput_aborts[i] = 0;
+        testers[i].t = q;
+        testers[i].me = i;
+        pthread_create(&tids[i], NULL, throughputFunc<T>, &testers[i]);
+    }
+    unsigned aborts = 0;
+    for (int i = 0; i < N_THREADS; ++i) {
+        pthread_join(tids[i], NULL);
+        aborts += throughput_aborts[i];
+    }
+    gettimeofday(&tv2, NULL);
+    printf("%s throughput time (%u aborts): ", name, aborts);
+    print_time(tv1, tv2);
+}
+
 // These tests are adapted from the queue tests in single.cc
 void queueTests() {
     data_structure q;
@@ -518,13 +583,82 @@ void queueTests() {
     }
 }
 
-void print_time(struct timeval tv1, struct timeval tv2) {
-    printf("%f\n", (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0);
+void multiQueueTests() {
+    {
+        // a single sub-heap is an exact priority queue
+        MultiPriorityQueue<int> q(1);
+        {
+            TransactionGuard t;
+            q.push(1);
+            q.push(3);
+            q.push(2);
+        }
+        {
+            TransactionGuard t;
+            assert(q.top() == 3);
+            assert(q.pop() == 3);
+            assert(q.pop() == 2);
+            assert(q.pop() == 1);
+            assert(q.pop() == -1);
+        }
+    }
+
+    {
+        // comparing every sub-heap's top is exact for a single thread
+        MultiPriorityQueue<int> q(4, 4);
+        for (int i = 0; i < 100; ++i)
+            q.push_nontrans(i);
+        for (int i = 99; i >= 0; --i) {
+            TransactionGuard t;
+            assert(q.pop() == i);
+        }
+        {
+            TransactionGuard t;
+            assert(q.pop() == -1);
+        }
+    }
+
+    {
+        // relaxed order: every value still comes out exactly once, and a
+        // pop after a top removes the value top returned
+        MultiPriorityQueue<int> q(8, 2);
+        for (int i = 0; i < 1000; ++i)
+            q.push_nontrans(i);
+        std::vector<bool> seen(1000, false);
+        for (int i = 0; i < 1000; ++i) {
+            TransactionGuard t;
+            int v = q.top();
+            assert(v >= 0 && v < 1000 && !seen[v]);
+            assert(q.top() == v);
+            assert(q.pop() == v);
+            seen[v] = true;
+        }
+        {
+            TransactionGuard t;
+            assert(q.top() == -1);
+            assert(q.pop() == -1);
+        }
+        assert(q.unsafe_size() == 0);
+    }
+
+    {
+        // popping an empty queue conflicts with a push to any sub-heap
+        MultiPriorityQueue<int> q(4, 2);
+        TestTransaction t(1);
+        assert(q.pop() == -1);
+
+        TestTransaction t1(2);
+        q.push(4);
+        assert(t1.try_commit());
+        assert(!t.try_commit());
+    }
 }
 
 int main() {
     queueTests();
     std::cout << "Done queue tests" << std::endl;
+    multiQueueTests();
+    std::cout << "Done multiqueue tests" << std::endl;
     lock = 0;
     // Run a parallel test with lots of transactions doing pushes and pops
     data_structure q;
@@ -547,6 +681,13 @@ int main() {
     for (unsigned i = 0; i < arraysize(initial_seeds); ++i)
         initial_seeds[i] = random();
 
+    {
+        data_structure eq;
+        MultiPriorityQueue<int> mq(2 * N_THREADS);
+        throughput(&eq, "PriorityQueue");
+        throughput(&mq, "MultiPriorityQueue");
+    }
+
     struct timeval tv1,tv2;
     gettimeofday(&tv1, NULL);
     
@@ -6,6 +6,9 @@ unsigned long long rbaccount_rotation, rbaccount_flip, rbaccount_insert, rbaccou
 #include <map>
 #include <vector>
 #include <string.h>
+#include <thread>
+#include <algorithm>
+#include <random>
 #include "RBTree.hh"
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -240,6 +243,177 @@ void mem_tests() {
     }
 }
 
+/***** ordered iteration and range lookups ******/
+void iterator_tests() {
+    // read-only transactions commit without validation, so the scanners
+    // below also write to this tree
+    tree_type other;
+    {
+        // forward, reverse and bounded scans
+        tree_type tree;
+        {
+            TransactionGuard init;
+            for (int i = 0; i < 10; ++i)
+                tree[i * 10] = i;
+        }
+        TestTransaction t1(1);
+        int n = 0;
+        for (auto it = tree.begin(); it != tree.end(); ++it)
+            assert(it->first == 10 * n++);
+        assert(n == 10);
+        for (auto it = tree.rbegin(); it != tree.rend(); ++it)
+            assert(it->first == 10 * --n);
+        assert(n == 0);
+        assert(tree.lower_bound(30)->first == 30);
+        assert(tree.lower_bound(31)->first == 40);
+        assert(tree.upper_bound(30)->first == 40);
+        assert(tree.lower_bound(-5)->first == 0);
+        assert(tree.lower_bound(91) == tree.end());
+        assert(tree.upper_bound(90) == tree.end());
+        auto it = tree.end();
+        --it;
+        assert(it->first == 90);
+        assert(t1.try_commit());
+    }
+    {
+        // scans see our own inserts and skip our own deletes
+        tree_type tree;
+        reset_tree(tree);
+        TestTransaction t1(1);
+        tree[5] = 5;
+        tree.erase(1);
+        tree.erase(3);
+        auto it = tree.begin();
+        assert(it->first == 2);
+        ++it;
+        assert(it->first == 5);
+        ++it;
+        assert(it == tree.end());
+        assert(tree.lower_bound(3)->first == 5);
+        assert(t1.try_commit());
+    }
+    {
+        // empty tree: a scan is invalidated by the first insert
+        tree_type tree;
+        TestTransaction t1(1), t2(2);
+        t1.use();
+        other[1] = 1;
+        assert(tree.begin() == tree.end());
+        t2.use();
+        tree[7] = 7;
+        assert(t2.try_commit());
+        t1.use();
+        assert(!t1.try_commit());
+    }
+    {
+        // phantom protection: an insert into a scanned range aborts the scan
+        tree_type tree;
+        reset_tree(tree);
+        TestTransaction t1(1), t2(2);
+        t1.use();
+        other[1] = 1;
+        int n = 0;
+        for (auto it = tree.lower_bound(2); it != tree.end(); ++it)
+            ++n;
+        assert(n == 2);
+        t2.use();
+        tree[4] = 4;
+        assert(t2.try_commit());
+        t1.use();
+        assert(!t1.try_commit());
+    }
+    {
+        // ... and so does an erase
+        tree_type tree;
+        reset_tree(tree);
+        TestTransaction t1(1), t2(2);
+        t1.use();
+        other[1] = 1;
+        auto it = tree.upper_bound(1);
+        assert(it->first == 2);
+        t2.use();
+        tree.erase(2);
+        assert(t2.try_commit());
+        t1.use();
+        assert(!t1.try_commit());
+    }
+    {
+        // inserts outside the scanned range don't conflict
+        tree_type tree;
+        {
+            TransactionGuard init;
+            for (int i = 0; i < 100; ++i)
+                tree[i * 2] = i;
+        }
+        TestTransaction t1(1), t2(2);
+        t1.use();
+        other[1] = 1;
+        auto it = tree.lower_bound(100);
+        for (int i = 0; i < 5; ++i, ++it)
+            assert(it->first == 100 + 2 * i);
+        t2.use();
+        tree[13] = 13;
+        assert(t2.try_commit());
+        t1.use();
+        assert(t1.try_commit());
+    }
+    {
+        // uncommitted inserts in a scanned range abort the scanner
+        tree_type tree;
+        reset_tree(tree);
+        TestTransaction t1(1), t2(2);
+        t1.use();
+        tree[4] = 4;
+        t2.use();
+        try {
+            for (auto it = tree.begin(); it != tree.end(); ++it)
+                (void) it->first;
+            assert(false);
+        } catch (Transaction::Abort e) {
+        }
+        t1.use();
+        assert(t1.try_commit());
+    }
+}
+
+// N writers insert disjoint keys in random order. Inserts under black
+// parents attach in parallel, so throughput should grow with N.
+void concurrent_insert_tests() {
+    const int per_thread = 100000;
+    for (int nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        tree_type tree;
+        std::vector<std::thread> threads;
+        struct timeval tv1, tv2;
+        gettimeofday(&tv1, nullptr);
+        for (int i = 0; i < nthreads; ++i)
+            threads.emplace_back([&tree, i, nthreads] () {
+                TThread::set_id(i);
+                std::vector<int> keys;
+                for (int k = 0; k < per_thread; ++k)
+                    keys.push_back(k * nthreads + i);
+                std::shuffle(keys.begin(), keys.end(), std::mt19937(i));
+                for (int k : keys) {
+                    TRANSACTION {
+                        tree[k] = k;
+                    } RETRY(true);
+                }
+            });
+        for (auto& t : threads)
+            t.join();
+        gettimeofday(&tv2, nullptr);
+        double secs = (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+
+        for (int base = 0; base < per_thread * nthreads; base += 1000) {
+            TestTransaction after(1);
+            assert(tree.size() == size_t(per_thread * nthreads));
+            for (int k = base; k < base + 1000; ++k)
+                assert(tree.count(k) == 1);
+            assert(after.try_commit());
+        }
+        printf("%d writers: %.0f inserts/sec\n", nthreads, per_thread * nthreads / secs);
+    }
+}
+
 int main() {
     // test single-threaded operations
     {
@@ -255,12 +429,13 @@ int main() {
         }
         assert(tree.size() == 100);
 
-        // iterators
-        //int i = 100;
-        //for (auto it = tree.begin(); it != tree.end(); it++) {
-        //    std::cout << "iterator is " << *it << std::endl;
-        //    assert((*it) == i--);
-        //}
+        // iterate_my_inserts
+        int n = 0;
+        for (auto it = tree.begin(); it != tree.end(); ++it, ++n) {
+            assert(it->first == n);
+            assert((int) it->second == 100 - n);
+        }
+        assert(n == 100);
         
         // count_my_inserts
         for (int i = 0; i < 100; ++i) {
@@ -295,7 +470,9 @@ int main() {
     erase_conflict_tests();
     update_conflict_tests();
     insert_then_delete_tests();
+    iterator_tests();
     mem_tests();
+    concurrent_insert_tests();
     // test abort-cleanup
     std::cout << "ALL TESTS PASS!!" << std:: endl;
     return 0;
@@ -0,0 +1,135 @@
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <stdlib.h>
+#include <new>
+#include <sys/time.h>
+#include "layoutLock/LayoutTree.hh"
+#include "clp.h"
+
+// Compare the reader-writer locks in layoutLock/llock.hh. Every thread
+// runs a share of ntrans critical sections; one in writefreq is a write.
+// Reported times are per critical section, so they include handing the
+// lock from writers to readers and back.
+//   scalar   ScalarRPRWLockImpl_, one shared reader counter
+//   scalable ScalableRWLock, one slot per thread
+//   numa     NumaRWLock, one reader counter per NUMA node
+
+int ntrans = 1000000;
+int writefreq = 100;
+int only_nthreads = 0;
+static const int thread_counts[] = {2, 8, 32, 64};
+
+// the protected data; a writer makes it odd while it holds the lock
+volatile unsigned long shared_data;
+
+template <typename L>
+struct Tester {
+    L* lock;
+    int me;
+    int n;
+};
+
+template <typename L>
+void* runFunc(void* x) {
+    Tester<L>* t = (Tester<L>*) x;
+    NumaRWLock<64>::setup();
+    unsigned r = t->me + 1;
+    for (int i = 0; i < t->n; ++i) {
+        if (writefreq && rand_r(&r) % writefreq == 0) {
+            t->lock->write_lock();
+            ++shared_data;
+            ++shared_data;
+            t->lock->write_unlock();
+        } else {
+            t->lock->read_lock();
+            assert(!(shared_data & 1));
+            t->lock->read_unlock();
+        }
+    }
+    return nullptr;
+}
+
+double elapsed(struct timeval tv1, struct timeval tv2) {
+    return (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+}
+
+template <typename L>
+void bench(const char* name, int nthreads) {
+    // NumaRWLock is cache-line aligned, which plain new does not guarantee
+    void* mem;
+    if (posix_memalign(&mem, CACHE_LINE_SIZE, sizeof(L)) != 0)
+        abort();
+    L* lock = new (mem) L;
+    NumaRWLock<64>::reset();
+    pthread_t tids[nthreads];
+    Tester<L> testers[nthreads];
+    struct timeval tv1, tv2;
+    gettimeofday(&tv1, NULL);
+    for (int i = 0; i < nthreads; ++i) {
+        testers[i] = Tester<L>{lock, i, ntrans / nthreads};
+        pthread_create(&tids[i], NULL, runFunc<L>, &testers[i]);
+    }
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(tids[i], NULL);
+    gettimeofday(&tv2, NULL);
+    double t = elapsed(tv1, tv2);
+    printf("%-9s %3d %f %8.1f\n", name, nthreads, t, t * 1e9 / ntrans);
+    lock->~L();
+    free(mem);
+}
+
+enum {
+    opt_nthreads, opt_ntrans, opt_writefreq
+};
+
+static const Clp_Option options[] = {
+    { "nthreads", 0, opt_nthreads, Clp_ValInt, Clp_Optional },
+    { "ntrans", 0, opt_ntrans, Clp_ValInt, Clp_Optional },
+    { "writefreq", 0, opt_writefreq, Clp_ValInt, Clp_Optional }
+};
+
+static void help() {
+    printf("Usage: [OPTIONS]\n\
+           Options:\n\
+           --nthreads=NTHREADS, run only this thread count, at most 64 (default 2, 8, 32 and 64)\n\
+           --ntrans=NTRANS, how many total critical sections to run (they'll be split between threads) (default %d)\n\
+           --writefreq=N, one critical section in N is a write, 0 for none (default %d)\n",
+           ntrans, writefreq);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    Clp_Parser *clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+            case opt_nthreads:
+                only_nthreads = clp->val.i;
+                break;
+            case opt_ntrans:
+                ntrans = clp->val.i;
+                break;
+            case opt_writefreq:
+                writefreq = clp->val.i;
+                break;
+            default:
+                help();
+        }
+    }
+    Clp_DeleteParser(clp);
+    if (only_nthreads < 0 || only_nthreads > 64)
+        help();
+
+    printf("lock      thr time     ns/op\n");
+    for (int nthreads : thread_counts) {
+        if (only_nthreads)
+            nthreads = only_nthreads;
+        bench<ScalarRPRWLockImpl_>("scalar", nthreads);
+        bench<ScalableRWLock<64>>("scalable", nthreads);
+        bench<NumaRWLock<64>>("numa", nthreads);
+        if (only_nthreads)
+            break;
+    }
+    return 0;
+}
@@ -1,11 +1,14 @@
 #include <iostream>
 #include <assert.h>
 #include <stdio.h>
+#include <vector>
 
 #include "Hashtable.hh"
 #include "MassTrans.hh"
+#include "SkipList.hh"
 #include "List.hh"
 #include "Queue.hh"
+#include "TQueue.hh"
 #include "Transaction.hh"
 #include "IntStr.hh"
 
@@ -15,8 +18,8 @@ volatile mrcu_epoch_type active_epoch = 1;
 
 using namespace std;
 
-template <typename T> class IntMassTrans {
-    MassTrans<T> m_;
+template <typename T, typename Box = versioned_value_struct<T>> class IntMassTrans {
+    MassTrans<T, Box> m_;
 public:
     bool transGet(int k, T& v) {
         return m_.transGet(IntStr(k).str(), v);
@@ -33,13 +36,21 @@ public:
     bool transDelete(int k) {
         return m_.transDelete(IntStr(k).str());
     }
+    template <typename Op>
+    bool transApply(int k, Op op) {
+        return m_.transApply(IntStr(k).str(), op);
+    }
+    bool transIncrement(int k, T delta) {
+        return m_.transIncrement(IntStr(k).str(), delta);
+    }
     void thread_init() {
         m_.thread_init();
     }
 };
 
+template <template <typename, unsigned, template <typename> class> class QueueType>
 void queueTests() {
-    Queue<int> q;
+    QueueType<int, 256, TOpaqueWrapped> q;
     int p;
 
     // NONEMPTY TESTS
@@ -264,6 +275,75 @@ void queueTests() {
         assert(!q.transPop());
         assert(t.try_commit());
     }
+
+    {
+        // elements spanning several chunks come out in FIFO order
+        QueueType<int, 4, TOpaqueWrapped> cq;
+        {
+            TransactionGuard t;
+            for (int i = 0; i < 10; ++i)
+                cq.transPush(i);
+        }
+        for (int i = 0; i < 10; ++i) {
+            TransactionGuard t;
+            assert(cq.transFront(p) && p == i);
+            assert(cq.transPop());
+            cq.transPush(i + 10);
+        }
+        for (int i = 0; i < 10; ++i)
+            assert(cq.nontrans_pop() == i + 10);
+        assert(cq.nontrans_empty());
+        cq.nontrans_push(7);
+        {
+            TransactionGuard t;
+            assert(cq.transFront(p) && p == 7);
+            assert(cq.transPop());
+            assert(!cq.transPop());
+        }
+    }
+}
+
+// TQueue producers commute: pushes neither conflict with each other nor with
+// pops of elements that already exist
+void tqueueTests() {
+    TQueue<int> q;
+    int p;
+    {
+        TestTransaction t1(1);
+        q.transPush(1);
+        TestTransaction t2(2);
+        q.transPush(2);
+        q.transPush(3);
+        assert(t1.try_commit());
+        assert(t2.try_commit());
+    }
+    {
+        TestTransaction t1(1);
+        assert(q.transFront(p) && p == 1);
+        assert(q.transPop());
+        TestTransaction t2(2);
+        q.transPush(4);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    {
+        TransactionGuard t;
+        for (int i = 2; i <= 4; ++i) {
+            assert(q.transFront(p) && p == i);
+            assert(q.transPop());
+        }
+        assert(!q.transPop());
+    }
+    {
+        // a pop that saw the queue empty conflicts with a later push
+        TestTransaction t1(1);
+        assert(!q.transFront(p));
+        q.transPush(5);
+        TestTransaction t2(2);
+        q.transPush(6);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
 }
 
 void linkedListTests() {
@@ -445,6 +525,81 @@ void rangeQueryTest() {
   }
 }
 
+void scanReadMyWritesTest() {
+  MassTrans<int> h;
+  {
+      TransactionGuard t_init;
+      for (int i = 10; i < 20; ++i)
+          assert(h.transInsert(IntStr(i).str(), i));
+  }
+
+  {
+  TransactionGuard t;
+  assert(h.transInsert(IntStr(25).str(), 25));
+  assert(h.transDelete(IntStr(12).str()));
+  h.transPut(IntStr(13).str(), 130);
+
+  std::vector<int> seen;
+  auto collect = [&] (Masstree::Str, const int& v) { seen.push_back(v); return true; };
+  size_t n = h.transScan("10", Masstree::Str(), collect);
+  assert(n == 10);
+  assert((seen == std::vector<int>{10, 11, 130, 14, 15, 16, 17, 18, 19, 25}));
+
+  seen.clear();
+  n = h.transScan("10", Masstree::Str(), collect, 3);
+  assert(n == 3);
+  assert((seen == std::vector<int>{10, 11, 130}));
+
+  seen.clear();
+  n = h.transRScan("25", "14", collect, 2);
+  assert(n == 2);
+  assert((seen == std::vector<int>{25, 19}));
+
+  seen.clear();
+  n = h.transPrefixScan("1", collect);
+  assert(n == 9);
+  assert(seen.front() == 10 && seen.back() == 19);
+
+  seen.clear();
+  n = h.transPrefixScan("2", collect);
+  assert(n == 1 && seen[0] == 25);
+  }
+}
+
+void multiGetTest() {
+  MassTrans<int> h;
+  {
+      TransactionGuard t_init;
+      for (int i = 0; i < 40; i += 2)
+          assert(h.transInsert(IntStr(i).str(), i + 100));
+  }
+
+  {
+  TransactionGuard t;
+  assert(h.transInsert(IntStr(41).str(), 141));
+  assert(h.transDelete(IntStr(4).str()));
+
+  std::vector<std::string> keys;
+  for (int i = 40; i >= 0; --i)
+      keys.push_back(std::to_string(i));
+  std::vector<int> vals(keys.size(), -1);
+  bool found[64];
+  size_t n = h.transMultiGet(keys.data(), keys.size(), vals.data(), found);
+  assert(n == 19);
+  for (size_t k = 0; k < keys.size(); ++k) {
+      int i = 40 - k;
+      bool expect = i % 2 == 0 && i != 4 && i != 40;
+      assert(found[k] == expect);
+      if (expect)
+          assert(vals[k] == i + 100);
+  }
+
+  std::string mine = "41";
+  int v;
+  assert(h.transMultiGet(&mine, 1, &v, found) == 1 && v == 141);
+  }
+}
+
 template <typename K, typename V>
 void basicQueryTests(MassTrans<K, V>& h) {
   TransactionGuard t19;
@@ -580,6 +735,184 @@ void basicMapTests(MapType& h) {
   basicQueryTests(h);
 }
 
+template <typename MapType>
+void applyTests(MapType& h) {
+  int v;
+  {
+      TransactionGuard t;
+      assert(h.transInsert(100, 10));
+  }
+
+  // blind increments commute, so neither transaction aborts
+  TestTransaction t1(1);
+  assert(h.transIncrement(100, 1));
+  h.transIncrement(100, 2);
+  TestTransaction t2(2);
+  assert(h.transIncrement(100, 5));
+  assert(t2.try_commit());
+  assert(t1.try_commit());
+  {
+      TransactionGuard t;
+      assert(h.transGet(100, v) && v == 18);
+  }
+
+  // reading a pending increment sees the merged value and validates it
+  TestTransaction t3(1);
+  assert(h.transIncrement(100, 1));
+  assert(h.transGet(100, v) && v == 19);
+  TestTransaction t4(2);
+  h.transIncrement(100, 1);
+  assert(t4.try_commit());
+  assert(!t3.try_commit());
+
+  // mixing with puts in one transaction
+  {
+      TransactionGuard t;
+      h.transPut(100, 1);
+      h.transApply(100, [] (int& x) { x *= 3; });
+      assert(h.transGet(100, v) && v == 3);
+      h.transIncrement(100, 1);
+  }
+  {
+      TransactionGuard t;
+      assert(h.transGet(100, v) && v == 4);
+      h.transIncrement(100, 5);
+      h.transPut(100, 7);
+  }
+  {
+      TransactionGuard t;
+      assert(h.transGet(100, v) && v == 7);
+  }
+
+  // absent keys start from Value()
+  {
+      TransactionGuard t;
+      assert(!h.transIncrement(101, 3));
+      assert(h.transGet(101, v) && v == 3);
+      h.transIncrement(101, 1);
+  }
+  {
+      TransactionGuard t;
+      assert(h.transGet(101, v) && v == 4);
+  }
+
+  // a blind increment still aborts if its key is deleted underneath it
+  TestTransaction t5(1);
+  h.transIncrement(101, 1);
+  TestTransaction t6(2);
+  assert(h.transDelete(101));
+  assert(t6.try_commit());
+  assert(!t5.try_commit());
+
+  {
+      TransactionGuard t;
+      h.transIncrement(100, 1);
+      assert(h.transDelete(100));
+      assert(!h.transGet(100, v));
+  }
+  {
+      TransactionGuard t;
+      assert(!h.transGet(100, v) && !h.transGet(101, v));
+  }
+}
+
+void skipListRangeTest() {
+  SkipList<int, int> h;
+  {
+      TransactionGuard t_init;
+      for (int i = 10; i < 100; i += 2)
+          assert(h.transInsert(i, i + 1));
+  }
+
+  {
+  TransactionGuard t;
+  assert(h.transInsert(25, 250));
+  assert(h.transDelete(12));
+  h.transPut(14, 140);
+
+  std::vector<int> seen;
+  auto collect = [&] (int, const int& v) { seen.push_back(v); return true; };
+  h.transQuery(10, 30, collect);
+  assert((seen == std::vector<int>{11, 140, 17, 19, 21, 23, 25, 250, 27, 29}));
+
+  seen.clear();
+  h.transQuery(11, 20, [&] (int k, const int& v) { seen.push_back(v); return k < 16; });
+  assert((seen == std::vector<int>{140, 17}));
+
+  seen.clear();
+  h.transQuery(100, 200, collect);
+  assert(seen.empty());
+  }
+
+  // an insert into a scanned range aborts the scanner
+  TestTransaction t1(1);
+  int n = 0;
+  h.transQuery(30, 40, [&] (int, const int&) { ++n; return true; });
+  assert(n == 5);
+  // need a write as well otherwise this txn would successfully commit as read-only
+  h.transPut(1000, 0);
+  TestTransaction t2(2);
+  assert(h.transInsert(33, 34));
+  assert(t2.try_commit());
+  assert(!t1.try_commit());
+
+  // an insert outside the scanned range doesn't
+  TestTransaction t3(1);
+  n = 0;
+  h.transQuery(40, 50, [&] (int, const int&) { ++n; return true; });
+  assert(n == 5);
+  h.transPut(1000, 0);
+  TestTransaction t4(2);
+  assert(h.transInsert(51, 52));
+  assert(h.transInsert(37, 38));
+  assert(t4.try_commit());
+  assert(t3.try_commit());
+
+  // a committed delete in the range aborts the scanner too
+  TestTransaction t5(1);
+  n = 0;
+  h.transQuery(50, 60, [&] (int, const int&) { ++n; return true; });
+  assert(n == 6);
+  h.transPut(1000, 0);
+  TestTransaction t6(2);
+  assert(h.transDelete(54));
+  assert(t6.try_commit());
+  assert(!t5.try_commit());
+
+  // inserting and deleting our own key leaves the gap observed
+  TestTransaction t7(1);
+  int x;
+  assert(h.transInsert(61, 62));
+  assert(h.transDelete(61));
+  assert(!h.transGet(61, x));
+  h.transPut(1000, 0);
+  TestTransaction t8(2);
+  assert(h.transInsert(61, 63));
+  assert(t8.try_commit());
+  assert(!t7.try_commit());
+
+  // our insert into a scanned gap splits it; an insert behind our node
+  // still lands in the range we scanned
+  TestTransaction t9(1);
+  n = 0;
+  h.transQuery(100, 200, [&] (int, const int&) { ++n; return true; });
+  assert(n == 0);
+  assert(h.transInsert(110, 111));
+  TestTransaction t10(2);
+  assert(h.transInsert(150, 151));
+  assert(t10.try_commit());
+  assert(!t9.try_commit());
+
+  {
+      TransactionGuard t;
+      assert(h.transGet(61, x) && x == 63);
+      assert(!h.transGet(54, x));
+      assert(h.transGet(37, x) && x == 38);
+      assert(!h.transGet(110, x) && h.transGet(150, x));
+  }
+  assert(h.nontrans_size() == 50);
+}
+
 int main() {
 
   // run on both Hashtable and MassTrans
@@ -588,6 +921,13 @@ int main() {
   IntMassTrans<int> m;
   m.thread_init();
   basicMapTests(m);
+  IntMassTrans<int, compact_versioned_value<int>> mi;
+  basicMapTests(mi);
+  SkipList<int, int> s;
+  basicMapTests(s);
+  applyTests(h);
+  applyTests(m);
+  applyTests(mi);
 
   // insert-then-delete node test
   insertDeleteTest(false);
@@ -597,11 +937,16 @@ int main() {
   insertDeleteSeparateTest();
 
   rangeQueryTest();
+  scanReadMyWritesTest();
+  multiGetTest();
+  skipListRangeTest();
 
   // string key testing
   stringKeyTests();
 
   linkedListTests();
   
-  queueTests();
+  queueTests<Queue>();
+  queueTests<TQueue>();
+  tqueueTests();
 }
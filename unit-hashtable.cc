@@ -0,0 +1,235 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+
+typedef Hashtable<int, int> table_type;
+
+// Make @key hot: every round, a reader of @key loses to a writer of it
+// at commit. Four conflicts are enough.
+void makeHot(table_type& h, int key) {
+    for (int i = 0; i < 4; ++i) {
+        int v;
+        TestTransaction t1(1);
+        assert(h.transGet(key, v));
+        h.transPut(key, v + 1);
+        TestTransaction t2(2);
+        h.transPut(key, 100);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+}
+
+void testColdStaysOptimistic() {
+    table_type h;
+    h.nontrans_set_adaptive_cc(true);
+    {
+        TransactionGuard t;
+        h.transInsert(1, 10);
+    }
+    // two writers of a cold key both get through to commit time
+    int v;
+    TestTransaction t1(1);
+    assert(h.transGet(1, v) && v == 10);
+    h.transPut(1, 11);
+    TestTransaction t2(2);
+    assert(h.transGet(1, v) && v == 10);
+    h.transPut(1, 12);
+    assert(t2.try_commit());
+    assert(!t1.try_commit());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testHotLocksEarly() {
+    table_type h;
+    h.nontrans_set_adaptive_cc(true);
+    {
+        TransactionGuard t;
+        h.transInsert(1, 10);
+        h.transInsert(2, 20);
+    }
+    makeHot(h, 1);
+
+    {
+        // t1 holds key 1 in shared mode from its first read on: t2 can
+        // read it too, but t3 can't write it
+        int v, v1;
+        TestTransaction t1(1);
+        assert(h.transGet(1, v1) && v1 == 100);
+        TestTransaction t2(2);
+        assert(h.transGet(1, v) && v == 100);
+        try {
+            TestTransaction t3(3);
+            h.transPut(1, 5);
+            assert(false && "shouldn't get here");
+        } catch (Transaction::Abort e) {
+        }
+        // other keys are unaffected
+        TestTransaction t4(4);
+        assert(h.transGet(2, v) && v == 20);
+        h.transPut(2, 21);
+        assert(t4.try_commit());
+        // t1's write waits for t2 to let go
+        t1.use();
+        h.transPut(1, v1 + 1);
+        t2.use();
+        assert(t2.try_commit());
+        t1.use();
+        assert(t1.try_commit());
+    }
+
+    {
+        // a hot write locks exclusively, so nobody else can even read
+        TestTransaction t1(1);
+        h.transPut(1, 102);
+        try {
+            TestTransaction t2(2);
+            int v;
+            h.transGet(1, v);
+            assert(false && "shouldn't get here");
+        } catch (Transaction::Abort e) {
+        }
+        t1.use();
+        h.transPut(1, 101);
+        assert(t1.try_commit());
+    }
+
+    {
+        // the lock went with the commit
+        TransactionGuard t;
+        int v;
+        assert(h.transGet(1, v) && v == 101);
+        assert(h.transGet(2, v) && v == 21);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testHotAbortReleases() {
+    table_type h;
+    h.nontrans_set_adaptive_cc(true);
+    {
+        TransactionGuard t;
+        h.transInsert(1, 10);
+    }
+    makeHot(h, 1);
+
+    int v;
+    try {
+        TestTransaction t1(1);
+        h.transPut(1, 50);
+        Sto::abort();
+    } catch (Transaction::Abort e) {
+    }
+    {
+        // an unfinished transaction releases its locks too
+        TestTransaction t2(2);
+        assert(h.transGet(1, v) && v == 100);
+    }
+    {
+        TestTransaction t3(3);
+        assert(h.transDelete(1));
+        assert(t3.try_commit());
+    }
+    {
+        TransactionGuard t;
+        assert(!h.transGet(1, v));
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Threads repeatedly increment a few keys with read-modify-write, as in a
+// skewed workload: all the conflicts are on those keys.
+static const int nkeys = 2;
+static const int nincrements = 20000;
+static const int nthreads = 4;
+
+struct Incrementer {
+    table_type* h;
+    int me;
+    long attempts;
+};
+
+void* incrementThread(void* x) {
+    Incrementer* in = (Incrementer*) x;
+    TThread::set_id(in->me);
+    Sto::update_threadid();
+    for (int i = 0; i < nincrements / nthreads; ++i) {
+        TRANSACTION {
+            ++in->attempts;
+            for (int k = 0; k < nkeys; ++k) {
+                int v;
+                in->h->transGet(k, v);
+                in->h->transPut(k, v + 1);
+            }
+        } RETRY(true);
+    }
+    return nullptr;
+}
+
+void testHotIncrements() {
+    table_type h;
+    h.nontrans_set_adaptive_cc(true);
+    for (int k = 0; k < nkeys; ++k) {
+        TransactionGuard t;
+        h.transInsert(k, 0);
+    }
+
+    pthread_t tids[nthreads];
+    Incrementer ins[nthreads];
+    for (int i = 0; i < nthreads; ++i) {
+        ins[i] = Incrementer{&h, i, 0};
+        pthread_create(&tids[i], NULL, incrementThread, &ins[i]);
+    }
+    long attempts = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+        attempts += ins[i].attempts;
+    }
+
+    for (int k = 0; k < nkeys; ++k) {
+        int v;
+        assert(h.nontrans_find(k, v) && v == nincrements);
+    }
+    printf("PASS: %s (%ld attempts for %d transactions)\n", __FUNCTION__,
+           attempts, nincrements);
+}
+
+void testManyApplies() {
+    table_type h;
+    h.nontrans_insert(1, 1);
+    {
+        // increments fold into one delta; other ops keep their order
+        TestTransaction t1(1);
+        for (int i = 0; i < 100000; ++i)
+            h.transIncrement(1, 1);
+        h.transApply(1, [] (int& v) { v |= 1 << 20; });
+        h.transIncrement(2, 5);
+        TestTransaction t2(2);
+        h.transIncrement(1, 10);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    int v;
+    assert(h.nontrans_find(1, v) && v == ((11 | 1 << 20) + 100000));
+    assert(h.nontrans_find(2, v) && v == 5);
+    {
+        TransactionGuard t;
+        h.transIncrement(1, 3);
+        h.transIncrement(1, 4);
+        assert(h.transGet(1, v) && v == ((11 | 1 << 20) + 100007));
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testColdStaysOptimistic();
+    testHotLocksEarly();
+    testHotAbortReleases();
+    testHotIncrements();
+    testManyApplies();
+    std::cout << "All tests pass!" << std::endl;
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <assert.h>
 #include <vector>
+#include <numeric>
 #include "Transaction.hh"
 #include "TArray.hh"
 #include "TBox.hh"
@@ -270,6 +271,145 @@ void testNoOpacity1() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+template <template <typename, typename, unsigned> class L>
+void testLayout(const char* name) {
+    TArray<int, 100, TOpaqueWrapped, L> f;
+    TArray<std::string, 10, TOpaqueWrapped, L> g;
+    TBox<int> box;
+    for (int i = 0; i < 100; i++)
+        f.nontrans_put(i, i);
+
+    {
+        TransactionGuard t;
+        g[3] = "three";
+        f[7] = -7;
+    }
+
+    {
+        TestTransaction t(1);
+        assert(std::accumulate(f.begin(), f.end(), 0) == 4950 - 14);
+        std::string s = g[3];
+        assert(s == "three");
+        box = 9; /* avoid read-only txn */
+
+        // a neighbour's write doesn't conflict, whatever the layout
+        TestTransaction t1(2);
+        g[4] = "four";
+        assert(t1.try_commit());
+        assert(t.try_commit());
+    }
+
+    {
+        TestTransaction t(1);
+        assert(f[50] == 50);
+        box = 9; /* avoid read-only txn */
+
+        TestTransaction t1(2);
+        f[50] = 51;
+        assert(t1.try_commit());
+        assert(!t.try_commit());
+    }
+
+    assert(f.nontrans_get(50) == 51 && f.nontrans_get(49) == 49);
+    assert(g.nontrans_get(4) == "four");
+    printf("PASS: %s<%s>\n", __FUNCTION__, name);
+}
+
+void testRangeRead() {
+    TArray<int, 1000> f;
+    TBox<int> box;
+    for (int i = 0; i < 1000; i++)
+        f.nontrans_put(i, i);
+
+    {
+        TransactionGuard t;
+        std::vector<int> v(1000);
+        f.transGetRange(0, 1000, v.begin());
+        assert(std::accumulate(v.begin(), v.end(), 0) == 499500);
+    }
+
+    {
+        TestTransaction t(1);
+        int v[100];
+        f.transGetRange(400, 500, v);
+        assert(v[0] == 400 && v[99] == 499);
+        box = 9; /* avoid read-only txn */
+
+        // writes outside the range don't conflict
+        TestTransaction t1(2);
+        f[399] = -1;
+        f[500] = -1;
+        assert(t1.try_commit());
+        assert(t.try_commit());
+    }
+
+    {
+        TestTransaction t(1);
+        int v[100];
+        f.transGetRange(400, 500, v);
+        box = 9; /* avoid read-only txn */
+
+        TestTransaction t1(2);
+        f[450] = -1;
+        assert(t1.try_commit());
+        assert(!t.try_commit());
+    }
+
+    {
+        // a conflict in the last, partial chunk, past its vector lanes
+        TestTransaction t(1);
+        int v[103];
+        f.transGetRange(400, 503, v);
+        box = 9; /* avoid read-only txn */
+
+        TestTransaction t1(2);
+        f[502] = -1;
+        assert(t1.try_commit());
+        assert(!t.try_commit());
+    }
+
+    {
+        // read-my-writes, and writes inside our own range
+        TestTransaction t(1);
+        f[10] = -10;
+        int v[20];
+        f.transGetRange(0, 20, v);
+        assert(v[9] == 9 && v[10] == -10);
+        f[11] = -11;
+        f.transGetRange(0, 20, v);
+        assert(v[11] == -11);
+        assert(t.try_commit());
+        assert(f.nontrans_get(10) == -10 && f.nontrans_get(11) == -11);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void benchRangeRead() {
+    TArray<int, 1000> a;
+    TBox<int> box;
+    for (int i = 0; i < 1000; ++i)
+        a.nontrans_put(i, i);
+    int v[1000];
+
+    for (int range = 0; range != 2; ++range) {
+        double before = gettime_d();
+        for (int iter = 0; iter < 10000; ++iter) {
+            TRANSACTION {
+                if (range)
+                    a.transGetRange(0, 1000, v);
+                else
+                    for (int i = 0; i < 1000; ++i)
+                        v[i] = a[i];
+                box = iter; /* validate at commit */
+            } RETRY(true);
+        }
+        double after = gettime_d();
+        printf("NS PER 1000-ELEMENT READ (%s): %g\n", range ? "transGetRange" : "transGet",
+               (after - before) * 1.0e9 / 10000);
+    }
+}
+
 void benchArray64() {
     TArray<int, 64> a;
     for (int i = 0; i < 64; ++i)
@@ -302,6 +442,11 @@ int main() {
     testConflictingModifyIter3();
     testOpacity1();
     testNoOpacity1();
+    testLayout<TInterleavedLayout>("interleaved");
+    testLayout<TSplitLayout>("split");
+    testLayout<TPaddedLayout>("padded");
+    testRangeRead();
     benchArray64();
+    benchRangeRead();
     return 0;
 }
@@ -0,0 +1,165 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include "Transaction.hh"
+#include "TBoosting.hh"
+#include "TBox.hh"
+
+typedef TBoostedMap<int, int> map_type;
+
+void testSimple() {
+    map_type m;
+
+    {
+        TransactionGuard t;
+        assert(m.transInsert(1, 10));
+        assert(!m.transInsert(1, 11));
+        int v;
+        assert(m.transGet(1, v) && v == 10);
+        assert(!m.transPut(2, 20));
+        assert(m.transPut(2, 21));
+        assert(m.transUpdate(1, 12));
+        assert(!m.transUpdate(3, 30));
+    }
+
+    {
+        TransactionGuard t;
+        int v;
+        assert(m.transGet(1, v) && v == 12);
+        assert(m.transGet(2, v) && v == 21);
+        assert(!m.transGet(3, v));
+        assert(m.transDelete(2));
+        assert(!m.transDelete(2));
+    }
+
+    int v;
+    assert(!m.nontrans_find(2, v));
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testAbortUndoes() {
+    map_type m;
+    TBox<int> box;
+    {
+        TransactionGuard t;
+        m.transInsert(2, 20);
+        m.transInsert(3, 30);
+    }
+
+    {
+        // an OCC conflict on box aborts t1, which undoes its boosted ops
+        TestTransaction t1(1);
+        int x = box;
+        assert(m.transInsert(1, 10));
+        assert(m.transDelete(2));
+        assert(m.transPut(3, 31));
+        assert(m.transInsert(2, 22));
+
+        TestTransaction t2(2);
+        box = x + 1;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    int v;
+    assert(!m.nontrans_find(1, v));
+    assert(m.nontrans_find(2, v) && v == 20);
+    assert(m.nontrans_find(3, v) && v == 30);
+
+    {
+        // its locks are gone too
+        TestTransaction t3(3);
+        assert(m.transDelete(2));
+        assert(t3.try_commit());
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReadersShare() {
+    map_type m;
+    {
+        TransactionGuard t;
+        m.transInsert(1, 10);
+    }
+
+    TestTransaction t1(1);
+    int v;
+    assert(m.transGet(1, v));
+    TestTransaction t2(2);
+    assert(m.transGet(1, v));
+    assert(t2.try_commit());
+    assert(t1.try_commit());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Threads move amounts between random accounts, reading both balances
+// and then writing them, so read locks are upgraded and acquisition
+// order is random: deadlocks are common and must all be broken.
+static const int naccounts = 16;
+static const int ntransfers = 20000;
+static const int nthreads = 4;
+
+struct Transferer {
+    map_type* m;
+    int me;
+};
+
+void* transferThread(void* x) {
+    Transferer* tr = (Transferer*) x;
+    TThread::set_id(tr->me);
+    Sto::update_threadid();
+    unsigned r = tr->me + 1;
+    for (int i = 0; i < ntransfers / nthreads; ++i) {
+        unsigned r_snap = r;
+        TRANSACTION {
+            r = r_snap;
+            int a = rand_r(&r) % naccounts, b = rand_r(&r) % naccounts;
+            int amount = rand_r(&r) % 10;
+            int va = 0, vb = 0;
+            tr->m->transGet(a, va);
+            tr->m->transGet(b, vb);
+            if (a != b) {
+                tr->m->transPut(a, va - amount);
+                tr->m->transPut(b, vb + amount);
+            }
+        } RETRY(true);
+    }
+    return nullptr;
+}
+
+void testDeadlocksBroken() {
+    map_type m;
+    for (int i = 0; i != naccounts; ++i) {
+        TransactionGuard t;
+        m.transInsert(i, 1000);
+    }
+
+    pthread_t tids[nthreads];
+    Transferer trs[nthreads];
+    for (int i = 0; i < nthreads; ++i) {
+        trs[i] = Transferer{&m, i};
+        pthread_create(&tids[i], NULL, transferThread, &trs[i]);
+    }
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(tids[i], NULL);
+
+    int sum = 0;
+    for (int i = 0; i != naccounts; ++i) {
+        int v;
+        assert(m.nontrans_find(i, v));
+        sum += v;
+    }
+    assert(sum == 1000 * naccounts);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testSimple();
+    testAbortUndoes();
+    testReadersShare();
+    testDeadlocksBroken();
+    std::cout << "All tests pass!" << std::endl;
+    return 0;
+}
@@ -245,6 +245,51 @@ void testStringWrapper() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testLargeTransaction() {
+    // more items than the transaction hashtable indexes, and more than
+    // the tset's first chunk directory holds
+    const int n = 33000;
+    TBox<int>* boxes = new TBox<int>[n];
+    TBox<std::string>* sboxes = new TBox<std::string>[n / 100];
+    {
+        TransactionGuard t;
+        for (int i = 0; i < n; ++i)
+            boxes[i] = boxes[i] + 1;
+        for (int i = 0; i < n / 100; ++i)
+            sboxes[i] = std::string(100, 'a');
+        // items past the hashtable are still found, not duplicated
+        assert(boxes[n - 1] == 1 && boxes[n / 2] == 1);
+        boxes[n - 1] = 2;
+    }
+    {
+        // the next transaction reuses the tset and buffer
+        TransactionGuard t;
+        for (int i = 0; i < n / 100; ++i) {
+            sboxes[i] = std::string(100, 'b');
+            boxes[i] = boxes[i] + 1;
+        }
+    }
+
+    {
+        // another big transaction reuses the item index; lookups must not
+        // find the first transaction's items
+        TransactionGuard t;
+        for (int i = n / 2; i < n; ++i)
+            boxes[i] = boxes[i] + 1;
+        assert(boxes[n - 1] == 3 && boxes[n / 2] == 2);
+        for (int i = n / 2; i < n; ++i)
+            boxes[i] = boxes[i] - 1;
+    }
+
+    for (int i = 0; i < n; ++i)
+        assert(boxes[i].nontrans_read() == (i < n / 100 || i == n - 1 ? 2 : 1));
+    for (int i = 0; i < n / 100; ++i)
+        assert(sboxes[i].nontrans_read() == std::string(100, 'b'));
+    delete[] boxes;
+    delete[] sboxes;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testSimpleInt();
     testSimpleString();
@@ -252,5 +297,6 @@ int main() {
     testOpacity1();
     testNoOpacity1();
     testStringWrapper();
+    testLargeTransaction();
     return 0;
 }
@@ -0,0 +1,145 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include "Transaction.hh"
+#include "TCommutative.hh"
+#include "TArray.hh"
+
+typedef TCommutative<int, TCommuteMax<int>> max_type;
+
+void testUpdatesDontConflict() {
+    max_type m;
+    {
+        TestTransaction t1(1);
+        m.update(5);
+        m.update(3);
+        TestTransaction t2(2);
+        m.update(7);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(m.nontrans_read() == 7);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReadsConflict() {
+    max_type m(10);
+    {
+        // reading sees our pending update, and depends on the value
+        TestTransaction t1(1);
+        m.update(12);
+        assert(m == 12);
+        TestTransaction t2(2);
+        m.update(20);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    {
+        // assignment overrides earlier updates; later ones apply to it
+        TransactionGuard t;
+        m.update(30);
+        m = 4;
+        m.update(3);
+        assert(m == 4);
+        m.update(8);
+    }
+    assert(m.nontrans_read() == 8);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testBoxMixedOps() {
+    TBox<int> b(10);
+    TBox<std::string> log;
+    {
+        TestTransaction t1(1);
+        b.commute<TCommuteAdd<int>>(5);
+        log.commute<TCommuteAppend<std::string>>("a");
+        TestTransaction t2(2);
+        b.commute<TCommuteAdd<int>>(1);
+        log.commute<TCommuteAppend<std::string>>("b");
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(b.nontrans_read() == 16);
+    assert(log.nontrans_read() == "ba");
+    {
+        // a different op has to read the box
+        TestTransaction t1(1);
+        b.commute<TCommuteAdd<int>>(4);
+        b.commute<TCommuteMax<int>>(15);
+        TestTransaction t2(2);
+        b.commute<TCommuteAdd<int>>(1);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(b.nontrans_read() == 17);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testArrayFlags() {
+    TArray<unsigned, 8> a;
+    {
+        TestTransaction t1(1);
+        a.transCommute<TCommuteOr<unsigned>>(3, 1);
+        TestTransaction t2(2);
+        a.transCommute<TCommuteOr<unsigned>>(3, 4);
+        a.transCommute<TCommuteOr<unsigned>>(5, 2);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    {
+        TransactionGuard t;
+        a.transCommute<TCommuteOr<unsigned>>(5, 8);
+        std::vector<unsigned> v;
+        a.transGetRange(0, 8, std::back_inserter(v));
+        assert(v[3] == 5 && v[5] == 10);
+        a[6] = 1;
+        a.transCommute<TCommuteOr<unsigned>>(6, 2);
+        assert(a[6] == 3);
+    }
+    assert(a.nontrans_get(5) == 10 && a.nontrans_get(6) == 3);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Threads record the largest value they've seen and set flag bits, as in
+// max-timestamp and flag-word slots that everyone updates.
+static const int nthreads = 4;
+static const int nupdates = 20000;
+max_type max_seen;
+TArray<unsigned, 2> flag_words;
+
+void* updateThread(void* x) {
+    int me = (intptr_t) x;
+    TThread::set_id(me);
+    Sto::update_threadid();
+    for (int i = 0; i < nupdates; ++i) {
+        TRANSACTION {
+            max_seen.update(i * nthreads + me);
+            flag_words.transCommute<TCommuteOr<unsigned>>(i % 2, 1U << ((i / 2 + me) % 16));
+        } RETRY(true);
+    }
+    return nullptr;
+}
+
+void testConcurrentUpdates() {
+    pthread_t tids[nthreads];
+    for (intptr_t i = 0; i < nthreads; ++i)
+        pthread_create(&tids[i], NULL, updateThread, (void*) i);
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(tids[i], NULL);
+    assert(max_seen.nontrans_read() == (nupdates - 1) * nthreads + nthreads - 1);
+    assert(flag_words.nontrans_get(0) == 0xFFFF && flag_words.nontrans_get(1) == 0xFFFF);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testUpdatesDontConflict();
+    testReadsConflict();
+    testBoxMixedOps();
+    testArrayFlags();
+    testConcurrentUpdates();
+    std::cout << "All tests pass!" << std::endl;
+    return 0;
+}
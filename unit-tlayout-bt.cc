@@ -5,6 +5,7 @@
 #include <vector>
 #include <thread>
 #include <unistd.h>
+#include <sys/time.h>
 
 //#include "Transaction.hh"
 #include "TLayoutBT.hh"
@@ -33,7 +34,231 @@ void thread_f (int i){
 	
 }
 
+typedef TLayoutBT<unsigned> tree_type;
+
+// keys not in the initial tree
+static unsigned fresh_key(tree_type& tree, dptrtype* dirtyP, unsigned from) {
+	while (1) {
+		bool present;
+		TRANSACTION {
+			present = tree.search(from, dirtyP);
+		} RETRY(false);
+		if (!present)
+			return from;
+		++from;
+	}
+}
+
+void testInsertSearch() {
+	tree_type tree;
+	dptrtype* dirtyP = tree.llock_.getDirtyP();
+	unsigned k = fresh_key(tree, dirtyP, 12345);
+
+	{
+		TestTransaction t1(1);
+		assert(tree.insert(k, dirtyP));
+		// read our own write
+		assert(tree.search(k, dirtyP));
+		assert(!tree.insert(k, dirtyP));
+		assert(t1.try_commit());
+	}
+	{
+		TestTransaction t1(1);
+		assert(tree.search(k, dirtyP));
+		assert(tree.remove(k, dirtyP));
+		assert(!tree.search(k, dirtyP));
+		assert(!tree.remove(k, dirtyP));
+		assert(t1.try_commit());
+	}
+	{
+		TestTransaction t1(1);
+		assert(!tree.search(k, dirtyP));
+		assert(t1.try_commit());
+	}
+	printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testOptimisticTreelets() {
+	tree_type tree;
+	dptrtype* dirtyP = tree.llock_.getDirtyP();
+	unsigned k = fresh_key(tree, dirtyP, 54321);
+
+	{
+		// readers of the same treelet don't block each other
+		TestTransaction t1(1);
+		assert(!tree.search(k, dirtyP));
+		TestTransaction t2(2);
+		assert(!tree.search(k, dirtyP));
+		assert(t2.try_commit());
+		assert(t1.try_commit());
+	}
+	{
+		// nor does a reader block a writer until the writer commits
+		TestTransaction t1(1);
+		assert(!tree.search(k, dirtyP));
+		TestTransaction t2(2);
+		assert(tree.insert(k, dirtyP));
+		assert(t2.try_commit());
+		assert(!t1.try_commit());
+	}
+	{
+		// a writer whose treelet changed underneath it aborts
+		TestTransaction t1(1);
+		assert(tree.remove(k, dirtyP));
+		TestTransaction t2(2);
+		assert(tree.remove(k, dirtyP));
+		assert(t2.try_commit());
+		assert(!t1.try_commit());
+	}
+	printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Readers keep checking a fixed set of keys while a writer inserts enough
+// keys to rebuild the backbone underneath them. Nontransactional readers
+// (LayoutTree::search) are outside any RCU epoch; the rebuild must drain
+// them before freeing what they may still be looking at.
+static const unsigned rebuild_base = 1000;
+static const int rebuild_inserts = 2000;
+static volatile bool rebuild_done;
+
+struct RebuildTester {
+	tree_type* tree;
+	int me;
+	bool nontrans;
+	long nread;
+};
+
+void* rebuildReader(void* x) {
+	RebuildTester* rt = (RebuildTester*) x;
+	TThread::set_id(rt->me);
+	Sto::update_threadid();
+	Layout_Lock::setup();
+	dptrtype* dirtyP = rt->tree->llock_.getDirtyP();
+	unsigned r = rt->me;
+	while (!rebuild_done) {
+		if (rt->nontrans) {
+			for (int j = 0; j < 8; ++j)
+				assert(rt->tree->LayoutTree::search(rebuild_base + 2 * (rand_r(&r) % 100), dirtyP));
+			++rt->nread;
+			continue;
+		}
+		unsigned r_snap = r;
+		TRANSACTION {
+			r = r_snap;
+			for (int j = 0; j < 8; ++j)
+				assert(rt->tree->search(rebuild_base + 2 * (rand_r(&r) % 100), dirtyP));
+		} RETRY(true);
+		++rt->nread;
+	}
+	return nullptr;
+}
+
+void testConcurrentRebuild(bool nontrans) {
+	// a small backbone, so rebuilding it is cheap
+	tree_type tree(4);
+	dptrtype* dirtyP = tree.llock_.getDirtyP();
+	for (unsigned i = 0; i != 100; ++i) {
+		TRANSACTION {
+			tree.insert(rebuild_base + 2 * i, dirtyP);
+		} RETRY(false);
+	}
+	int size0 = tree.size(tree.head);
+	assert(tree.backboneSize == 0);
+
+	rebuild_done = false;
+	const int nreaders = 3;
+	pthread_t tids[nreaders];
+	RebuildTester rts[nreaders];
+	for (int i = 0; i < nreaders; ++i) {
+		rts[i] = RebuildTester{&tree, i + 1, nontrans, 0};
+		pthread_create(&tids[i], NULL, rebuildReader, &rts[i]);
+	}
+	// odd keys above the checked range
+	for (int i = 0; i != rebuild_inserts; ++i) {
+		TRANSACTION {
+			tree.insert(rebuild_base + 1001 + 2 * i, dirtyP);
+		} RETRY(true);
+	}
+	rebuild_done = true;
+	for (int i = 0; i < nreaders; ++i)
+		pthread_join(tids[i], NULL);
+
+	// rebuilt at least once (old nodes are freed, so head may be reused)
+	assert(tree.backboneSize > 0);
+	assert(tree.size(tree.head) == size0 + rebuild_inserts);
+	for (int i = 0; i != rebuild_inserts; ++i) {
+		TRANSACTION {
+			assert(tree.search(rebuild_base + 1001 + 2 * i, dirtyP));
+		} RETRY(false);
+	}
+	printf("PASS: %s%s\n", __FUNCTION__, nontrans ? " (nontransactional readers)" : "");
+}
+
+// Read-mostly scaling: each transaction searches bench_ops random keys and,
+// one time in ten, also inserts or removes one.
+static const int bench_ops = 8;
+static const int bench_ntrans = 200000;
+static const unsigned bench_keys = 1 << 16;
+
+struct Bench {
+	tree_type* tree;
+	int me;
+	int ntrans;
+};
+
+void* benchThread(void* x) {
+	Bench* b = (Bench*) x;
+	TThread::set_id(b->me);
+	Sto::update_threadid();
+	Layout_Lock::setup();
+	dptrtype* dirtyP = b->tree->llock_.getDirtyP();
+	unsigned r = b->me + 1;
+	for (int i = 0; i < b->ntrans; ++i) {
+		unsigned r_snap = r;
+		TRANSACTION {
+			r = r_snap;
+			for (int j = 0; j < bench_ops; ++j)
+				b->tree->search(rand_r(&r) % bench_keys, dirtyP);
+			if (rand_r(&r) % 10 == 0) {
+				unsigned k = rand_r(&r) % bench_keys;
+				if (k % 2)
+					b->tree->insert(k, dirtyP);
+				else
+					b->tree->remove(k, dirtyP);
+			}
+		} RETRY(true);
+	}
+	return nullptr;
+}
+
+void benchReadMostly() {
+	printf("read-mostly scaling (%d searches/txn, 10%% writers, %d txns)\n", bench_ops, bench_ntrans);
+	for (int nthreads = 1; nthreads <= 8; nthreads *= 2) {
+		tree_type tree;
+		pthread_t tids[nthreads];
+		Bench bs[nthreads];
+		struct timeval tv1, tv2;
+		gettimeofday(&tv1, NULL);
+		for (int i = 0; i < nthreads; ++i) {
+			bs[i] = Bench{&tree, i, bench_ntrans / nthreads};
+			pthread_create(&tids[i], NULL, benchThread, &bs[i]);
+		}
+		for (int i = 0; i < nthreads; ++i)
+			pthread_join(tids[i], NULL);
+		gettimeofday(&tv2, NULL);
+		double t = (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+		printf("  %d threads: %f s, %.0f txns/s", nthreads, t, bench_ntrans / t);
+#if STO_PROFILE_COUNTERS
+		txp_counters tc = Transaction::txp_counters_combined();
+		printf(" (%llu aborts)", tc.p(txp_total_aborts));
+		Transaction::clear_stats();
+#endif
+		printf("\n");
+	}
+}
+
 int main() {
+	Layout_Lock::setup();
 	TLayoutBT<unsigned> tree;
 	dptrtype* dirtyP = tree.llock_.getDirtyP();
 
@@ -44,6 +269,16 @@ int main() {
 		assert(t1.try_commit());
 	}
 
+	testInsertSearch();
+	testOptimisticTreelets();
+
+	pthread_t advancer;
+	pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+	pthread_detach(advancer);
+	testConcurrentRebuild(false);
+	testConcurrentRebuild(true);
+	benchReadMostly();
+
 	/*std::vector<std::thread> threads;
 
 	for (int i=0; i<10; i++){
@@ -0,0 +1,139 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include <sys/time.h>
+#include "Transaction.hh"
+#include "TransPessimisticLocking.hh"
+
+TransPessimisticLocking locking;
+
+void testReadersShare() {
+    RWLock rw;
+    {
+        TestTransaction t1(1);
+        locking.transReadLock(&rw);
+        locking.transReadLockKey(10);
+        TestTransaction t2(2);
+        locking.transReadLock(&rw);
+        locking.transReadLockKey(10);
+        // repeated acquisitions are no-ops
+        locking.transReadLockKey(10);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    // everything was released at commit
+    assert(rw.tryWriteLock());
+    rw.writeUnlock();
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testWriterExcludes() {
+    locking.clear_stats();
+    {
+        TestTransaction t1(1);
+        locking.transReadLockKey(20);
+        try {
+            TestTransaction t2(2);
+            locking.transWriteLockKey(20);
+            assert(false && "shouldn't get here");
+        } catch (Transaction::Abort e) {
+        }
+        t1.use();
+        // with the other writer gone we can upgrade
+        locking.transWriteLockKey(20);
+        assert(t1.try_commit());
+    }
+    {
+        // the aborted transaction released its locks too
+        TestTransaction t3(3);
+        locking.transWriteLockKey(20);
+        assert(t3.try_commit());
+    }
+    auto s = locking.stats();
+    assert(s.failed == 1 && s.waited == 1 && s.spins > 0);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testAbortReleases() {
+    RWLock rw;
+    SpinLock sl;
+    try {
+        TestTransaction t1(1);
+        locking.transWriteLock(&rw);
+        locking.transSpinLock(&sl);
+        locking.transWriteLockKey(30);
+        Sto::abort();
+    } catch (Transaction::Abort e) {
+    }
+    assert(rw.tryReadLock());
+    rw.readUnlock();
+    assert(sl.tryLock());
+    sl.unlock();
+    {
+        TestTransaction t2(2);
+        locking.transWriteLockKey(30);
+        assert(t2.try_commit());
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Read-lock scaling: every transaction read-locks the same few keys,
+// either through shared RWLock words or through the striped table.
+static const int bench_keys = 8;
+static const int bench_ntrans = 400000;
+RWLock bench_rwlocks[bench_keys];
+
+struct Bench {
+    bool striped;
+    int me;
+    int ntrans;
+};
+
+void* benchThread(void* x) {
+    Bench* b = (Bench*) x;
+    TThread::set_id(b->me);
+    Sto::update_threadid();
+    for (int i = 0; i < b->ntrans; ++i) {
+        TRANSACTION {
+            for (int k = 0; k < bench_keys; ++k)
+                if (b->striped)
+                    locking.transReadLockKey(k);
+                else
+                    locking.transReadLock(&bench_rwlocks[k]);
+        } RETRY(true);
+    }
+    return nullptr;
+}
+
+void benchReaders() {
+    printf("read-lock scaling (%d shared keys/txn, %d txns)\n", bench_keys, bench_ntrans);
+    for (int striped = 0; striped != 2; ++striped)
+        for (int nthreads = 1; nthreads <= 8; nthreads *= 2) {
+            pthread_t tids[nthreads];
+            Bench bs[nthreads];
+            struct timeval tv1, tv2;
+            gettimeofday(&tv1, NULL);
+            for (int i = 0; i < nthreads; ++i) {
+                bs[i] = Bench{bool(striped), i, bench_ntrans / nthreads};
+                pthread_create(&tids[i], NULL, benchThread, &bs[i]);
+            }
+            for (int i = 0; i < nthreads; ++i)
+                pthread_join(tids[i], NULL);
+            gettimeofday(&tv2, NULL);
+            double t = (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+            printf("  %-7s %d threads: %f s, %.0f txns/s\n", striped ? "striped" : "rwlock",
+                   nthreads, t, bench_ntrans / t);
+        }
+    locking.print_stats(stdout);
+}
+
+int main() {
+    testReadersShare();
+    testWriterExcludes();
+    testAbortReleases();
+    benchReaders();
+    std::cout << "All tests pass!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,237 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include "Transaction.hh"
+#include "TArray.hh"
+#include "TBox.hh"
+#include "Hashtable.hh"
+
+typedef TArray<int, 16> array_type;
+// identity hash, so key k lives in bucket k % 8
+typedef Hashtable<int, int> table_type;
+
+void testSumSurvivesWrites() {
+    array_type a;
+    TBox<int> out;
+    for (int i = 0; i != 16; ++i)
+        a.nontrans_put(i, i);
+    {
+        // a write inside the slice that keeps the comparison's outcome
+        TestTransaction t1(1);
+        assert(a.transSum(0, 4) <= 10);
+        out = 1;
+        TestTransaction t2(2);
+        a[2] = 4;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    {
+        // ...and one that flips it
+        TestTransaction t1(1);
+        assert(a.transSum(0, 4) <= 10);
+        out = 2;
+        TestTransaction t2(2);
+        a[3] = 6;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    {
+        // converting the sum to a value pins it, but not the elements
+        TestTransaction t1(1);
+        int sum = a.transSum(0, 4);
+        assert(sum == 11);
+        out = sum;
+        TestTransaction t2(2);
+        a[0] = 1;
+        a[1] = 0;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    {
+        TestTransaction t1(1);
+        int sum = a.transSum(0, 4);
+        out = sum;
+        TestTransaction t2(2);
+        a[0] = 2;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(out.nontrans_read() == 11);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSumOwnWrites() {
+    array_type a;
+    {
+        TransactionGuard t;
+        a[1] = 5;
+        a.transCommute<TCommuteAdd<int>>(2, 3);
+        assert(a.transSum(0, 4) == 8);
+        assert(a.transSum(2, 16) == 3);
+        a[1] = 7;
+        assert(a.transSum(0, 4) > 9);
+    }
+    assert(a.nontrans_get(1) == 7 && a.nontrans_get(2) == 3);
+    {
+        // narrowing the predicate on the same slice
+        TestTransaction t1(1);
+        assert(a.transSum(0, 4) >= 5);
+        assert(a.transSum(0, 4) < 20);
+        a[8] = 1;
+        TestTransaction t2(2);
+        a[3] = 10;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testRangeEmpty() {
+    table_type h(8);
+    TBox<int> out;
+    h.nontrans_insert(2, 2);
+    {
+        // an insert into the same bucket, but outside the range
+        TestTransaction t1(1);
+        assert(h.transCount(10, 12) == 0);
+        out = 1;
+        TestTransaction t2(2);
+        h.transInsert(18, 18);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    {
+        // an insert inside the range
+        TestTransaction t1(1);
+        assert(h.transCount(10, 12) == 0);
+        out = 2;
+        TestTransaction t2(2);
+        h.transInsert(11, 11);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    {
+        // deleting one of two keys leaves `count > 0` alone
+        TransactionGuard t;
+        h.transInsert(10, 10);
+    }
+    {
+        TestTransaction t1(1);
+        assert(h.transCount(10, 12) > 0);
+        out = 3;
+        TestTransaction t2(2);
+        h.transDelete(11);
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(out.nontrans_read() == 3);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testCountOwnWrites() {
+    table_type h(8);
+    h.nontrans_insert(3, 3);
+    {
+        TransactionGuard t;
+        assert(h.transCount(0, 8) == 1);
+        h.transInsert(4, 4);
+        h.transInsert(5, 5);
+        h.transDelete(3);
+        assert(h.transCount(0, 8) == 2);
+        assert(h.transCount(0, 5) == 1);
+        h.transDelete(5);
+        assert(h.transCount(5, 6) == 0);
+    }
+    {
+        TransactionGuard t;
+        assert(h.transCount(0, 8) == 1);
+        int v;
+        assert(h.transGet(4, v) && v == 4);
+    }
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Threads move units between slots, but only when the source half of the
+// array keeps more than floor_units units. The total never changes, and each
+// half's predicate-guarded floor holds.
+static const int nthreads = 4;
+void testSumCommute() {
+    array_type a;
+    for (int i = 0; i != 16; ++i)
+        a.nontrans_put(i, 1);
+    {
+        // a pending addition counts toward the sum without reading its
+        // element, so a concurrent write to that element doesn't abort us
+        TestTransaction t1(1);
+        a.transCommute<TCommuteAdd<int>>(2, 5);
+        assert(a.transSum(0, 4) <= 20);
+        TestTransaction t2(2);
+        a[2] = 3;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(a.nontrans_get(2) == 8);
+    {
+        // ...but it still counts toward the predicate
+        TestTransaction t1(1);
+        a.transCommute<TCommuteAdd<int>>(2, 5);
+        assert(a.transSum(0, 4) <= 20);
+        TestTransaction t2(2);
+        a[2] = 13;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(a.nontrans_get(2) == 13);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+static const int ntransfers = 20000;
+static const int floor_units = 200;
+array_type units;
+
+void* transferThread(void* x) {
+    int me = (intptr_t) x;
+    TThread::set_id(me);
+    Sto::update_threadid();
+    unsigned seed = me + 1;
+    for (int i = 0; i < ntransfers; ++i) {
+        int from = rand_r(&seed) % 16, to = rand_r(&seed) % 16;
+        int half = from < 8 ? 0 : 8;
+        TRANSACTION {
+            if (units[from] > 0 && units.transSum(half, half + 8) > floor_units) {
+                units[from] = units[from] - 1;
+                units[to] = units[to] + 1;
+            }
+        } RETRY(true);
+    }
+    return nullptr;
+}
+
+void testConcurrentTransfers() {
+    for (int i = 0; i != 16; ++i)
+        units.nontrans_put(i, 30);
+    pthread_t tids[nthreads];
+    for (intptr_t i = 0; i < nthreads; ++i)
+        pthread_create(&tids[i], NULL, transferThread, (void*) i);
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(tids[i], NULL);
+    int halves[2] = {0, 0};
+    for (int i = 0; i != 16; ++i)
+        halves[i / 8] += units.nontrans_get(i);
+    assert(halves[0] >= floor_units && halves[1] >= floor_units);
+    assert(halves[0] + halves[1] == 16 * 30);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testSumSurvivesWrites();
+    testSumOwnWrites();
+    testSumCommute();
+    testRangeEmpty();
+    testCountOwnWrites();
+    testConcurrentTransfers();
+    std::cout << "All tests pass!" << std::endl;
+    return 0;
+}
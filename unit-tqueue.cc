@@ -0,0 +1,124 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <pthread.h>
+#include "Transaction.hh"
+#include "TQueue.hh"
+
+typedef TQueue<int, 4> queue_type;
+
+// A read-only object whose check() runs a blind push of @value from another
+// thread, then reports @ok. Reading it after the queue lands that push
+// between the queue's lock/check and its install.
+struct PushDuringCheck : public TObject {
+    queue_type& q;
+    int value;
+    bool ok;
+    PushDuringCheck(queue_type& q_, int v, bool ok_)
+        : q(q_), value(v), ok(ok_) {
+    }
+    void observe() {
+        Sto::item(this, 0).add_read(0);
+    }
+
+    static void* pusher(void* x) {
+        PushDuringCheck* self = (PushDuringCheck*) x;
+        TThread::set_id(2);
+        Sto::update_threadid();
+        TRANSACTION {
+            self->q.transPush(self->value);
+        } RETRY(false);
+        return nullptr;
+    }
+    bool lock(TransItem&, Transaction&) override {
+        return true;
+    }
+    bool check(TransItem&, Transaction&) override {
+        pthread_t tid;
+        pthread_create(&tid, NULL, pusher, this);
+        pthread_join(tid, NULL);
+        return ok;
+    }
+    void install(TransItem&, Transaction&) override {
+    }
+    void unlock(TransItem&) override {
+    }
+};
+
+void testBasic() {
+    queue_type q;
+    int v;
+    {
+        TransactionGuard t;
+        assert(!q.transFront(v));
+        for (int i = 0; i != 10; ++i)
+            q.transPush(i);
+        assert(q.transFront(v) && v == 0);
+    }
+    {
+        TransactionGuard t;
+        for (int i = 0; i != 6; ++i) {
+            assert(q.transFront(v) && v == i);
+            assert(q.transPop());
+        }
+    }
+    for (int i = 6; i != 10; ++i)
+        assert(q.nontrans_pop() == i);
+    assert(q.nontrans_empty());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testPushAfterEmptyKeepsOrder() {
+    queue_type q;
+    PushDuringCheck hook(q, 2, true);
+    int v;
+    {
+        // we saw the queue empty, so our push comes first even though the
+        // other thread's push commits before we install
+        TransactionGuard t;
+        assert(!q.transFront(v));
+        q.transPush(1);
+        hook.observe();
+    }
+    assert(q.nontrans_pop() == 1);
+    assert(q.nontrans_pop() == 2);
+    assert(q.nontrans_empty());
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testAbortAfterReserve() {
+    queue_type q;
+    PushDuringCheck hook(q, 3, false);
+    int v;
+    {
+        // we reserve positions 0-4, then abort after a push took position 5
+        TestTransaction t(1);
+        assert(!q.transFront(v));
+        for (int i = 0; i != 5; ++i)
+            q.transPush(10 + i);
+        hook.observe();
+        assert(!t.try_commit());
+    }
+    assert(!q.nontrans_empty());
+    {
+        TransactionGuard t;
+        assert(q.transFront(v) && v == 3);
+        assert(q.transPop());
+        assert(!q.transPop());
+    }
+    assert(q.nontrans_empty());
+    {
+        TransactionGuard t;
+        q.transPush(4);
+    }
+    assert(q.nontrans_pop() == 4);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testBasic();
+    testPushAfterEmptyKeepsOrder();
+    testAbortAfterReserve();
+    std::cout << "All tests pass!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,196 @@
+#undef NDEBUG
+#include <string>
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include "Transaction.hh"
+#include "TSplitCounter.hh"
+
+typedef TSplitCounter<long> counter_type;
+
+void testJoined() {
+    counter_type c(10);
+    {
+        TestTransaction t1(1);
+        ++c;
+        TestTransaction t2(2);
+        c += 5;
+        assert(t2.try_commit());
+        assert(t1.try_commit());
+    }
+    {
+        TransactionGuard t;
+        assert(c == 16);
+        c = 3;
+        ++c;
+        assert(c == 4);
+    }
+    assert(!c.is_split() && c.nontrans_read() == 4);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSplitIncrements() {
+    counter_type c(10), d;
+    assert(c.split() && c.is_split());
+    {
+        // increments land in the threads' own slots
+        TestTransaction t1(1);
+        ++c;
+        TestTransaction t2(2);
+        c += 5;
+        TestTransaction t3(3);
+        c -= 2;
+        assert(t2.try_commit());
+        assert(t3.try_commit());
+        assert(t1.try_commit());
+    }
+    assert(c.is_split() && c.nontrans_read() == 14);
+    {
+        // a read sums the slots and depends on every one of them
+        TestTransaction t1(1);
+        long v = c;
+        assert(v == 14);
+        d = v;
+        TestTransaction t2(2);
+        ++c;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    assert(c.is_split() && c.nontrans_read() == 15);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReadModifyWrite() {
+    counter_type c;
+    c.split();
+    {
+        TestTransaction t1(1);
+        ++c;
+        assert(t1.try_commit());
+    }
+    {
+        // read-modify-write goes to the base value and leaves the slots be
+        TestTransaction t1(1);
+        long v = c;
+        c += v;
+        TestTransaction t2(2);
+        ++c;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+    {
+        TransactionGuard t;
+        long v = c;
+        c += v;
+    }
+    assert(c.is_split() && c.nontrans_read() == 4);
+    {
+        // an assignment joins the counter
+        TransactionGuard t;
+        c = 7;
+    }
+    assert(!c.is_split() && c.nontrans_read() == 7);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testPhaseChangeConflicts() {
+    counter_type c(1), d;
+    c.split();
+    {
+        TestTransaction t1(1);
+        ++c;
+        assert(t1.try_commit());
+    }
+    {
+        // a reader that straddles a join fails even though the total is
+        // unchanged
+        TestTransaction t1(1);
+        assert(c == 2);
+        ++d;
+        assert(c.join());
+        assert(!t1.try_commit());
+    }
+    {
+        TestTransaction t1(1);
+        assert(c == 2);
+        ++d;
+        assert(c.split());
+        assert(!t1.try_commit());
+    }
+    assert(c.nontrans_read() == 2);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testReadsJoin() {
+    counter_type c;
+    c.split();
+    const unsigned n = counter_type::join_check_reads;
+    for (unsigned i = 0; i != n; ++i) {
+        TransactionGuard t;
+        ++c;
+    }
+    // as many reads as increments keeps the split phase
+    for (unsigned i = 0; i != n; ++i) {
+        TransactionGuard t;
+        long v = c;
+        assert(v == (long) n);
+    }
+    assert(c.is_split());
+    // once reads outnumber increments, the reading transaction joins the
+    // counter when it finishes, not during the read
+    for (unsigned i = 0; i != n; ++i) {
+        TestTransaction t(1);
+        long v = c;
+        assert(v == (long) n && c.is_split());
+        assert(t.try_commit());
+    }
+    assert(!c.is_split() && c.nontrans_read() == (long) n);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// Every thread increments the counter; one in a hundred transactions reads
+// it, and thread 0 also forces phase changes along the way.
+static const int nthreads = 4;
+static const int nincrements = 40000;
+counter_type hot;
+
+void* incrementThread(void* x) {
+    int me = (intptr_t) x;
+    TThread::set_id(me);
+    Sto::update_threadid();
+    long last = 0;
+    for (int i = 0; i < nincrements / nthreads; ++i) {
+        if (me == 0 && i % 1000 == 0)
+            i % 2000 ? hot.join() : hot.split();
+        TRANSACTION {
+            if (i % 100 == 99) {
+                long v = hot;
+                assert(v >= last);
+                last = v;
+            } else
+                ++hot;
+        } RETRY(true);
+    }
+    return nullptr;
+}
+
+void testConcurrentIncrements() {
+    pthread_t tids[nthreads];
+    for (intptr_t i = 0; i < nthreads; ++i)
+        pthread_create(&tids[i], NULL, incrementThread, (void*) i);
+    for (int i = 0; i < nthreads; ++i)
+        pthread_join(tids[i], NULL);
+    assert(hot.nontrans_read() == nincrements - nincrements / 100);
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testJoined();
+    testSplitIncrements();
+    testReadModifyWrite();
+    testPhaseChangeConflicts();
+    testReadsJoin();
+    testConcurrentIncrements();
+    std::cout << "All tests pass!" << std::endl;
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <assert.h>
 #include <vector>
+#include <pthread.h>
 #include "Transaction.hh"
 #include "TVector.hh"
 #include "TBox.hh"
@@ -976,6 +977,174 @@ void testIndexPushOverlap() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testGrowth() {
+    TVector<int> v;
+    TBox<int> box;
+
+    // enough elements to fill several chunks and outgrow the directory
+    TRANSACTION {
+        for (int i = 0; i < 3000; ++i)
+            v.push_back(i);
+    } RETRY(false);
+    assert(v.nontrans_size() == 3000);
+    for (int i = 0; i < 3000; ++i)
+        assert(v.nontrans_get(i) == i);
+
+    {
+        TestTransaction t1(1);
+        assert(v[5] == 5);
+        assert(v[2999] == 2999);
+        box = 9; /* avoid read-only txn */
+
+        // growing doesn't move elements, so it doesn't conflict with reads
+        TestTransaction t2(2);
+        for (int i = 3000; i < 6000; ++i)
+            v.push_back(i);
+        assert(t2.try_commit());
+
+        t1.use();
+        v[5] = -5;
+        assert(t1.try_commit());
+    }
+
+    {
+        TestTransaction t1(1);
+        // past the allocated storage
+        try {
+            int x = v[20000];
+            (void) x;
+            assert(false);
+        } catch (std::out_of_range&) {
+        }
+        box = 9; /* avoid read-only txn */
+
+        TestTransaction t2(2);
+        v.resize(20001);
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    GUARDED {
+        assert(v.size() == 20001);
+        assert(v[5] == -5);
+        assert(v[5999] == 5999);
+        assert(v[20000] == 0);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// A read-only object whose check() runs a push_back of @value from another
+// thread, then reports @ok. Reading it lands that push between the vector's
+// lock and install.
+struct PushDuringCheck : public TObject {
+    TVector<int>& v;
+    int value;
+    bool ok;
+    bool committed;
+    PushDuringCheck(TVector<int>& v_, int value_, bool ok_)
+        : v(v_), value(value_), ok(ok_), committed(false) {
+    }
+    void observe() {
+        Sto::item(this, 0).add_read(0);
+    }
+
+    static void* pusher(void* x) {
+        PushDuringCheck* self = (PushDuringCheck*) x;
+        TestTransaction t(2);
+        self->v.push_back(self->value);
+        self->committed = t.try_commit();
+        return nullptr;
+    }
+    bool lock(TransItem&, Transaction&) override {
+        return true;
+    }
+    bool check(TransItem&, Transaction&) override {
+        pthread_t tid;
+        pthread_create(&tid, NULL, pusher, this);
+        pthread_join(tid, NULL);
+        return ok;
+    }
+    void install(TransItem&, Transaction&) override {
+    }
+    void unlock(TransItem&) override {
+    }
+};
+
+void testAppendDuringCommit() {
+    TVector<int> f;
+    {
+        TransactionGuard t;
+        f.push_back(10);
+    }
+
+    {
+        // a blind push_back doesn't hold the size lock through its commit,
+        // so the other thread's push lands first
+        PushDuringCheck hook(f, 30, true);
+        TestTransaction t1(1);
+        f.push_back(20);
+        hook.observe();
+        assert(t1.try_commit());
+        assert(hook.committed);
+    }
+    assert(f.nontrans_size() == 3);
+    assert(f.nontrans_get(1) == 30);
+    assert(f.nontrans_get(2) == 20);
+
+    {
+        // aborting after the lock phase leaves no trace
+        PushDuringCheck hook(f, 40, false);
+        TestTransaction t1(1);
+        f.push_back(50);
+        f.push_back(60);
+        hook.observe();
+        assert(!t1.try_commit());
+        assert(hook.committed);
+    }
+    GUARDED {
+        f.push_back(70);
+    }
+    assert(f.nontrans_size() == 5);
+    assert(f.nontrans_get(3) == 40);
+    assert(f.nontrans_get(4) == 70);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+template <template <typename, typename, unsigned> class L>
+void testLayout(const char* name) {
+    TVector<int, TOpaqueWrapped, L> v;
+    TBox<int> box;
+
+    TRANSACTION {
+        for (int i = 0; i < 1000; ++i)
+            v.push_back(i);
+    } RETRY(false);
+
+    {
+        TestTransaction t1(1);
+        int sum = 0;
+        for (auto it = v.begin(); it != v.end(); ++it)
+            sum += *it;
+        assert(sum == 499500);
+        box = 9; /* avoid read-only txn */
+
+        TestTransaction t2(2);
+        v[999] = 0;
+        assert(t2.try_commit());
+        assert(!t1.try_commit());
+    }
+
+    TRANSACTION {
+        v.pop_back();
+        v.push_back(-1);
+    } RETRY(false);
+    assert(v.nontrans_size() == 1000);
+    assert(v.nontrans_get(998) == 998 && v.nontrans_get(999) == -1);
+    printf("PASS: %s<%s>\n", __FUNCTION__, name);
+}
+
 void testOpacity() {
     TVector<int> f;
     TBox<int> box;
@@ -1257,6 +1426,11 @@ int main() {
     testResize();
     testFrontBack();
     testIndexPushOverlap();
+    testGrowth();
+    testAppendDuringCommit();
+    testLayout<TInterleavedLayout>("interleaved");
+    testLayout<TSplitLayout>("split");
+    testLayout<TPaddedLayout>("padded");
     testOpacity();
     testNoOpacity();
     return 0;
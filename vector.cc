@@ -2,8 +2,11 @@
 #include <iostream>
 #include <assert.h>
 #include <vector>
+#include <pthread.h>
+#include <sys/time.h>
 #include "Transaction.hh"
 #include "Vector.hh"
+#include "TVector.hh"
 
 void testSimpleInt() {
     Vector<int> f;
@@ -611,6 +614,51 @@ void testIteratorBetterSemantics() {
 
 
 
+// Append scaling: each thread commits `ntrans` transactions that each
+// push_back one element onto a shared TVector. Blind appends are placed at
+// commit; with `sized`, every transaction also reads the size, so appends
+// conflict with each other and retry.
+struct AppendRunner {
+    TVector<int>* v;
+    int me;
+    int ntrans;
+    bool sized;
+};
+
+void* appendFunc(void* x) {
+    AppendRunner* r = (AppendRunner*) x;
+    TThread::set_id(r->me);
+    for (int i = 0; i < r->ntrans; ++i) {
+        TRANSACTION {
+            r->v->push_back(r->me);
+            if (r->sized)
+                (void) (r->v->size() > 0);
+        } RETRY(true);
+    }
+    return nullptr;
+}
+
+void benchAppend(bool sized) {
+    const int ntrans = 100000;
+    for (int nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        TVector<int> v;
+        std::vector<pthread_t> tids(nthreads);
+        std::vector<AppendRunner> runners(nthreads);
+        struct timeval tv1, tv2;
+        gettimeofday(&tv1, NULL);
+        for (int i = 0; i < nthreads; ++i) {
+            runners[i] = AppendRunner{&v, i, ntrans, sized};
+            pthread_create(&tids[i], NULL, appendFunc, &runners[i]);
+        }
+        for (int i = 0; i < nthreads; ++i)
+            pthread_join(tids[i], NULL);
+        gettimeofday(&tv2, NULL);
+        assert(v.nontrans_size() == ntrans * nthreads);
+        double t = (tv2.tv_sec - tv1.tv_sec) + (tv2.tv_usec - tv1.tv_usec) / 1000000.0;
+        printf("append %-5s %d threads: %f s, %.0f appends/s\n",
+               sized ? "sized" : "blind", nthreads, t, ntrans * nthreads / t);
+    }
+}
 
 
 int main() {
@@ -639,5 +687,7 @@ int main() {
     testMulPushPops1();
     testUpdatePop();
     testIteratorBetterSemantics();
+    benchAppend(false);
+    benchAppend(true);
     return 0;
 }
@@ -134,3 +134,69 @@ private:
   version_type version_;
   value_type* valueptr_;
 };
+
+// Compact box for small fixed-size values: the version and the value share
+// one cache line, with no second allocation for the value, and boxes come
+// from the inserting thread's Masstree pool allocator rather than malloc.
+// The box is still reached through the leaf's value pointer, so a lookup
+// still pays that extra access; only storing values in the leaf would
+// remove it. Only for trivially copyable values of up to 24 bytes. There is
+// deliberately no malloc-based make(): deallocate_rcu returns boxes to the
+// pool.
+template <typename T>
+struct compact_versioned_value {
+  typedef T value_type;
+  typedef TransactionTid::type version_type;
+
+  static_assert(mass::is_trivially_copyable<T>::value,
+                "compact_versioned_value requires a trivially copyable value");
+  static_assert(sizeof(T) <= 24, "compact_versioned_value holds at most 24 bytes");
+
+  static compact_versioned_value* make(const value_type& val, version_type v, threadinfo& ti) {
+    void* p = ti.pool_allocate(sizeof(compact_versioned_value), memtag_value);
+    return new (p) compact_versioned_value(val, v);
+  }
+
+  bool needsResize(const value_type&) {
+    return false;
+  }
+  compact_versioned_value* resizeIfNeeded(const value_type&) {
+    return NULL;
+  }
+
+  inline void set_value(const value_type& v) {
+    value_ = v;
+  }
+  inline const value_type& read_value() const {
+    return value_;
+  }
+  inline value_type& writeable_value() {
+    return value_;
+  }
+
+  inline const version_type& version() const {
+    return version_;
+  }
+  inline version_type& version() {
+    return version_;
+  }
+
+  inline void deallocate_rcu(threadinfo& ti) {
+    ti.pool_deallocate_rcu(this, sizeof(compact_versioned_value), memtag_value);
+  }
+
+  // Masstree debug printer
+  void print(FILE *f, const char *prefix, int indent, lcdf::Str key,
+    kvtimestamp_t, char *suffix) {
+    std::stringstream vss;
+    vss << value_;
+    fprintf(f, "%s%*s%.*s = %s%s\n", prefix, indent, "",
+        key.len, key.s, vss.str().c_str(), suffix);
+  }
+
+private:
+  compact_versioned_value(const value_type& val, version_type v) : version_(v), value_(val) {}
+
+  version_type version_;
+  value_type value_;
+};